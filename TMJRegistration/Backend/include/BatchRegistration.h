@@ -0,0 +1,169 @@
+#ifndef BATCH_REGISTRATION_H
+#define BATCH_REGISTRATION_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "ImageRegistration.h"
+
+/**
+ * @brief 批量配准 / 多任务调度 - 单进程内执行一个配准任务队列
+ *
+ * 替代在脚本中逐个启动 MIRegistration 进程的做法 (每个进程都按 hardware_concurrency
+ * 创建线程, 多个进程同时运行时线程数超额、内存不受控, 且每次都重新读取固定图像、
+ * 重新构建固定图像金字塔):
+ * - 队列中每个任务为 (fixed, moving, mask, config); 固定图像和掩膜相同的任务组成一组,
+ *   组内共享固定图像、掩膜和固定图像金字塔 (ROI裁剪、Winsorize、各层级只计算一次);
+ *   组内最后一个任务结束后释放
+ * - 全局线程预算: 同时运行的任务线程 + 线程池后台线程 = threads,
+ *   各任务的度量分块提交到同一个全局线程池, 空闲线程加入当前人手最少的任务 (分块级工作窃取)
+ * - 内存预算: 开始任务前按图像尺寸和配置估算其金字塔/梯度/MIND特征内存 (见 EstimateImageMemory),
+ *   与正在运行的任务合计超出 memoryLimitMB 时暂缓, 直到有任务结束释放内存;
+ *   没有任务在运行时总是放行队列中的第一个任务, 保证队列能执行完
+ * - 移动图像在任务开始时才加载, 任务结束后其金字塔/特征随 ImageRegistration 一起释放
+ * - 每个任务输出到各自的子目录
+ *
+ * 清单格式 (JSON, 相对路径相对于清单文件所在目录):
+ * {
+ *     "fixed": "fixed.nrrd",                 (各任务的默认固定图像, 任务可单独指定)
+ *     "fixedMask": "mask.nrrd",              (可选, 默认固定图像掩膜)
+ *     "config": "config/MIND/Rigid.json",    (可选, 各任务的默认配置)
+ *     "output": "batch_output",              (输出根目录, 每个任务一个子目录)
+ *     "maxConcurrentJobs": 2,                (可选, 同时运行的任务数上限)
+ *     "threads": 16,                         (可选, 全局线程预算, 0 = hardware_concurrency)
+ *     "memoryLimitMB": 8192,                 (可选, 内存预算, 0 = 不限制)
+ *     "jobs": [
+ *         { "moving": "p01.nrrd", "initial": "p01_coarse.h5" },
+ *         { "name": "p02", "moving": "p02.nrrd", "config": "Affine.json", "output": "p02_result" },
+ *         { "fixed": "p03_ct.nrrd", "fixedMask": "p03_mask.nrrd", "moving": "p03_mr.nrrd" }
+ *     ]
+ * }
+ * 任务名默认取移动图像文件名 (不含扩展名), 输出目录默认为 <output>/<name>。
+ * 任务单独指定 fixed 时不继承顶层 fixedMask (掩膜定义在顶层固定图像的网格上)。
+ */
+class BatchRegistration
+{
+public:
+    struct Job
+    {
+        std::string name;
+        std::string fixedImagePath;
+        std::string fixedMaskPath;          // 空表示不使用掩膜
+        std::string movingImagePath;
+        std::string initialTransformPath;   // 空表示不使用初始变换
+        std::string configFilePath;         // 空表示使用清单的默认配置
+        std::string outputFolder;
+    };
+
+    struct Manifest
+    {
+        std::string fixedImagePath;           // 任务未指定时的默认值
+        std::string fixedMaskPath;
+        std::string configFilePath;
+        std::string outputFolder;
+        unsigned int maxConcurrentJobs = 0;   // 0 = 默认值 (DefaultMaxConcurrentJobs)
+        unsigned int numberOfThreads = 0;     // 全局线程预算, 0 = hardware_concurrency
+        double memoryLimitMB = 0.0;           // 0 = 不限制
+        std::vector<Job> jobs;
+    };
+
+    struct JobResult
+    {
+        std::string name;
+        bool success = false;
+        std::string errorMessage;
+        std::string transformPath;
+        ConfigManager::TransformType transformType = ConfigManager::TransformType::Rigid;
+        double elapsedTime = 0.0;       // 秒 (含移动图像加载和变换保存)
+        double finalMetricValue = 0.0;
+        double projectedMemoryMB = 0.0;   // 调度时估算的移动图像侧内存
+    };
+
+    static const unsigned int DefaultMaxConcurrentJobs = 2;
+
+    BatchRegistration();
+
+    // 读取并校验清单 (缺少必需字段或JSON无效时抛出 std::runtime_error)
+    static Manifest LoadManifest(const std::string& manifestPath);
+
+    void SetManifest(const Manifest& manifest) { m_Manifest = manifest; }
+    const Manifest& GetManifest() const { return m_Manifest; }
+
+    // 命令行覆盖 (作用于所有任务)
+    void SetSamplingPercentage(double percent) { m_SamplingPercentage = percent; }   // <0 表示使用配置值
+    void SetNumberOfThreads(unsigned int threads) { m_Manifest.numberOfThreads = threads; }
+    void SetMemoryLimitMB(double limitMB) { m_Manifest.memoryLimitMB = limitMB; }
+    void SetInitializationMode(InitializationMode mode) { m_InitializationMode = mode; m_HasInitializationMode = true; }
+    void SetVerbose(bool v) { m_Verbose = v; }
+
+    // 执行全部任务, 返回成功的任务数; 单个任务失败不影响其他任务
+    size_t Run();
+
+    const std::vector<JobResult>& GetResults() const { return m_Results; }
+
+    // 打印各任务结果汇总
+    void PrintSummary() const;
+    
+    /**
+     * @brief 估算一幅图像在配准中占用的内存 (字节)
+     *
+     * 按未裁剪的全图估算 (ROI裁剪时实际更小, 估算偏保守):
+     * 原图 + Winsorize副本 + 各层级图像 (Σ V/s³);
+     * 移动图像另加各层级梯度 (每体素16字节);
+     * 使用MIND时移动图像另加各层级的特征块 (特征+梯度每通道16字节, 每层级不超过 mindTileCacheMB;
+     * 块按需计算, 实际通常远小于此); 固定图像的MIND描述子只在采样点计算, 不计入。
+     */
+    static double EstimateImageMemory(uint64_t numberOfVoxels, const ConfigManager::RegistrationConfig& config, bool isMovingImage);
+    
+    // 只读取图像头得到体素数, 失败时返回0
+    static uint64_t ReadNumberOfVoxels(const std::string& imagePath);
+
+private:
+    // 固定图像和掩膜相同的任务共用的资源
+    struct FixedGroup
+    {
+        std::unique_ptr<ImageRegistration> reference;   // 持有已加载的固定图像/掩膜/固定图像金字塔
+        std::mutex loadMutex;
+        size_t remainingJobs = 0;         // 尚未结束的任务数, 归零时释放
+        double projectedMemory = 0.0;     // 字节
+        bool charged = false;             // 是否已计入内存预算
+    };
+    
+    JobResult RunJob(const Job& job, const ConfigManager::RegistrationConfig& config, FixedGroup& group);
+    
+    // 组内第一个任务加载固定图像资源, 其余任务等待后直接使用
+    const ImageRegistration& AcquireFixedResources(const Job& job, FixedGroup& group);
+    
+    // 在调度锁内调用: 按队列顺序找第一个能放入内存预算的任务, 没有时返回 npos
+    size_t FindAdmissibleJob() const;
+
+    Manifest m_Manifest;
+    double m_SamplingPercentage;
+    InitializationMode m_InitializationMode;
+    bool m_HasInitializationMode;
+    bool m_Verbose;
+
+    std::vector<JobResult> m_Results;
+    
+    // =========== 调度状态 (由 m_ScheduleMutex 保护) ===========
+    std::vector<ConfigManager::RegistrationConfig> m_JobConfigs;
+    std::vector<double> m_JobMemory;                 // 各任务移动图像侧的估算内存 (字节)
+    std::vector<FixedGroup*> m_JobGroups;
+    std::map<std::string, std::unique_ptr<FixedGroup>> m_FixedGroups;
+    std::vector<size_t> m_PendingJobs;               // 队列顺序
+    size_t m_RunningJobs;
+    double m_ProjectedMemory;                        // 正在运行的任务 + 已加载的固定图像组 (字节)
+    double m_PeakProjectedMemory;
+    std::mutex m_ScheduleMutex;
+    std::condition_variable m_ScheduleChanged;
+
+    // HDF5 (ITK变换文件读写) 默认不是线程安全的, 各任务的 .h5 读写串行执行
+    std::mutex m_TransformIOMutex;
+    std::mutex m_LogMutex;
+};
+
+#endif // BATCH_REGISTRATION_H
@@ -23,6 +23,15 @@
  * 支持的度量类型:
  * - MattesMutualInformation (互信息, 默认)
  * - MIND (Modality Independent Neighbourhood Descriptor)
+ * 
+ * 多阶段配准 ("stages" 数组): 每个阶段一个对象, 可单独指定
+ * transformType / metricType / optimizerType / levels (参与的金字塔层级, 省略表示全部),
+ * 未指定的字段继承顶层设置。存在 "stages" 时忽略顶层 transformType。
+ *   "stages": [
+ *       {"transformType": "Translation", "levels": [0, 1]},
+ *       {"transformType": "Rigid", "metricType": "MIND", "levels": [1, 2, 3]},
+ *       {"transformType": "Affine", "metricType": "MIND", "levels": [3, 4]}
+ *   ]
  */
 class ConfigManager
 {
@@ -30,6 +39,7 @@ public:
     // 变换类型枚举
     enum class TransformType
     {
+        Translation,     // 平移变换 (以刚体变换实现, 旋转保持初始值, 只优化3个平移参数)
         Rigid,           // 刚体变换 (6参数)
         Affine,          // 仿射变换 (12参数)
         RigidThenAffine  // 级联变换: 先刚体后仿射 (自动两阶段)
@@ -49,6 +59,15 @@ public:
         GaussNewton                   // Gauss-Newton优化器 (MIND推荐)
     };
     
+    // 多阶段配准中的一个阶段
+    struct StageConfig
+    {
+        TransformType transformType = TransformType::Rigid;   // Translation / Rigid / Affine
+        MetricType metricType = MetricType::MattesMutualInformation;
+        OptimizerType optimizerType = OptimizerType::RegularStepGradientDescent;
+        std::vector<unsigned int> levels;   // 参与的金字塔层级 (0 = 最粗), 空表示全部层级
+    };
+    
     // 配置参数结构
     struct RegistrationConfig
     {
@@ -63,6 +82,7 @@ public:
         
         // 度量参数 (MI专用)
         unsigned int numberOfHistogramBins = 32;
+        bool useExplicitPDFDerivatives = true;   // false: 两遍梯度, 不分配 bins²×参数数 的导数直方图
         unsigned int numberOfSpatialSamples = 0; // deprecated if samplingPercentage is used
         double samplingPercentage = 0.25; // 25% sampling by default
         
@@ -70,6 +90,7 @@ public:
         unsigned int mindRadius = 1;           // MIND描述符计算半径
         double mindSigma = 0.8;                // MIND指数衰减参数
         std::string mindNeighborhoodType = "6-connected";  // 邻域类型: "6-connected" 或 "26-connected"
+        double mindTileCacheMB = 1024.0;       // 移动图像MIND特征块缓存内存上限 (每层级, MB)
         
         // 优化器参数
         std::vector<double> learningRate = {2.0, 1.0, 0.5, 0.1, 0.05};  // Per-level learning rates
@@ -87,10 +108,18 @@ public:
         unsigned int numberOfLevels = 5;
         std::vector<unsigned int> shrinkFactors = {12, 8, 4, 2, 1};
         std::vector<double> smoothingSigmas = {4.0, 3.0, 2.0, 1.0, 1.0};
+        bool useRecursivePyramid = false;   // true: 粗层级由已平滑的细层级递增平滑+抽取得到
         
         // 采样策略
         bool useStratifiedSampling = true;
         unsigned int randomSeed = 121212;
+        
+        // ROI裁剪 (仅在提供固定图像掩膜时生效)
+        bool cropToMaskROI = false;   // 建金字塔前把固定/移动图像裁剪到掩膜包围盒+边距
+        double roiCropMargin = 20.0;  // 捕获边距 (mm)
+        
+        // 多阶段配准 (非空时按顺序在同一进程内执行, 共享金字塔和特征缓存)
+        std::vector<StageConfig> stages;
     };
 
     ConfigManager();
@@ -105,6 +134,9 @@ public:
     // 创建默认配置文件
     static bool CreateDefaultConfigFile(const std::string& filePath, TransformType type = TransformType::Rigid);
     
+    // 评估模式的默认配置 (找不到 Evaluation.json 时使用): 单层、零学习率、1次迭代
+    static RegistrationConfig CreateEvaluationConfig();
+    
     // 获取配置
     const RegistrationConfig& GetConfig() const { return m_Config; }
     RegistrationConfig& GetConfig() { return m_Config; }
@@ -131,15 +163,27 @@ public:
     
     // 打印配置信息
     void PrintConfig() const;
+    
+    // =========== 简单JSON解析辅助函数 (批量配准清单等也使用) ===========
+    static std::string Trim(const std::string& str);
+    static std::string ExtractValue(const std::string& content, const std::string& key);
+    static std::vector<std::string> ExtractArray(const std::string& content, const std::string& key);
+    
+    // 查找键对应的数组 (允许嵌套对象/数组), 返回 '[' 和匹配的 ']' 的位置
+    static bool FindArrayBlock(const std::string& content, const std::string& key, size_t& begin, size_t& end);
+    // 把数组内容拆分为顶层的 {...} 对象
+    static std::vector<std::string> SplitObjects(const std::string& arrayContent);
+    // 字符串转义: Unescape 还原 \\ \" \/ (如Windows路径), Escape 用于输出JSON字符串
+    static std::string UnescapeString(const std::string& value);
+    static std::string EscapeString(const std::string& value);
 
 private:
     RegistrationConfig m_Config;
     
-    // 简单JSON解析辅助函数
-    std::string Trim(const std::string& str) const;
     bool ParseJsonFile(const std::string& content);
-    std::string ExtractValue(const std::string& content, const std::string& key) const;
-    std::vector<std::string> ExtractArray(const std::string& content, const std::string& key) const;
+    
+    // 解析一个阶段对象 (未指定的字段继承当前顶层设置), 无效时抛出异常
+    StageConfig ParseStage(const std::string& object) const;
     
     // JSON生成辅助
     std::string GenerateJson() const;
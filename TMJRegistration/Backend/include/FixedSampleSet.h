@@ -0,0 +1,77 @@
+#ifndef FIXED_SAMPLE_SET_H
+#define FIXED_SAMPLE_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "itkImage.h"
+#include "AlignedAllocator.h"
+
+/**
+ * @brief 固定图像采样点集合 - 结构数组(SoA)存储 (MI / MIND 共用)
+ *
+ * 替代每个采样点一个结构体(含 itk::Point、std::vector 等)的数组:
+ * 物理坐标 x/y/z 各自一段连续对齐的缓冲区, 另存每个采样点在固定图像
+ * 原始缓冲区中的线性偏移, 度量可据此一次性取出固定图像强度或MIND通道值,
+ * 自行存放为同样按采样序号排列的扁平数组。
+ *
+ * 建立时按 Morton(Z序) 码对体素索引排序: 相邻采样点在空间上相邻,
+ * 经过平滑变换后在移动图像中访问的缓存行也相邻, 避免打乱顺序带来的随机访存。
+ * 排序只改变求和顺序, 不改变采样点集合本身。
+ *
+ * 用法:
+ *   FixedSampleSet samples;
+ *   samples.Build(fixedImage, indices);
+ *   for (size_t i = 0; i < samples.GetNumberOfSamples(); ++i)
+ *       point = samples.GetPoint(i);
+ */
+class FixedSampleSet
+{
+public:
+    using ImageType = itk::Image<float, 3>;
+    using IndexType = ImageType::IndexType;
+    using PointType = ImageType::PointType;
+
+    FixedSampleSet() = default;
+
+    // 由体素索引建立采样集 (索引需位于图像缓冲区域内)
+    // sortByMortonOrder=true 时先按Z序重排, indices 返回时为排序后的顺序
+    void Build(const ImageType* image, std::vector<IndexType>& indices, bool sortByMortonOrder = true);
+    void Clear();
+
+    size_t GetNumberOfSamples() const { return m_BufferOffsets.size(); }
+    bool IsEmpty() const { return m_BufferOffsets.empty(); }
+
+    // 第i个采样点的物理坐标
+    inline PointType GetPoint(size_t i) const;
+
+    // 第i个采样点在固定图像(及同几何的特征图像)原始缓冲区中的线性偏移
+    size_t GetBufferOffset(size_t i) const { return m_BufferOffsets[i]; }
+
+    // 三个坐标各取低21位交错为63位Morton码
+    static uint64_t ComputeMortonCode(uint32_t x, uint32_t y, uint32_t z);
+
+    // 按Morton码原地排序体素索引, 索引相对于 start 计算
+    static void SortByMortonOrder(std::vector<IndexType>& indices, const IndexType& start);
+
+private:
+    AlignedVector<double> m_PointX;
+    AlignedVector<double> m_PointY;
+    AlignedVector<double> m_PointZ;
+    std::vector<size_t> m_BufferOffsets;
+};
+
+// ============================================================================
+// 内联实现 (热点路径)
+// ============================================================================
+
+inline FixedSampleSet::PointType FixedSampleSet::GetPoint(size_t i) const
+{
+    PointType point;
+    point[0] = m_PointX[i];
+    point[1] = m_PointY[i];
+    point[2] = m_PointZ[i];
+    return point;
+}
+
+#endif // FIXED_SAMPLE_SET_H
@@ -45,6 +45,8 @@ public:
     // Gauss-Newton特有的函数类型
     using ResidualFunctionType = std::function<void(ResidualVectorType&)>;
     using JacobianFunctionType = std::function<void(JacobianMatrixType&)>;
+    // 直接返回正规方程: JtJ (n×n, 行主序), Jtf (n), 返回值为残差个数
+    using NormalEquationsFunctionType = std::function<size_t(std::vector<double>&, std::vector<double>&)>;
 
     GaussNewtonOptimizer();
     ~GaussNewtonOptimizer();
@@ -78,6 +80,10 @@ public:
     // J[i][p] = ∂f[i]/∂q[p] = -∇MIND_moving · ∂T/∂q_p
     void SetJacobianFunction(JacobianFunctionType jacobianFunc) { m_JacobianFunction = jacobianFunc; }
     
+    // 设置正规方程函数 (可选): 度量自行累加 J^T J 和 J^T f (未缩放),
+    // 设置后优先于残差/雅可比函数, 不再物化 m×n 的雅可比矩阵
+    void SetNormalEquationsFunction(NormalEquationsFunctionType normalEquationsFunc) { m_NormalEquationsFunction = normalEquationsFunc; }
+    
     // Levenberg-Marquardt阻尼参数
     void SetDampingFactor(double lambda) { m_DampingFactor = lambda; }
     double GetDampingFactor() const { return m_DampingFactor; }
@@ -155,6 +161,7 @@ private:
     SetParametersType m_SetParameters;
     ResidualFunctionType m_ResidualFunction;
     JacobianFunctionType m_JacobianFunction;
+    NormalEquationsFunctionType m_NormalEquationsFunction;
     
     // =========== 观察者 ===========
     ObserverType m_Observer;
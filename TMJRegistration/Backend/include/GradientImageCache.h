@@ -0,0 +1,93 @@
+#ifndef GRADIENT_IMAGE_CACHE_H
+#define GRADIENT_IMAGE_CACHE_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "itkImage.h"
+#include "AlignedAllocator.h"
+
+/**
+ * @brief 交错存储的图像梯度 (每体素 gx, gy, gz, 0 共4个float)
+ *
+ * 与源图像的缓冲区域逐体素对应, 体素 i 的梯度位于 buffer[4*i .. 4*i+2]。
+ * 第4个分量为填充, 使每个体素的梯度占16字节, 三线性插值时8个角点各一次对齐读取。
+ */
+struct InterleavedGradientImage
+{
+    static const unsigned int Components = 4;
+
+    AlignedVector<float> buffer;
+    size_t numberOfPixels = 0;
+
+    const float* GetBufferPointer() const { return buffer.data(); }
+};
+
+/**
+ * @brief 梯度图像计算与缓存 (MI / MIND 共用)
+ *
+ * 替代 itk::GradientImageFilter + 逐体素 SetPixel 拆分为3幅标量图像的做法:
+ * 直接在线程池中按z切片并行计算, 一次写出交错的梯度缓冲区。
+ *
+ * 数值语义与 itk::GradientImageFilter 默认设置一致:
+ * - 中心差分 (I[x+1] - I[x-1]) / (2*spacing), 使用物理spacing
+ * - 边界按 ZeroFluxNeumann 处理 (越界邻居取边界体素)
+ * - 结果经方向矩阵转换到物理空间 (UseImageDirection)
+ *
+ * 缓存键 = 图像指针 + 修改时间(MTime)。同一金字塔层级的图像对象被重复使用时
+ * (例如刚体阶段之后的仿射阶段, 或MIND特征未重新计算时) 直接返回已有结果。
+ *
+ * 内存: 所有记录以弱引用登记, 只要还有度量持有该梯度就能命中;
+ * 另外按最近使用顺序在内存预算内(默认512MB)保留强引用,
+ * 使暂时无人持有的层级(例如级联中下一阶段将再次使用的粗层级)不会立即被释放。
+ * 线程安全。
+ */
+class GradientImageCache
+{
+public:
+    using ImageType = itk::Image<float, 3>;
+    using GradientPointer = std::shared_ptr<const InterleavedGradientImage>;
+
+    struct Statistics
+    {
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+    };
+
+    // 进程级共享缓存
+    static GradientImageCache& GetGlobalInstance();
+
+    explicit GradientImageCache(size_t memoryBudgetBytes = 512ull * 1024 * 1024);
+
+    // 获取图像梯度 (未命中时计算并缓存); maxThreads=0 使用线程池全部线程
+    GradientPointer GetGradient(const ImageType* image, unsigned int maxThreads = 0);
+
+    // 直接计算, 不经过缓存
+    static GradientPointer ComputeGradient(const ImageType* image, unsigned int maxThreads = 0);
+
+    void Clear();
+    void SetMemoryBudget(size_t bytes);
+    Statistics GetStatistics() const;
+
+private:
+    struct Entry
+    {
+        const ImageType* image = nullptr;
+        unsigned long modifiedTime = 0;
+        unsigned long lastUse = 0;
+        size_t bytes = 0;
+        std::weak_ptr<const InterleavedGradientImage> gradient;
+        GradientPointer retained;  // 预算内的强引用
+    };
+
+    // 按最近使用重新分配强引用, 并清理已失效的记录 (调用方持有 m_Mutex)
+    void UpdateRetention();
+
+    std::vector<Entry> m_Entries;
+    size_t m_MemoryBudget;
+    unsigned long m_UseCounter;
+    Statistics m_Statistics;
+    mutable std::mutex m_Mutex;
+};
+
+#endif // GRADIENT_IMAGE_CACHE_H
@@ -19,6 +19,8 @@
 #include "RegularStepGradientDescentOptimizer.h"
 #include "GaussNewtonOptimizer.h"
 #include "ConfigManager.h"
+#include "MultiResolutionPyramid.h"
+#include "MaskBitmap.h"
 
 /**
  * @brief 变换初始化模式枚举
@@ -79,15 +81,28 @@ public:
     // 掩膜区域值>0的区域将参与配准计算,值=0的区域被忽略
     bool LoadFixedMask(const std::string& maskFilePath);
     bool HasFixedMask() const { return m_FixedImageMask.IsNotNull(); }
+    
+    // ROI裁剪: 有掩膜时在建金字塔前把固定图像裁剪到掩膜包围盒+边距,
+    // 移动图像裁剪到该区域经初始变换映射后的包围盒+边距; 金字塔/梯度/MIND特征随ROI大小缩放
+    void SetCropToMaskROI(bool crop) { m_CropToMaskROI = crop; }
+    bool GetCropToMaskROI() const { return m_CropToMaskROI; }
+    void SetROICropMargin(double marginMM) { m_ROICropMargin = marginMM; }
+    double GetROICropMargin() const { return m_ROICropMargin; }
 
     // =========== 变换类型设置 ===========
     void SetTransformType(ConfigManager::TransformType type);
     ConfigManager::TransformType GetTransformType() const { return m_TransformType; }
+    // 上次配准结果所用的变换类型 (级联配准结束后为最后一个阶段的类型), 输出/保存结果时使用
+    ConfigManager::TransformType GetResultTransformType() const { return m_ResultTransformType; }
     
     // =========== 度量类型设置 ===========
     void SetMetricType(ConfigManager::MetricType type) { m_MetricType = type; }
     ConfigManager::MetricType GetMetricType() const { return m_MetricType; }
     
+    // =========== 优化器类型设置 ===========
+    void SetOptimizerType(ConfigManager::OptimizerType type) { m_OptimizerType = type; }
+    ConfigManager::OptimizerType GetOptimizerType() const { return m_OptimizerType; }
+    
     // =========== 初始变换加载 ===========
     // 从.h5文件加载初始变换(粗配准结果)
     bool LoadInitialTransform(const std::string& h5FilePath);
@@ -98,6 +113,7 @@ public:
 
     // =========== 配准参数设置 ===========
     void SetNumberOfHistogramBins(unsigned int bins) { m_NumberOfHistogramBins = bins; }
+    void SetUseExplicitPDFDerivatives(bool use) { m_UseExplicitPDFDerivatives = use; }
     void SetNumberOfSamples(unsigned int samples) { m_NumberOfSpatialSamples = samples; }
     void SetNumberOfSpatialSamples(unsigned int samples) { m_NumberOfSpatialSamples = samples; }
     void SetLearningRate(const std::vector<double>& rates) { m_LearningRate = rates; }
@@ -110,6 +126,8 @@ public:
     void SetMINDRadius(unsigned int radius) { m_MINDRadius = radius; }
     void SetMINDSigma(double sigma) { m_MINDSigma = sigma; }
     void SetMINDNeighborhoodType(const std::string& type) { m_MINDNeighborhoodType = type; }
+    // 移动图像MIND特征块缓存的内存上限 (每层级, MB)
+    void SetMINDTileCacheMemoryMB(double megabytes);
     
     // =========== 多分辨率设置 ===========
     void SetNumberOfLevels(unsigned int levels) { m_NumberOfLevels = levels; }
@@ -117,6 +135,12 @@ public:
     void SetShrinkFactorsPerLevel(const std::vector<unsigned int>& factors) { m_ShrinkFactors = factors; }
     void SetSmoothingSigmas(const std::vector<double>& sigmas) { m_SmoothingSigmas = sigmas; }
     void SetSmoothingSigmasPerLevel(const std::vector<double>& sigmas) { m_SmoothingSigmas = sigmas; }
+    // 递归金字塔: 由细到粗预先构建, 粗层级由细层级递增平滑+抽取得到 (见 MultiResolutionPyramid)
+    void SetUseRecursivePyramid(bool use) { m_UseRecursivePyramid = use; }
+    bool GetUseRecursivePyramid() const { return m_UseRecursivePyramid; }
+    // 只执行指定的金字塔层级 (0 = 最粗), 空表示全部层级; 迭代次数/学习率仍按层级序号取值
+    void SetActiveLevels(const std::vector<unsigned int>& levels) { m_ActiveLevels = levels; }
+    std::vector<unsigned int> GetActiveLevels() const { return m_ActiveLevels; }
     
     // =========== 观察者回调 ===========
     void SetIterationObserver(ObserverCallbackType callback) { m_IterationObserver = callback; }
@@ -137,8 +161,15 @@ public:
     // =========== 参数获取 (用于级联配准) ===========
     ImageType::Pointer GetFixedImage() const { return m_FixedImage; }
     ImageType::Pointer GetMovingImage() const { return m_MovingImage; }
+    
+    // 多分辨率金字塔 (级联各阶段共享同一对象时, 相同层级只计算一次)
+    MultiResolutionPyramid::Pointer GetFixedPyramid() const { return m_FixedPyramid; }
+    MultiResolutionPyramid::Pointer GetMovingPyramid() const { return m_MovingPyramid; }
+    void SetFixedPyramid(MultiResolutionPyramid::Pointer pyramid) { m_FixedPyramid = pyramid; }
+    void SetMovingPyramid(MultiResolutionPyramid::Pointer pyramid) { m_MovingPyramid = pyramid; }
     MaskSpatialObjectType::Pointer GetFixedImageMask() const { return m_FixedImageMask; }
     unsigned int GetNumberOfHistogramBins() const { return m_NumberOfHistogramBins; }
+    bool GetUseExplicitPDFDerivatives() const { return m_UseExplicitPDFDerivatives; }
     double GetSamplingPercentage() const { return m_SamplingPercentage; }
     std::vector<double> GetLearningRate() const { return m_LearningRate; }
     double GetMinimumStepLength() const { return m_MinimumStepLength; }
@@ -151,6 +182,13 @@ public:
     unsigned int GetRandomSeed() const { return m_RandomSeed; }
     void SetFixedImageMask(MaskSpatialObjectType::Pointer mask) { m_FixedImageMask = mask; }
     
+    // =========== 批量配准: 共享固定图像资源 ===========
+    // 使用 source 已加载的固定图像、掩膜(含体素数)和固定图像金字塔, 不复制图像数据;
+    // 多个实例可在各自线程中并发运行 (金字塔是线程安全的)
+    void ShareFixedResources(const ImageRegistration& source);
+    // 移动图像MIND特征经共享缓存获取 (服务模式: 同一移动图像的特征在请求之间保留)
+    void SetSharedMovingMINDFeatureCache(std::shared_ptr<MINDMetric::SharedFeatureCache> cache);
+    
     // 度量类型和MIND参数获取
     unsigned int GetMINDRadius() const { return m_MINDRadius; }
     double GetMINDSigma() const { return m_MINDSigma; }
@@ -159,6 +197,40 @@ public:
     // =========== 执行配准 ===========
     void Update();
 
+    // =========== 级联配准 (同一实例内多阶段) ===========
+    struct CascadeStageResult
+    {
+        ConfigManager::TransformType transformType;
+        double elapsedTime;              // 秒
+        double finalMetricValue;         // 该阶段没有运行任何层级时为 NaN
+        std::vector<double> parameters;  // 该阶段优化后的变换参数
+    };
+    
+    /**
+     * @brief 依次执行各阶段 (每个阶段的变换为 Translation / Rigid / Affine)
+     * 
+     * 每个阶段可指定自己的度量、优化器和参与的金字塔层级 (见 ConfigManager::StageConfig)。
+     * 上一阶段的结果直接在内存中作为下一阶段的初始变换 (不经临时.h5文件),
+     * 各阶段共用本实例的金字塔层级、ROI裁剪区域、掩膜位图和度量对象,
+     * 因此后续阶段各层级的图像、梯度和MIND特征均命中缓存, 阶段启动几乎没有额外开销。
+     * 结束后 GetResultTransformType() 为最后一个阶段的类型, GetElapsedTime() 为各阶段总耗时;
+     * 变换类型、初始变换、度量、优化器和层级设置恢复为调用前的值。
+     */
+    void RunCascade(const std::vector<ConfigManager::StageConfig>& stages);
+    // 各阶段使用当前度量/优化器和全部层级
+    void RunCascade(const std::vector<ConfigManager::TransformType>& stageTypes);
+    const std::vector<CascadeStageResult>& GetCascadeStageResults() const { return m_CascadeStageResults; }
+    
+    // 以当前变换类型的优化结果作为初始变换 (复制到内存中的复合变换, 替代写文件再 LoadInitialTransform)
+    void SetInitialTransformFromCurrentResult();
+    
+    // 按配置执行: "stages" 非空时多阶段级联, RigidThenAffine 时 Rigid→Affine 级联, 否则单阶段 Update()
+    void RunConfigured(const ConfigManager::RegistrationConfig& config);
+    
+    // 保存最后执行阶段的单个变换 (不使用 CompositeTransform) 到 outputFolder/registration_transform_<时间戳>.h5,
+    // 目录不存在时创建; 返回文件路径
+    std::string SaveFinalTransform(const std::string& outputFolder) const;
+
     // =========== 评估互信息值（不执行优化）===========
     /**
      * @brief 计算给定变换下的互信息值
@@ -186,7 +258,7 @@ public:
     TransformType::Pointer GetTransform() const { return m_RigidTransform; }
     TransformType::Pointer GetFinalTransform() const { return m_RigidTransform; }
 
-    // 获取最终度量值
+    // 获取最终度量值 (上次 Update 没有运行任何层级时为 NaN, 不沿用之前的值)
     double GetFinalMetricValue() const { return m_FinalMetricValue; }
     
     // 获取MIND度量对象指针（用于级联配准中的缓存管理）
@@ -202,13 +274,19 @@ private:
     // =========== 输入图像 ===========
     ImageType::Pointer m_FixedImage;
     ImageType::Pointer m_MovingImage;
+    MultiResolutionPyramid::Pointer m_FixedPyramid;
+    MultiResolutionPyramid::Pointer m_MovingPyramid;
     
     // =========== 掩膜 (用于局部配准) ===========
     MaskSpatialObjectType::Pointer m_FixedImageMask;
     unsigned long m_MaskVoxelCount;  // 掩膜内体素数 (用于正确显示采样信息)
+    bool m_CropToMaskROI;            // 建金字塔前裁剪到掩膜ROI
+    double m_ROICropMargin;          // ROI裁剪捕获边距 (mm)
+    MaskBitmap m_FixedMaskBitmap;    // 掩膜栅格化到全分辨率固定图像网格 (ROI计算用, 按指针+MTime缓存)
 
     // =========== 变换 ===========
     ConfigManager::TransformType m_TransformType;
+    ConfigManager::TransformType m_ResultTransformType;  // 上次 Update 使用的变换类型
     RigidTransformType::Pointer m_RigidTransform;
     AffineTransformType::Pointer m_AffineTransform;
     CompositeTransformType::Pointer m_InitialTransform;
@@ -224,6 +302,7 @@ private:
 
     // =========== 配准参数 ===========
     unsigned int m_NumberOfHistogramBins;
+    bool m_UseExplicitPDFDerivatives;  // MI梯度模式: 显式PDF导数 / 两遍
     unsigned int m_NumberOfSpatialSamples;
     double m_SamplingPercentage; // 比例形式: 0.1 = 10%
     
@@ -247,6 +326,8 @@ private:
     unsigned int m_NumberOfLevels;
     std::vector<unsigned int> m_ShrinkFactors;
     std::vector<double> m_SmoothingSigmas;
+    bool m_UseRecursivePyramid;
+    std::vector<unsigned int> m_ActiveLevels;  // 空表示全部层级
     unsigned int m_RandomSeed;
     bool m_UseStratifiedSampling;
     
@@ -261,8 +342,21 @@ private:
     double m_FinalMetricValue;
     double m_ElapsedTime;
     bool m_Verbose;
+    
+    // =========== 级联配准 ===========
+    std::vector<CascadeStageResult> m_CascadeStageResults;
+    bool m_RetainCropRegions;                        // RunCascade 期间为 true
+    bool m_HasRetainedCropRegions;
+    ImageType::RegionType m_RetainedFixedCropRegion;  // 上一阶段使用的ROI裁剪区域
+    ImageType::RegionType m_RetainedMovingCropRegion;
 
     // =========== 内部方法 ===========
+    // Translation 与 Rigid 共用刚体变换对象 (Translation 只优化平移参数)
+    bool UsesRigidTransform() const;
+    bool ResultUsesRigidTransform() const;
+    bool IsLevelActive(unsigned int level) const;
+    unsigned int GetLevelIterations(unsigned int level) const;   // 未单独配置的层级使用第一个值
+    
     void InitializeTransform();
     void InitializeRigidTransform();
     void InitializeAffineTransform();
@@ -271,9 +365,12 @@ private:
     void RunSingleLevelRigid(ImageType::Pointer fixedImage, ImageType::Pointer movingImage, unsigned int level);
     void RunSingleLevelAffine(ImageType::Pointer fixedImage, ImageType::Pointer movingImage, unsigned int level);
     
-    ImageType::Pointer ShrinkImage(ImageType::Pointer image, unsigned int factor);
-    ImageType::Pointer SmoothImage(ImageType::Pointer image, double sigma);
-    ImageType::Pointer WinsorizeImage(ImageType::Pointer image, double lowerQuantile = 0.005, double upperQuantile = 0.995);
+    // ROI裁剪区域 (大小为0表示不裁剪), 裁剪本身由金字塔完成
+    void ComputeMaskROICropRegions(ImageType::RegionType& fixedRegion, ImageType::RegionType& movingRegion);
+    ImageType::RegionType ComputeCropRegion(ImageType::Pointer image, const std::vector<ImageType::PointType>& points, double margin);
+    
+    // 评估用图像: 全分辨率、不截断 (经由金字塔获取, 与配准共享)
+    void GetEvaluationImages(ImageType::Pointer& fixedImage, ImageType::Pointer& movingImage);
     
     // 使用 ITK CenteredTransformInitializer 初始化变换
     template<typename TTransform>
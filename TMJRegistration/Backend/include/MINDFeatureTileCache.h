@@ -0,0 +1,152 @@
+#ifndef MIND_FEATURE_TILE_CACHE_H
+#define MIND_FEATURE_TILE_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include "itkImage.h"
+#include "AlignedAllocator.h"
+#include "TrilinearSampler.h"
+
+/**
+ * @brief 移动图像MIND特征及其梯度的惰性分块缓存 (线程安全)
+ *
+ * 替代预先为整幅移动图像计算全部通道、交错特征体和梯度的做法:
+ * 全视野MRI上每体素要存 C 个特征值 + 3C 个梯度 (26邻域时416字节),
+ * 而配准中变换后的采样点只落在与固定图像/掩膜交叠的一小部分区域。
+ * 这里把图像划分为 T³ 体素的块 (T=16或32, 默认32), 某块在第一个采样点的插值角点
+ * 落入时才计算, 其余块从不计算。
+ *
+ * - 块内按体素优先交错存储: 每体素 C 个特征值, 以及 3C 个物理空间梯度 gx[C], gy[C], gz[C]
+ * - 数值与完整计算 (MINDMetric::ComputeMINDFeatures + 中心差分梯度) 逐体素一致 (至浮点舍入):
+ *   块在 [块 ± 1体素 (梯度) ± patch半径] 的局部区域内做可分离盒式滤波, 局部区域只在图像边界处截断,
+ *   因此边界体素和邻居越界的语义都不变
+ * - 块指针以原子方式发布 (release/acquire), 已计算的块读取无锁;
+ *   未命中时每块一把互斥锁, 同一块只计算一次, 同时需要该块的其他线程等待其结果
+ * - 内存上限: 只在遍历之间 (BeginPass) 按最近使用淘汰块, 遍历过程中块只增不减;
+ *   单次遍历的工作集超过上限时本次遍历内暂时超出, 下次遍历开始时淘汰
+ * - 统计: 角点查找命中数、块计算数 (未命中)、淘汰数、驻留块数和字节数及峰值
+ *
+ * 读取经 Accessor (每个线程分块一个): 记住上次使用的块 (采样点按Morton序排列,
+ * 相邻采样点的角点通常落在同一块), 命中计数先在本地累计, 析构时合并。
+ * Accessor 存在期间持有共享锁, 淘汰需要独占锁, 因此多个度量共享同一缓存时也不会释放正在读取的块。
+ */
+class MINDFeatureTileCache
+{
+public:
+    using ImageType = itk::Image<float, 3>;
+
+    struct Statistics
+    {
+        unsigned long hits = 0;        // 角点查找命中已计算的块
+        unsigned long misses = 0;      // 计算的块数
+        unsigned long evictions = 0;   // 因内存上限淘汰的块数
+        size_t residentTiles = 0;
+        size_t residentBytes = 0;
+        size_t peakBytes = 0;
+        size_t totalTiles = 0;         // 图像划分的块总数
+    };
+
+    static const unsigned int DefaultTileSize = 32;
+    static const size_t DefaultMemoryLimit = 1024ull * 1024 * 1024;   // 1GB
+
+    // image 的缓冲区须覆盖整幅图像; offsets 为各通道的邻居偏移, radius 为patch半径;
+    // tileSize 须为2的幂 (4..64)
+    MINDFeatureTileCache(ImageType::Pointer image,
+                         const std::vector<std::array<int, 3>>& offsets,
+                         unsigned int radius,
+                         size_t memoryLimitBytes = DefaultMemoryLimit,
+                         unsigned int tileSize = DefaultTileSize);
+    ~MINDFeatureTileCache();
+
+    MINDFeatureTileCache(const MINDFeatureTileCache&) = delete;
+    MINDFeatureTileCache& operator=(const MINDFeatureTileCache&) = delete;
+
+    ImageType::Pointer GetImage() const { return m_Image; }
+    size_t GetNumberOfChannels() const { return m_NumberOfChannels; }
+    unsigned int GetTileSize() const { return m_TileSize; }
+
+    // 内存上限在下次 BeginPass 时生效
+    void SetMemoryLimit(size_t bytes) { m_MemoryLimit.store(bytes, std::memory_order_relaxed); }
+    size_t GetMemoryLimit() const { return m_MemoryLimit.load(std::memory_order_relaxed); }
+
+    // 一次遍历 (一次度量评估) 开始前调用: 推进使用计数, 驻留超出上限时淘汰最久未用的块
+    // (有其他 Accessor 正在读取时跳过淘汰)
+    void BeginPass();
+
+    // 释放全部块 (等待正在进行的读取结束)
+    void Clear();
+
+    Statistics GetStatistics() const;
+
+    // 单块的交错数据
+    struct Tile
+    {
+        long size[3] = {0, 0, 0};
+        AlignedVector<float> values;      // 每体素 C 个特征值
+        AlignedVector<float> gradients;   // 每体素 3C 个梯度: gx[C], gy[C], gz[C]
+        size_t bytes = 0;
+        mutable std::atomic<unsigned long> lastUse{0};
+    };
+
+    /**
+     * @brief 一个线程分块内的读取句柄 (不可跨线程共享)
+     */
+    class Accessor
+    {
+    public:
+        explicit Accessor(MINDFeatureTileCache& cache);
+        ~Accessor();
+
+        Accessor(const Accessor&) = delete;
+        Accessor& operator=(const Accessor&) = delete;
+
+        // location 由与 GetImage() 几何相同的 TrilinearSampler 计算
+        // values: C 个插值特征值; gradients: 3C 个插值梯度 (gx[C], gy[C], gz[C]), 可为 nullptr
+        void Evaluate(const TrilinearSampler::Location& location, double* values, double* gradients);
+
+    private:
+        inline const Tile* GetTile(size_t tileIndex);
+
+        MINDFeatureTileCache& m_Cache;
+        std::shared_lock<std::shared_mutex> m_Lock;
+        unsigned long m_Pass;
+        size_t m_LastTileIndex;
+        const Tile* m_LastTile;
+        unsigned long m_Hits;
+    };
+
+private:
+    // 取块: 未计算时在该块的锁内计算并发布; computed 返回本次是否计算
+    const Tile* LoadTile(size_t tileIndex, bool& computed);
+    std::unique_ptr<Tile> ComputeTile(size_t tileIndex) const;
+
+    ImageType::Pointer m_Image;
+    std::vector<std::array<int, 3>> m_Offsets;
+    const size_t m_NumberOfChannels;
+    const long m_Radius;
+    const unsigned int m_TileSize;
+    unsigned int m_TileShift;
+    long m_Size[3];
+    size_t m_NumberOfTiles[3];
+    size_t m_TotalTiles;
+    double m_GradientScale[3];
+    double m_Direction[3][3];
+    bool m_IdentityDirection;
+
+    std::unique_ptr<std::atomic<const Tile*>[]> m_Tiles;   // 已发布的块 (未计算为 nullptr)
+    std::vector<std::unique_ptr<Tile>> m_TileStorage;      // 块的所有权, 按块序号
+    std::unique_ptr<std::mutex[]> m_TileMutexes;           // 每块一把, 只在计算时使用
+    mutable std::shared_mutex m_AccessMutex;               // Accessor 共享持有, 淘汰/清空独占
+
+    std::atomic<size_t> m_MemoryLimit;
+    std::atomic<unsigned long> m_PassCounter;
+    std::atomic<unsigned long> m_Hits;
+    mutable std::mutex m_StatisticsMutex;                  // 保护以下统计
+    Statistics m_Statistics;
+};
+
+#endif // MIND_FEATURE_TILE_CACHE_H
@@ -0,0 +1,102 @@
+#ifndef MIND_KERNELS_H
+#define MIND_KERNELS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief MIND描述子计算的内部核函数 (MINDMetric 与 MINDFeatureTileCache 共用)
+ *
+ * 完整特征图、采样点稀疏描述子和惰性分块特征使用同一组核,
+ * 保证三条路径在相同体素处得到相同的值。
+ */
+namespace MINDKernels
+{
+
+// 沿x方向 (连续存储) 对一行做盒式均值, 原地写回
+// 越界位置取边界体素 (与 MeanImageFilter 的 ZeroFluxNeumann 边界一致), 除以完整窗口大小
+inline void BoxFilterRow(float* row, long length, long radius, std::vector<float>& scratch)
+{
+    scratch.assign(row, row + length);
+    const double scale = 1.0 / static_cast<double>(2 * radius + 1);
+
+    double sum = 0.0;
+    for (long k = -radius; k <= radius; ++k)
+    {
+        sum += scratch[std::min(std::max(k, 0L), length - 1)];
+    }
+    for (long i = 0; i < length; ++i)
+    {
+        row[i] = static_cast<float>(sum * scale);
+        sum += scratch[std::min(i + radius + 1, length - 1)];
+        sum -= scratch[std::max(i - radius, 0L)];
+    }
+}
+
+// 沿跨步方向 (y或z) 做盒式均值: count 条长度为 width 的连续行 (第k行起始于 base + k*stride),
+// 以整行为单位维护滑动和, 内层循环沿x连续访问
+inline void BoxFilterStrided(float* base, long count, size_t stride, long width, long radius,
+                             std::vector<float>& scratch, std::vector<double>& sums)
+{
+    scratch.resize(static_cast<size_t>(count) * width);
+    for (long k = 0; k < count; ++k)
+    {
+        const float* row = base + static_cast<size_t>(k) * stride;
+        std::copy(row, row + width, scratch.data() + static_cast<size_t>(k) * width);
+    }
+
+    const double scale = 1.0 / static_cast<double>(2 * radius + 1);
+    sums.assign(static_cast<size_t>(width), 0.0);
+    for (long k = -radius; k <= radius; ++k)
+    {
+        const float* row = scratch.data() + static_cast<size_t>(std::min(std::max(k, 0L), count - 1)) * width;
+        for (long x = 0; x < width; ++x)
+        {
+            sums[x] += row[x];
+        }
+    }
+    for (long i = 0; i < count; ++i)
+    {
+        float* out = base + static_cast<size_t>(i) * stride;
+        const float* add = scratch.data() + static_cast<size_t>(std::min(i + radius + 1, count - 1)) * width;
+        const float* sub = scratch.data() + static_cast<size_t>(std::max(i - radius, 0L)) * width;
+        for (long x = 0; x < width; ++x)
+        {
+            out[x] = static_cast<float>(sums[x] * scale);
+            sums[x] += static_cast<double>(add[x]) - sub[x];
+        }
+    }
+}
+
+// 一个体素的描述子: 输入各方向 D_P, 原地写出归一化的 MIND 向量
+//   V(x) = mean_r(D_P) + eps
+//   MIND(x,r) = exp(-D_P / V)
+//   归一化: 除以各方向的最大值 (论文Eq.4: n是归一化常数使最大值为1)
+inline void NormalizeDescriptor(float* values, size_t numDirections)
+{
+    float sum = 0.0f;
+    for (size_t dir = 0; dir < numDirections; ++dir)
+    {
+        sum += values[dir];
+    }
+    const float variance = sum / static_cast<float>(numDirections) + 1e-10f;
+
+    float maxValue = 0.0f;
+    for (size_t dir = 0; dir < numDirections; ++dir)
+    {
+        values[dir] = std::exp(-values[dir] / variance);
+        maxValue = std::max(maxValue, values[dir]);
+    }
+
+    const float normalization = maxValue + 1e-10f;   // 防止除零
+    for (size_t dir = 0; dir < numDirections; ++dir)
+    {
+        values[dir] /= normalization;
+    }
+}
+
+} // namespace MINDKernels
+
+#endif // MIND_KERNELS_H
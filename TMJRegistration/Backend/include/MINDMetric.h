@@ -9,10 +9,17 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <future>
 #include "itkImage.h"
 #include "itkLinearInterpolateImageFunction.h"
 #include "itkTransform.h"
 #include "itkImageMaskSpatialObject.h"
+#include "MetricEvaluationCache.h"
+#include "TrilinearSampler.h"
+#include "FixedSampleSet.h"
+#include "RandomVoxelSelector.h"
+#include "MaskBitmap.h"
+#include "MINDFeatureTileCache.h"
 
 /**
  * @brief MIND (Modality Independent Neighbourhood Descriptor) 度量类
@@ -33,6 +40,7 @@
  * - 3D实现，支持6邻域或26邻域
  * - 与现有优化器框架兼容
  * - 支持解析梯度计算（通过有限差分）
+ * - 固定图像描述子只在采样点计算; 移动图像特征及其梯度按块惰性计算 (MINDFeatureTileCache)
  */
 class MINDMetric
 {
@@ -57,6 +65,49 @@ public:
         SixConnected,    // 6邻域: ±x, ±y, ±z (faces)
         TwentySixConnected  // 26邻域: full 3x3x3 cube excluding center
     };
+    
+    /**
+     * @brief 多个度量对象共享的MIND特征缓存 (线程安全)
+     *
+     * 服务模式中移动图像的特征块缓存经此获取, 同一移动图像各层级已计算的块在请求之间保持
+     * (固定图像只在采样点计算描述子, 不使用特征缓存)。
+     * 键与实例内特征缓存相同 (图像指针+MTime+半径+邻域类型)。
+     * 并发请求同一项时只有第一个调用者创建, 其余调用者等待其结果。
+     * 每项的内存由各自的块缓存上限约束。
+     */
+    class SharedFeatureCache
+    {
+    public:
+        using FeatureTiles = std::shared_ptr<MINDFeatureTileCache>;
+        using ComputeFunctionType = std::function<void(FeatureTiles&)>;
+        
+        static const size_t DefaultMaxEntries = 16;   // 超出时淘汰最久未用的已完成项
+        explicit SharedFeatureCache(size_t maxEntries = DefaultMaxEntries) : m_MaxEntries(maxEntries) {}
+        
+        // 命中时返回 true; 未命中时调用 compute 创建并登记 (compute 抛出异常时不登记, 异常传给所有等待者)
+        bool Acquire(ImageType::Pointer image, unsigned int radius, NeighborhoodType neighborhoodType,
+                     const ComputeFunctionType& compute, FeatureTiles& tiles);
+        void Clear();
+        size_t GetNumberOfEntries();
+        
+        // 各项块缓存统计之和 (totalTiles/峰值按项累加)
+        MINDFeatureTileCache::Statistics GetTileStatistics();
+        
+    private:
+        struct Entry
+        {
+            ImageType::Pointer image;
+            unsigned long modifiedTime = 0;
+            unsigned int radius = 0;
+            NeighborhoodType neighborhoodType = NeighborhoodType::SixConnected;
+            std::shared_future<FeatureTiles> tiles;
+            unsigned long lastUse = 0;
+        };
+        const size_t m_MaxEntries;
+        std::mutex m_Mutex;
+        std::vector<Entry> m_Entries;
+        unsigned long m_UseCounter = 0;
+    };
 
     MINDMetric();
     ~MINDMetric();
@@ -69,13 +120,13 @@ public:
     void SetMovingImage(ImageType::Pointer movingImage);
     
     // 设置变换(使用通用变换基类)
-    void SetTransform(TransformBaseType::Pointer transform) { m_Transform = transform; }
+    void SetTransform(TransformBaseType::Pointer transform) { m_Transform = transform; m_EvaluationCache.Invalidate(); }
     
     // 设置雅可比矩阵计算函数(由外部提供)
-    void SetJacobianFunction(JacobianFunctionType func) { m_JacobianFunction = func; }
+    void SetJacobianFunction(JacobianFunctionType func) { m_JacobianFunction = func; m_EvaluationCache.Invalidate(); }
     
     // 设置参数数量(根据变换类型: 刚体6, 仿射12)
-    void SetNumberOfParameters(unsigned int num) { m_NumberOfParameters = num; }
+    void SetNumberOfParameters(unsigned int num) { m_NumberOfParameters = num; m_EvaluationCache.Invalidate(); }
 
     // =========== MIND特定参数 ===========
     // 设置MIND描述符半径（用于计算局部方差）
@@ -116,6 +167,17 @@ public:
     
     // 显式清空缓存（用于级联配准阶段切换）
     void ResetCache();
+    
+    // 移动图像特征改为从共享缓存获取 (服务模式在请求之间保留), 空指针恢复为实例内缓存
+    void SetSharedMovingFeatureCache(std::shared_ptr<SharedFeatureCache> cache) { m_SharedMovingFeatureCache = cache; }
+    std::shared_ptr<SharedFeatureCache> GetSharedMovingFeatureCache() const { return m_SharedMovingFeatureCache; }
+    
+    // 移动图像特征块缓存的内存上限 (每幅移动图像/层级一个块缓存, 默认1GB)
+    void SetMovingFeatureTileMemoryLimit(size_t bytes) { m_MovingFeatureTileMemoryLimit = bytes; }
+    size_t GetMovingFeatureTileMemoryLimit() const { return m_MovingFeatureTileMemoryLimit; }
+    
+    // 当前移动图像特征块缓存的统计 (Initialize 之前为空)
+    MINDFeatureTileCache::Statistics GetMovingFeatureTileStatistics() const;
 
     // 计算MIND-SSD值和梯度
     double GetValue();
@@ -134,6 +196,10 @@ public:
     // 同时获取残差和雅可比矩阵(更高效,避免重复计算变换点)
     void GetResidualsAndJacobian(std::vector<double>& residuals,
                                   std::vector<std::vector<double>>& jacobian);
+    
+    // 直接组装正规方程 JtJ = J^T J (P×P, 行主序) 和 Jtf = J^T f (P), 不物化残差和雅可比矩阵
+    // 采样点分块并行累加, 按分块顺序合并; 返回残差个数 (numValidSamples * numChannels)
+    size_t GetNormalEquations(std::vector<double>& JtJ, std::vector<double>& Jtf);
 
     // 获取当前度量值
     double GetCurrentValue() const { return m_CurrentValue; }
@@ -141,10 +207,20 @@ public:
     // 获取有效采样点数量(用于调试)
     unsigned int GetNumberOfValidSamples() const { return m_NumberOfValidSamples; }
     
-    // 计算图像的MIND特征图（公开供测试使用）
+    // 评估缓存: 同一参数上的重复代价/梯度请求直接返回缓存结果
+    void SetUseEvaluationCache(bool use) { m_EvaluationCache.SetEnabled(use); }
+    const MetricEvaluationCache::Statistics& GetEvaluationCacheStatistics() const { return m_EvaluationCache.GetStatistics(); }
+    
+    // 计算图像的完整MIND特征图（公开供测试/导出使用; 配准中固定图像用 ComputeSparseMINDDescriptors, 移动图像按块计算）
     void ComputeMINDFeatures(ImageType::Pointer image, 
                              std::vector<ImageType::Pointer>& mindFeatures);
     
+    // 只在给定缓冲区偏移处计算MIND描述子 (含patch均值和局部方差),
+    // 结果写入 descriptors[i * 通道数 + ch], 与完整特征图在这些位置的值一致
+    void ComputeSparseMINDDescriptors(ImageType::Pointer image,
+                                      const std::vector<size_t>& bufferOffsets,
+                                      float* descriptors);
+    
     // 计算并返回中间 D_P (patch distance) 图
     void ComputePatchDistances(ImageType::Pointer image,
                                 std::vector<ImageType::Pointer>& dpImages);
@@ -159,12 +235,13 @@ private:
     InterpolatorType::Pointer m_Interpolator;
     TransformBaseType::Pointer m_Transform;
     
-    // MIND特征图
-    std::vector<ImageType::Pointer> m_FixedMINDFeatures;   // 每个邻域方向一个
-    std::vector<ImageType::Pointer> m_MovingMINDFeatures;  // 每个邻域方向一个
+    // 移动图像MIND特征及梯度的块缓存 (按需计算; 固定图像的描述子只在采样点计算, 存于 m_SampleFixedMIND)
+    std::shared_ptr<MINDFeatureTileCache> m_MovingMINDTiles;
+    size_t m_MovingFeatureTileMemoryLimit;
     
     // 掩膜 (可选,用于局部配准)
     MaskSpatialObjectType::Pointer m_FixedImageMask;
+    MaskBitmap m_FixedMaskBitmap;   // 掩膜栅格化到当前固定图像网格 (掩膜/固定图像改变时重建)
     
     // 雅可比矩阵计算函数(外部提供)
     JacobianFunctionType m_JacobianFunction;
@@ -173,19 +250,31 @@ private:
     // 移动图像梯度(用于梯度计算)
     std::array<ImageType::Pointer, 3> m_MovingImageGradient;
     
-    // 预分配的MIND特征插值器(避免循环内重复创建)
-    std::vector<InterpolatorType::Pointer> m_MovingMINDInterpolators;
     std::array<InterpolatorType::Pointer, 3> m_GradientInterpolators;
     
-    // 移动图像MIND特征梯度（每个特征通道的x/y/z梯度）
-    std::vector<std::array<ImageType::Pointer, 3>> m_MovingMINDFeatureGradients;
-    std::vector<std::array<InterpolatorType::Pointer, 3>> m_MovingMINDFeatureGradientInterpolators;
+    // 热点循环的采样核: 所有通道及其梯度几何相同, 每个采样点只计算一次三线性权重,
+    // 再经 MINDFeatureTileCache::Accessor 从角点所在的块读取交错的通道向量
+    TrilinearSampler m_MovingMINDSampler;
     
     // 缓存机制：避免多分辨率中重复计算MIND特征
-    ImageType::Pointer m_CachedFixedImage;
     ImageType::Pointer m_CachedMovingImage;
-    bool m_FixedMINDFeaturesValid;
     bool m_MovingMINDFeaturesValid;
+    
+    // 按图像缓存的MIND特征块 (金字塔各层级的移动图像各一项):
+    // 级联下一阶段从粗层级重新开始时, 同一层级图像对象已计算的块直接命中, 不再重新计算
+    struct FeatureCacheEntry
+    {
+        ImageType::Pointer image;          // 持有图像, 保证指针键不被复用
+        unsigned long modifiedTime = 0;
+        unsigned int radius = 0;
+        NeighborhoodType neighborhoodType = NeighborhoodType::SixConnected;
+        std::shared_ptr<MINDFeatureTileCache> tiles;
+        unsigned long lastUse = 0;
+    };
+    static const size_t MaxFeatureCacheEntries = 16;   // 超出时淘汰最久未用的项
+    std::vector<FeatureCacheEntry> m_FeatureCache;
+    unsigned long m_FeatureCacheUseCounter;
+    std::shared_ptr<SharedFeatureCache> m_SharedMovingFeatureCache;
 
     // MIND参数
     unsigned int m_MINDRadius;     // MIND描述符计算半径
@@ -202,14 +291,11 @@ private:
     bool m_UseStratifiedSampling;
     unsigned int m_NumberOfValidSamples;
     
-    // 采样点信息
-    struct SamplePoint
-    {
-        ImageType::PointType fixedPoint;     // 固定图像中的物理点
-        ImageType::IndexType fixedIndex;     // 固定图像中的索引
-        std::vector<float> fixedMINDValues;  // 固定图像MIND特征值
-    };
-    std::vector<SamplePoint> m_SamplePoints;
+    // 采样点 (结构数组, 按Morton序排列, 见 FixedSampleSet)
+    FixedSampleSet m_Samples;
+    
+    // 固定图像MIND特征值, 扁平存储: m_SampleFixedMIND[sample * numChannels + channel]
+    AlignedVector<float> m_SampleFixedMIND;
 
     // 当前度量值
     double m_CurrentValue;
@@ -223,25 +309,34 @@ private:
     
     // 有限差分步长(用于梯度计算)
     double m_FiniteDifferenceStep;
+    
+    // 按变换参数缓存的评估结果
+    MetricEvaluationCache m_EvaluationCache;
 
     // ============ 内部方法 ============
     
     // 初始化邻域偏移量
     void InitializeNeighborhoodOffsets();
     
-    // 辅助函数：平移图像
-    ImageType::Pointer ShiftImage(ImageType::Pointer image, int offsetX, int offsetY, int offsetZ);
+    // 辅助函数：分配与输入图像几何相同的特征图
+    static ImageType::Pointer AllocateFeatureImage(ImageType::Pointer image);
     
-    // 辅助函数：均值滤波（用于计算Patch内的平均值）
-    ImageType::Pointer ApplyMeanFilter(ImageType::Pointer image);
+    // 单方向 D_P(x, x+r): 按索引偏移求平方差, 再做可分离盒式滤波 (滑动和), 直接写入 output
+    void ComputePatchDistance(ImageType::Pointer image, const std::array<int, 3>& offset, float* output);
     
-    // 计算MIND特征梯度（用于解析梯度）
-    void ComputeMINDFeatureGradients();
+    // 为图像创建特征块缓存 (当前邻域/半径/内存上限, 块在首次读取时才计算)
+    std::shared_ptr<MINDFeatureTileCache> CreateFeatureTiles(ImageType::Pointer image) const;
     
     // 采样策略
     void SampleFixedImage();
     void SampleFixedImageStratified();
     void SampleFixedImageRandom();
+    void StoreSamples(std::vector<ImageType::IndexType>& indices);  // 建立采样集并在采样点计算固定MIND描述子
+    void UpdateFixedMaskBitmap();
+    
+    // 取图像的MIND特征块缓存: 特征缓存中有(图像指针+MTime+半径+邻域类型一致)时直接返回, 否则创建并登记
+    // 返回是否命中缓存
+    bool AcquireMINDFeatureTiles(ImageType::Pointer image, std::shared_ptr<MINDFeatureTileCache>& tiles);
     
     // 计算MIND-SSD度量值
     double ComputeMINDSSD();
@@ -250,7 +345,10 @@ private:
     void ComputeFiniteDifferenceGradient(ParametersType& derivative);
     
     // 计算解析梯度（基于链式法则）
-    void ComputeAnalyticalGradient(ParametersType& derivative);
+    // ssdValue/validSamples 可选输出同一遍历中得到的MIND-SSD值, 用于填充评估缓存
+    void ComputeAnalyticalGradient(ParametersType& derivative,
+                                   double* ssdValue = nullptr,
+                                   unsigned int* validSampleCount = nullptr);
     
     // 辅助函数：在给定变换参数下计算度量值
     double ComputeValueAtParameters(const ParametersType& parameters);
@@ -258,6 +356,7 @@ private:
     // 将变换参数应用到变换对象
     void SetTransformParameters(const ParametersType& parameters);
     ParametersType GetTransformParameters() const;
+    ParametersType GetEvaluationCacheKey() const;  // 当前变换参数(含固定参数)
 };
 
 #endif // MIND_METRIC_H
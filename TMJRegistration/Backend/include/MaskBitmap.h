@@ -0,0 +1,122 @@
+#ifndef MASK_BITMAP_H
+#define MASK_BITMAP_H
+
+#include <cstdint>
+#include <vector>
+#include "itkImage.h"
+#include "itkImageMaskSpatialObject.h"
+
+/**
+ * @brief 栅格化到参考图像网格的掩膜 (位图 + 行程 + 包围盒)
+ *
+ * 替代对每个体素调用 TransformIndexToPhysicalPoint + ImageMaskSpatialObject::IsInsideInWorldSpace
+ * (每次都是一次物理点到掩膜索引的逆变换和边界判断) 的做法:
+ * 每个金字塔层级只把掩膜栅格化到该层固定图像网格上一次, 之后的计数、采样
+ * 都只做位测试或直接按行程枚举。
+ *
+ * 判定语义与 ImageMaskSpatialObject 一致 (对象到世界变换为单位变换时):
+ * 参考体素中心的物理点 → 掩膜连续索引 → 四舍五入(半整数向上) → 在掩膜缓冲区内且像素非零。
+ *
+ * 只在掩膜非零包围盒映射到参考网格后的区域内逐体素判定, 区域外直接视为掩膜外,
+ * 对TMJ ROI这类只占体数据约2%的掩膜可跳过绝大部分体素。
+ * 判定沿x方向增量计算, 并按z切片在线程池中并行。
+ */
+class MaskBitmap
+{
+public:
+    using ImageType = itk::Image<float, 3>;
+    using MaskImageType = itk::Image<unsigned char, 3>;
+    using MaskSpatialObjectType = itk::ImageMaskSpatialObject<3>;
+    using IndexType = ImageType::IndexType;
+    using RegionType = ImageType::RegionType;
+
+    // 一行内连续的掩膜体素段, rank 为该段首个体素在全部掩膜体素(扫描顺序)中的序号
+    struct Run
+    {
+        IndexType start;
+        uint64_t length;
+        uint64_t rank;
+    };
+
+    MaskBitmap();
+
+    // 栅格化到参考图像的最大可能区域; 掩膜图像和参考图像均未改变(指针+MTime)时直接返回
+    void Rasterize(const MaskSpatialObjectType* mask, const ImageType* reference, unsigned int maxThreads = 0);
+
+    // 栅格化到掩膜自身的网格 (用于统计掩膜体素数和包围盒)
+    void Rasterize(const MaskImageType* mask, unsigned int maxThreads = 0);
+
+    void Clear();
+
+    bool IsRasterized() const { return m_Rasterized; }
+
+    // 参考网格中的索引是否在掩膜内
+    inline bool IsInside(const IndexType& index) const;
+
+    uint64_t GetNumberOfInsideVoxels() const { return m_NumberOfInsideVoxels; }
+
+    // 掩膜体素在参考网格中的紧包围盒 (无掩膜体素时大小为0)
+    const RegionType& GetBoundingBox() const { return m_BoundingBox; }
+
+    // 参考网格的完整区域
+    const RegionType& GetReferenceRegion() const { return m_ReferenceRegion; }
+
+    // 按扫描顺序(x最快)排列的行程
+    const std::vector<Run>& GetRuns() const { return m_Runs; }
+
+    // 第rank个掩膜体素 (扫描顺序, 0 <= rank < GetNumberOfInsideVoxels()), 二分查找行程
+    IndexType GetInsideVoxel(uint64_t rank) const;
+
+private:
+    // 在给定网格上栅格化: indexToPhysical/origin 描述参考网格
+    void RasterizeOnGrid(const MaskImageType* mask,
+                         const RegionType& referenceRegion,
+                         const double referenceOrigin[3],
+                         const double indexToPhysical[3][3],
+                         unsigned int maxThreads);
+
+    // 掩膜图像中非零体素的包围盒 (按掩膜指针+MTime缓存, 金字塔各层共用)
+    const RegionType& GetMaskIndexBoundingBox(const MaskImageType* mask);
+
+    bool m_Rasterized;
+    RegionType m_ReferenceRegion;
+    RegionType m_RasterRegion;       // 实际逐体素判定(存放位图)的区域, 其外均为掩膜外
+    RegionType m_BoundingBox;
+    uint64_t m_NumberOfInsideVoxels;
+
+    // 位图: 每行按64位字对齐, 不同行不共用字 (便于按切片并行写入)
+    std::vector<uint64_t> m_Bits;
+    size_t m_WordsPerRow;
+
+    std::vector<Run> m_Runs;
+
+    // 缓存键
+    const void* m_MaskImage;
+    unsigned long m_MaskModifiedTime;
+    const void* m_ReferenceImage;
+    unsigned long m_ReferenceModifiedTime;
+
+    const MaskImageType* m_BoundingBoxMask;
+    unsigned long m_BoundingBoxMaskModifiedTime;
+    RegionType m_MaskIndexBoundingBox;
+};
+
+// ============================================================================
+// 内联实现 (热点路径)
+// ============================================================================
+
+inline bool MaskBitmap::IsInside(const IndexType& index) const
+{
+    if (!m_Rasterized || !m_RasterRegion.IsInside(index))
+    {
+        return false;
+    }
+
+    const size_t x = static_cast<size_t>(index[0] - m_RasterRegion.GetIndex(0));
+    const size_t y = static_cast<size_t>(index[1] - m_RasterRegion.GetIndex(1));
+    const size_t z = static_cast<size_t>(index[2] - m_RasterRegion.GetIndex(2));
+    const size_t row = z * m_RasterRegion.GetSize(1) + y;
+    return (m_Bits[row * m_WordsPerRow + (x >> 6)] >> (x & 63)) & 1u;
+}
+
+#endif // MASK_BITMAP_H
@@ -7,12 +7,21 @@
 #include <array>
 #include <functional>
 #include <thread>
+#include <algorithm>
 #include <mutex>
 #include <atomic>
 #include "itkImage.h"
 #include "itkLinearInterpolateImageFunction.h"
 #include "itkTransform.h"
 #include "itkImageMaskSpatialObject.h"
+#include "AlignedAllocator.h"
+#include "MetricEvaluationCache.h"
+#include "ThreadPool.h"
+#include "TrilinearSampler.h"
+#include "GradientImageCache.h"
+#include "FixedSampleSet.h"
+#include "RandomVoxelSelector.h"
+#include "MaskBitmap.h"
 
 /**
  * @brief Mattes互信息度量类 - 带解析梯度
@@ -31,6 +40,14 @@
  * 其中 dp(f,m)/dp 通过链式法则计算:
  * dp(f,m)/dp = sum_samples [ dB/dm * dm/dp ]
  * dm/dp = gradient_M(T(x)) * dT/dp
+ * 
+ * 梯度计算的两种模式 (SetUseExplicitPDFDerivatives):
+ * - 显式 (默认): 单遍同时累加联合PDF和 B×B×P 的联合PDF导数, 再与 log 项缩并。
+ *   每个分块一份 B²·P 缓冲区, 内存随参数数和线程数线性增长。
+ * - 两遍 (对应ITK v4的非显式PDF导数模式): 第1遍只构建联合PDF;
+ *   第2遍对每个采样点直接计算 sum_f sum_m B_f * dB_m/dm * log(p(f,m)/p(m)) * dm/dp,
+ *   累加到长度为P的梯度向量。没有 B²·P 缓冲区, 适合高自由度变换,
+ *   代价是每个采样点插值和变换两次。
  */
 class MattesMutualInformation
 {
@@ -61,13 +78,13 @@ public:
     void SetMovingImage(ImageType::Pointer movingImage);
     
     // 设置变换(使用通用变换基类)
-    void SetTransform(TransformBaseType::Pointer transform) { m_Transform = transform; }
+    void SetTransform(TransformBaseType::Pointer transform) { m_Transform = transform; m_EvaluationCache.Invalidate(); }
     
     // 设置雅可比矩阵计算函数(由外部提供,支持不同变换类型)
-    void SetJacobianFunction(JacobianFunctionType func) { m_JacobianFunction = func; }
+    void SetJacobianFunction(JacobianFunctionType func) { m_JacobianFunction = func; m_EvaluationCache.Invalidate(); }
     
     // 设置参数数量(根据变换类型: 刚体6, 仿射12)
-    void SetNumberOfParameters(unsigned int num) { m_NumberOfParameters = num; }
+    void SetNumberOfParameters(unsigned int num) { m_NumberOfParameters = num; m_EvaluationCache.Invalidate(); }
 
     // 设置参数
     void SetNumberOfHistogramBins(unsigned int bins) { m_NumberOfHistogramBins = bins; }
@@ -88,6 +105,10 @@ public:
     // 多线程设置
     void SetNumberOfThreads(unsigned int n) { m_NumberOfThreads = n; }
     unsigned int GetNumberOfThreads() const { return m_NumberOfThreads; }
+    
+    // 梯度计算模式: true=显式联合PDF导数(单遍), false=两遍(不分配 B²·P 导数缓冲区)
+    void SetUseExplicitPDFDerivatives(bool use) { m_UseExplicitPDFDerivatives = use; m_EvaluationCache.Invalidate(); }
+    bool GetUseExplicitPDFDerivatives() const { return m_UseExplicitPDFDerivatives; }
 
     // 初始化
     void Initialize();
@@ -96,6 +117,7 @@ public:
     void ReinitializeSampling();
 
     // 计算互信息值和梯度
+    // GetValue() 只构建联合PDF(不计算导数直方图/梯度插值/雅可比), 供代价函数和线搜索使用
     double GetValue();
     void GetDerivative(ParametersType& derivative);
     void GetValueAndDerivative(double& value, ParametersType& derivative);
@@ -114,24 +136,46 @@ public:
     
     // 获取有效采样点数量(用于调试)
     unsigned int GetNumberOfValidSamples() const { return m_NumberOfValidSamples; }
+    
+    // 评估缓存: 同一参数上的重复代价/梯度请求直接返回缓存结果
+    void SetUseEvaluationCache(bool use) { m_EvaluationCache.SetEnabled(use); }
+    const MetricEvaluationCache::Statistics& GetEvaluationCacheStatistics() const { return m_EvaluationCache.GetStatistics(); }
+    
+    // 分阶段计时 (累加采样点直方图 / 合并归一化 / 两遍模式的第2遍), 用于线程扩展性分析
+    struct TimingStatistics
+    {
+        double accumulateSeconds = 0.0;
+        double mergeSeconds = 0.0;
+        double derivativePassSeconds = 0.0;
+        unsigned long evaluations = 0;
+    };
+    const TimingStatistics& GetTimingStatistics() const { return m_TimingStatistics; }
+    void ResetTimingStatistics() { m_TimingStatistics = TimingStatistics(); }
+    
+    // 当前已分配的联合PDF导数缓冲区字节数 (各分块局部 + 合并结果), 两遍模式下为0
+    size_t GetDerivativeBufferBytes() const;
 
 private:
     // 图像指针
     ImageType::Pointer m_FixedImage;
     ImageType::Pointer m_MovingImage;
-    InterpolatorType::Pointer m_Interpolator;
     TransformBaseType::Pointer m_Transform;
     
     // 掩膜 (可选,用于局部配准)
     MaskSpatialObjectType::Pointer m_FixedImageMask;
+    MaskBitmap m_FixedMaskBitmap;   // 掩膜栅格化到当前固定图像网格 (掩膜/固定图像改变时重建)
     
     // 雅可比矩阵计算函数(外部提供)
     JacobianFunctionType m_JacobianFunction;
     unsigned int m_NumberOfParameters;
 
-    // 移动图像梯度(用于解析梯度计算)
-    std::array<ImageType::Pointer, 3> m_MovingImageGradient;
-    std::array<InterpolatorType::Pointer, 3> m_GradientInterpolators;
+    // 移动图像梯度(用于解析梯度计算), 交错存储, 来自共享梯度缓存
+    GradientImageCache::GradientPointer m_MovingImageGradient;
+    
+    // 热点循环的采样核: 强度和3个梯度分量共用一次三线性权重计算
+    TrilinearSampler m_MovingSampler;
+    const float* m_MovingImageBuffer;
+    const float* m_MovingGradientBuffer;
 
     // 直方图参数
     unsigned int m_NumberOfHistogramBins;
@@ -142,26 +186,29 @@ private:
     bool m_UseStratifiedSampling;
     unsigned int m_NumberOfValidSamples;
 
-    // B样条Parzen窗的联合直方图 (二维)
-    std::vector<std::vector<double>> m_JointPDF;
+    // 连续、64字节对齐的直方图缓冲区
+    using HistogramBufferType = AlignedVector<double>;
+
+    // B样条Parzen窗的联合直方图 (行主序, 扁平存储)
+    // m_JointPDF[fixedBin * numBins + movingBin]
+    HistogramBufferType m_JointPDF;
     
     // 边缘概率分布
     std::vector<double> m_FixedImageMarginalPDF;
     std::vector<double> m_MovingImageMarginalPDF;
     
-    // 用于解析梯度的联合PDF导数存储
-    // m_JointPDFDerivatives[param][fixedBin][movingBin]
-    std::vector<std::vector<std::vector<double>>> m_JointPDFDerivatives;
+    // 用于解析梯度的联合PDF导数存储 (参数索引位于最内层)
+    // m_JointPDFDerivatives[(fixedBin * numBins + movingBin) * numParams + param]
+    // 每个(fixedBin, movingBin)的更新是一段连续的6/12个double, 可整体向量化
+    HistogramBufferType m_JointPDFDerivatives;
 
-    // 采样点信息(扩展版)
-    struct SamplePoint
-    {
-        ImageType::PointType fixedPoint;     // 固定图像中的物理点
-        double fixedValue;                   // 固定图像强度
-        int fixedParzenWindowIndex;          // 固定图像B样条起始索引
-        std::array<double, 4> fixedBSplineWeights;  // 固定图像B样条权重
-    };
-    std::vector<SamplePoint> m_SamplePoints;
+    // 采样点 (结构数组, 按Morton序排列, 见 FixedSampleSet)
+    FixedSampleSet m_Samples;
+    
+    // 固定图像B样条Parzen窗, 与 m_Samples 同序:
+    // 起始bin m_SampleFixedParzenIndices[i], 权重 m_SampleFixedWeights[4*i .. 4*i+3]
+    std::vector<int> m_SampleFixedParzenIndices;
+    AlignedVector<double> m_SampleFixedWeights;
 
     // 图像强度范围
     double m_FixedImageMin;
@@ -183,35 +230,63 @@ private:
     // 多线程参数
     unsigned int m_NumberOfThreads;
     
-    // 多线程局部直方图 (每个线程一个)
+    // 梯度计算模式 (见类说明)
+    bool m_UseExplicitPDFDerivatives;
+    
+    // 两遍模式: log(p(f,m)/p(m)) 表 (布局同 m_JointPDF, 无效单元为0)
+    // 和按分块序号索引的P维梯度部分和 (按分块顺序合并, 结果与线程调度无关)
+    HistogramBufferType m_PDFLogRatios;
+    std::vector<AlignedVector<double>> m_ChunkDerivatives;
+    
+    // 按变换参数缓存的评估结果
+    MetricEvaluationCache m_EvaluationCache;
+    
+    TimingStatistics m_TimingStatistics;
+    
+    // 多线程局部直方图 (每个分块一个)
+    // 布局与 m_JointPDF / m_JointPDFDerivatives 相同
     struct ThreadLocalHistograms
     {
-        std::vector<std::vector<double>> jointPDF;
-        std::vector<std::vector<std::vector<double>>> jointPDFDerivatives;
+        HistogramBufferType jointPDF;
+        HistogramBufferType jointPDFDerivatives;
         unsigned int validSamples;
         
         ThreadLocalHistograms(unsigned int numBins, unsigned int numParams)
-            : validSamples(0)
+            : jointPDF(static_cast<size_t>(numBins) * numBins, 0.0)
+            , jointPDFDerivatives(static_cast<size_t>(numBins) * numBins * numParams, 0.0)
+            , validSamples(0)
         {
-            jointPDF.resize(numBins, std::vector<double>(numBins, 0.0));
-            jointPDFDerivatives.resize(numParams);
-            for (auto& paramDeriv : jointPDFDerivatives)
+        }
+        
+        // 清零 (仅值路径不触碰导数缓冲区)
+        void Reset(bool includeDerivatives)
+        {
+            std::fill(jointPDF.begin(), jointPDF.end(), 0.0);
+            if (includeDerivatives)
             {
-                paramDeriv.resize(numBins, std::vector<double>(numBins, 0.0));
+                std::fill(jointPDFDerivatives.begin(), jointPDFDerivatives.end(), 0.0);
             }
+            validSamples = 0;
         }
     };
+    
+    // 持久分块直方图: 跨调用复用, 只在bin数/参数数变化时重新分配。
+    // 按分块序号(而非执行线程)索引, 合并顺序固定, 结果与线程调度无关
+    std::vector<ThreadLocalHistograms> m_ChunkHistograms;
 
     // ============ 内部方法 ============
     
     // 初始化相关
     void ComputeImageExtrema();
     void ComputeMovingImageGradient();
+    void SetupMovingSampler();
     
     // 采样策略
     void SampleFixedImage();
     void SampleFixedImageStratified();  // 分层均匀采样
     void SampleFixedImageRandom();      // 随机采样
+    void StoreSamples(std::vector<ImageType::IndexType>& indices);  // 建立采样集并预计算固定图像Parzen窗
+    void UpdateFixedMaskBitmap();       // 有掩膜时栅格化到固定图像网格, 否则清空
     
     // B样条相关
     double EvaluateCubicBSpline(double u) const;
@@ -225,10 +300,24 @@ private:
     void ComputeJointPDFAndDerivatives();
     void ComputeJointPDFAndDerivativesThreaded();  // 多线程版本
     void ComputePDFRange(size_t startIdx, size_t endIdx, ThreadLocalHistograms& localHist);
+    void MergeAndNormalizeHistograms(size_t numberOfHistograms, bool includeDerivatives = true);
+    
+    // 线程池调度: 确定分块数并准备持久分块直方图
+    void PrepareChunkHistograms(size_t numberOfChunks, bool includeDerivatives);
+    void RunPDFKernelThreaded(bool includeDerivatives);
+    
+    // 仅值路径: 只累加联合PDF, 跳过导数直方图、梯度插值和雅可比回调
+    void ComputeJointPDFThreaded();
+    void ComputePDFValueRange(size_t startIdx, size_t endIdx, ThreadLocalHistograms& localHist);
     double ComputeMutualInformation();
     void ComputeAnalyticalGradient(ParametersType& derivative);
     
+    // 两遍模式的第2遍: 在已构建的联合PDF上逐采样点累加梯度
+    void ComputeAnalyticalGradientTwoPass(ParametersType& derivative);
+    void ComputeDerivativeRange(size_t startIdx, size_t endIdx, double* derivative);
+    
     // 辅助函数
+    ParametersType GetEvaluationCacheKey() const;  // 当前变换参数(含固定参数)
     double ComputeFixedImageContinuousIndex(double value) const;
     double ComputeMovingImageContinuousIndex(double value) const;
 };
@@ -0,0 +1,82 @@
+#ifndef METRIC_EVALUATION_CACHE_H
+#define METRIC_EVALUATION_CACHE_H
+
+#include <vector>
+
+/**
+ * @brief 度量评估结果缓存 (按变换参数精确匹配)
+ *
+ * 优化器经常在同一组参数上先后请求代价值和梯度, 例如:
+ * - RegularStep: 步长被拒绝后回退参数, 下一次迭代在同一参数上再次请求梯度
+ * - Gauss-Newton: 残差/雅可比之后线搜索在当前参数上请求梯度,
+ *   线搜索接受的试探点随后又被重新评估一次代价值
+ *
+ * 缓存键 = 变换参数向量(逐位相等) + 采样代数(generation)。
+ * 任何改变度量结果的操作(重新采样、更换图像/变换/雅可比函数)都必须调用
+ * Invalidate() 递增代数, 使旧结果失效。
+ *
+ * 容量很小(默认4条), 按最近使用淘汰, 查找为线性扫描。
+ * 非线程安全: 每个度量实例持有自己的缓存, 只在优化线程中访问。
+ */
+class MetricEvaluationCache
+{
+public:
+    using ParametersType = std::vector<double>;
+
+    // 命中统计 (用于调试输出)
+    struct Statistics
+    {
+        unsigned long valueHits = 0;
+        unsigned long valueMisses = 0;
+        unsigned long derivativeHits = 0;
+        unsigned long derivativeMisses = 0;
+    };
+
+    explicit MetricEvaluationCache(unsigned int capacity = 4);
+    ~MetricEvaluationCache();
+
+    void SetEnabled(bool enabled);
+    bool GetEnabled() const { return m_Enabled; }
+
+    // 使所有缓存结果失效 (采样集、图像或变换改变时调用)
+    void Invalidate();
+    unsigned long GetGeneration() const { return m_Generation; }
+
+    // 查找缓存: 命中返回true并输出结果
+    bool FindValue(const ParametersType& parameters, double& value, unsigned int& validSamples);
+    bool FindDerivative(const ParametersType& parameters, ParametersType& derivative);
+
+    // 写入缓存 (同一参数的值和梯度合并在一条记录中)
+    void StoreValue(const ParametersType& parameters, double value, unsigned int validSamples);
+    void StoreDerivative(const ParametersType& parameters, const ParametersType& derivative);
+
+    const Statistics& GetStatistics() const { return m_Statistics; }
+    void ResetStatistics() { m_Statistics = Statistics(); }
+
+private:
+    struct Entry
+    {
+        ParametersType parameters;
+        unsigned long generation = 0;
+        unsigned long lastUse = 0;
+
+        bool hasValue = false;
+        double value = 0.0;
+        unsigned int validSamples = 0;
+
+        bool hasDerivative = false;
+        ParametersType derivative;
+    };
+
+    Entry* FindEntry(const ParametersType& parameters);
+    Entry& FindOrCreateEntry(const ParametersType& parameters);
+
+    std::vector<Entry> m_Entries;
+    unsigned int m_Capacity;
+    unsigned long m_Generation;
+    unsigned long m_UseCounter;
+    bool m_Enabled;
+    Statistics m_Statistics;
+};
+
+#endif // METRIC_EVALUATION_CACHE_H
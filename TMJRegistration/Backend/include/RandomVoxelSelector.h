@@ -0,0 +1,67 @@
+#ifndef RANDOM_VOXEL_SELECTOR_H
+#define RANDOM_VOXEL_SELECTOR_H
+
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "itkImage.h"
+#include "MaskBitmap.h"
+
+/**
+ * @brief 无放回随机体素选择 (MI / MIND 的随机采样共用)
+ *
+ * 替代"收集全部体素索引 → 整体打乱 → 取前N个"的做法:
+ * 全分辨率CBCT上该数组可达数百MB, 且每个金字塔层级、每个级联阶段都要重做一次。
+ * 这里的代价只与采样数相关:
+ *
+ * - SelectDistinct: 从 [0, N) 中选 k 个不同序号。
+ *   k 远小于 N 时使用 Floyd 算法 (k 次随机数 + 哈希集合), 期望 O(k);
+ *   k 接近 N 时改用顺序选择 (Knuth 算法S), 一次遍历且无需额外集合。
+ * - SelectVoxels: 在区域内按线性序号选取体素, 不遍历图像;
+ *   掩膜版本按 MaskBitmap 的行程序号选取, 只与行程数和采样数相关。
+ *
+ * 所有方法都只从调用方传入的随机数生成器取数, 相同种子得到相同结果。
+ */
+class RandomVoxelSelector
+{
+public:
+    using ImageType = itk::Image<float, 3>;
+    using IndexType = ImageType::IndexType;
+    using RegionType = ImageType::RegionType;
+    using GeneratorType = std::mt19937;
+
+    // 从 [0, populationSize) 中无放回选取 min(count, populationSize) 个序号, 结果升序
+    static void SelectDistinct(uint64_t populationSize, uint64_t count,
+                               GeneratorType& generator, std::vector<uint64_t>& selected);
+
+    // 在区域内无放回随机选取 min(count, 体素数) 个体素, 结果按扫描顺序
+    static void SelectVoxels(const RegionType& region, uint64_t count,
+                             GeneratorType& generator, std::vector<IndexType>& indices);
+
+    // 在掩膜内(且位于 restrictRegion 内)无放回随机选取 min(count, 掩膜体素数) 个体素, 结果按扫描顺序
+    static void SelectVoxels(const MaskBitmap& mask, const RegionType& restrictRegion, uint64_t count,
+                             GeneratorType& generator, std::vector<IndexType>& indices);
+
+    // 线性序号 (x最快) ↔ 区域内索引
+    static inline IndexType LinearToIndex(const RegionType& region, uint64_t linearIndex);
+};
+
+// ============================================================================
+// 内联实现
+// ============================================================================
+
+inline RandomVoxelSelector::IndexType RandomVoxelSelector::LinearToIndex(const RegionType& region,
+                                                                         uint64_t linearIndex)
+{
+    const uint64_t sizeX = region.GetSize(0);
+    const uint64_t sizeY = region.GetSize(1);
+
+    IndexType index;
+    index[0] = region.GetIndex(0) + static_cast<long>(linearIndex % sizeX);
+    linearIndex /= sizeX;
+    index[1] = region.GetIndex(1) + static_cast<long>(linearIndex % sizeY);
+    index[2] = region.GetIndex(2) + static_cast<long>(linearIndex / sizeY);
+    return index;
+}
+
+#endif // RANDOM_VOXEL_SELECTOR_H
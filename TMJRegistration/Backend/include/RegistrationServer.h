@@ -0,0 +1,119 @@
+#ifndef REGISTRATION_SERVER_H
+#define REGISTRATION_SERVER_H
+
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include "ImageRegistration.h"
+
+/**
+ * @brief 常驻配准服务 (--serve) - 消除每次调用的进程启动和缓存重建
+ *
+ * 替代 Slicer 模块每次配准/评估都经 subprocess 启动一次 MIRegistration 的做法
+ * (每次都要付出进程启动、ITK IO工厂注册、读取NRRD、重建金字塔和MIND特征的开销):
+ * 进程常驻, 逐行读取JSON请求, 每个请求回复一行JSON。请求之间保留:
+ * - 已加载的图像 (键 = 路径 + 文件修改时间 + 文件大小, 文件被改写后自动重新读取)
+ * - 每幅图像的多分辨率金字塔 (图像对象不变, 金字塔各层级直接命中)
+ * - 固定图像 + 掩膜组合 (掩膜栅格化统计只做一次)
+ * - 移动图像已计算的MIND特征块 (MINDMetric::SharedFeatureCache; 固定图像描述子只在采样点计算)
+ * 因此用调整后的参数重新配准, 或评估一个新的变换时, 不再有任何加载和预处理开销。
+ *
+ * 协议 (每行一个JSON对象; 路径中的反斜杠按JSON转义):
+ *   {"id": 1, "command": "register", "fixed": "f.nrrd", "moving": "m.nrrd", "output": "out/",
+ *    "config": "Rigid.json", "fixedMask": "mask.nrrd", "initial": "coarse.h5",
+ *    "transformType": "Affine", "samplingPercentage": 0.1, "initMode": "moments"}
+ *     → {"id": "1", "status": "ok", "transformPath": "...", "transformType": "Rigid",
+ *        "metricValue": ..., "elapsedTime": ..., "parameters": [...]}
+ *   {"id": 2, "command": "evaluate", "fixed": "...", "moving": "...", "transform": "t.h5",
+ *    "fixedMask": "...", "config": "Evaluation.json"}
+ *     → {"id": "2", "status": "ok", "metricValue": ..., "elapsedTime": ...}
+ *   {"id": 3, "command": "status"}     → 缓存状态 (含MIND特征块的驻留数/字节数/命中/未命中/淘汰)
+ *   {"id": 4, "command": "clear"}      → 清空所有缓存
+ *   {"id": 5, "command": "shutdown"}   → 回复后退出
+ * 出错时回复 {"id": ..., "status": "error", "message": "..."}, 服务继续运行。
+ * 响应中的 id 原样回显为字符串。
+ * 启动完成时先输出一行 {"status": "ready"}。
+ *
+ * 标准输入/输出模式下, 日志 (std::cout) 由调用方重定向到 stderr, 标准输出只有协议行。
+ * 请求按顺序逐个处理 (每个请求内部仍使用全部线程)。
+ */
+class RegistrationServer
+{
+public:
+    using ImageType = ImageRegistration::ImageType;
+
+    RegistrationServer();
+
+    void SetVerbose(bool v) { m_Verbose = v; }
+
+    // 缓存的图像数上限 (超出时淘汰最久未用的图像及其金字塔)
+    void SetMaximumNumberOfCachedImages(size_t count) { m_MaximumNumberOfCachedImages = count; }
+
+    // 从 input 逐行读取请求, 响应写到 output; 收到 shutdown 或输入结束时返回
+    int ServeStream(std::istream& input, std::ostream& output);
+
+    // 在本地UNIX域套接字上监听 (仅POSIX), 依次服务各个连接, 收到 shutdown 时返回
+    int ServeSocket(const std::string& socketPath);
+
+    // 处理一条请求, 返回一行JSON响应 (不含换行); shutdown 请求时置 shutdownRequested
+    std::string HandleRequest(const std::string& request, bool& shutdownRequested);
+
+    static const size_t DefaultMaximumNumberOfCachedImages = 8;
+
+private:
+    // 文件身份: 修改时间 + 大小
+    struct FileStamp
+    {
+        std::filesystem::file_time_type writeTime;
+        uintmax_t size = 0;
+        bool operator==(const FileStamp& other) const { return writeTime == other.writeTime && size == other.size; }
+        bool operator!=(const FileStamp& other) const { return !(*this == other); }
+    };
+
+    struct CachedImage
+    {
+        FileStamp stamp;
+        ImageType::Pointer image;
+        MultiResolutionPyramid::Pointer pyramid;
+        unsigned long lastUse = 0;
+    };
+
+    // 固定图像 + 掩膜 (经 ImageRegistration::ShareFixedResources 提供给各请求)
+    struct FixedReference
+    {
+        ImageType::Pointer fixedImage;     // 创建时的固定图像对象, 图像被重新读取后失效
+        FileStamp maskStamp;
+        std::unique_ptr<ImageRegistration> reference;
+        unsigned long lastUse = 0;
+    };
+
+    static FileStamp GetFileStamp(const std::string& path);
+
+    // 取缓存的图像 (文件未变时直接返回, 否则重新读取)
+    CachedImage& AcquireImage(const std::string& path);
+    const ImageRegistration& AcquireFixedReference(const std::string& fixedPath, const std::string& maskPath);
+
+    std::string HandleRegister(const std::string& request, const std::string& id);
+    std::string HandleEvaluate(const std::string& request, const std::string& id);
+    std::string HandleStatus(const std::string& id);
+    void ClearCaches();
+
+    // 请求中的通用设置: 共享固定资源、移动图像及其金字塔、共享特征缓存
+    void PrepareRegistration(ImageRegistration& registration, const std::string& request);
+
+    static std::string GetString(const std::string& request, const std::string& key);
+    static std::string ErrorResponse(const std::string& id, const std::string& message);
+
+    std::map<std::string, CachedImage> m_Images;
+    std::map<std::string, FixedReference> m_FixedReferences;   // 键 = 固定图像路径 + 掩膜路径
+    std::shared_ptr<MINDMetric::SharedFeatureCache> m_FeatureCache;
+    size_t m_MaximumNumberOfCachedImages;
+    unsigned long m_UseCounter;
+    unsigned long m_NumberOfRequests;
+    bool m_Verbose;
+};
+
+#endif // REGISTRATION_SERVER_H
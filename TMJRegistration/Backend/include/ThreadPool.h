@@ -0,0 +1,102 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+/**
+ * @brief 进程级持久工作线程池
+ *
+ * 替代每次度量调用都创建/销毁 std::thread 的做法:
+ * - 线程在进程生命周期内常驻, 提交任务只需唤醒, 无创建开销
+ * - 调用线程本身也参与计算(占用工作者槽位0), 因此 N 线程的池只创建 N-1 个后台线程
+ * - 任务被切分为固定大小的分块, 各工作者通过原子计数器动态领取(自调度),
+ *   先完成的线程自动"窃取"剩余分块, 负载不均(掩膜覆盖不均、越界采样点)时不会空转
+ * - 多个调用方可同时提交任务(例如批处理中并发的多个配准), 空闲线程加入当前执行线程最少的未完成任务,
+ *   各任务的分块在线程间动态窃取, 总线程数始终为池大小 + 调用线程数
+ *
+ * 确定性约定:
+ * 分块边界只由 (numberOfItems, chunkSize) 决定, 与线程数和调度顺序无关。
+ * 需要可重复结果的归约应按 chunkIndex 存放部分结果, 再按分块顺序合并;
+ * workerIndex 仅用于选择线程私有的临时缓冲区。
+ *
+ * 用法:
+ *   ThreadPool::GetGlobalInstance().ParallelFor(numSamples, chunkSize,
+ *       [&](size_t chunkIndex, size_t begin, size_t end, unsigned int workerIndex) { ... },
+ *       maxWorkers);
+ */
+class ThreadPool
+{
+public:
+    // 分块回调: chunkIndex=分块序号, [begin, end)=分块范围, workerIndex=执行槽位 (< maxWorkers)
+    using ChunkFunctionType = std::function<void(size_t chunkIndex, size_t begin, size_t end,
+                                                 unsigned int workerIndex)>;
+
+    // 全局线程池 (首次调用时按 SetGlobalNumberOfThreads 或 hardware_concurrency 创建)
+    static ThreadPool& GetGlobalInstance();
+
+    // 设置全局线程池大小 (应在启动时、首次使用前调用; 之后调用会重建线程池)
+    static void SetGlobalNumberOfThreads(unsigned int numberOfThreads);
+    static unsigned int GetGlobalNumberOfThreads();
+
+    explicit ThreadPool(unsigned int numberOfThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // 总工作者数(含调用线程)
+    unsigned int GetNumberOfThreads() const { return m_NumberOfThreads; }
+
+    // 并行执行 [0, numberOfItems), 按 chunkSize 分块
+    // maxWorkers: 参与的最大工作者数(含调用线程), 0 表示使用全部线程
+    // 回调抛出的第一个异常会在所有分块结束后在调用线程重新抛出
+    void ParallelFor(size_t numberOfItems, size_t chunkSize,
+                     const ChunkFunctionType& func, unsigned int maxWorkers = 0);
+
+    // 分块数 = ceil(numberOfItems / chunkSize)
+    static size_t ComputeNumberOfChunks(size_t numberOfItems, size_t chunkSize);
+
+    // 实际参与的工作者数上限 (用于预先分配线程私有缓冲区)
+    unsigned int GetNumberOfWorkers(unsigned int maxWorkers) const;
+
+private:
+    struct Job
+    {
+        const ChunkFunctionType* function = nullptr;
+        size_t numberOfItems = 0;
+        size_t chunkSize = 1;
+        size_t numberOfChunks = 0;
+        std::atomic<size_t> nextChunk{0};
+
+        // 以下成员由线程池互斥锁保护
+        unsigned int maxWorkers = 1;
+        unsigned int joinedWorkers = 0;   // 已分配的槽位数
+        unsigned int activeWorkers = 0;   // 正在执行的后台线程数
+
+        std::mutex exceptionMutex;
+        std::exception_ptr exception;
+    };
+
+    void WorkerLoop();
+    std::shared_ptr<Job> FindAvailableJob() const;
+    static void RunChunks(Job& job, unsigned int workerIndex);
+
+    unsigned int m_NumberOfThreads;
+    std::vector<std::thread> m_Threads;
+    std::deque<std::shared_ptr<Job>> m_Jobs;
+
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_WorkAvailable;
+    std::condition_variable m_JobFinished;
+    bool m_Stop;
+};
+
+#endif // THREAD_POOL_H
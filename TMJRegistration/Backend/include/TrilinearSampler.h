@@ -0,0 +1,213 @@
+#ifndef TRILINEAR_SAMPLER_H
+#define TRILINEAR_SAMPLER_H
+
+#include <array>
+#include <cstddef>
+#include "itkImage.h"
+
+/**
+ * @brief 基于原始连续缓冲区的三线性采样核 (MI / MIND 共用)
+ *
+ * 替代热点循环中逐图像调用 itk::LinearInterpolateImageFunction 的做法:
+ * 对一个物理点只计算一次连续索引和8个角点偏移/权重(Location),
+ * 然后可以在任意多个几何相同的缓冲区上复用 —— 例如移动图像强度+3个梯度分量,
+ * 或全部MIND通道 —— 每个缓冲区只需8次乘加, 没有虚函数调用和重复的边界判断。
+ *
+ * 边界语义与 itk::LinearInterpolateImageFunction 保持一致:
+ * - 连续索引 ci 满足 start-0.5 <= ci < start+size-0.5 时视为在缓冲区内 (IsInsideBuffer)
+ * - 插值时 ci 被限制在 [start, start+size-1], 超出末端的相邻体素取边界体素
+ *
+ * 用法:
+ *   TrilinearSampler sampler;
+ *   sampler.SetImage(movingImage);
+ *   TrilinearSampler::Location loc;
+ *   if (sampler.ComputeLocation(point, loc))
+ *       value = TrilinearSampler::Evaluate(buffer, loc);
+ */
+class TrilinearSampler
+{
+public:
+    using ImageType = itk::Image<float, 3>;
+    using PointType = ImageType::PointType;
+
+    // 一个采样位置: 8个角点的缓冲区偏移和三线性权重
+    // 角点编号 k 的 bit0/bit1/bit2 分别表示 x/y/z 方向取上邻体素
+    // lowerIndex/upperIndex 为下/上邻体素相对缓冲区起点的索引 (供按块存储的数据定位角点)
+    struct Location
+    {
+        std::array<size_t, 8> offsets;
+        std::array<double, 8> weights;
+        std::array<long, 3> lowerIndex;
+        std::array<long, 3> upperIndex;
+    };
+
+    TrilinearSampler();
+
+    // 记录图像几何 (缓冲区域、原点、物理点到索引的矩阵)
+    void SetImage(const ImageType* image);
+    bool IsInitialized() const { return m_Initialized; }
+
+    // 检查另一幅图像是否与当前几何完全一致 (共用 Location 的前提)
+    bool HasSameGeometry(const ImageType* image) const;
+
+    size_t GetNumberOfPixels() const { return m_NumberOfPixels; }
+
+    // 物理点 → 角点偏移和权重; 点在缓冲区外时返回false
+    inline bool ComputeLocation(const PointType& point, Location& location) const;
+
+    // 单个缓冲区插值
+    static inline double Evaluate(const float* buffer, const Location& location);
+
+    // 强度 + 3个梯度分量 (共用一次权重计算)
+    // gradientBuffer 为交错梯度图像 (每体素 gx, gy, gz, pad 共4个float, 见 InterleavedGradientImage)
+    static inline void EvaluateValueAndGradient(const float* valueBuffer,
+                                                const float* gradientBuffer,
+                                                const Location& location,
+                                                double& value,
+                                                std::array<double, 3>& gradient);
+
+    // 通道交错缓冲区 (每体素 numberOfComponents 个连续float, 如全部MIND通道):
+    // values[c] = Σ_k w_k * buffer[offset_k * numberOfComponents + c], 内层沿通道连续, 可向量化
+    static inline void EvaluateInterleaved(const float* buffer,
+                                           size_t numberOfComponents,
+                                           const Location& location,
+                                           double* values);
+
+    // N个通道缓冲区 (buffers[c] 为第c个通道), 结果写入 values[0..N)
+    static inline void EvaluateChannels(const float* const* buffers,
+                                        size_t numberOfChannels,
+                                        const Location& location,
+                                        double* values);
+
+private:
+    bool m_Initialized;
+    size_t m_NumberOfPixels;
+
+    double m_Origin[3];
+    double m_PhysicalToIndex[3][3];
+    double m_StartIndex[3];
+    long m_Size[3];
+    size_t m_Stride[3];
+};
+
+// ============================================================================
+// 内联实现 (热点路径)
+// ============================================================================
+
+inline bool TrilinearSampler::ComputeLocation(const PointType& point, Location& location) const
+{
+    const double dx = point[0] - m_Origin[0];
+    const double dy = point[1] - m_Origin[1];
+    const double dz = point[2] - m_Origin[2];
+
+    size_t lower[3];
+    size_t upper[3];
+    double fraction[3];
+
+    for (int d = 0; d < 3; ++d)
+    {
+        const double ci = m_PhysicalToIndex[d][0] * dx
+                        + m_PhysicalToIndex[d][1] * dy
+                        + m_PhysicalToIndex[d][2] * dz
+                        - m_StartIndex[d];
+
+        // IsInsideBuffer: [-0.5, size-0.5)
+        if (!(ci >= -0.5) || !(ci < m_Size[d] - 0.5))
+        {
+            return false;
+        }
+
+        // 限制到 [0, size-1] 后取下邻体素和小数部分
+        const double clamped = (ci < 0.0) ? 0.0 : ((ci > m_Size[d] - 1) ? static_cast<double>(m_Size[d] - 1) : ci);
+        const long base = static_cast<long>(clamped);
+        const long next = (base + 1 < m_Size[d]) ? base + 1 : base;
+
+        fraction[d] = clamped - base;
+        location.lowerIndex[d] = base;
+        location.upperIndex[d] = next;
+        lower[d] = static_cast<size_t>(base) * m_Stride[d];
+        upper[d] = static_cast<size_t>(next) * m_Stride[d];
+    }
+
+    const double wx[2] = {1.0 - fraction[0], fraction[0]};
+    const double wy[2] = {1.0 - fraction[1], fraction[1]};
+    const double wz[2] = {1.0 - fraction[2], fraction[2]};
+
+    for (int k = 0; k < 8; ++k)
+    {
+        const int bx = k & 1;
+        const int by = (k >> 1) & 1;
+        const int bz = (k >> 2) & 1;
+
+        location.offsets[k] = (bx ? upper[0] : lower[0])
+                            + (by ? upper[1] : lower[1])
+                            + (bz ? upper[2] : lower[2]);
+        location.weights[k] = wx[bx] * wy[by] * wz[bz];
+    }
+
+    return true;
+}
+
+inline double TrilinearSampler::Evaluate(const float* buffer, const Location& location)
+{
+    double value = 0.0;
+    for (int k = 0; k < 8; ++k)
+    {
+        value += location.weights[k] * buffer[location.offsets[k]];
+    }
+    return value;
+}
+
+inline void TrilinearSampler::EvaluateValueAndGradient(const float* valueBuffer,
+                                                       const float* gradientBuffer,
+                                                       const Location& location,
+                                                       double& value,
+                                                       std::array<double, 3>& gradient)
+{
+    double v = 0.0, gx = 0.0, gy = 0.0, gz = 0.0;
+    for (int k = 0; k < 8; ++k)
+    {
+        const size_t offset = location.offsets[k];
+        const double w = location.weights[k];
+        const float* g = gradientBuffer + 4 * offset;
+        v += w * valueBuffer[offset];
+        gx += w * g[0];
+        gy += w * g[1];
+        gz += w * g[2];
+    }
+    value = v;
+    gradient = {gx, gy, gz};
+}
+
+inline void TrilinearSampler::EvaluateInterleaved(const float* buffer,
+                                                  size_t numberOfComponents,
+                                                  const Location& location,
+                                                  double* values)
+{
+    for (size_t c = 0; c < numberOfComponents; ++c)
+    {
+        values[c] = 0.0;
+    }
+    for (int k = 0; k < 8; ++k)
+    {
+        const double w = location.weights[k];
+        const float* voxel = buffer + location.offsets[k] * numberOfComponents;
+        for (size_t c = 0; c < numberOfComponents; ++c)
+        {
+            values[c] += w * voxel[c];
+        }
+    }
+}
+
+inline void TrilinearSampler::EvaluateChannels(const float* const* buffers,
+                                               size_t numberOfChannels,
+                                               const Location& location,
+                                               double* values)
+{
+    for (size_t c = 0; c < numberOfChannels; ++c)
+    {
+        values[c] = Evaluate(buffers[c], location);
+    }
+}
+
+#endif // TRILINEAR_SAMPLER_H
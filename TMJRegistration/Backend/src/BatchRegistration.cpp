@@ -0,0 +1,586 @@
+#include "BatchRegistration.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <itkImageIOFactory.h>
+#include <itkMultiThreaderBase.h>
+#include "ThreadPool.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+// 清单中的相对路径相对于清单文件所在目录
+std::string ResolvePath(const std::string& value, const fs::path& baseDirectory)
+{
+    if (value.empty())
+    {
+        return value;
+    }
+    fs::path path(ConfigManager::UnescapeString(value));
+    if (path.is_relative())
+    {
+        path = baseDirectory / path;
+    }
+    return path.lexically_normal().string();
+}
+
+// 移动图像文件名 (去掉 .nii.gz 这类双扩展名)
+std::string DefaultJobName(const std::string& movingImagePath)
+{
+    fs::path stem = fs::path(movingImagePath).stem();
+    if (stem.extension() == ".nii")
+    {
+        stem = stem.stem();
+    }
+    return stem.string();
+}
+
+} // namespace
+
+// ============================================================================
+// 构造函数
+// ============================================================================
+
+BatchRegistration::BatchRegistration()
+    : m_SamplingPercentage(-1.0)
+    , m_InitializationMode(InitializationMode::Geometry)
+    , m_HasInitializationMode(false)
+    , m_Verbose(false)
+    , m_RunningJobs(0)
+    , m_ProjectedMemory(0.0)
+    , m_PeakProjectedMemory(0.0)
+{
+}
+
+// ============================================================================
+// 清单解析
+// ============================================================================
+
+BatchRegistration::Manifest BatchRegistration::LoadManifest(const std::string& manifestPath)
+{
+    std::ifstream file(manifestPath);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open batch manifest: " + manifestPath);
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string content = buffer.str();
+
+    const fs::path baseDirectory = fs::absolute(manifestPath).parent_path();
+    Manifest manifest;
+
+    // 任务数组单独解析, 顶层字段在去掉任务数组后的内容中查找 (任务中的同名键不会被误匹配)
+    size_t jobsBegin = 0;
+    size_t jobsEnd = 0;
+    if (!ConfigManager::FindArrayBlock(content, "jobs", jobsBegin, jobsEnd))
+    {
+        throw std::runtime_error("Batch manifest has no \"jobs\" array: " + manifestPath);
+    }
+    const std::vector<std::string> jobObjects =
+        ConfigManager::SplitObjects(content.substr(jobsBegin + 1, jobsEnd - jobsBegin - 1));
+    const std::string topLevel = content.substr(0, jobsBegin) + "[]" + content.substr(jobsEnd + 1);
+
+    manifest.fixedImagePath = ResolvePath(ConfigManager::ExtractValue(topLevel, "fixed"), baseDirectory);
+    manifest.fixedMaskPath = ResolvePath(ConfigManager::ExtractValue(topLevel, "fixedMask"), baseDirectory);
+    manifest.configFilePath = ResolvePath(ConfigManager::ExtractValue(topLevel, "config"), baseDirectory);
+    manifest.outputFolder = ResolvePath(ConfigManager::ExtractValue(topLevel, "output"), baseDirectory);
+    const std::string maxJobs = ConfigManager::ExtractValue(topLevel, "maxConcurrentJobs");
+    if (!maxJobs.empty())
+    {
+        manifest.maxConcurrentJobs = static_cast<unsigned int>(std::stoul(maxJobs));
+    }
+    const std::string threads = ConfigManager::ExtractValue(topLevel, "threads");
+    if (!threads.empty())
+    {
+        manifest.numberOfThreads = static_cast<unsigned int>(std::stoul(threads));
+    }
+    const std::string memoryLimit = ConfigManager::ExtractValue(topLevel, "memoryLimitMB");
+    if (!memoryLimit.empty())
+    {
+        manifest.memoryLimitMB = std::stod(memoryLimit);
+    }
+
+    if (manifest.outputFolder.empty())
+    {
+        manifest.outputFolder = (baseDirectory / "batch_output").string();
+    }
+
+    std::set<std::string> usedNames;
+    for (size_t i = 0; i < jobObjects.size(); ++i)
+    {
+        const std::string& object = jobObjects[i];
+        Job job;
+        // 任务单独指定固定图像时, 掩膜也只取任务自己的 (顶层掩膜定义在顶层固定图像上)
+        job.fixedImagePath = ResolvePath(ConfigManager::ExtractValue(object, "fixed"), baseDirectory);
+        if (job.fixedImagePath.empty())
+        {
+            job.fixedImagePath = manifest.fixedImagePath;
+            job.fixedMaskPath = manifest.fixedMaskPath;
+        }
+        else
+        {
+            job.fixedMaskPath = ResolvePath(ConfigManager::ExtractValue(object, "fixedMask"), baseDirectory);
+        }
+        job.movingImagePath = ResolvePath(ConfigManager::ExtractValue(object, "moving"), baseDirectory);
+        job.initialTransformPath = ResolvePath(ConfigManager::ExtractValue(object, "initial"), baseDirectory);
+        job.configFilePath = ResolvePath(ConfigManager::ExtractValue(object, "config"), baseDirectory);
+        if (job.configFilePath.empty())
+        {
+            job.configFilePath = manifest.configFilePath;
+        }
+        if (job.fixedImagePath.empty())
+        {
+            throw std::runtime_error("Batch job " + std::to_string(i + 1) + " has no \"fixed\" image");
+        }
+        if (job.movingImagePath.empty())
+        {
+            throw std::runtime_error("Batch job " + std::to_string(i + 1) + " has no \"moving\" image");
+        }
+
+        // 任务名重复时追加序号, 保证输出目录互不相同
+        job.name = ConfigManager::UnescapeString(ConfigManager::ExtractValue(object, "name"));
+        if (job.name.empty())
+        {
+            job.name = DefaultJobName(job.movingImagePath);
+        }
+        if (!usedNames.insert(job.name).second)
+        {
+            job.name += "_" + std::to_string(i + 1);
+            usedNames.insert(job.name);
+        }
+
+        const std::string output = ConfigManager::ExtractValue(object, "output");
+        job.outputFolder = output.empty()
+            ? (fs::path(manifest.outputFolder) / job.name).string()
+            : ResolvePath(output, baseDirectory);
+
+        manifest.jobs.push_back(job);
+    }
+
+    if (manifest.jobs.empty())
+    {
+        throw std::runtime_error("Batch manifest contains no jobs: " + manifestPath);
+    }
+
+    std::cout << "[Batch] Loaded manifest: " << manifestPath << " (" << manifest.jobs.size() << " jobs)" << std::endl;
+    return manifest;
+}
+
+// ============================================================================
+// 执行
+// ============================================================================
+
+size_t BatchRegistration::Run()
+{
+    const size_t numberOfJobs = m_Manifest.jobs.size();
+    m_Results.assign(numberOfJobs, JobResult());
+    if (numberOfJobs == 0)
+    {
+        return 0;
+    }
+
+    // 全局线程预算: 每个任务线程在线程池中占用调用者槽位, 后台线程数 = 预算 - 任务线程数
+    const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned int threadBudget = m_Manifest.numberOfThreads > 0 ? m_Manifest.numberOfThreads : hardwareThreads;
+    const unsigned int requestedJobs = m_Manifest.maxConcurrentJobs > 0 ? m_Manifest.maxConcurrentJobs : DefaultMaxConcurrentJobs;
+    const unsigned int numberOfWorkers = static_cast<unsigned int>(
+        std::min<size_t>(std::min(requestedJobs, threadBudget), numberOfJobs));
+    ThreadPool::SetGlobalNumberOfThreads(threadBudget - numberOfWorkers + 1);
+    // ITK滤波器 (平滑、抽取等) 使用ITK自己的线程, 按同时运行的任务数平分预算
+    itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(std::max(1u, threadBudget / numberOfWorkers));
+
+    // 读取各任务配置, 估算内存, 按 (固定图像, 掩膜) 分组
+    m_JobConfigs.assign(numberOfJobs, ConfigManager::RegistrationConfig());
+    m_JobMemory.assign(numberOfJobs, 0.0);
+    m_JobGroups.assign(numberOfJobs, nullptr);
+    m_FixedGroups.clear();
+    m_PendingJobs.clear();
+    m_RunningJobs = 0;
+    m_ProjectedMemory = 0.0;
+    m_PeakProjectedMemory = 0.0;
+
+    std::map<std::string, uint64_t> voxelCounts;
+    auto numberOfVoxels = [&voxelCounts](const std::string& path) {
+        auto it = voxelCounts.find(path);
+        if (it == voxelCounts.end())
+        {
+            it = voxelCounts.emplace(path, ReadNumberOfVoxels(path)).first;
+        }
+        return it->second;
+    };
+
+    for (size_t i = 0; i < numberOfJobs; ++i)
+    {
+        const Job& job = m_Manifest.jobs[i];
+        ConfigManager configManager;
+        if (!job.configFilePath.empty() && !configManager.LoadFromFile(job.configFilePath))
+        {
+            m_Results[i].name = job.name;
+            m_Results[i].errorMessage = "Could not load config: " + job.configFilePath;
+            continue;
+        }
+        m_JobConfigs[i] = configManager.GetConfig();
+
+        auto& group = m_FixedGroups[job.fixedImagePath + "\n" + job.fixedMaskPath];
+        if (!group)
+        {
+            group = std::make_unique<FixedGroup>();
+        }
+        // 组内共享的只有固定图像、掩膜和固定图像金字塔 (见 ImageRegistration::ShareFixedResources)。
+        // 固定图像的MIND描述子按采样点在各任务的度量内计算, 不在组内共享;
+        // 其内存与采样点数成正比 (远小于各层级图像), EstimateImageMemory 不计入。
+        // 组内各任务配置可能不同, 按最大的估算计
+        group->projectedMemory = std::max(group->projectedMemory,
+            EstimateImageMemory(numberOfVoxels(job.fixedImagePath), m_JobConfigs[i], false));
+        ++group->remainingJobs;
+        m_JobGroups[i] = group.get();
+
+        m_JobMemory[i] = EstimateImageMemory(numberOfVoxels(job.movingImagePath), m_JobConfigs[i], true);
+        m_PendingJobs.push_back(i);
+    }
+
+    const double megabyte = 1024.0 * 1024.0;
+    std::cout << "\n[Batch] " << numberOfJobs << " jobs, " << m_FixedGroups.size() << " fixed image(s); "
+              << numberOfWorkers << " concurrent jobs, thread budget " << threadBudget
+              << " (" << ThreadPool::GetGlobalNumberOfThreads() - 1 << " pool workers)";
+    if (m_Manifest.memoryLimitMB > 0.0)
+    {
+        std::cout << ", memory limit " << std::fixed << std::setprecision(0) << m_Manifest.memoryLimitMB << " MB";
+    }
+    std::cout << std::endl;
+
+    const auto batchStart = std::chrono::high_resolution_clock::now();
+
+    // 各线程领取队列中下一个可放入内存预算的任务 (任务耗时差别大时比静态划分更均衡)
+    auto worker = [this, megabyte]() {
+        while (true)
+        {
+            size_t index = 0;
+            FixedGroup* group = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_ScheduleMutex);
+                size_t position = std::string::npos;
+                m_ScheduleChanged.wait(lock, [this, &position]() {
+                    if (m_PendingJobs.empty())
+                    {
+                        return true;
+                    }
+                    position = FindAdmissibleJob();
+                    return position != std::string::npos;
+                });
+                if (m_PendingJobs.empty())
+                {
+                    return;
+                }
+
+                index = m_PendingJobs[position];
+                m_PendingJobs.erase(m_PendingJobs.begin() + static_cast<std::ptrdiff_t>(position));
+                group = m_JobGroups[index];
+
+                double charge = m_JobMemory[index];
+                if (!group->charged)
+                {
+                    charge += group->projectedMemory;
+                    group->charged = true;
+                }
+                m_ProjectedMemory += charge;
+                m_PeakProjectedMemory = std::max(m_PeakProjectedMemory, m_ProjectedMemory);
+                ++m_RunningJobs;
+
+                if (m_Manifest.memoryLimitMB > 0.0 && m_ProjectedMemory > m_Manifest.memoryLimitMB * megabyte)
+                {
+                    std::cerr << "[Warning] Job " << m_Manifest.jobs[index].name << " alone exceeds the memory limit ("
+                              << std::fixed << std::setprecision(0) << m_ProjectedMemory / megabyte << " MB projected)" << std::endl;
+                }
+            }
+
+            JobResult result = RunJob(m_Manifest.jobs[index], m_JobConfigs[index], *group);
+            result.projectedMemoryMB = m_JobMemory[index] / megabyte;
+            m_Results[index] = result;
+
+            {
+                std::lock_guard<std::mutex> lock(m_ScheduleMutex);
+                m_ProjectedMemory -= m_JobMemory[index];
+                --m_RunningJobs;
+                // 组内最后一个任务结束: 释放固定图像、金字塔和共享特征
+                if (--group->remainingJobs == 0)
+                {
+                    group->reference.reset();
+                    if (group->charged)
+                    {
+                        m_ProjectedMemory -= group->projectedMemory;
+                        group->charged = false;
+                    }
+                }
+            }
+            m_ScheduleChanged.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < numberOfWorkers; ++t)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    m_FixedGroups.clear();
+
+    const auto batchEnd = std::chrono::high_resolution_clock::now();
+    const double batchSeconds = std::chrono::duration<double>(batchEnd - batchStart).count();
+
+    const size_t succeeded = static_cast<size_t>(std::count_if(m_Results.begin(), m_Results.end(),
+                                                               [](const JobResult& r) { return r.success; }));
+    std::cout << "\n[Batch] Completed " << succeeded << " / " << m_Results.size() << " jobs in "
+              << std::fixed << std::setprecision(2) << batchSeconds << " seconds (peak projected memory "
+              << std::setprecision(0) << m_PeakProjectedMemory / megabyte << " MB)" << std::endl;
+    return succeeded;
+}
+
+size_t BatchRegistration::FindAdmissibleJob() const
+{
+    // 先按队列顺序找能放入剩余预算的任务 (同组固定图像已计入时只需移动图像侧的内存)
+    const double limit = m_Manifest.memoryLimitMB * 1024.0 * 1024.0;
+    for (size_t position = 0; position < m_PendingJobs.size(); ++position)
+    {
+        const size_t index = m_PendingJobs[position];
+        const FixedGroup* group = m_JobGroups[index];
+        const double cost = m_JobMemory[index] + (group->charged ? 0.0 : group->projectedMemory);
+        if (limit <= 0.0 || m_ProjectedMemory + cost <= limit)
+        {
+            return position;
+        }
+    }
+
+    // 没有任务在运行时放行队首, 否则单个超出预算的任务会永远等待
+    if (m_RunningJobs == 0 && !m_PendingJobs.empty())
+    {
+        return 0;
+    }
+    return std::string::npos;
+}
+
+const ImageRegistration& BatchRegistration::AcquireFixedResources(const Job& job, FixedGroup& group)
+{
+    std::lock_guard<std::mutex> lock(group.loadMutex);
+    if (group.reference)
+    {
+        return *group.reference;
+    }
+
+    if (!fs::exists(job.fixedImagePath))
+    {
+        throw std::runtime_error("Fixed image not found: " + job.fixedImagePath);
+    }
+
+    {
+        std::lock_guard<std::mutex> logLock(m_LogMutex);
+        std::cout << "[Batch] Loading shared fixed image: " << job.fixedImagePath << std::endl;
+    }
+    auto reference = std::make_unique<ImageRegistration>();
+    reference->SetFixedImagePath(job.fixedImagePath);
+    // 断开读取器管线: 各任务线程中的滤波器以该图像为输入时不会再触发读取器更新
+    reference->GetFixedImage()->DisconnectPipeline();
+    if (!job.fixedMaskPath.empty())
+    {
+        if (!fs::exists(job.fixedMaskPath))
+        {
+            std::cerr << "[Warning] Mask file not found: " << job.fixedMaskPath << std::endl;
+        }
+        else if (!reference->LoadFixedMask(job.fixedMaskPath))
+        {
+            std::cerr << "[Warning] Failed to load mask, continuing without mask" << std::endl;
+        }
+    }
+
+    group.reference = std::move(reference);
+    return *group.reference;
+}
+
+BatchRegistration::JobResult BatchRegistration::RunJob(const Job& job, const ConfigManager::RegistrationConfig& config,
+                                                       FixedGroup& group)
+{
+    JobResult result;
+    result.name = job.name;
+    const auto jobStart = std::chrono::high_resolution_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(m_LogMutex);
+        std::cout << "\n[Batch] Job started: " << job.name << " (" << job.movingImagePath << ")" << std::endl;
+    }
+
+    try
+    {
+        if (!fs::exists(job.movingImagePath))
+        {
+            throw std::runtime_error("Moving image not found: " + job.movingImagePath);
+        }
+
+        ImageRegistration registration;
+        registration.LoadFromConfig(config);
+        registration.SetVerbose(m_Verbose);
+        if (m_SamplingPercentage >= 0.0)
+        {
+            registration.SetSamplingPercentage(m_SamplingPercentage);
+        }
+        if (m_HasInitializationMode)
+        {
+            registration.SetInitializationMode(m_InitializationMode);
+        }
+
+        registration.ShareFixedResources(AcquireFixedResources(job, group));
+        registration.SetMovingImagePath(job.movingImagePath);
+
+        if (!job.initialTransformPath.empty())
+        {
+            if (!fs::exists(job.initialTransformPath))
+            {
+                throw std::runtime_error("Initial transform file not found: " + job.initialTransformPath);
+            }
+            std::lock_guard<std::mutex> lock(m_TransformIOMutex);
+            if (!registration.LoadInitialTransform(job.initialTransformPath))
+            {
+                throw std::runtime_error("Failed to load initial transform: " + job.initialTransformPath);
+            }
+        }
+
+        // 与单次配准相同: "stages" 非空或 RigidThenAffine 时在同一实例内级联
+        registration.RunConfigured(config);
+
+        result.transformType = registration.GetResultTransformType();
+        result.finalMetricValue = registration.GetFinalMetricValue();
+        {
+            std::lock_guard<std::mutex> lock(m_TransformIOMutex);
+            result.transformPath = registration.SaveFinalTransform(job.outputFolder);
+        }
+        result.success = true;
+    }
+    catch (const itk::ExceptionObject& e)
+    {
+        result.errorMessage = std::string("ITK: ") + e.what();
+    }
+    catch (const std::exception& e)
+    {
+        result.errorMessage = e.what();
+    }
+
+    const auto jobEnd = std::chrono::high_resolution_clock::now();
+    result.elapsedTime = std::chrono::duration<double>(jobEnd - jobStart).count();
+
+    {
+        std::lock_guard<std::mutex> lock(m_LogMutex);
+        if (result.success)
+        {
+            std::cout << "[Batch] Job finished: " << job.name << " (" << std::fixed << std::setprecision(2)
+                      << result.elapsedTime << " seconds) -> " << result.transformPath << std::endl;
+        }
+        else
+        {
+            std::cerr << "[Batch] Job failed: " << job.name << ": " << result.errorMessage << std::endl;
+        }
+    }
+    return result;
+}
+
+void BatchRegistration::PrintSummary() const
+{
+    std::cout << "\n[Batch Summary]" << std::endl;
+    for (const auto& result : m_Results)
+    {
+        if (result.success)
+        {
+            std::cout << "  " << std::left << std::setw(24) << result.name << std::right
+                      << " OK     " << std::setw(8) << ConfigManager::TransformTypeToString(result.transformType)
+                      << "  " << std::fixed << std::setprecision(2) << std::setw(8) << result.elapsedTime << " s"
+                      << "  metric " << std::scientific << std::setprecision(4) << result.finalMetricValue
+                      << "  " << result.transformPath << std::endl;
+        }
+        else
+        {
+            std::cout << "  " << std::left << std::setw(24) << result.name << std::right
+                      << " FAILED " << result.errorMessage << std::endl;
+        }
+    }
+}
+
+// ============================================================================
+// 内存估算
+// ============================================================================
+
+uint64_t BatchRegistration::ReadNumberOfVoxels(const std::string& imagePath)
+{
+    auto imageIO = itk::ImageIOFactory::CreateImageIO(imagePath.c_str(), itk::ImageIOFactory::IOFileModeEnum::ReadMode);
+    if (imageIO.IsNull())
+    {
+        return 0;
+    }
+
+    try
+    {
+        imageIO->SetFileName(imagePath);
+        imageIO->ReadImageInformation();
+    }
+    catch (const itk::ExceptionObject&)
+    {
+        return 0;
+    }
+
+    uint64_t numberOfVoxels = 1;
+    for (unsigned int d = 0; d < imageIO->GetNumberOfDimensions(); ++d)
+    {
+        numberOfVoxels *= static_cast<uint64_t>(imageIO->GetDimensions(d));
+    }
+    return numberOfVoxels;
+}
+
+double BatchRegistration::EstimateImageMemory(uint64_t numberOfVoxels, const ConfigManager::RegistrationConfig& config,
+                                              bool isMovingImage)
+{
+    const double voxels = static_cast<double>(numberOfVoxels);
+
+    bool usesMIND = (config.metricType == ConfigManager::MetricType::MIND);
+    for (const auto& stage : config.stages)
+    {
+        usesMIND = usesMIND || (stage.metricType == ConfigManager::MetricType::MIND);
+    }
+    const double channels = (config.mindNeighborhoodType == "26-connected") ? 26.0 : 6.0;
+
+    // 各层级体素数之和 Σ V/s³; MIND特征块缓存每层级最多占用其内存上限
+    const double tileCacheLimit = config.mindTileCacheMB * 1024.0 * 1024.0;
+    double levelVoxels = 0.0;
+    double mindBytes = 0.0;
+    for (unsigned int level = 0; level < config.numberOfLevels; ++level)
+    {
+        const double shrink = (level < config.shrinkFactors.size()) ? std::max(1u, config.shrinkFactors[level]) : 1.0;
+        const double voxelsAtLevel = voxels / (shrink * shrink * shrink);
+        levelVoxels += voxelsAtLevel;
+        mindBytes += std::min(voxelsAtLevel * channels * 4 * sizeof(float), tileCacheLimit);   // 特征 + 特征梯度
+    }
+
+    double bytesPerLevelVoxel = sizeof(float);
+    if (isMovingImage)
+    {
+        bytesPerLevelVoxel += 4 * sizeof(float);                  // 交错梯度
+    }
+    if (!usesMIND || !isMovingImage)
+    {
+        // 固定图像的MIND描述子只在采样点计算, 不计入
+        mindBytes = 0.0;
+    }
+
+    return 2.0 * sizeof(float) * voxels + bytesPerLevelVoxel * levelVoxels + mindBytes;
+}
@@ -25,6 +25,7 @@ std::string ConfigManager::TransformTypeToString(TransformType type)
 {
     switch (type)
     {
+        case TransformType::Translation: return "Translation";
         case TransformType::Rigid: return "Rigid";
         case TransformType::Affine: return "Affine";
         case TransformType::RigidThenAffine: return "RigidThenAffine";
@@ -37,6 +38,7 @@ ConfigManager::TransformType ConfigManager::StringToTransformType(const std::str
     std::string lower = str;
     std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
     
+    if (lower == "translation") return TransformType::Translation;
     if (lower == "affine") return TransformType::Affine;
     if (lower == "rigidthenaffine" || lower == "rigid+affine" || lower == "rigidaffine") 
         return TransformType::RigidThenAffine;
@@ -113,7 +115,7 @@ void ConfigManager::SetOptimizerType(const std::string& typeStr)
 // 字符串处理辅助函数
 // ============================================================================
 
-std::string ConfigManager::Trim(const std::string& str) const
+std::string ConfigManager::Trim(const std::string& str)
 {
     size_t start = str.find_first_not_of(" \t\n\r\"");
     if (start == std::string::npos) return "";
@@ -125,7 +127,7 @@ std::string ConfigManager::Trim(const std::string& str) const
 // 简单JSON解析
 // ============================================================================
 
-std::string ConfigManager::ExtractValue(const std::string& content, const std::string& key) const
+std::string ConfigManager::ExtractValue(const std::string& content, const std::string& key)
 {
     // 查找 "key": value 或 "key": "value"
     std::string searchKey = "\"" + key + "\"";
@@ -155,7 +157,7 @@ std::string ConfigManager::ExtractValue(const std::string& content, const std::s
     return Trim(content.substr(pos, endPos - pos));
 }
 
-std::vector<std::string> ConfigManager::ExtractArray(const std::string& content, const std::string& key) const
+std::vector<std::string> ConfigManager::ExtractArray(const std::string& content, const std::string& key)
 {
     std::vector<std::string> result;
     
@@ -186,10 +188,193 @@ std::vector<std::string> ConfigManager::ExtractArray(const std::string& content,
     return result;
 }
 
-bool ConfigManager::ParseJsonFile(const std::string& content)
+bool ConfigManager::FindArrayBlock(const std::string& content, const std::string& key, size_t& begin, size_t& end)
+{
+    std::string searchKey = "\"" + key + "\"";
+    size_t pos = content.find(searchKey);
+    if (pos == std::string::npos) return false;
+    
+    pos = content.find_first_not_of(" \t\n\r:", pos + searchKey.size());
+    if (pos == std::string::npos || content[pos] != '[') return false;
+    
+    // 括号配对 (跳过字符串内的括号)
+    int depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    for (size_t i = pos; i < content.size(); ++i)
+    {
+        const char c = content[i];
+        if (inString)
+        {
+            // 反斜杠只转义紧随其后的一个字符 ("C:\\out\\" 末尾的引号不被转义)
+            if (escaped) escaped = false;
+            else if (c == '\\') escaped = true;
+            else if (c == '"') inString = false;
+            continue;
+        }
+        if (c == '"')
+        {
+            inString = true;
+            continue;
+        }
+        
+        if (c == '[' || c == '{')
+        {
+            ++depth;
+        }
+        else if (c == ']' || c == '}')
+        {
+            if (--depth == 0)
+            {
+                begin = pos;
+                end = i;
+                return true;
+            }
+        }
+    }
+    
+    throw std::runtime_error("Unterminated array for key: " + key);
+}
+
+std::vector<std::string> ConfigManager::SplitObjects(const std::string& arrayContent)
+{
+    std::vector<std::string> objects;
+    
+    int depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    size_t objectStart = 0;
+    for (size_t i = 0; i < arrayContent.size(); ++i)
+    {
+        const char c = arrayContent[i];
+        if (inString)
+        {
+            if (escaped) escaped = false;
+            else if (c == '\\') escaped = true;
+            else if (c == '"') inString = false;
+            continue;
+        }
+        if (c == '"')
+        {
+            inString = true;
+            continue;
+        }
+        
+        if (c == '{')
+        {
+            if (depth++ == 0) objectStart = i;
+        }
+        else if (c == '}')
+        {
+            if (--depth == 0)
+            {
+                objects.push_back(arrayContent.substr(objectStart, i - objectStart + 1));
+            }
+        }
+    }
+    
+    return objects;
+}
+
+std::string ConfigManager::UnescapeString(const std::string& value)
+{
+    std::string result;
+    result.reserve(value.size());
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        if (value[i] == '\\' && i + 1 < value.size() && (value[i + 1] == '\\' || value[i + 1] == '"' || value[i + 1] == '/'))
+        {
+            ++i;
+        }
+        result.push_back(value[i]);
+    }
+    return result;
+}
+
+std::string ConfigManager::EscapeString(const std::string& value)
+{
+    std::string result;
+    result.reserve(value.size() + 8);
+    for (char c : value)
+    {
+        switch (c)
+        {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            default:   result.push_back(c); break;
+        }
+    }
+    return result;
+}
+
+ConfigManager::StageConfig ConfigManager::ParseStage(const std::string& object) const
+{
+    StageConfig stage;
+    
+    std::string transformType = ExtractValue(object, "transformType");
+    if (transformType.empty())
+    {
+        throw std::runtime_error("Stage is missing transformType");
+    }
+    stage.transformType = StringToTransformType(transformType);
+    if (stage.transformType == TransformType::RigidThenAffine)
+    {
+        throw std::runtime_error("Stage transformType must be Translation, Rigid or Affine");
+    }
+    
+    // 度量继承顶层设置; 阶段指定了度量但未指定优化器时, 按度量选择默认优化器 (与顶层规则一致)
+    std::string metricType = ExtractValue(object, "metricType");
+    stage.metricType = metricType.empty() ? m_Config.metricType : StringToMetricType(metricType);
+    
+    std::string optimizerType = ExtractValue(object, "optimizerType");
+    if (!optimizerType.empty())
+    {
+        stage.optimizerType = StringToOptimizerType(optimizerType);
+    }
+    else if (!metricType.empty())
+    {
+        stage.optimizerType = (stage.metricType == MetricType::MIND) ? OptimizerType::GaussNewton
+                                                                     : OptimizerType::RegularStepGradientDescent;
+    }
+    else
+    {
+        stage.optimizerType = m_Config.optimizerType;
+    }
+    
+    for (const auto& s : ExtractArray(object, "levels"))
+    {
+        unsigned int level = std::stoul(s);
+        if (level >= m_Config.numberOfLevels)
+        {
+            throw std::runtime_error("Stage level " + s + " out of range (numberOfLevels = " +
+                                     std::to_string(m_Config.numberOfLevels) + ")");
+        }
+        stage.levels.push_back(level);
+    }
+    std::sort(stage.levels.begin(), stage.levels.end());
+    stage.levels.erase(std::unique(stage.levels.begin(), stage.levels.end()), stage.levels.end());
+    
+    return stage;
+}
+
+bool ConfigManager::ParseJsonFile(const std::string& fileContent)
 {
     try
     {
+        // 阶段数组先从内容中取出, 以免阶段对象内的 transformType 等键被当作顶层键解析
+        std::string content = fileContent;
+        std::string stagesContent;
+        size_t stagesBegin = 0;
+        size_t stagesEnd = 0;
+        if (FindArrayBlock(content, "stages", stagesBegin, stagesEnd))
+        {
+            stagesContent = content.substr(stagesBegin + 1, stagesEnd - stagesBegin - 1);
+            content = content.substr(0, stagesBegin) + "[]" + content.substr(stagesEnd + 1);
+        }
+        
         // 解析变换类型
         std::string transformType = ExtractValue(content, "transformType");
         if (!transformType.empty())
@@ -228,6 +413,14 @@ bool ConfigManager::ParseJsonFile(const std::string& content)
         std::string bins = ExtractValue(content, "numberOfHistogramBins");
         if (!bins.empty()) m_Config.numberOfHistogramBins = std::stoul(bins);
         
+        std::string explicitDerivatives = ExtractValue(content, "useExplicitPDFDerivatives");
+        if (!explicitDerivatives.empty())
+        {
+            std::string lower = explicitDerivatives;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            m_Config.useExplicitPDFDerivatives = (lower == "true" || lower == "1");
+        }
+        
         // 解析MIND参数
         std::string mindRadius = ExtractValue(content, "mindRadius");
         if (!mindRadius.empty()) m_Config.mindRadius = std::stoul(mindRadius);
@@ -238,6 +431,9 @@ bool ConfigManager::ParseJsonFile(const std::string& content)
         std::string mindNeighborhood = ExtractValue(content, "mindNeighborhoodType");
         if (!mindNeighborhood.empty()) m_Config.mindNeighborhoodType = mindNeighborhood;
         
+        std::string mindTileCache = ExtractValue(content, "mindTileCacheMB");
+        if (!mindTileCache.empty()) m_Config.mindTileCacheMB = std::stod(mindTileCache);
+        
     std::string samples = ExtractValue(content, "numberOfSpatialSamples");
     if (!samples.empty()) m_Config.numberOfSpatialSamples = std::stoul(samples);
     std::string sampPct = ExtractValue(content, "samplingPercentage");
@@ -374,6 +570,14 @@ bool ConfigManager::ParseJsonFile(const std::string& content)
             }
         }
         
+        std::string recursivePyramid = ExtractValue(content, "useRecursivePyramid");
+        if (!recursivePyramid.empty())
+        {
+            std::string lower = recursivePyramid;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            m_Config.useRecursivePyramid = (lower == "true" || lower == "1");
+        }
+        
         // 解析采样参数
         std::string stratified = ExtractValue(content, "useStratifiedSampling");
         if (!stratified.empty())
@@ -386,6 +590,25 @@ bool ConfigManager::ParseJsonFile(const std::string& content)
         std::string seed = ExtractValue(content, "randomSeed");
         if (!seed.empty()) m_Config.randomSeed = std::stoul(seed);
         
+        // 解析ROI裁剪参数
+        std::string cropROI = ExtractValue(content, "cropToMaskROI");
+        if (!cropROI.empty())
+        {
+            std::string lower = cropROI;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            m_Config.cropToMaskROI = (lower == "true" || lower == "1");
+        }
+        
+        std::string cropMargin = ExtractValue(content, "roiCropMargin");
+        if (!cropMargin.empty()) m_Config.roiCropMargin = std::stod(cropMargin);
+        
+        // 解析阶段列表 (在顶层设置之后, 阶段未指定的字段继承顶层设置)
+        m_Config.stages.clear();
+        for (const auto& object : SplitObjects(stagesContent))
+        {
+            m_Config.stages.push_back(ParseStage(object));
+        }
+        
         return true;
     }
     catch (const std::exception& e)
@@ -430,9 +653,33 @@ std::string ConfigManager::GenerateJson() const
     oss << "    \"_comment\": \"Registration Configuration File\",\n";
     oss << "    \n";
     oss << "    \"transformType\": \"" << TransformTypeToString(m_Config.transformType) << "\",\n";
+    if (!m_Config.stages.empty())
+    {
+        oss << "    \"stages\": [\n";
+        for (size_t s = 0; s < m_Config.stages.size(); ++s)
+        {
+            const auto& stage = m_Config.stages[s];
+            oss << "        {\"transformType\": \"" << TransformTypeToString(stage.transformType) << "\", "
+                << "\"metricType\": \"" << MetricTypeToString(stage.metricType) << "\", "
+                << "\"optimizerType\": \"" << OptimizerTypeToString(stage.optimizerType) << "\"";
+            if (!stage.levels.empty())
+            {
+                oss << ", \"levels\": [";
+                for (size_t i = 0; i < stage.levels.size(); ++i)
+                {
+                    oss << stage.levels[i];
+                    if (i < stage.levels.size() - 1) oss << ", ";
+                }
+                oss << "]";
+            }
+            oss << "}" << (s < m_Config.stages.size() - 1 ? "," : "") << "\n";
+        }
+        oss << "    ],\n";
+    }
     oss << "    \n";
     oss << "    \"_section_metric\": \"=== Metric Parameters ===\",\n";
     oss << "    \"numberOfHistogramBins\": " << m_Config.numberOfHistogramBins << ",\n";
+    oss << "    \"useExplicitPDFDerivatives\": " << (m_Config.useExplicitPDFDerivatives ? "true" : "false") << ",\n";
     if (m_Config.numberOfSpatialSamples > 0)
     {
         oss << "    \"numberOfSpatialSamples\": " << m_Config.numberOfSpatialSamples << ",\n";
@@ -485,10 +732,15 @@ std::string ConfigManager::GenerateJson() const
     }
     oss << "],\n";
     
+    oss << "    \"useRecursivePyramid\": " << (m_Config.useRecursivePyramid ? "true" : "false") << ",\n";
     oss << "    \n";
     oss << "    \"_section_sampling\": \"=== Sampling Parameters ===\",\n";
     oss << "    \"useStratifiedSampling\": " << (m_Config.useStratifiedSampling ? "true" : "false") << ",\n";
-    oss << "    \"randomSeed\": " << m_Config.randomSeed << "\n";
+    oss << "    \"randomSeed\": " << m_Config.randomSeed << ",\n";
+    oss << "    \n";
+    oss << "    \"_section_roi\": \"=== ROI Crop Parameters ===\",\n";
+    oss << "    \"cropToMaskROI\": " << (m_Config.cropToMaskROI ? "true" : "false") << ",\n";
+    oss << "    \"roiCropMargin\": " << std::fixed << std::setprecision(1) << m_Config.roiCropMargin << "\n";
     oss << "}\n";
     
     return oss.str();
@@ -517,6 +769,20 @@ bool ConfigManager::CreateDefaultConfigFile(const std::string& filePath, Transfo
     return config.SaveToFile(filePath);
 }
 
+ConfigManager::RegistrationConfig ConfigManager::CreateEvaluationConfig()
+{
+    RegistrationConfig config;
+    config.transformType = TransformType::Affine;
+    config.numberOfHistogramBins = 32;
+    config.samplingPercentage = 0.1;
+    config.learningRate = {0.0};
+    config.numberOfIterations = {1};
+    config.numberOfLevels = 1;
+    config.shrinkFactors = {1};
+    config.smoothingSigmas = {0.0};
+    return config;
+}
+
 // ============================================================================
 // 打印配置
 // ============================================================================
@@ -525,6 +791,28 @@ void ConfigManager::PrintConfig() const
 {
     std::cout << "\n[Configuration]" << std::endl;
     std::cout << "  Transform Type: " << TransformTypeToString(m_Config.transformType) << std::endl;
+    for (size_t s = 0; s < m_Config.stages.size(); ++s)
+    {
+        const auto& stage = m_Config.stages[s];
+        std::cout << "  Stage " << (s + 1) << ": " << TransformTypeToString(stage.transformType)
+                  << ", " << MetricTypeToString(stage.metricType)
+                  << ", " << OptimizerTypeToString(stage.optimizerType) << ", levels ";
+        if (stage.levels.empty())
+        {
+            std::cout << "all";
+        }
+        else
+        {
+            std::cout << "[";
+            for (size_t i = 0; i < stage.levels.size(); ++i)
+            {
+                std::cout << stage.levels[i];
+                if (i < stage.levels.size() - 1) std::cout << ", ";
+            }
+            std::cout << "]";
+        }
+        std::cout << std::endl;
+    }
     std::cout << "  Metric Type: " << MetricTypeToString(m_Config.metricType) << std::endl;
     std::cout << "  Optimizer Type: " << OptimizerTypeToString(m_Config.optimizerType) << std::endl;
     
@@ -532,12 +820,14 @@ void ConfigManager::PrintConfig() const
     if (m_Config.metricType == MetricType::MattesMutualInformation)
     {
         std::cout << "  Histogram Bins: " << m_Config.numberOfHistogramBins << std::endl;
+        std::cout << "  PDF Derivatives: " << (m_Config.useExplicitPDFDerivatives ? "Explicit" : "Two-pass") << std::endl;
     }
     else if (m_Config.metricType == MetricType::MIND)
     {
         std::cout << "  MIND Radius: " << m_Config.mindRadius << std::endl;
         std::cout << "  MIND Sigma: " << m_Config.mindSigma << std::endl;
         std::cout << "  MIND Neighborhood: " << m_Config.mindNeighborhoodType << std::endl;
+        std::cout << "  MIND Tile Cache: " << m_Config.mindTileCacheMB << " MB" << std::endl;
     }
     
     // Gauss-Newton特有参数
@@ -591,6 +881,13 @@ void ConfigManager::PrintConfig() const
     }
     std::cout << "]" << std::endl;
     
+    std::cout << "  Recursive Pyramid: " << (m_Config.useRecursivePyramid ? "Yes" : "No") << std::endl;
     std::cout << "  Stratified Sampling: " << (m_Config.useStratifiedSampling ? "Yes" : "No") << std::endl;
     std::cout << "  Random Seed: " << m_Config.randomSeed << std::endl;
+    std::cout << "  Crop To Mask ROI: " << (m_Config.cropToMaskROI ? "Yes" : "No");
+    if (m_Config.cropToMaskROI)
+    {
+        std::cout << " (margin " << m_Config.roiCropMargin << " mm)";
+    }
+    std::cout << std::endl;
 }
@@ -0,0 +1,102 @@
+#include "FixedSampleSet.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+// ============================================================================
+// Morton码
+// ============================================================================
+
+// 将低21位展开为每隔2位一位 (x → x00x00x...)
+static inline uint64_t SpreadBits21(uint32_t value)
+{
+    uint64_t x = value & 0x1fffff;
+    x = (x | (x << 32)) & 0x1f00000000ffffull;
+    x = (x | (x << 16)) & 0x1f0000ff0000ffull;
+    x = (x | (x << 8))  & 0x100f00f00f00f00full;
+    x = (x | (x << 4))  & 0x10c30c30c30c30c3ull;
+    x = (x | (x << 2))  & 0x1249249249249249ull;
+    return x;
+}
+
+uint64_t FixedSampleSet::ComputeMortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return SpreadBits21(x) | (SpreadBits21(y) << 1) | (SpreadBits21(z) << 2);
+}
+
+void FixedSampleSet::SortByMortonOrder(std::vector<IndexType>& indices, const IndexType& start)
+{
+    // (Morton码, 原序号) 排序: 同一体素被重复采样时按原顺序, 结果确定
+    std::vector<std::pair<uint64_t, size_t>> keys(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        keys[i].first = ComputeMortonCode(static_cast<uint32_t>(indices[i][0] - start[0]),
+                                          static_cast<uint32_t>(indices[i][1] - start[1]),
+                                          static_cast<uint32_t>(indices[i][2] - start[2]));
+        keys[i].second = i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<IndexType> sorted(indices.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        sorted[i] = indices[keys[i].second];
+    }
+    indices.swap(sorted);
+}
+
+// ============================================================================
+// 建立采样集
+// ============================================================================
+
+void FixedSampleSet::Build(const ImageType* image, std::vector<IndexType>& indices, bool sortByMortonOrder)
+{
+    if (!image)
+    {
+        throw std::runtime_error("FixedSampleSet: image is null");
+    }
+
+    // 偏移相对于缓冲区域 (与 GetBufferPointer 及 TrilinearSampler 一致)
+    const auto& region = image->GetBufferedRegion();
+    const IndexType start = region.GetIndex();
+    const size_t strideY = region.GetSize(0);
+    const size_t strideZ = strideY * region.GetSize(1);
+
+    if (sortByMortonOrder)
+    {
+        SortByMortonOrder(indices, start);
+    }
+
+    const size_t numberOfSamples = indices.size();
+    m_PointX.resize(numberOfSamples);
+    m_PointY.resize(numberOfSamples);
+    m_PointZ.resize(numberOfSamples);
+    m_BufferOffsets.resize(numberOfSamples);
+
+    for (size_t i = 0; i < numberOfSamples; ++i)
+    {
+        const IndexType& index = indices[i];
+        if (!region.IsInside(index))
+        {
+            throw std::runtime_error("FixedSampleSet: sample index outside the buffered region");
+        }
+
+        PointType point;
+        image->TransformIndexToPhysicalPoint(index, point);
+        m_PointX[i] = point[0];
+        m_PointY[i] = point[1];
+        m_PointZ[i] = point[2];
+
+        m_BufferOffsets[i] = static_cast<size_t>(index[0] - start[0])
+                           + static_cast<size_t>(index[1] - start[1]) * strideY
+                           + static_cast<size_t>(index[2] - start[2]) * strideZ;
+    }
+}
+
+void FixedSampleSet::Clear()
+{
+    m_PointX.clear();
+    m_PointY.clear();
+    m_PointZ.clear();
+    m_BufferOffsets.clear();
+}
@@ -60,11 +60,11 @@ void GaussNewtonOptimizer::StartOptimization()
     }
     
     // 检查是否设置了Gauss-Newton特有的函数
-    bool useGaussNewton = (m_ResidualFunction && m_JacobianFunction);
+    bool useGaussNewton = (m_NormalEquationsFunction || (m_ResidualFunction && m_JacobianFunction));
     
     if (!useGaussNewton && !m_GradientFunction)
     {
-        throw std::runtime_error("[GaussNewton] Either (ResidualFunction + JacobianFunction) or GradientFunction must be set");
+        throw std::runtime_error("[GaussNewton] Either NormalEquationsFunction, (ResidualFunction + JacobianFunction) or GradientFunction must be set");
     }
     
     // 初始化
@@ -167,59 +167,94 @@ void GaussNewtonOptimizer::AdvanceOneStep()
     m_PreviousParameters = currentParams;
     m_PreviousValue = m_CurrentValue;
     
-    // 1. 获取残差向量 f
-    ResidualVectorType residuals;
-    m_ResidualFunction(residuals);
+    const size_t n = m_NumberOfParameters;  // 参数数量
+    Eigen::MatrixXd JtJ(n, n);
+    Eigen::VectorXd Jtf(n);
     
-    if (residuals.empty())
+    if (m_NormalEquationsFunction)
     {
-        if (m_Verbose)
+        // 1-4. 度量直接给出未缩放的 J^T J 和 J^T f
+        std::vector<double> normalMatrix;
+        std::vector<double> normalVector;
+        const size_t m = m_NormalEquationsFunction(normalMatrix, normalVector);
+        
+        if (m == 0 || normalMatrix.size() != n * n || normalVector.size() != n)
         {
-            std::cerr << "[GaussNewton] Warning: Empty residual vector" << std::endl;
+            if (m_Verbose)
+            {
+                std::cerr << "[GaussNewton] Warning: Invalid normal equations" << std::endl;
+            }
+            m_StopCondition = SINGULAR_MATRIX;
+            return;
         }
-        m_StopCondition = SINGULAR_MATRIX;
-        return;
-    }
-    
-    // 2. 获取雅可比矩阵 J (m×n)
-    JacobianMatrixType jacobian;
-    m_JacobianFunction(jacobian);
-    
-    if (jacobian.empty() || jacobian[0].size() != m_NumberOfParameters)
-    {
-        if (m_Verbose)
+        
+        // 应用参数尺度: J_scaled = J / scales => JtJ_ij / (s_i s_j), Jtf_i / s_i
+        for (size_t i = 0; i < n; ++i)
         {
-            std::cerr << "[GaussNewton] Warning: Invalid Jacobian matrix" << std::endl;
+            double scaleI = (i < m_Scales.size()) ? m_Scales[i] : 1.0;
+            for (size_t j = 0; j < n; ++j)
+            {
+                double scaleJ = (j < m_Scales.size()) ? m_Scales[j] : 1.0;
+                JtJ(i, j) = normalMatrix[i * n + j] / (scaleI * scaleJ);
+            }
+            Jtf(i) = normalVector[i] / scaleI;
         }
-        m_StopCondition = SINGULAR_MATRIX;
-        return;
-    }
-    
-    const size_t m = residuals.size();   // 残差数量
-    const size_t n = m_NumberOfParameters;  // 参数数量
-    
-    // 3. 转换为Eigen矩阵
-    Eigen::VectorXd f(m);
-    for (size_t i = 0; i < m; ++i)
-    {
-        f(i) = residuals[i];
     }
-    
-    Eigen::MatrixXd J(m, n);
-    for (size_t i = 0; i < m; ++i)
+    else
     {
-        for (size_t j = 0; j < n; ++j)
+        // 1. 获取残差向量 f
+        ResidualVectorType residuals;
+        m_ResidualFunction(residuals);
+        
+        if (residuals.empty())
+        {
+            if (m_Verbose)
+            {
+                std::cerr << "[GaussNewton] Warning: Empty residual vector" << std::endl;
+            }
+            m_StopCondition = SINGULAR_MATRIX;
+            return;
+        }
+        
+        // 2. 获取雅可比矩阵 J (m×n)
+        JacobianMatrixType jacobian;
+        m_JacobianFunction(jacobian);
+        
+        if (jacobian.empty() || jacobian[0].size() != m_NumberOfParameters)
+        {
+            if (m_Verbose)
+            {
+                std::cerr << "[GaussNewton] Warning: Invalid Jacobian matrix" << std::endl;
+            }
+            m_StopCondition = SINGULAR_MATRIX;
+            return;
+        }
+        
+        const size_t m = residuals.size();   // 残差数量
+        
+        // 3. 转换为Eigen矩阵
+        Eigen::VectorXd f(m);
+        for (size_t i = 0; i < m; ++i)
         {
-            // 应用参数尺度: J_scaled = J / scales
-            double scale = (j < m_Scales.size()) ? m_Scales[j] : 1.0;
-            J(i, j) = jacobian[i][j] / scale;
+            f(i) = residuals[i];
         }
+        
+        Eigen::MatrixXd J(m, n);
+        for (size_t i = 0; i < m; ++i)
+        {
+            for (size_t j = 0; j < n; ++j)
+            {
+                // 应用参数尺度: J_scaled = J / scales
+                double scale = (j < m_Scales.size()) ? m_Scales[j] : 1.0;
+                J(i, j) = jacobian[i][j] / scale;
+            }
+        }
+        
+        // 4. 计算 J^T J 和 J^T f
+        JtJ = J.transpose() * J;
+        Jtf = J.transpose() * f;
     }
     
-    // 4. 计算 J^T J 和 J^T f
-    Eigen::MatrixXd JtJ = J.transpose() * J;
-    Eigen::VectorXd Jtf = J.transpose() * f;
-    
     // 5. 求解正规方程 (J^T J + λI) u = -J^T f
     Eigen::VectorXd u(n);
     if (!SolveNormalEquations(JtJ, Jtf, u))
@@ -0,0 +1,230 @@
+#include "GradientImageCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// ============================================================================
+// 全局实例
+// ============================================================================
+
+GradientImageCache& GradientImageCache::GetGlobalInstance()
+{
+    static GradientImageCache instance;
+    return instance;
+}
+
+// ============================================================================
+// 构造函数
+// ============================================================================
+
+GradientImageCache::GradientImageCache(size_t memoryBudgetBytes)
+    : m_MemoryBudget(memoryBudgetBytes)
+    , m_UseCounter(0)
+{
+}
+
+// ============================================================================
+// 梯度计算 (按z切片并行)
+// ============================================================================
+
+GradientImageCache::GradientPointer GradientImageCache::ComputeGradient(const ImageType* image,
+                                                                        unsigned int maxThreads)
+{
+    if (!image)
+    {
+        throw std::runtime_error("GradientImageCache: image is null");
+    }
+
+    const auto& region = image->GetBufferedRegion();
+    const long nx = static_cast<long>(region.GetSize(0));
+    const long ny = static_cast<long>(region.GetSize(1));
+    const long nz = static_cast<long>(region.GetSize(2));
+    const size_t sliceStride = static_cast<size_t>(nx) * ny;
+
+    const auto& spacing = image->GetSpacing();
+    const auto& direction = image->GetDirection();
+
+    // 中心差分系数 0.5/spacing
+    const double scale[3] = {
+        0.5 / spacing[0],
+        0.5 / spacing[1],
+        0.5 / spacing[2]
+    };
+
+    double directionMatrix[3][3];
+    bool identityDirection = true;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            directionMatrix[i][j] = direction(i, j);
+            if (std::abs(directionMatrix[i][j] - (i == j ? 1.0 : 0.0)) > 1e-12)
+            {
+                identityDirection = false;
+            }
+        }
+    }
+
+    auto gradient = std::make_shared<InterleavedGradientImage>();
+    gradient->numberOfPixels = sliceStride * static_cast<size_t>(nz);
+    gradient->buffer.resize(gradient->numberOfPixels * InterleavedGradientImage::Components);
+
+    const float* input = image->GetBufferPointer();
+    float* output = gradient->buffer.data();
+
+    ThreadPool::GetGlobalInstance().ParallelFor(static_cast<size_t>(nz), 1,
+        [&](size_t, size_t zBegin, size_t zEnd, unsigned int) {
+            for (long z = static_cast<long>(zBegin); z < static_cast<long>(zEnd); ++z)
+            {
+                // ZeroFluxNeumann: 越界邻居取边界体素
+                const long zm = (z > 0) ? z - 1 : z;
+                const long zp = (z < nz - 1) ? z + 1 : z;
+
+                for (long y = 0; y < ny; ++y)
+                {
+                    const long ym = (y > 0) ? y - 1 : y;
+                    const long yp = (y < ny - 1) ? y + 1 : y;
+
+                    const size_t rowOffset = static_cast<size_t>(z) * sliceStride + static_cast<size_t>(y) * nx;
+                    const float* row = input + rowOffset;
+                    const float* rowYm = input + static_cast<size_t>(z) * sliceStride + static_cast<size_t>(ym) * nx;
+                    const float* rowYp = input + static_cast<size_t>(z) * sliceStride + static_cast<size_t>(yp) * nx;
+                    const float* rowZm = input + static_cast<size_t>(zm) * sliceStride + static_cast<size_t>(y) * nx;
+                    const float* rowZp = input + static_cast<size_t>(zp) * sliceStride + static_cast<size_t>(y) * nx;
+                    float* out = output + rowOffset * InterleavedGradientImage::Components;
+
+                    for (long x = 0; x < nx; ++x)
+                    {
+                        const long xm = (x > 0) ? x - 1 : x;
+                        const long xp = (x < nx - 1) ? x + 1 : x;
+
+                        const double g0 = scale[0] * (static_cast<double>(row[xp]) - row[xm]);
+                        const double g1 = scale[1] * (static_cast<double>(rowYp[x]) - rowYm[x]);
+                        const double g2 = scale[2] * (static_cast<double>(rowZp[x]) - rowZm[x]);
+
+                        float* voxel = out + static_cast<size_t>(x) * InterleavedGradientImage::Components;
+                        if (identityDirection)
+                        {
+                            voxel[0] = static_cast<float>(g0);
+                            voxel[1] = static_cast<float>(g1);
+                            voxel[2] = static_cast<float>(g2);
+                        }
+                        else
+                        {
+                            // 索引空间梯度 → 物理空间 (与 TransformLocalVectorToPhysicalVector 一致)
+                            for (unsigned int i = 0; i < 3; ++i)
+                            {
+                                voxel[i] = static_cast<float>(directionMatrix[i][0] * g0 +
+                                                              directionMatrix[i][1] * g1 +
+                                                              directionMatrix[i][2] * g2);
+                            }
+                        }
+                        voxel[3] = 0.0f;
+                    }
+                }
+            }
+        },
+        maxThreads);
+
+    return gradient;
+}
+
+// ============================================================================
+// 缓存
+// ============================================================================
+
+GradientImageCache::GradientPointer GradientImageCache::GetGradient(const ImageType* image,
+                                                                    unsigned int maxThreads)
+{
+    if (!image)
+    {
+        throw std::runtime_error("GradientImageCache: image is null");
+    }
+
+    const unsigned long modifiedTime = image->GetMTime();
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (auto& entry : m_Entries)
+        {
+            if (entry.image == image && entry.modifiedTime == modifiedTime)
+            {
+                GradientPointer gradient = entry.gradient.lock();
+                if (gradient)
+                {
+                    entry.lastUse = ++m_UseCounter;
+                    ++m_Statistics.hits;
+                    UpdateRetention();
+                    return gradient;
+                }
+            }
+        }
+        ++m_Statistics.misses;
+    }
+
+    // 在锁外计算, 不阻塞其他图像的查询
+    GradientPointer gradient = ComputeGradient(image, maxThreads);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // 同一图像的旧版本(MTime不同)不会再被命中, 直接替换
+    m_Entries.erase(std::remove_if(m_Entries.begin(), m_Entries.end(),
+        [image](const Entry& entry) { return entry.image == image; }), m_Entries.end());
+
+    Entry entry;
+    entry.image = image;
+    entry.modifiedTime = modifiedTime;
+    entry.lastUse = ++m_UseCounter;
+    entry.bytes = gradient->buffer.size() * sizeof(float);
+    entry.gradient = gradient;
+    m_Entries.push_back(entry);
+
+    UpdateRetention();
+    return gradient;
+}
+
+void GradientImageCache::UpdateRetention()
+{
+    // 调用方持有 m_Mutex
+    std::sort(m_Entries.begin(), m_Entries.end(),
+        [](const Entry& a, const Entry& b) { return a.lastUse > b.lastUse; });
+
+    size_t retainedBytes = 0;
+    for (auto& entry : m_Entries)
+    {
+        GradientPointer gradient = entry.gradient.lock();
+        if (gradient && retainedBytes + entry.bytes <= m_MemoryBudget)
+        {
+            entry.retained = gradient;
+            retainedBytes += entry.bytes;
+        }
+        else
+        {
+            entry.retained.reset();
+        }
+    }
+
+    // 既无强引用又无外部持有者的记录已失效
+    m_Entries.erase(std::remove_if(m_Entries.begin(), m_Entries.end(),
+        [](const Entry& entry) { return !entry.retained && entry.gradient.expired(); }), m_Entries.end());
+}
+
+void GradientImageCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Entries.clear();
+}
+
+void GradientImageCache::SetMemoryBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_MemoryBudget = bytes;
+    UpdateRetention();
+}
+
+GradientImageCache::Statistics GradientImageCache::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Statistics;
+}
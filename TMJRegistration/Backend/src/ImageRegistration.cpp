@@ -1,14 +1,21 @@
 #include "ImageRegistration.h"
 #include "GaussNewtonOptimizer.h"
+#include "MaskBitmap.h"
 #include <iostream>
 #include <iomanip>
 #include <chrono>
 #include <cmath>
 #include <algorithm>
+#include <limits>
+#include <ctime>
+#include <filesystem>
+#include <sstream>
 #include <itkImageFileReader.h>
 #include <itkTransformFileReader.h>
+#include <itkTransformFileWriter.h>
 #include <itkImageRegionConstIterator.h>
 #include <itkImageRegionIterator.h>
+#include <itkRegionOfInterestImageFilter.h>
 
 // ============================================================================
 // 构造函数和析构函数
@@ -16,10 +23,12 @@
 
 ImageRegistration::ImageRegistration()
     : m_TransformType(ConfigManager::TransformType::Rigid)
+    , m_ResultTransformType(ConfigManager::TransformType::Rigid)
     , m_MetricType(ConfigManager::MetricType::MattesMutualInformation)
     , m_OptimizerType(ConfigManager::OptimizerType::RegularStepGradientDescent)
     , m_UseInitialTransform(false)
     , m_NumberOfHistogramBins(64)
+    , m_UseExplicitPDFDerivatives(true)
     , m_NumberOfSpatialSamples(100000)
     , m_MINDRadius(1)
     , m_MINDSigma(0.8)
@@ -33,6 +42,7 @@ ImageRegistration::ImageRegistration()
     , m_UseLevenbergMarquardt(true)
     , m_DampingFactor(1e-3)
     , m_NumberOfLevels(3)
+    , m_UseRecursivePyramid(false)
     , m_RandomSeed(121212)
     , m_UseStratifiedSampling(true)
     , m_SamplingPercentage(0.10)
@@ -40,7 +50,11 @@ ImageRegistration::ImageRegistration()
     , m_ElapsedTime(0.0)
     , m_Verbose(false)
     , m_MaskVoxelCount(0)  // 初始化掩膜体素数为0
+    , m_CropToMaskROI(false)
+    , m_ROICropMargin(20.0)
     , m_InitializationMode(InitializationMode::Geometry)  // 默认使用几何中心对齐
+    , m_RetainCropRegions(false)
+    , m_HasRetainedCropRegions(false)
 {
     // 默认多分辨率设置
     m_ShrinkFactors = {4, 2, 1};
@@ -56,6 +70,10 @@ ImageRegistration::ImageRegistration()
     m_RigidTransform = RigidTransformType::New();
     m_AffineTransform = AffineTransformType::New();
     m_InitialTransform = CompositeTransformType::New();
+    
+    // 多分辨率金字塔 (可被 SetFixedPyramid/SetMovingPyramid 替换为共享对象)
+    m_FixedPyramid = std::make_shared<MultiResolutionPyramid>();
+    m_MovingPyramid = std::make_shared<MultiResolutionPyramid>();
 }
 
 ImageRegistration::~ImageRegistration()
@@ -133,19 +151,11 @@ bool ImageRegistration::LoadFixedMask(const std::string& maskFilePath)
         m_FixedImageMask->SetImage(maskImage);
         m_FixedImageMask->Update();
         
-        // 统计掩膜内的体素数量
-        using IteratorType = itk::ImageRegionConstIterator<MaskImageType>;
-        IteratorType it(maskImage, maskImage->GetLargestPossibleRegion());
-        unsigned long maskVoxels = 0;
-        unsigned long totalVoxels = 0;
-        for (it.GoToBegin(); !it.IsAtEnd(); ++it)
-        {
-            ++totalVoxels;
-            if (it.Get() > 0)
-            {
-                ++maskVoxels;
-            }
-        }
+        // 统计掩膜内的体素数量 (在掩膜自身网格上栅格化, 只扫描非零包围盒)
+        MaskBitmap maskBitmap;
+        maskBitmap.Rasterize(maskImage.GetPointer());
+        unsigned long maskVoxels = static_cast<unsigned long>(maskBitmap.GetNumberOfInsideVoxels());
+        unsigned long totalVoxels = static_cast<unsigned long>(maskImage->GetLargestPossibleRegion().GetNumberOfPixels());
         
         double maskPercentage = 100.0 * static_cast<double>(maskVoxels) / static_cast<double>(totalVoxels);
         
@@ -155,6 +165,12 @@ bool ImageRegistration::LoadFixedMask(const std::string& maskFilePath)
         std::cout << "[Fixed Mask] Loaded: " << maskFilePath << std::endl;
         std::cout << "  Mask coverage: " << maskVoxels << " / " << totalVoxels 
                   << " voxels (" << std::fixed << std::setprecision(1) << maskPercentage << "%)" << std::endl;
+        if (maskVoxels > 0)
+        {
+            const auto& box = maskBitmap.GetBoundingBox();
+            std::cout << "  Mask bounding box: index [" << box.GetIndex(0) << ", " << box.GetIndex(1) << ", " << box.GetIndex(2)
+                      << "] size [" << box.GetSize(0) << ", " << box.GetSize(1) << ", " << box.GetSize(2) << "]" << std::endl;
+        }
         
         return true;
     }
@@ -166,6 +182,28 @@ bool ImageRegistration::LoadFixedMask(const std::string& maskFilePath)
     }
 }
 
+// ============================================================================
+// 批量配准: 共享固定图像资源
+// ============================================================================
+
+void ImageRegistration::ShareFixedResources(const ImageRegistration& source)
+{
+    m_FixedImage = source.m_FixedImage;
+    m_FixedImageMask = source.m_FixedImageMask;
+    m_MaskVoxelCount = source.m_MaskVoxelCount;
+    m_FixedPyramid = source.m_FixedPyramid;
+}
+
+void ImageRegistration::SetSharedMovingMINDFeatureCache(std::shared_ptr<MINDMetric::SharedFeatureCache> cache)
+{
+    m_MINDMetric->SetSharedMovingFeatureCache(cache);
+}
+
+void ImageRegistration::SetMINDTileCacheMemoryMB(double megabytes)
+{
+    m_MINDMetric->SetMovingFeatureTileMemoryLimit(static_cast<size_t>(std::max(0.0, megabytes) * 1024.0 * 1024.0));
+}
+
 // ============================================================================
 // 变换类型设置
 // ============================================================================
@@ -177,7 +215,34 @@ void ImageRegistration::SetTransformType(ConfigManager::TransformType type)
 
 unsigned int ImageRegistration::GetNumberOfParameters() const
 {
-    return (m_TransformType == ConfigManager::TransformType::Rigid) ? 6 : 12;
+    return UsesRigidTransform() ? 6 : 12;
+}
+
+bool ImageRegistration::UsesRigidTransform() const
+{
+    return m_TransformType == ConfigManager::TransformType::Rigid ||
+           m_TransformType == ConfigManager::TransformType::Translation;
+}
+
+bool ImageRegistration::ResultUsesRigidTransform() const
+{
+    return m_ResultTransformType == ConfigManager::TransformType::Rigid ||
+           m_ResultTransformType == ConfigManager::TransformType::Translation;
+}
+
+bool ImageRegistration::IsLevelActive(unsigned int level) const
+{
+    return m_ActiveLevels.empty() ||
+           std::find(m_ActiveLevels.begin(), m_ActiveLevels.end(), level) != m_ActiveLevels.end();
+}
+
+unsigned int ImageRegistration::GetLevelIterations(unsigned int level) const
+{
+    if (m_NumberOfIterations.empty())
+    {
+        return 0;
+    }
+    return (level < m_NumberOfIterations.size()) ? m_NumberOfIterations[level] : m_NumberOfIterations[0];
 }
 
 // ============================================================================
@@ -269,12 +334,14 @@ void ImageRegistration::LoadFromConfig(const ConfigManager::RegistrationConfig&
     m_MetricType = config.metricType;
     m_OptimizerType = config.optimizerType;
     m_NumberOfHistogramBins = config.numberOfHistogramBins;
+    m_UseExplicitPDFDerivatives = config.useExplicitPDFDerivatives;
     m_NumberOfSpatialSamples = config.numberOfSpatialSamples;
     
     // MIND参数
     m_MINDRadius = config.mindRadius;
     m_MINDSigma = config.mindSigma;
     m_MINDNeighborhoodType = config.mindNeighborhoodType;
+    SetMINDTileCacheMemoryMB(config.mindTileCacheMB);
     
     m_LearningRate = config.learningRate;
     m_MinimumStepLength = config.minimumStepLength;
@@ -290,9 +357,12 @@ void ImageRegistration::LoadFromConfig(const ConfigManager::RegistrationConfig&
     m_NumberOfLevels = config.numberOfLevels;
     m_ShrinkFactors = config.shrinkFactors;
     m_SmoothingSigmas = config.smoothingSigmas;
+    m_UseRecursivePyramid = config.useRecursivePyramid;
     m_UseStratifiedSampling = config.useStratifiedSampling;
     m_RandomSeed = config.randomSeed;
     m_SamplingPercentage = config.samplingPercentage;
+    m_CropToMaskROI = config.cropToMaskROI;
+    m_ROICropMargin = config.roiCropMargin;
 }
 
 // ============================================================================
@@ -308,7 +378,7 @@ ImageRegistration::CompositeTransformType::Pointer ImageRegistration::GetFinalCo
     // 这避免了粗配准被应用两次的问题。
     
     // 只添加优化后的最终变换
-    if (m_TransformType == ConfigManager::TransformType::Rigid)
+    if (ResultUsesRigidTransform())
     {
         composite->AddTransform(m_RigidTransform);
     }
@@ -381,7 +451,7 @@ void ImageRegistration::ComputeGeometricCenter(ImageType::Pointer image, ImageTy
 
 void ImageRegistration::InitializeTransform()
 {
-    if (m_TransformType == ConfigManager::TransformType::Rigid)
+    if (UsesRigidTransform())
     {
         InitializeRigidTransform();
     }
@@ -524,88 +594,126 @@ void ImageRegistration::InitializeAffineTransform()
 }
 
 // ============================================================================
-// 图像预处理
+// ROI裁剪
 // ============================================================================
 
-ImageRegistration::ImageType::Pointer ImageRegistration::ShrinkImage(ImageType::Pointer image, unsigned int factor)
+void ImageRegistration::ComputeMaskROICropRegions(ImageType::RegionType& fixedRegion, ImageType::RegionType& movingRegion)
 {
-    if (factor <= 1)
+    // 默认不裁剪 (大小为0的区域)
+    fixedRegion = ImageType::RegionType();
+    movingRegion = ImageType::RegionType();
+
+    // 掩膜栅格化到固定图像网格, 取紧包围盒 (掩膜和固定图像未改变时直接复用)
+    m_FixedMaskBitmap.Rasterize(m_FixedImageMask.GetPointer(), m_FixedImage.GetPointer());
+    if (m_FixedMaskBitmap.GetNumberOfInsideVoxels() == 0)
     {
-        return image;
+        std::cout << "[ROI Crop] Warning: mask does not overlap the fixed image, skipping crop" << std::endl;
+        return;
     }
 
-    using ShrinkFilterType = itk::ShrinkImageFilter<ImageType, ImageType>;
-    auto shrinkFilter = ShrinkFilterType::New();
-    shrinkFilter->SetInput(image);
-    shrinkFilter->SetShrinkFactors(factor);
-    shrinkFilter->Update();
-    return shrinkFilter->GetOutput();
-}
+    // 包围盒8个角点 (体素中心) 的物理坐标
+    const auto& box = m_FixedMaskBitmap.GetBoundingBox();
+    std::vector<ImageType::PointType> boxCorners;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        ImageType::IndexType index;
+        for (unsigned int d = 0; d < 3; ++d)
+        {
+            index[d] = ((corner >> d) & 1) ? box.GetIndex(d) + static_cast<long>(box.GetSize(d)) - 1 : box.GetIndex(d);
+        }
+        ImageType::PointType point;
+        m_FixedImage->TransformIndexToPhysicalPoint(index, point);
+        boxCorners.push_back(point);
+    }
 
-ImageRegistration::ImageType::Pointer ImageRegistration::SmoothImage(ImageType::Pointer image, double sigma)
-{
-    if (sigma <= 0.0)
+    fixedRegion = ComputeCropRegion(m_FixedImage, boxCorners, m_ROICropMargin);
+
+    // 裁剪后的固定区域角点经当前变换 (已由初始变换初始化) 映射到移动图像, 再外扩边距
+    std::vector<ImageType::PointType> movingCorners;
+    for (int corner = 0; corner < 8; ++corner)
     {
-        return image;
+        ImageType::IndexType index;
+        for (unsigned int d = 0; d < 3; ++d)
+        {
+            index[d] = ((corner >> d) & 1) ? fixedRegion.GetIndex(d) + static_cast<long>(fixedRegion.GetSize(d)) - 1
+                                           : fixedRegion.GetIndex(d);
+        }
+        ImageType::PointType point;
+        m_FixedImage->TransformIndexToPhysicalPoint(index, point);
+        if (m_TransformType == ConfigManager::TransformType::Affine)
+        {
+            movingCorners.push_back(m_AffineTransform->TransformPoint(point));
+        }
+        else
+        {
+            movingCorners.push_back(m_RigidTransform->TransformPoint(point));
+        }
     }
 
-    using SmoothingFilterType = itk::SmoothingRecursiveGaussianImageFilter<ImageType, ImageType>;
-    auto smoothFilter = SmoothingFilterType::New();
-    smoothFilter->SetInput(image);
-    smoothFilter->SetSigma(sigma);
-    smoothFilter->Update();
-    return smoothFilter->GetOutput();
+    movingRegion = ComputeCropRegion(m_MovingImage, movingCorners, m_ROICropMargin);
+
+    const auto fixedFull = m_FixedImage->GetLargestPossibleRegion().GetSize();
+    const auto movingFull = m_MovingImage->GetLargestPossibleRegion().GetSize();
+    const auto fixedCrop = fixedRegion.GetSize();
+    const auto movingCrop = movingRegion.GetSize();
+
+    std::cout << "[ROI Crop] Fixed:  [" << fixedFull[0] << ", " << fixedFull[1] << ", " << fixedFull[2] << "] -> ["
+              << fixedCrop[0] << ", " << fixedCrop[1] << ", " << fixedCrop[2] << "] (margin "
+              << std::fixed << std::setprecision(1) << m_ROICropMargin << " mm)" << std::endl;
+
+    if (movingRegion.GetNumberOfPixels() == 0)
+    {
+        // 初始变换把ROI映射到移动图像之外: 保留完整移动图像
+        std::cout << "[ROI Crop] Warning: transformed ROI is outside the moving image, moving image not cropped" << std::endl;
+        return;
+    }
+
+    std::cout << "[ROI Crop] Moving: [" << movingFull[0] << ", " << movingFull[1] << ", " << movingFull[2] << "] -> ["
+              << movingCrop[0] << ", " << movingCrop[1] << ", " << movingCrop[2] << "]" << std::endl;
 }
 
-ImageRegistration::ImageType::Pointer ImageRegistration::WinsorizeImage(ImageType::Pointer image, double lowerQuantile, double upperQuantile)
+ImageRegistration::ImageType::RegionType ImageRegistration::ComputeCropRegion(ImageType::Pointer image,
+                                                                              const std::vector<ImageType::PointType>& points,
+                                                                              double margin)
 {
-    // ANTs风格的Winsorizing: 将强度截断在指定分位数之间
-    // 这能极大提高MI对软组织的敏感度,忽略骨骼高亮或背景噪声
-    
-    using IteratorType = itk::ImageRegionConstIterator<ImageType>;
-    using OutputIteratorType = itk::ImageRegionIterator<ImageType>;
-    
-    // 1. 收集所有像素值
-    std::vector<float> values;
-    IteratorType it(image, image->GetLargestPossibleRegion());
-    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    const auto largest = image->GetLargestPossibleRegion();
+    const auto spacing = image->GetSpacing();
+
+    double lower[3] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    double upper[3] = {std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+    for (const auto& point : points)
     {
-        values.push_back(it.Get());
+        itk::ContinuousIndex<double, 3> continuousIndex;
+        image->TransformPhysicalPointToContinuousIndex(point, continuousIndex);
+        for (unsigned int d = 0; d < 3; ++d)
+        {
+            lower[d] = std::min(lower[d], continuousIndex[d]);
+            upper[d] = std::max(upper[d], continuousIndex[d]);
+        }
     }
-    
-    // 2. 排序并计算分位数
-    std::sort(values.begin(), values.end());
-    size_t lowerIndex = static_cast<size_t>(lowerQuantile * values.size());
-    size_t upperIndex = static_cast<size_t>(upperQuantile * values.size());
-    
-    if (lowerIndex >= values.size()) lowerIndex = 0;
-    if (upperIndex >= values.size()) upperIndex = values.size() - 1;
-    
-    float lowerThreshold = values[lowerIndex];
-    float upperThreshold = values[upperIndex];
-    
-    // 3. 创建输出图像并截断
-    auto output = ImageType::New();
-    output->SetRegions(image->GetLargestPossibleRegion());
-    output->SetSpacing(image->GetSpacing());
-    output->SetOrigin(image->GetOrigin());
-    output->SetDirection(image->GetDirection());
-    output->Allocate();
-    
-    IteratorType inputIt(image, image->GetLargestPossibleRegion());
-    OutputIteratorType outputIt(output, output->GetLargestPossibleRegion());
-    
-    for (inputIt.GoToBegin(), outputIt.GoToBegin(); !inputIt.IsAtEnd(); ++inputIt, ++outputIt)
+
+    // 边距按各轴间距换算为体素数, 结果与最大区域求交; 交集为空时返回大小为0的区域
+    ImageType::RegionType region;
+    ImageType::IndexType start;
+    ImageType::SizeType size;
+    for (unsigned int d = 0; d < 3; ++d)
     {
-        float value = inputIt.Get();
-        if (value < lowerThreshold)
-            value = lowerThreshold;
-        else if (value > upperThreshold)
-            value = upperThreshold;
-        outputIt.Set(value);
+        const long marginVoxels = static_cast<long>(std::ceil(margin / spacing[d]));
+        const long regionBegin = largest.GetIndex(d);
+        const long regionEnd = regionBegin + static_cast<long>(largest.GetSize(d));
+        const long begin = std::max(regionBegin, static_cast<long>(std::floor(lower[d])) - marginVoxels);
+        const long end = std::min(regionEnd, static_cast<long>(std::ceil(upper[d])) + marginVoxels + 1);
+        start[d] = begin;
+        size[d] = (end > begin) ? static_cast<ImageType::SizeType::SizeValueType>(end - begin) : 0;
     }
-    
-    return output;
+    region.SetIndex(start);
+    region.SetSize(size);
+    if (region.GetNumberOfPixels() == 0)
+    {
+        size.Fill(0);
+        region.SetSize(size);
+    }
+    return region;
 }
 
 // ============================================================================
@@ -630,7 +738,7 @@ double ImageRegistration::ComputePhysicalRadius(ImageType::Pointer image)
 
 std::vector<double> ImageRegistration::EstimateParameterScales()
 {
-    if (m_TransformType == ConfigManager::TransformType::Rigid)
+    if (UsesRigidTransform())
     {
         return EstimateRigidParameterScales();
     }
@@ -704,7 +812,7 @@ std::vector<double> ImageRegistration::EstimateAffineParameterScales()
 
 void ImageRegistration::RunSingleLevel(ImageType::Pointer fixedImage, ImageType::Pointer movingImage, unsigned int level)
 {
-    if (m_TransformType == ConfigManager::TransformType::Rigid)
+    if (UsesRigidTransform())
     {
         RunSingleLevelRigid(fixedImage, movingImage, level);
     }
@@ -712,6 +820,15 @@ void ImageRegistration::RunSingleLevel(ImageType::Pointer fixedImage, ImageType:
     {
         RunSingleLevelAffine(fixedImage, movingImage, level);
     }
+
+    if (m_Verbose && m_MetricType == ConfigManager::MetricType::MIND)
+    {
+        const auto tiles = m_MINDMetric->GetMovingFeatureTileStatistics();
+        std::cout << "  [MIND] Feature tiles: " << tiles.residentTiles << "/" << tiles.totalTiles << " resident ("
+                  << std::fixed << std::setprecision(1) << tiles.residentBytes / (1024.0 * 1024.0) << " MB, peak "
+                  << tiles.peakBytes / (1024.0 * 1024.0) << " MB), " << tiles.misses << " computed, "
+                  << tiles.evictions << " evicted, " << tiles.hits << " corner hits" << std::endl;
+    }
 }
 
 // ============================================================================
@@ -754,6 +871,15 @@ static void ComputeRigidJacobian(
     jacobian[5] = {0.0, 0.0, 1.0};
 }
 
+// 平移阶段: 旋转参数 (Euler3D 参数 0-2) 的雅可比置零
+static void ZeroRotationJacobian(std::vector<std::array<double, 3>>& jacobian)
+{
+    for (unsigned int p = 0; p < 3; ++p)
+    {
+        jacobian[p] = {0.0, 0.0, 0.0};
+    }
+}
+
 // ============================================================================
 // 仿射变换的雅可比矩阵计算
 // ============================================================================
@@ -809,11 +935,7 @@ static void ComputeAffineJacobian(
 void ImageRegistration::RunSingleLevelRigid(ImageType::Pointer fixedImage, ImageType::Pointer movingImage, unsigned int level)
 {
     // 获取当前层的迭代次数
-    unsigned int currentIterations = m_NumberOfIterations[0];  // 默认使用第一个值
-    if (level < m_NumberOfIterations.size())
-    {
-        currentIterations = m_NumberOfIterations[level];
-    }
+    const unsigned int currentIterations = GetLevelIterations(level);
     
     // 如果当前层迭代次数为0,直接跳过
     if (currentIterations == 0)
@@ -822,6 +944,13 @@ void ImageRegistration::RunSingleLevelRigid(ImageType::Pointer fixedImage, Image
         return;
     }
     
+    // 平移阶段: 旋转参数的雅可比置零, 梯度和Gauss-Newton法方程中旋转分量均为0, 旋转保持初始值
+    const bool translationOnly = (m_TransformType == ConfigManager::TransformType::Translation);
+    if (translationOnly)
+    {
+        std::cout << "  Translation only (rotation fixed)" << std::endl;
+    }
+    
     // 根据度量类型配置度量
     if (m_MetricType == ConfigManager::MetricType::MIND)
     {
@@ -848,9 +977,13 @@ void ImageRegistration::RunSingleLevelRigid(ImageType::Pointer fixedImage, Image
         m_MINDMetric->SetUseStratifiedSampling(m_UseStratifiedSampling);
         
         auto rigidTransformPtr = m_RigidTransform;
-        m_MINDMetric->SetJacobianFunction([rigidTransformPtr](const ImageType::PointType& point,
-                                                               std::vector<std::array<double, 3>>& jacobian) {
+        m_MINDMetric->SetJacobianFunction([rigidTransformPtr, translationOnly](const ImageType::PointType& point,
+                                                                                std::vector<std::array<double, 3>>& jacobian) {
             ComputeRigidJacobian(point, rigidTransformPtr, jacobian);
+            if (translationOnly)
+            {
+                ZeroRotationJacobian(jacobian);
+            }
         });
         
         m_MINDMetric->Initialize();
@@ -875,6 +1008,11 @@ void ImageRegistration::RunSingleLevelRigid(ImageType::Pointer fixedImage, Image
             m_GaussNewtonOptimizer->SetJacobianFunction([this](std::vector<std::vector<double>>& jacobian) {
                 m_MINDMetric->GetJacobian(jacobian);
             });
+            
+            // 正规方程由度量并行直接累加 (优先于上面的残差/雅可比路径, 一次遍历, 不物化雅可比)
+            m_GaussNewtonOptimizer->SetNormalEquationsFunction([this](std::vector<double>& JtJ, std::vector<double>& Jtf) {
+                return m_MINDMetric->GetNormalEquations(JtJ, Jtf);
+            });
         }
         else
         {
@@ -894,6 +1032,7 @@ void ImageRegistration::RunSingleLevelRigid(ImageType::Pointer fixedImage, Image
         m_MIMetric->SetFixedImage(fixedImage);
         m_MIMetric->SetMovingImage(movingImage);
         m_MIMetric->SetNumberOfHistogramBins(m_NumberOfHistogramBins);
+        m_MIMetric->SetUseExplicitPDFDerivatives(m_UseExplicitPDFDerivatives);
         if (m_SamplingPercentage > 0.0 && m_SamplingPercentage <= 1.0)
         {
             m_MIMetric->SetSamplingPercentage(m_SamplingPercentage);
@@ -914,14 +1053,19 @@ void ImageRegistration::RunSingleLevelRigid(ImageType::Pointer fixedImage, Image
         m_MIMetric->SetUseStratifiedSampling(m_UseStratifiedSampling);
         
         auto rigidTransformPtr = m_RigidTransform;
-        m_MIMetric->SetJacobianFunction([rigidTransformPtr](const ImageType::PointType& point,
-                                                           std::vector<std::array<double, 3>>& jacobian) {
+        m_MIMetric->SetJacobianFunction([rigidTransformPtr, translationOnly](const ImageType::PointType& point,
+                                                                            std::vector<std::array<double, 3>>& jacobian) {
             ComputeRigidJacobian(point, rigidTransformPtr, jacobian);
+            if (translationOnly)
+            {
+                ZeroRotationJacobian(jacobian);
+            }
         });
         
         m_MIMetric->Initialize();
         
         // 配置优化器使用MI度量 (MI始终使用RegularStep)
+        // 代价函数只需要标量值: GetValue() 走仅值路径, 不构建导数直方图
         m_Optimizer->SetCostFunction([this]() -> double {
             return m_MIMetric->GetValue();
         });
@@ -1108,11 +1252,7 @@ void ImageRegistration::RunSingleLevelRigid(ImageType::Pointer fixedImage, Image
 void ImageRegistration::RunSingleLevelAffine(ImageType::Pointer fixedImage, ImageType::Pointer movingImage, unsigned int level)
 {
     // 获取当前层的迭代次数
-    unsigned int currentIterations = m_NumberOfIterations[0];
-    if (level < m_NumberOfIterations.size())
-    {
-        currentIterations = m_NumberOfIterations[level];
-    }
+    const unsigned int currentIterations = GetLevelIterations(level);
     
     // 如果当前层迭代次数为0,直接跳过
     if (currentIterations == 0)
@@ -1174,6 +1314,11 @@ void ImageRegistration::RunSingleLevelAffine(ImageType::Pointer fixedImage, Imag
             m_GaussNewtonOptimizer->SetJacobianFunction([this](std::vector<std::vector<double>>& jacobian) {
                 m_MINDMetric->GetJacobian(jacobian);
             });
+            
+            // 正规方程由度量并行直接累加 (优先于上面的残差/雅可比路径, 一次遍历, 不物化雅可比)
+            m_GaussNewtonOptimizer->SetNormalEquationsFunction([this](std::vector<double>& JtJ, std::vector<double>& Jtf) {
+                return m_MINDMetric->GetNormalEquations(JtJ, Jtf);
+            });
         }
         else
         {
@@ -1193,6 +1338,7 @@ void ImageRegistration::RunSingleLevelAffine(ImageType::Pointer fixedImage, Imag
         m_MIMetric->SetFixedImage(fixedImage);
         m_MIMetric->SetMovingImage(movingImage);
         m_MIMetric->SetNumberOfHistogramBins(m_NumberOfHistogramBins);
+        m_MIMetric->SetUseExplicitPDFDerivatives(m_UseExplicitPDFDerivatives);
         if (m_SamplingPercentage > 0.0 && m_SamplingPercentage <= 1.0)
         {
             m_MIMetric->SetSamplingPercentage(m_SamplingPercentage);
@@ -1221,6 +1367,7 @@ void ImageRegistration::RunSingleLevelAffine(ImageType::Pointer fixedImage, Imag
         m_MIMetric->Initialize();
         
         // 配置优化器使用MI度量 (MI始终使用RegularStep)
+        // 代价函数只需要标量值: GetValue() 走仅值路径, 不构建导数直方图
         m_Optimizer->SetCostFunction([this]() -> double {
             return m_MIMetric->GetValue();
         });
@@ -1419,6 +1566,17 @@ void ImageRegistration::RunSingleLevelAffine(ImageType::Pointer fixedImage, Imag
 // 评估互信息值（不执行优化）
 // ============================================================================
 
+void ImageRegistration::GetEvaluationImages(ImageType::Pointer& fixedImage, ImageType::Pointer& movingImage)
+{
+    m_FixedPyramid->SetInput(m_FixedImage);
+    m_MovingPyramid->SetInput(m_MovingImage);
+
+    MultiResolutionPyramid::LevelSettings fullResolution;
+    fullResolution.winsorize = false;
+    fixedImage = m_FixedPyramid->GetLevel(fullResolution);
+    movingImage = m_MovingPyramid->GetLevel(fullResolution);
+}
+
 double ImageRegistration::EvaluateMutualInformation(RigidTransformType::Pointer transform)
 {
     if (!m_FixedImage || !m_MovingImage)
@@ -1452,13 +1610,18 @@ double ImageRegistration::EvaluateMutualInformation(RigidTransformType::Pointer
         std::cout << "  Fixed mask: Enabled" << std::endl;
     }
     
+    // 评估使用全分辨率、未截断的原始图像, 经由与配准共用的金字塔对象获取
+    ImageType::Pointer fixedImage;
+    ImageType::Pointer movingImage;
+    GetEvaluationImages(fixedImage, movingImage);
+    
     double metricValue = 0.0;
     
     if (m_MetricType == ConfigManager::MetricType::MIND)
     {
         // 使用MIND度量评估
-        m_MINDMetric->SetFixedImage(m_FixedImage);
-        m_MINDMetric->SetMovingImage(m_MovingImage);
+        m_MINDMetric->SetFixedImage(fixedImage);
+        m_MINDMetric->SetMovingImage(movingImage);
         m_MINDMetric->SetMINDRadius(m_MINDRadius);
         m_MINDMetric->SetMINDSigma(m_MINDSigma);
         m_MINDMetric->SetNeighborhoodTypeFromString(m_MINDNeighborhoodType);
@@ -1490,9 +1653,10 @@ double ImageRegistration::EvaluateMutualInformation(RigidTransformType::Pointer
     else
     {
         // 使用互信息度量评估（默认）
-        m_MIMetric->SetFixedImage(m_FixedImage);
-        m_MIMetric->SetMovingImage(m_MovingImage);
+        m_MIMetric->SetFixedImage(fixedImage);
+        m_MIMetric->SetMovingImage(movingImage);
         m_MIMetric->SetNumberOfHistogramBins(m_NumberOfHistogramBins);
+        m_MIMetric->SetUseExplicitPDFDerivatives(m_UseExplicitPDFDerivatives);
         m_MIMetric->SetSamplingPercentage(m_SamplingPercentage);
         m_MIMetric->SetRandomSeed(m_RandomSeed);
         
@@ -1555,13 +1719,18 @@ double ImageRegistration::EvaluateMutualInformation(AffineTransformType::Pointer
         std::cout << "  Fixed mask: Enabled" << std::endl;
     }
     
+    // 评估使用全分辨率、未截断的原始图像, 经由与配准共用的金字塔对象获取
+    ImageType::Pointer fixedImage;
+    ImageType::Pointer movingImage;
+    GetEvaluationImages(fixedImage, movingImage);
+    
     double metricValue = 0.0;
     
     if (m_MetricType == ConfigManager::MetricType::MIND)
     {
         // 使用MIND度量评估
-        m_MINDMetric->SetFixedImage(m_FixedImage);
-        m_MINDMetric->SetMovingImage(m_MovingImage);
+        m_MINDMetric->SetFixedImage(fixedImage);
+        m_MINDMetric->SetMovingImage(movingImage);
         m_MINDMetric->SetMINDRadius(m_MINDRadius);
         m_MINDMetric->SetMINDSigma(m_MINDSigma);
         m_MINDMetric->SetNeighborhoodTypeFromString(m_MINDNeighborhoodType);
@@ -1593,9 +1762,10 @@ double ImageRegistration::EvaluateMutualInformation(AffineTransformType::Pointer
     else
     {
         // 使用互信息度量评估（默认）
-        m_MIMetric->SetFixedImage(m_FixedImage);
-        m_MIMetric->SetMovingImage(m_MovingImage);
+        m_MIMetric->SetFixedImage(fixedImage);
+        m_MIMetric->SetMovingImage(movingImage);
         m_MIMetric->SetNumberOfHistogramBins(m_NumberOfHistogramBins);
+        m_MIMetric->SetUseExplicitPDFDerivatives(m_UseExplicitPDFDerivatives);
         m_MIMetric->SetSamplingPercentage(m_SamplingPercentage);
         m_MIMetric->SetRandomSeed(m_RandomSeed);
         
@@ -1638,8 +1808,9 @@ void ImageRegistration::Update()
 
     auto startTime = std::chrono::high_resolution_clock::now();
 
-    // 初始化变换
+    // 初始化变换 (之后结果保存在该类型的变换对象中)
     InitializeTransform();
+    m_ResultTransformType = m_TransformType;
 
     // 把 verbose 传递下去
     if (m_MetricType == ConfigManager::MetricType::MIND)
@@ -1666,6 +1837,7 @@ void ImageRegistration::Update()
         if (i == 0) std::cout << " (coarse)";
         else if (i == m_NumberOfLevels - 1) std::cout << " (fine)";
         else std::cout << " (medium)";
+        if (!IsLevelActive(i)) std::cout << " [not in this stage]";
         std::cout << std::endl;
     }
 
@@ -1710,9 +1882,79 @@ void ImageRegistration::Update()
                   << "% of total voxels)\n";
     }
 
+    // ROI裁剪区域 (在任何金字塔处理之前, 只影响本次配准使用的图像, 不改变输入图像)
+    ImageType::RegionType fixedCropRegion;
+    ImageType::RegionType movingCropRegion;
+    if (m_CropToMaskROI && m_FixedImageMask.IsNotNull())
+    {
+        ComputeMaskROICropRegions(fixedCropRegion, movingCropRegion);
+        
+        // 级联后续阶段: 移动图像ROI由上一阶段结果映射得到, 仍落在上一阶段的区域内时沿用该区域
+        // (大小为0表示完整图像), 使移动金字塔层级及其梯度/MIND特征直接命中缓存
+        if (m_RetainCropRegions && m_HasRetainedCropRegions && fixedCropRegion == m_RetainedFixedCropRegion &&
+            movingCropRegion.GetNumberOfPixels() > 0 &&
+            (m_RetainedMovingCropRegion.GetNumberOfPixels() == 0 || m_RetainedMovingCropRegion.IsInside(movingCropRegion)))
+        {
+            movingCropRegion = m_RetainedMovingCropRegion;
+            std::cout << "[ROI Crop] Moving ROI still covered by previous cascade stage, reusing it" << std::endl;
+        }
+        
+        if (m_RetainCropRegions)
+        {
+            m_RetainedFixedCropRegion = fixedCropRegion;
+            m_RetainedMovingCropRegion = movingCropRegion;
+            m_HasRetainedCropRegions = true;
+        }
+    }
+
+    // 金字塔输入与当前图像相同时保留已计算的层级 (级联的后续阶段直接复用)
+    m_FixedPyramid->SetInput(m_FixedImage);
+    m_MovingPyramid->SetInput(m_MovingImage);
+    m_FixedPyramid->SetUseRecursiveConstruction(m_UseRecursivePyramid);
+    m_MovingPyramid->SetUseRecursiveConstruction(m_UseRecursivePyramid);
+    const auto fixedPyramidStart = m_FixedPyramid->GetStatistics();
+    const auto movingPyramidStart = m_MovingPyramid->GetStatistics();
+
+    // ANTs风格的预处理：Winsorizing -> Smooth -> Shrink (由金字塔按需计算并缓存)
+    auto makeLevelSettings = [this](unsigned int level, const ImageType::RegionType& cropRegion) {
+        MultiResolutionPyramid::LevelSettings settings;
+        settings.shrinkFactor = (level < m_ShrinkFactors.size()) ? m_ShrinkFactors[level] : 1;
+        settings.smoothingSigma = (level < m_SmoothingSigmas.size()) ? m_SmoothingSigmas[level] : 0.0;
+        settings.winsorize = true;
+        settings.lowerQuantile = 0.005;
+        settings.upperQuantile = 0.995;
+        settings.cropRegion = cropRegion;
+        return settings;
+    };
+
+    // 递归金字塔: 由细到粗预先构建, 使每个粗层级都能从已构建的细层级导出
+    // 只构建本阶段实际运行的层级 (迭代次数为0的层级被跳过, 不需要其图像)
+    if (m_UseRecursivePyramid)
+    {
+        for (unsigned int level = m_NumberOfLevels; level-- > 0;)
+        {
+            if (!IsLevelActive(level) || GetLevelIterations(level) == 0)
+            {
+                continue;
+            }
+            m_FixedPyramid->GetLevel(makeLevelSettings(level, fixedCropRegion));
+            m_MovingPyramid->GetLevel(makeLevelSettings(level, movingCropRegion));
+        }
+    }
+
+    // 度量值只由本次实际运行的层级给出: 级联中某阶段所有层级都被跳过时不沿用上一阶段的值
+    m_FinalMetricValue = std::numeric_limits<double>::quiet_NaN();
+    unsigned int levelsRun = 0;
+
     // 多分辨率金字塔
     for (unsigned int level = 0; level < m_NumberOfLevels; ++level)
     {
+        // 多阶段配准中本阶段不参与的层级
+        if (!IsLevelActive(level))
+        {
+            continue;
+        }
+        
         unsigned int shrinkFactor = (level < m_ShrinkFactors.size()) ? m_ShrinkFactors[level] : 1;
         double smoothingSigma = (level < m_SmoothingSigmas.size()) ? m_SmoothingSigmas[level] : 0.0;
         
@@ -1726,22 +1968,233 @@ void ImageRegistration::Update()
             std::cout << "  Shrink Factor: " << shrinkFactor << "x" << std::endl;
             std::cout << "  Smoothing Sigma: " << std::fixed << std::setprecision(2) << smoothingSigma << " mm" << std::endl;
         }
+        
+        // 迭代次数为0: 跳过该层, 也不构建其金字塔图像
+        if (GetLevelIterations(level) == 0)
+        {
+            std::cout << "  [Skipping] Level " << level << " iterations set to 0" << std::endl;
+            continue;
+        }
 
-        // ANTs风格的预处理：Winsorizing -> Smooth -> Shrink
-        ImageType::Pointer fixedPyramid = WinsorizeImage(m_FixedImage, 0.005, 0.995);
-        fixedPyramid = SmoothImage(fixedPyramid, smoothingSigma);
-        fixedPyramid = ShrinkImage(fixedPyramid, shrinkFactor);
-
-        ImageType::Pointer movingPyramid = WinsorizeImage(m_MovingImage, 0.005, 0.995);
-        movingPyramid = SmoothImage(movingPyramid, smoothingSigma);
-        movingPyramid = ShrinkImage(movingPyramid, shrinkFactor);
+        ImageType::Pointer fixedPyramid = m_FixedPyramid->GetLevel(makeLevelSettings(level, fixedCropRegion));
+        ImageType::Pointer movingPyramid = m_MovingPyramid->GetLevel(makeLevelSettings(level, movingCropRegion));
 
         RunSingleLevel(fixedPyramid, movingPyramid, level);
+        ++levelsRun;
+    }
+
+    if (m_Verbose)
+    {
+        const auto fixedPyramidEnd = m_FixedPyramid->GetStatistics();
+        const auto movingPyramidEnd = m_MovingPyramid->GetStatistics();
+        std::cout << "[Pyramid] Fixed levels: " << (fixedPyramidEnd.misses - fixedPyramidStart.misses) << " computed ("
+                  << (fixedPyramidEnd.recursiveBuilds - fixedPyramidStart.recursiveBuilds) << " from finer levels), "
+                  << (fixedPyramidEnd.hits - fixedPyramidStart.hits) << " reused; Moving levels: "
+                  << (movingPyramidEnd.misses - movingPyramidStart.misses) << " computed ("
+                  << (movingPyramidEnd.recursiveBuilds - movingPyramidStart.recursiveBuilds) << " from finer levels), "
+                  << (movingPyramidEnd.hits - movingPyramidStart.hits) << " reused" << std::endl;
     }
 
     auto endTime = std::chrono::high_resolution_clock::now();
     m_ElapsedTime = std::chrono::duration<double>(endTime - startTime).count();
 
-    std::cout << "Final metric value: " << std::scientific << std::setprecision(4) 
-              << m_FinalMetricValue << std::endl;
+    if (levelsRun == 0)
+    {
+        std::cout << "[Warning] No level ran (all iteration counts are 0 or no level is active); "
+                  << "final metric value not evaluated, transform left at its initial value" << std::endl;
+    }
+    else
+    {
+        std::cout << "Final metric value: " << std::scientific << std::setprecision(4) 
+                  << m_FinalMetricValue << std::endl;
+    }
+}
+
+// ============================================================================
+// 级联配准
+// ============================================================================
+
+void ImageRegistration::SetInitialTransformFromCurrentResult()
+{
+    // 复制当前结果: 下一阶段优化的是另一个变换对象, 但初始变换不应随之改变
+    m_InitialTransform = CompositeTransformType::New();
+    if (UsesRigidTransform())
+    {
+        auto rigidCopy = RigidTransformType::New();
+        rigidCopy->SetFixedParameters(m_RigidTransform->GetFixedParameters());
+        rigidCopy->SetParameters(m_RigidTransform->GetParameters());
+        m_InitialTransform->AddTransform(rigidCopy);
+    }
+    else
+    {
+        auto affineCopy = AffineTransformType::New();
+        affineCopy->SetFixedParameters(m_AffineTransform->GetFixedParameters());
+        affineCopy->SetParameters(m_AffineTransform->GetParameters());
+        m_InitialTransform->AddTransform(affineCopy);
+    }
+    m_UseInitialTransform = true;
+    
+    std::cout << "[Initial Transform] Using in-memory " << ConfigManager::TransformTypeToString(m_TransformType)
+              << " result as initial transform" << std::endl;
+}
+
+void ImageRegistration::RunConfigured(const ConfigManager::RegistrationConfig& config)
+{
+    if (!config.stages.empty())
+    {
+        RunCascade(config.stages);
+    }
+    else if (config.transformType == ConfigManager::TransformType::RigidThenAffine)
+    {
+        RunCascade({ConfigManager::TransformType::Rigid, ConfigManager::TransformType::Affine});
+    }
+    else
+    {
+        Update();
+    }
+}
+
+std::string ImageRegistration::SaveFinalTransform(const std::string& outputFolder) const
+{
+    // 按最后执行的阶段类型保存
+    itk::Transform<double, 3, 3>::Pointer finalTransform;
+    if (ResultUsesRigidTransform())
+    {
+        finalTransform = m_RigidTransform;
+    }
+    else
+    {
+        finalTransform = m_AffineTransform;
+    }
+    
+    namespace fs = std::filesystem;
+    if (!fs::exists(outputFolder))
+    {
+        fs::create_directories(outputFolder);
+    }
+    
+    auto now = std::chrono::system_clock::now();
+    auto time_t_now = std::chrono::system_clock::to_time_t(now);
+    std::tm tm_now;
+#ifdef _WIN32
+    localtime_s(&tm_now, &time_t_now);
+#else
+    localtime_r(&time_t_now, &tm_now);
+#endif
+    std::ostringstream filename;
+    filename << "registration_transform_" << std::put_time(&tm_now, "%Y%m%d_%H%M%S") << ".h5";
+    const fs::path outputPath = fs::path(outputFolder) / filename.str();
+    
+    using WriterType = itk::TransformFileWriter;
+    auto writer = WriterType::New();
+    writer->SetFileName(outputPath.string());
+    writer->SetInput(finalTransform);
+    writer->Update();
+    return outputPath.string();
+}
+
+void ImageRegistration::RunCascade(const std::vector<ConfigManager::TransformType>& stageTypes)
+{
+    std::vector<ConfigManager::StageConfig> stages;
+    for (auto type : stageTypes)
+    {
+        ConfigManager::StageConfig stage;
+        stage.transformType = type;
+        stage.metricType = m_MetricType;
+        stage.optimizerType = m_OptimizerType;
+        stages.push_back(stage);
+    }
+    RunCascade(stages);
+}
+
+void ImageRegistration::RunCascade(const std::vector<ConfigManager::StageConfig>& stages)
+{
+    if (stages.empty())
+    {
+        throw std::runtime_error("[Cascade] No stages specified");
+    }
+    for (const auto& stage : stages)
+    {
+        if (stage.transformType == ConfigManager::TransformType::RigidThenAffine)
+        {
+            throw std::runtime_error("[Cascade] Each stage must be Translation, Rigid or Affine");
+        }
+        for (unsigned int level : stage.levels)
+        {
+            if (level >= m_NumberOfLevels)
+            {
+                throw std::runtime_error("[Cascade] Stage level out of range: " + std::to_string(level));
+            }
+        }
+    }
+    
+    // 阶段设置只在级联期间生效 (SetInitialTransformFromCurrentResult 会替换初始变换对象, 保存指针即可)
+    const ConfigManager::TransformType savedTransformType = m_TransformType;
+    const CompositeTransformType::Pointer savedInitialTransform = m_InitialTransform;
+    const bool savedUseInitialTransform = m_UseInitialTransform;
+    const ConfigManager::MetricType savedMetricType = m_MetricType;
+    const ConfigManager::OptimizerType savedOptimizerType = m_OptimizerType;
+    const std::vector<unsigned int> savedActiveLevels = m_ActiveLevels;
+    auto restoreSettings = [&]() {
+        m_TransformType = savedTransformType;
+        m_InitialTransform = savedInitialTransform;
+        m_UseInitialTransform = savedUseInitialTransform;
+        m_MetricType = savedMetricType;
+        m_OptimizerType = savedOptimizerType;
+        m_ActiveLevels = savedActiveLevels;
+        m_RetainCropRegions = false;
+    };
+    
+    m_CascadeStageResults.clear();
+    m_RetainCropRegions = true;
+    m_HasRetainedCropRegions = false;
+    double totalElapsedTime = 0.0;
+    
+    try
+    {
+        for (size_t stage = 0; stage < stages.size(); ++stage)
+        {
+            const auto& stageConfig = stages[stage];
+            std::cout << "\n[Cascade Stage " << (stage + 1) << "/" << stages.size() << ": "
+                      << ConfigManager::TransformTypeToString(stageConfig.transformType) << ", "
+                      << ConfigManager::MetricTypeToString(stageConfig.metricType) << ", "
+                      << ConfigManager::OptimizerTypeToString(stageConfig.optimizerType) << "]" << std::endl;
+            std::cout << "==========================================" << std::endl;
+            
+            // 上一阶段的结果作为本阶段的初始变换
+            if (stage > 0)
+            {
+                SetInitialTransformFromCurrentResult();
+            }
+            SetTransformType(stageConfig.transformType);
+            m_MetricType = stageConfig.metricType;
+            m_OptimizerType = stageConfig.optimizerType;
+            m_ActiveLevels = stageConfig.levels;
+            Update();
+            totalElapsedTime += m_ElapsedTime;
+            
+            CascadeStageResult result;
+            result.transformType = stageConfig.transformType;
+            result.elapsedTime = m_ElapsedTime;
+            result.finalMetricValue = m_FinalMetricValue;
+            const auto parameters = UsesRigidTransform() ? m_RigidTransform->GetParameters()
+                                                         : m_AffineTransform->GetParameters();
+            for (unsigned int i = 0; i < parameters.GetSize(); ++i)
+            {
+                result.parameters.push_back(parameters[i]);
+            }
+            m_CascadeStageResults.push_back(result);
+            
+            std::cout << "\n[Cascade Stage " << (stage + 1) << "/" << stages.size() << " Completed]" << std::endl;
+            std::cout << "  Time: " << std::fixed << std::setprecision(2) << result.elapsedTime << " seconds" << std::endl;
+        }
+    }
+    catch (...)
+    {
+        restoreSettings();
+        throw;
+    }
+    
+    restoreSettings();
+    m_ElapsedTime = totalElapsedTime;
 }
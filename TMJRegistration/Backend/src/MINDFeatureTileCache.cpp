@@ -0,0 +1,472 @@
+#include "MINDFeatureTileCache.h"
+#include "MINDKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// ============================================================================
+// 构造函数和析构函数
+// ============================================================================
+
+MINDFeatureTileCache::MINDFeatureTileCache(ImageType::Pointer image,
+                                           const std::vector<std::array<int, 3>>& offsets,
+                                           unsigned int radius,
+                                           size_t memoryLimitBytes,
+                                           unsigned int tileSize)
+    : m_Image(image)
+    , m_Offsets(offsets)
+    , m_NumberOfChannels(offsets.size())
+    , m_Radius(static_cast<long>(radius))
+    , m_TileSize(tileSize)
+    , m_TileShift(0)
+    , m_TotalTiles(0)
+    , m_IdentityDirection(true)
+    , m_MemoryLimit(memoryLimitBytes)
+    , m_PassCounter(0)
+    , m_Hits(0)
+{
+    if (!m_Image)
+    {
+        throw std::runtime_error("[MIND] Feature tile cache requires an image");
+    }
+    // 块按缓冲区索引定位, 要求缓冲区覆盖整幅图像 (金字塔各层级均满足)
+    if (m_Image->GetBufferedRegion() != m_Image->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("[MIND] Image buffer must cover the largest possible region");
+    }
+    if (m_NumberOfChannels == 0)
+    {
+        throw std::runtime_error("[MIND] Feature tile cache requires at least one neighbourhood offset");
+    }
+    if (m_TileSize < 4 || m_TileSize > 64 || (m_TileSize & (m_TileSize - 1)) != 0)
+    {
+        throw std::runtime_error("[MIND] Feature tile size must be a power of two between 4 and 64");
+    }
+    while ((1u << m_TileShift) < m_TileSize)
+    {
+        ++m_TileShift;
+    }
+
+    const auto size = m_Image->GetLargestPossibleRegion().GetSize();
+    const auto& spacing = m_Image->GetSpacing();
+    const auto& direction = m_Image->GetDirection();
+    m_TotalTiles = 1;
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        m_Size[d] = static_cast<long>(size[d]);
+        m_NumberOfTiles[d] = (size[d] + m_TileSize - 1) / m_TileSize;
+        m_TotalTiles *= m_NumberOfTiles[d];
+        m_GradientScale[d] = 0.5 / spacing[d];
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            m_Direction[d][j] = direction(d, j);
+            if (std::abs(m_Direction[d][j] - (d == j ? 1.0 : 0.0)) > 1e-12)
+            {
+                m_IdentityDirection = false;
+            }
+        }
+    }
+
+    m_Tiles.reset(new std::atomic<const Tile*>[m_TotalTiles]);
+    for (size_t i = 0; i < m_TotalTiles; ++i)
+    {
+        m_Tiles[i].store(nullptr, std::memory_order_relaxed);
+    }
+    m_TileStorage.resize(m_TotalTiles);
+    m_TileMutexes.reset(new std::mutex[m_TotalTiles]);
+    m_Statistics.totalTiles = m_TotalTiles;
+}
+
+MINDFeatureTileCache::~MINDFeatureTileCache()
+{
+}
+
+// ============================================================================
+// 内存管理和统计
+// ============================================================================
+
+void MINDFeatureTileCache::BeginPass()
+{
+    const unsigned long pass = m_PassCounter.fetch_add(1, std::memory_order_relaxed) + 1;
+    const size_t limit = GetMemoryLimit();
+    {
+        std::lock_guard<std::mutex> lock(m_StatisticsMutex);
+        if (m_Statistics.residentBytes <= limit)
+        {
+            return;
+        }
+    }
+
+    // 其他度量正在读取 (共享同一缓存) 时不淘汰, 留到之后的遍历
+    std::unique_lock<std::shared_mutex> accessLock(m_AccessMutex, std::try_to_lock);
+    if (!accessLock.owns_lock())
+    {
+        return;
+    }
+
+    std::vector<std::pair<unsigned long, size_t>> resident;   // (最近使用, 块序号)
+    for (size_t i = 0; i < m_TotalTiles; ++i)
+    {
+        if (m_TileStorage[i])
+        {
+            resident.emplace_back(m_TileStorage[i]->lastUse.load(std::memory_order_relaxed), i);
+        }
+    }
+    std::sort(resident.begin(), resident.end());
+
+    std::lock_guard<std::mutex> lock(m_StatisticsMutex);
+    for (const auto& entry : resident)
+    {
+        if (m_Statistics.residentBytes <= limit || entry.first >= pass)
+        {
+            break;
+        }
+        const size_t tileIndex = entry.second;
+        m_Statistics.residentBytes -= m_TileStorage[tileIndex]->bytes;
+        --m_Statistics.residentTiles;
+        ++m_Statistics.evictions;
+        m_Tiles[tileIndex].store(nullptr, std::memory_order_relaxed);
+        m_TileStorage[tileIndex].reset();
+    }
+}
+
+void MINDFeatureTileCache::Clear()
+{
+    std::unique_lock<std::shared_mutex> accessLock(m_AccessMutex);
+    for (size_t i = 0; i < m_TotalTiles; ++i)
+    {
+        m_Tiles[i].store(nullptr, std::memory_order_relaxed);
+        m_TileStorage[i].reset();
+    }
+
+    std::lock_guard<std::mutex> lock(m_StatisticsMutex);
+    m_Statistics.residentTiles = 0;
+    m_Statistics.residentBytes = 0;
+}
+
+MINDFeatureTileCache::Statistics MINDFeatureTileCache::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_StatisticsMutex);
+    Statistics statistics = m_Statistics;
+    statistics.hits = m_Hits.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+// ============================================================================
+// 块计算
+// ============================================================================
+
+const MINDFeatureTileCache::Tile* MINDFeatureTileCache::LoadTile(size_t tileIndex, bool& computed)
+{
+    std::lock_guard<std::mutex> tileLock(m_TileMutexes[tileIndex]);
+
+    // 等待锁期间其他线程可能已经算好
+    computed = false;
+    const Tile* tile = m_Tiles[tileIndex].load(std::memory_order_acquire);
+    if (tile)
+    {
+        return tile;
+    }
+
+    std::unique_ptr<Tile> created = ComputeTile(tileIndex);
+    created->lastUse.store(m_PassCounter.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    const size_t bytes = created->bytes;
+    tile = created.get();
+    m_TileStorage[tileIndex] = std::move(created);
+    m_Tiles[tileIndex].store(tile, std::memory_order_release);
+    computed = true;
+
+    std::lock_guard<std::mutex> lock(m_StatisticsMutex);
+    ++m_Statistics.misses;
+    ++m_Statistics.residentTiles;
+    m_Statistics.residentBytes += bytes;
+    m_Statistics.peakBytes = std::max(m_Statistics.peakBytes, m_Statistics.residentBytes);
+    return tile;
+}
+
+std::unique_ptr<MINDFeatureTileCache::Tile> MINDFeatureTileCache::ComputeTile(size_t tileIndex) const
+{
+    const size_t tileCoordinate[3] = {
+        tileIndex % m_NumberOfTiles[0],
+        (tileIndex / m_NumberOfTiles[0]) % m_NumberOfTiles[1],
+        tileIndex / (m_NumberOfTiles[0] * m_NumberOfTiles[1])};
+
+    // 三层区域 (全局索引, 半开区间):
+    // 块本身 ⊂ 特征区域 (块 ± 1, 中心差分需要) ⊂ 局部区域 (特征区域 ± patch半径, 盒式滤波需要)
+    // 后两者只在图像边界处截断, 此时局部盒式滤波的边界截断与完整计算相同
+    long tileBegin[3], tileEnd[3], featureBegin[3], featureEnd[3], blockBegin[3], blockEnd[3];
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        tileBegin[d] = static_cast<long>(tileCoordinate[d]) * m_TileSize;
+        tileEnd[d] = std::min(tileBegin[d] + static_cast<long>(m_TileSize), m_Size[d]);
+        featureBegin[d] = std::max(tileBegin[d] - 1, 0L);
+        featureEnd[d] = std::min(tileEnd[d] + 1, m_Size[d]);
+        blockBegin[d] = std::max(featureBegin[d] - m_Radius, 0L);
+        blockEnd[d] = std::min(featureEnd[d] + m_Radius, m_Size[d]);
+    }
+
+    const long nx = m_Size[0];
+    const long ny = m_Size[1];
+    const long nz = m_Size[2];
+    const size_t sliceStride = static_cast<size_t>(nx) * ny;
+    const float* input = m_Image->GetBufferPointer();
+    const size_t numChannels = m_NumberOfChannels;
+
+    const long bx = blockEnd[0] - blockBegin[0];
+    const long by = blockEnd[1] - blockBegin[1];
+    const long bz = blockEnd[2] - blockBegin[2];
+    const size_t blockSlice = static_cast<size_t>(bx) * by;
+
+    const long fx = featureEnd[0] - featureBegin[0];
+    const long fy = featureEnd[1] - featureBegin[1];
+    const long fz = featureEnd[2] - featureBegin[2];
+
+    std::vector<float> block(blockSlice * static_cast<size_t>(bz));
+    std::vector<float> features(static_cast<size_t>(fx) * fy * fz * numChannels);
+    std::vector<float> scratch;
+    std::vector<double> sums;
+
+    for (size_t dir = 0; dir < numChannels; ++dir)
+    {
+        const auto& r = m_Offsets[dir];
+
+        // 步骤1: 局部区域上的 (I(y) - I(y+r))^2, 邻居越出图像时取0 (同 MINDMetric::ComputePatchDistance)
+        for (long z = 0; z < bz; ++z)
+        {
+            const long gz = blockBegin[2] + z;
+            const long zs = gz + r[2];
+            for (long y = 0; y < by; ++y)
+            {
+                const long gy = blockBegin[1] + y;
+                const long ys = gy + r[1];
+                const float* row = input + static_cast<size_t>(gz) * sliceStride + static_cast<size_t>(gy) * nx;
+                const float* neighborRow = (zs >= 0 && zs < nz && ys >= 0 && ys < ny)
+                    ? input + static_cast<size_t>(zs) * sliceStride + static_cast<size_t>(ys) * nx
+                    : nullptr;
+                float* out = block.data() + static_cast<size_t>(z) * blockSlice + static_cast<size_t>(y) * bx;
+                for (long x = 0; x < bx; ++x)
+                {
+                    const long gx = blockBegin[0] + x;
+                    const long xs = gx + r[0];
+                    const float neighbor = (neighborRow && xs >= 0 && xs < nx) ? neighborRow[xs] : 0.0f;
+                    const float diff = row[gx] - neighbor;
+                    out[x] = diff * diff;
+                }
+            }
+        }
+
+        // 步骤2: 可分离盒式滤波, 顺序与完整计算相同 (x行, 切片内y, 最后z)
+        if (m_Radius > 0)
+        {
+            for (long z = 0; z < bz; ++z)
+            {
+                float* slice = block.data() + static_cast<size_t>(z) * blockSlice;
+                for (long y = 0; y < by; ++y)
+                {
+                    MINDKernels::BoxFilterRow(slice + static_cast<size_t>(y) * bx, bx, m_Radius, scratch);
+                }
+                MINDKernels::BoxFilterStrided(slice, by, static_cast<size_t>(bx), bx, m_Radius, scratch, sums);
+            }
+            for (long y = 0; y < by; ++y)
+            {
+                MINDKernels::BoxFilterStrided(block.data() + static_cast<size_t>(y) * bx, bz, blockSlice, bx, m_Radius,
+                                              scratch, sums);
+            }
+        }
+
+        // 步骤3: 特征区域写入交错缓冲区的第 dir 个通道
+        for (long z = featureBegin[2]; z < featureEnd[2]; ++z)
+        {
+            for (long y = featureBegin[1]; y < featureEnd[1]; ++y)
+            {
+                const float* source = block.data() + static_cast<size_t>(z - blockBegin[2]) * blockSlice +
+                                      static_cast<size_t>(y - blockBegin[1]) * bx - blockBegin[0];
+                float* target = features.data() +
+                    ((static_cast<size_t>(z - featureBegin[2]) * fy + static_cast<size_t>(y - featureBegin[1])) * fx) * numChannels;
+                for (long x = featureBegin[0]; x < featureEnd[0]; ++x)
+                {
+                    target[static_cast<size_t>(x - featureBegin[0]) * numChannels + dir] = source[x];
+                }
+            }
+        }
+    }
+
+    // 步骤4: 方差、exp 和最大值归一化
+    const size_t numberOfFeatureVoxels = static_cast<size_t>(fx) * fy * fz;
+    for (size_t i = 0; i < numberOfFeatureVoxels; ++i)
+    {
+        MINDKernels::NormalizeDescriptor(features.data() + i * numChannels, numChannels);
+    }
+
+    // 步骤5: 块内体素的特征值和中心差分梯度
+    // (边界与系数同 GradientImageCache: ZeroFluxNeumann, 0.5/spacing, 索引空间 → 物理空间)
+    auto tile = std::make_unique<Tile>();
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        tile->size[d] = tileEnd[d] - tileBegin[d];
+    }
+    const size_t numberOfTileVoxels = static_cast<size_t>(tile->size[0]) * tile->size[1] * tile->size[2];
+    tile->values.resize(numberOfTileVoxels * numChannels);
+    tile->gradients.resize(numberOfTileVoxels * numChannels * 3);
+    tile->bytes = (tile->values.size() + tile->gradients.size()) * sizeof(float);
+
+    auto featureAt = [&](long x, long y, long z) {
+        return features.data() +
+            ((static_cast<size_t>(z - featureBegin[2]) * fy + static_cast<size_t>(y - featureBegin[1])) * fx +
+             static_cast<size_t>(x - featureBegin[0])) * numChannels;
+    };
+
+    size_t voxelIndex = 0;
+    for (long z = tileBegin[2]; z < tileEnd[2]; ++z)
+    {
+        const long zm = (z > 0) ? z - 1 : z;
+        const long zp = (z < nz - 1) ? z + 1 : z;
+        for (long y = tileBegin[1]; y < tileEnd[1]; ++y)
+        {
+            const long ym = (y > 0) ? y - 1 : y;
+            const long yp = (y < ny - 1) ? y + 1 : y;
+            for (long x = tileBegin[0]; x < tileEnd[0]; ++x, ++voxelIndex)
+            {
+                const long xm = (x > 0) ? x - 1 : x;
+                const long xp = (x < nx - 1) ? x + 1 : x;
+                const float* center = featureAt(x, y, z);
+                const float* xMinus = featureAt(xm, y, z);
+                const float* xPlus = featureAt(xp, y, z);
+                const float* yMinus = featureAt(x, ym, z);
+                const float* yPlus = featureAt(x, yp, z);
+                const float* zMinus = featureAt(x, y, zm);
+                const float* zPlus = featureAt(x, y, zp);
+
+                std::copy(center, center + numChannels, tile->values.data() + voxelIndex * numChannels);
+
+                float* gx = tile->gradients.data() + voxelIndex * numChannels * 3;
+                float* gy = gx + numChannels;
+                float* gz = gy + numChannels;
+                for (size_t ch = 0; ch < numChannels; ++ch)
+                {
+                    const double g0 = m_GradientScale[0] * (static_cast<double>(xPlus[ch]) - xMinus[ch]);
+                    const double g1 = m_GradientScale[1] * (static_cast<double>(yPlus[ch]) - yMinus[ch]);
+                    const double g2 = m_GradientScale[2] * (static_cast<double>(zPlus[ch]) - zMinus[ch]);
+                    if (m_IdentityDirection)
+                    {
+                        gx[ch] = static_cast<float>(g0);
+                        gy[ch] = static_cast<float>(g1);
+                        gz[ch] = static_cast<float>(g2);
+                    }
+                    else
+                    {
+                        gx[ch] = static_cast<float>(m_Direction[0][0] * g0 + m_Direction[0][1] * g1 + m_Direction[0][2] * g2);
+                        gy[ch] = static_cast<float>(m_Direction[1][0] * g0 + m_Direction[1][1] * g1 + m_Direction[1][2] * g2);
+                        gz[ch] = static_cast<float>(m_Direction[2][0] * g0 + m_Direction[2][1] * g1 + m_Direction[2][2] * g2);
+                    }
+                }
+            }
+        }
+    }
+
+    return tile;
+}
+
+// ============================================================================
+// Accessor: 线程分块内的读取
+// ============================================================================
+
+MINDFeatureTileCache::Accessor::Accessor(MINDFeatureTileCache& cache)
+    : m_Cache(cache)
+    , m_Lock(cache.m_AccessMutex)
+    , m_Pass(cache.m_PassCounter.load(std::memory_order_relaxed))
+    , m_LastTileIndex(static_cast<size_t>(-1))
+    , m_LastTile(nullptr)
+    , m_Hits(0)
+{
+}
+
+MINDFeatureTileCache::Accessor::~Accessor()
+{
+    m_Cache.m_Hits.fetch_add(m_Hits, std::memory_order_relaxed);
+}
+
+inline const MINDFeatureTileCache::Tile* MINDFeatureTileCache::Accessor::GetTile(size_t tileIndex)
+{
+    if (tileIndex == m_LastTileIndex)
+    {
+        ++m_Hits;
+        return m_LastTile;
+    }
+
+    const Tile* tile = m_Cache.m_Tiles[tileIndex].load(std::memory_order_acquire);
+    if (tile)
+    {
+        ++m_Hits;
+    }
+    else
+    {
+        bool computed = false;
+        tile = m_Cache.LoadTile(tileIndex, computed);
+        if (!computed)
+        {
+            ++m_Hits;
+        }
+    }
+
+    if (tile->lastUse.load(std::memory_order_relaxed) != m_Pass)
+    {
+        tile->lastUse.store(m_Pass, std::memory_order_relaxed);
+    }
+    m_LastTileIndex = tileIndex;
+    m_LastTile = tile;
+    return tile;
+}
+
+void MINDFeatureTileCache::Accessor::Evaluate(const TrilinearSampler::Location& location,
+                                              double* values,
+                                              double* gradients)
+{
+    const size_t numChannels = m_Cache.m_NumberOfChannels;
+    const size_t numGradients = numChannels * 3;
+    const unsigned int shift = m_Cache.m_TileShift;
+    const long mask = static_cast<long>(m_Cache.m_TileSize) - 1;
+    const size_t tilesX = m_Cache.m_NumberOfTiles[0];
+    const size_t tilesY = m_Cache.m_NumberOfTiles[1];
+
+    std::fill(values, values + numChannels, 0.0);
+    if (gradients)
+    {
+        std::fill(gradients, gradients + numGradients, 0.0);
+    }
+
+    // 8个角点可能跨块 (块边界附近), 逐角点定位; 同一块时 GetTile 直接返回上次的块
+    for (int k = 0; k < 8; ++k)
+    {
+        const double w = location.weights[k];
+        if (w == 0.0)
+        {
+            continue;   // 零权重角点 (恰好落在体素上) 不读取, 避免为其计算相邻块
+        }
+
+        const long x = (k & 1) ? location.upperIndex[0] : location.lowerIndex[0];
+        const long y = (k & 2) ? location.upperIndex[1] : location.lowerIndex[1];
+        const long z = (k & 4) ? location.upperIndex[2] : location.lowerIndex[2];
+        const size_t tileIndex = static_cast<size_t>(x >> shift) +
+            tilesX * (static_cast<size_t>(y >> shift) + tilesY * static_cast<size_t>(z >> shift));
+        const Tile* tile = GetTile(tileIndex);
+
+        const size_t local = static_cast<size_t>(x & mask) +
+            static_cast<size_t>(tile->size[0]) * (static_cast<size_t>(y & mask) +
+                                                  static_cast<size_t>(tile->size[1]) * static_cast<size_t>(z & mask));
+
+        const float* voxel = tile->values.data() + local * numChannels;
+        for (size_t c = 0; c < numChannels; ++c)
+        {
+            values[c] += w * voxel[c];
+        }
+        if (gradients)
+        {
+            const float* gradient = tile->gradients.data() + local * numGradients;
+            for (size_t c = 0; c < numGradients; ++c)
+            {
+                gradients[c] += w * gradient[c];
+            }
+        }
+    }
+}
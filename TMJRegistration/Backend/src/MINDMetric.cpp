@@ -1,30 +1,36 @@
 #include "MINDMetric.h"
+#include "ThreadPool.h"
+#include "MINDKernels.h"
 #include <iostream>
 #include <iomanip>
 #include <cmath>
 #include <algorithm>
 #include <numeric>
+#include <iterator>
 #include <itkImageRegionConstIterator.h>
 #include <itkImageRegionIterator.h>
 #include <itkImageRegionIteratorWithIndex.h>
-#include <itkGradientImageFilter.h>
+#include <itkImageRegionConstIteratorWithIndex.h>
 #include <itkNeighborhoodIterator.h>
 #include <itkConstNeighborhoodIterator.h>
-#include <itkTranslationTransform.h>
-#include <itkResampleImageFilter.h>
 #include <itkLinearInterpolateImageFunction.h>
-#include <itkMeanImageFilter.h>
-#include <itkSubtractImageFilter.h>
-#include <itkSquareImageFilter.h>
-#include <itkAddImageFilter.h>
-#include <itkMultiplyImageFilter.h>
+
+using MINDKernels::BoxFilterRow;
+using MINDKernels::BoxFilterStrided;
+using MINDKernels::NormalizeDescriptor;
+
+// 采样点分块大小 (固定值, 使分块边界和归约顺序与线程数无关)
+static const size_t kSampleChunkSize = 1024;
 
 // ============================================================================
 // 构造函数和析构函数
 // ============================================================================
 
 MINDMetric::MINDMetric()
-    : m_NumberOfParameters(6)
+    : m_MovingFeatureTileMemoryLimit(MINDFeatureTileCache::DefaultMemoryLimit)
+    , m_NumberOfParameters(6)
+    , m_MovingMINDFeaturesValid(false)
+    , m_FeatureCacheUseCounter(0)
     , m_MINDRadius(1)
     , m_MINDSigma(0.8)
     , m_NeighborhoodType(NeighborhoodType::SixConnected)
@@ -35,10 +41,8 @@ MINDMetric::MINDMetric()
     , m_NumberOfValidSamples(0)
     , m_CurrentValue(0.0)
     , m_Verbose(false)
-    , m_NumberOfThreads(std::thread::hardware_concurrency())
+    , m_NumberOfThreads(ThreadPool::GetGlobalNumberOfThreads())
     , m_FiniteDifferenceStep(1e-4)
-    , m_FixedMINDFeaturesValid(false)
-    , m_MovingMINDFeaturesValid(false)
 {
     // 初始化邻域偏移量
     InitializeNeighborhoodOffsets();
@@ -118,8 +122,7 @@ void MINDMetric::SetNeighborhoodTypeFromString(const std::string& typeStr)
 void MINDMetric::SetFixedImage(ImageType::Pointer fixedImage)
 {
     m_FixedImage = fixedImage;
-    // 图像改变时重置缓存标志，确保下次Initialize()重新计算MIND特征
-    m_FixedMINDFeaturesValid = false;
+    m_EvaluationCache.Invalidate();
 }
 
 void MINDMetric::SetMovingImage(ImageType::Pointer movingImage)
@@ -132,104 +135,139 @@ void MINDMetric::SetMovingImage(ImageType::Pointer movingImage)
     
     // 图像改变时重置缓存标志，确保下次Initialize()重新计算MIND特征
     m_MovingMINDFeaturesValid = false;
+    m_EvaluationCache.Invalidate();
 }
 
 // ============================================================================
-// 辅助函数: 平移图像
+// 辅助函数
 // ============================================================================
 
-MINDMetric::ImageType::Pointer MINDMetric::ShiftImage(ImageType::Pointer image, 
-                                                        int offsetX, int offsetY, int offsetZ)
+MINDMetric::ImageType::Pointer MINDMetric::AllocateFeatureImage(ImageType::Pointer image)
 {
-    using TransformType = itk::TranslationTransform<double, 3>;
-    using ResampleFilterType = itk::ResampleImageFilter<ImageType, ImageType>;
-    using InterpolatorType = itk::LinearInterpolateImageFunction<ImageType, double>;
-    
-    auto transform = TransformType::New();
-    TransformType::OutputVectorType translation;
-    // ITK的Translation是物理坐标偏移，需要乘以spacing
-    auto spacing = image->GetSpacing();
-    translation[0] = -offsetX * spacing[0];  // 负号：平移方向相反
-    translation[1] = -offsetY * spacing[1];
-    translation[2] = -offsetZ * spacing[2];
-    transform->Translate(translation);
-    
-    auto resampler = ResampleFilterType::New();
-    resampler->SetTransform(transform);
-    resampler->SetInput(image);
-    resampler->SetSize(image->GetLargestPossibleRegion().GetSize());
-    resampler->SetOutputOrigin(image->GetOrigin());
-    resampler->SetOutputSpacing(image->GetSpacing());
-    resampler->SetOutputDirection(image->GetDirection());
-    resampler->SetDefaultPixelValue(0.0f);
-    
-    auto interpolator = InterpolatorType::New();
-    resampler->SetInterpolator(interpolator);
-    
-    resampler->Update();
-    return resampler->GetOutput();
+    // 融合核按缓冲区线性下标寻址, 要求缓冲区覆盖整幅图像 (金字塔各层级均满足)
+    if (image->GetBufferedRegion() != image->GetLargestPossibleRegion())
+    {
+        throw std::runtime_error("[MIND] Image buffer must cover the largest possible region");
+    }
+    
+    auto feature = ImageType::New();
+    feature->SetRegions(image->GetLargestPossibleRegion());
+    feature->SetSpacing(image->GetSpacing());
+    feature->SetOrigin(image->GetOrigin());
+    feature->SetDirection(image->GetDirection());
+    feature->Allocate();
+    return feature;
 }
 
 // ============================================================================
-// 辅助函数: 均值滤波 (计算Patch内的平均值)
+// MIND特征计算 (融合核)
 // ============================================================================
 
-MINDMetric::ImageType::Pointer MINDMetric::ApplyMeanFilter(ImageType::Pointer image)
+void MINDMetric::ComputePatchDistance(ImageType::Pointer image, const std::array<int, 3>& offset, float* output)
 {
-    using MeanFilterType = itk::MeanImageFilter<ImageType, ImageType>;
-    
-    auto meanFilter = MeanFilterType::New();
-    meanFilter->SetInput(image);
-    
-    // Patch半径由m_MINDRadius决定 (通常为1，即3x3x3 patch)
-    ImageType::SizeType radius;
-    radius.Fill(m_MINDRadius);
-    meanFilter->SetRadius(radius);
+    // D_P(x, x+r) = 盒式均值[(I(x) - I(x+r))^2], 邻居按索引偏移直接读取, 越界取0
+    // (替代每方向一次 ResampleImageFilter + Subtract + Square + MeanImageFilter)
+    const auto size = image->GetLargestPossibleRegion().GetSize();
+    const long nx = static_cast<long>(size[0]);
+    const long ny = static_cast<long>(size[1]);
+    const long nz = static_cast<long>(size[2]);
+    const size_t sliceStride = static_cast<size_t>(nx) * ny;
+    const long radius = static_cast<long>(m_MINDRadius);
+    const float* input = image->GetBufferPointer();
+    
+    // x的有效邻居范围 [xBegin, xEnd), 其余位置邻居为0
+    const long xBegin = std::max(0L, -static_cast<long>(offset[0]));
+    const long xEnd = std::min(nx, nx - offset[0]);
+    
+    ThreadPool& pool = ThreadPool::GetGlobalInstance();
+    
+    // 步骤1: 逐z切片计算平方差, 并在切片内完成x/y方向盒式滤波 (切片之间互不依赖)
+    pool.ParallelFor(static_cast<size_t>(nz), 1,
+        [&](size_t, size_t zBegin, size_t zEnd, unsigned int) {
+            std::vector<float> scratch;
+            std::vector<double> sums;
+            for (long z = static_cast<long>(zBegin); z < static_cast<long>(zEnd); ++z)
+            {
+                const long zs = z + offset[2];
+                float* slice = output + static_cast<size_t>(z) * sliceStride;
+                
+                for (long y = 0; y < ny; ++y)
+                {
+                    const long ys = y + offset[1];
+                    const float* row = input + static_cast<size_t>(z) * sliceStride + static_cast<size_t>(y) * nx;
+                    float* out = slice + static_cast<size_t>(y) * nx;
+                    
+                    if (zs < 0 || zs >= nz || ys < 0 || ys >= ny)
+                    {
+                        for (long x = 0; x < nx; ++x)
+                        {
+                            out[x] = row[x] * row[x];
+                        }
+                    }
+                    else
+                    {
+                        const float* neighbor = input + static_cast<size_t>(zs) * sliceStride +
+                                                static_cast<size_t>(ys) * nx + offset[0];
+                        for (long x = 0; x < xBegin; ++x)
+                        {
+                            out[x] = row[x] * row[x];
+                        }
+                        for (long x = xBegin; x < xEnd; ++x)
+                        {
+                            const float diff = row[x] - neighbor[x];
+                            out[x] = diff * diff;
+                        }
+                        for (long x = std::max(xBegin, xEnd); x < nx; ++x)
+                        {
+                            out[x] = row[x] * row[x];
+                        }
+                    }
+                    
+                    if (radius > 0)
+                    {
+                        BoxFilterRow(out, nx, radius, scratch);
+                    }
+                }
+                
+                if (radius > 0)
+                {
+                    BoxFilterStrided(slice, ny, static_cast<size_t>(nx), nx, radius, scratch, sums);
+                }
+            }
+        },
+        m_NumberOfThreads);
     
-    meanFilter->Update();
-    return meanFilter->GetOutput();
+    // 步骤2: z方向盒式滤波, 逐y处理一个xz平面
+    if (radius > 0)
+    {
+        pool.ParallelFor(static_cast<size_t>(ny), 1,
+            [&](size_t, size_t yBegin, size_t yEnd, unsigned int) {
+                std::vector<float> scratch;
+                std::vector<double> sums;
+                for (long y = static_cast<long>(yBegin); y < static_cast<long>(yEnd); ++y)
+                {
+                    BoxFilterStrided(output + static_cast<size_t>(y) * nx, nz, sliceStride, nx, radius, scratch, sums);
+                }
+            },
+            m_NumberOfThreads);
+    }
 }
 
-// ============================================================================
-// MIND特征计算 (正确实现)
-// ============================================================================
-
 void MINDMetric::ComputePatchDistances(ImageType::Pointer image,
                                         std::vector<ImageType::Pointer>& dpImages)
 {
     dpImages.clear();
     dpImages.resize(m_NeighborhoodOffsets.size());
     
-    ImageType::RegionType region = image->GetLargestPossibleRegion();
-    
     if (m_Verbose)
     {
         std::cout << "[MIND] Computing D_P (patch distances) only..." << std::endl;
     }
     
-    // 计算所有方向的 D_P(x, x+r)
     for (size_t dir = 0; dir < m_NeighborhoodOffsets.size(); ++dir)
     {
-        const auto& offset = m_NeighborhoodOffsets[dir];
-        
-        // 平移图像: I(x+r)
-        ImageType::Pointer shiftedImage = ShiftImage(image, offset[0], offset[1], offset[2]);
-        
-        // 计算差值图: I(x) - I(x+r)
-        using SubtractFilterType = itk::SubtractImageFilter<ImageType, ImageType, ImageType>;
-        auto subtractFilter = SubtractFilterType::New();
-        subtractFilter->SetInput1(image);
-        subtractFilter->SetInput2(shiftedImage);
-        subtractFilter->Update();
-        
-        // 计算平方差图: (I(x) - I(x+r))^2
-        using SquareFilterType = itk::SquareImageFilter<ImageType, ImageType>;
-        auto squareFilter = SquareFilterType::New();
-        squareFilter->SetInput(subtractFilter->GetOutput());
-        squareFilter->Update();
-        
-        // 对平方差图进行均值滤波，得到 D_P(x, x+r)
-        dpImages[dir] = ApplyMeanFilter(squareFilter->GetOutput());
+        dpImages[dir] = AllocateFeatureImage(image);
+        ComputePatchDistance(image, m_NeighborhoodOffsets[dir], dpImages[dir]->GetBufferPointer());
     }
     
     if (m_Verbose)
@@ -241,11 +279,6 @@ void MINDMetric::ComputePatchDistances(ImageType::Pointer image,
 void MINDMetric::ComputeMINDFeatures(ImageType::Pointer image, 
                                       std::vector<ImageType::Pointer>& mindFeatures)
 {
-    mindFeatures.clear();
-    mindFeatures.resize(m_NeighborhoodOffsets.size());
-    
-    ImageType::RegionType region = image->GetLargestPossibleRegion();
-    
     if (m_Verbose)
     {
         std::cout << "[MIND] Computing patch-based MIND descriptors..." << std::endl;
@@ -254,117 +287,38 @@ void MINDMetric::ComputeMINDFeatures(ImageType::Pointer image,
     }
     
     // ========================================
-    // 步骤1: 计算所有方向的 D_P(x, x+r)
-    // ========================================
-    std::vector<ImageType::Pointer> dpImages;
-    ComputePatchDistances(image, dpImages);
-    
+    // 步骤1: 各方向 D_P(x, x+r) 直接写入对应特征通道的缓冲区 (不再分配中间图像)
     // ========================================
-    // 步骤2: 计算方差 V(x) = (1/6) * sum(D_P)
-    // ========================================
-    ImageType::Pointer varianceImage = ImageType::New();
-    varianceImage->SetRegions(region);
-    varianceImage->SetSpacing(image->GetSpacing());
-    varianceImage->SetOrigin(image->GetOrigin());
-    varianceImage->SetDirection(image->GetDirection());
-    varianceImage->Allocate();
-    varianceImage->FillBuffer(0.0f);
-    
-    // 累加所有方向的 D_P
-    using AddFilterType = itk::AddImageFilter<ImageType, ImageType, ImageType>;
-    ImageType::Pointer sumImage = dpImages[0];
-    for (size_t dir = 1; dir < dpImages.size(); ++dir)
-    {
-        auto addFilter = AddFilterType::New();
-        addFilter->SetInput1(sumImage);
-        addFilter->SetInput2(dpImages[dir]);
-        addFilter->Update();
-        sumImage = addFilter->GetOutput();
-    }
-    
-    // 除以邻域数量得到平均值
-    using IteratorType = itk::ImageRegionIterator<ImageType>;
-    IteratorType varIt(varianceImage, region);
-    IteratorType sumIt(sumImage, region);
-    
-    const float numDirections = static_cast<float>(m_NeighborhoodOffsets.size());
-    for (varIt.GoToBegin(), sumIt.GoToBegin(); !varIt.IsAtEnd(); ++varIt, ++sumIt)
-    {
-        float avgDp = sumIt.Get() / numDirections;
-        // V(x) = mean(D_P)，添加epsilon防止除零
-        float variance = avgDp + 1e-10f;
-        varIt.Set(variance);
-    }
-    
-    if (m_Verbose)
-    {
-        std::cout << "  V(x) computed as mean of D_P over " << numDirections << " directions" << std::endl;
-    }
+    ComputePatchDistances(image, mindFeatures);
     
-    // ========================================
-    // 步骤3: 计算 MIND(x,r) = exp(-D_P / V)
-    // ========================================
-    for (size_t dir = 0; dir < m_NeighborhoodOffsets.size(); ++dir)
+    const size_t numDirections = mindFeatures.size();
+    const size_t numberOfPixels = image->GetLargestPossibleRegion().GetNumberOfPixels();
+    std::vector<float*> channels(numDirections);
+    for (size_t dir = 0; dir < numDirections; ++dir)
     {
-        mindFeatures[dir] = ImageType::New();
-        mindFeatures[dir]->SetRegions(region);
-        mindFeatures[dir]->SetSpacing(image->GetSpacing());
-        mindFeatures[dir]->SetOrigin(image->GetOrigin());
-        mindFeatures[dir]->SetDirection(image->GetDirection());
-        mindFeatures[dir]->Allocate();
-        
-        IteratorType featureIt(mindFeatures[dir], region);
-        IteratorType dpIt(dpImages[dir], region);
-        IteratorType varIt2(varianceImage, region);
-        
-        for (featureIt.GoToBegin(), dpIt.GoToBegin(), varIt2.GoToBegin();
-             !featureIt.IsAtEnd(); ++featureIt, ++dpIt, ++varIt2)
-        {
-            float dp = dpIt.Get();
-            float variance = varIt2.Get();
-            float mindValue = std::exp(-dp / variance);
-            featureIt.Set(mindValue);
-        }
+        channels[dir] = mindFeatures[dir]->GetBufferPointer();
     }
     
     // ========================================
-    // 步骤4: 归一化 - 除以每个位置的最大值 (论文Eq.4: n是归一化常数使最大值为1)
+    // 步骤2-4: 方差、exp 和最大值归一化 (单次分块遍历, 原地写回; 与稀疏描述子共用 NormalizeDescriptor)
     // ========================================
-    ImageType::Pointer maxImage = ImageType::New();
-    maxImage->SetRegions(region);
-    maxImage->SetSpacing(image->GetSpacing());
-    maxImage->SetOrigin(image->GetOrigin());
-    maxImage->SetDirection(image->GetDirection());
-    maxImage->Allocate();
-    maxImage->FillBuffer(0.0f);
-    
-    using ConstIteratorType = itk::ImageRegionConstIterator<ImageType>;
-    IteratorType maxIt(maxImage, region);
-    for (maxIt.GoToBegin(); !maxIt.IsAtEnd(); ++maxIt)
-    {
-        ImageType::IndexType idx = maxIt.GetIndex();
-        float maxVal = 0.0f;
-        for (size_t dir = 0; dir < m_NeighborhoodOffsets.size(); ++dir)
-        {
-            float val = mindFeatures[dir]->GetPixel(idx);
-            maxVal = std::max(maxVal, val);
-        }
-        maxIt.Set(maxVal + 1e-10f);  // 防止除零
-    }
-    
-    // 归一化：mind = exp(-D_P/V) / max(exp(-D_P/V))
-    for (size_t dir = 0; dir < m_NeighborhoodOffsets.size(); ++dir)
-    {
-        IteratorType featureIt(mindFeatures[dir], region);
-        ConstIteratorType maxConstIt(maxImage, region);
-        
-        for (featureIt.GoToBegin(), maxConstIt.GoToBegin();
-             !featureIt.IsAtEnd(); ++featureIt, ++maxConstIt)
-        {
-            float normalized = featureIt.Get() / maxConstIt.Get();
-            featureIt.Set(normalized);
-        }
-    }
+    ThreadPool::GetGlobalInstance().ParallelFor(numberOfPixels, kSampleChunkSize,
+        [&](size_t, size_t begin, size_t end, unsigned int) {
+            std::vector<float> descriptor(numDirections);
+            for (size_t i = begin; i < end; ++i)
+            {
+                for (size_t dir = 0; dir < numDirections; ++dir)
+                {
+                    descriptor[dir] = channels[dir][i];
+                }
+                NormalizeDescriptor(descriptor.data(), numDirections);
+                for (size_t dir = 0; dir < numDirections; ++dir)
+                {
+                    channels[dir][i] = descriptor[dir];
+                }
+            }
+        },
+        m_NumberOfThreads);
     
     if (m_Verbose)
     {
@@ -373,77 +327,92 @@ void MINDMetric::ComputeMINDFeatures(ImageType::Pointer image,
     }
 }
 
-// ============================================================================
-// MIND特征梯度计算
-// ============================================================================
-
-void MINDMetric::ComputeMINDFeatureGradients()
+void MINDMetric::ComputeSparseMINDDescriptors(ImageType::Pointer image,
+                                              const std::vector<size_t>& bufferOffsets,
+                                              float* descriptors)
 {
-    m_MovingMINDFeatureGradients.clear();
-    m_MovingMINDFeatureGradientInterpolators.clear();
-    
-    m_MovingMINDFeatureGradients.resize(m_MovingMINDFeatures.size());
-    m_MovingMINDFeatureGradientInterpolators.resize(m_MovingMINDFeatures.size());
-    
-    using GradientFilterType = itk::GradientImageFilter<ImageType, float, float>;
-    using GradientImageType = GradientFilterType::OutputImageType;
-    
-    for (size_t ch = 0; ch < m_MovingMINDFeatures.size(); ++ch)
+    // 只在给定体素处计算描述子, 结果与完整特征体在这些位置的值一致:
+    // D_P(x, x+r) = 窗口内 (I(y) - I(y+r))^2 的均值, y 越界时取边界体素 (对应盒式滤波的边界),
+    // y+r 越界时 I 取0 (对应完整计算中的邻居读取)
+    if (image->GetBufferedRegion() != image->GetLargestPossibleRegion())
     {
-        auto gradientFilter = GradientFilterType::New();
-        gradientFilter->SetInput(m_MovingMINDFeatures[ch]);
-        gradientFilter->Update();
-        
-        GradientImageType::Pointer gradientImage = gradientFilter->GetOutput();
-        
-        // 分离梯度分量到独立的图像
-        ImageType::RegionType region = m_MovingMINDFeatures[ch]->GetLargestPossibleRegion();
-        
-        for (unsigned int dim = 0; dim < 3; ++dim)
-        {
-            m_MovingMINDFeatureGradients[ch][dim] = ImageType::New();
-            m_MovingMINDFeatureGradients[ch][dim]->SetRegions(region);
-            m_MovingMINDFeatureGradients[ch][dim]->SetSpacing(m_MovingMINDFeatures[ch]->GetSpacing());
-            m_MovingMINDFeatureGradients[ch][dim]->SetOrigin(m_MovingMINDFeatures[ch]->GetOrigin());
-            m_MovingMINDFeatureGradients[ch][dim]->SetDirection(m_MovingMINDFeatures[ch]->GetDirection());
-            m_MovingMINDFeatureGradients[ch][dim]->Allocate();
-        }
-        
-        // 提取梯度分量
-        using GradientIteratorType = itk::ImageRegionConstIterator<GradientImageType>;
-        using OutputIteratorType = itk::ImageRegionIterator<ImageType>;
-        
-        GradientIteratorType gitInput(gradientImage, region);
-        std::array<OutputIteratorType, 3> gitOutput = {
-            OutputIteratorType(m_MovingMINDFeatureGradients[ch][0], region),
-            OutputIteratorType(m_MovingMINDFeatureGradients[ch][1], region),
-            OutputIteratorType(m_MovingMINDFeatureGradients[ch][2], region)
-        };
-        
-        for (gitInput.GoToBegin(); !gitInput.IsAtEnd(); ++gitInput)
-        {
-            auto gradient = gitInput.Get();
-            for (unsigned int dim = 0; dim < 3; ++dim)
-            {
-                gitOutput[dim].Set(gradient[dim]);
-                ++gitOutput[dim];
-            }
-        }
-        
-        // 创建插值器
-        for (unsigned int dim = 0; dim < 3; ++dim)
-        {
-            m_MovingMINDFeatureGradientInterpolators[ch][dim] = InterpolatorType::New();
-            m_MovingMINDFeatureGradientInterpolators[ch][dim]->SetInputImage(
-                m_MovingMINDFeatureGradients[ch][dim]);
-        }
+        throw std::runtime_error("[MIND] Image buffer must cover the largest possible region");
     }
     
-    if (m_Verbose)
-    {
-        std::cout << "[MIND] Computed gradients for " << m_MovingMINDFeatures.size() 
-                  << " feature channels" << std::endl;
-    }
+    const auto size = image->GetLargestPossibleRegion().GetSize();
+    const long nx = static_cast<long>(size[0]);
+    const long ny = static_cast<long>(size[1]);
+    const long nz = static_cast<long>(size[2]);
+    const size_t sliceStride = static_cast<size_t>(nx) * ny;
+    const long radius = static_cast<long>(m_MINDRadius);
+    const double patchScale = 1.0 / std::pow(static_cast<double>(2 * radius + 1), 3);
+    const float* input = image->GetBufferPointer();
+    const size_t numDirections = m_NeighborhoodOffsets.size();
+    
+    auto clampIndex = [](long value, long extent) { return std::min(std::max(value, 0L), extent - 1); };
+    
+    ThreadPool::GetGlobalInstance().ParallelFor(bufferOffsets.size(), kSampleChunkSize,
+        [&](size_t, size_t begin, size_t end, unsigned int) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t offset = bufferOffsets[i];
+                const long z = static_cast<long>(offset / sliceStride);
+                const long y = static_cast<long>((offset % sliceStride) / nx);
+                const long x = static_cast<long>(offset % nx);
+                float* descriptor = descriptors + i * numDirections;
+                
+                for (size_t dir = 0; dir < numDirections; ++dir)
+                {
+                    const auto& r = m_NeighborhoodOffsets[dir];
+                    double sum = 0.0;
+                    for (long pz = -radius; pz <= radius; ++pz)
+                    {
+                        const long vz = clampIndex(z + pz, nz);
+                        const long wz = vz + r[2];
+                        const bool zInside = (wz >= 0 && wz < nz);
+                        for (long py = -radius; py <= radius; ++py)
+                        {
+                            const long vy = clampIndex(y + py, ny);
+                            const long wy = vy + r[1];
+                            const bool yzInside = zInside && (wy >= 0 && wy < ny);
+                            const float* row = input + static_cast<size_t>(vz) * sliceStride + static_cast<size_t>(vy) * nx;
+                            const float* neighborRow = yzInside
+                                ? input + static_cast<size_t>(wz) * sliceStride + static_cast<size_t>(wy) * nx
+                                : nullptr;
+                            for (long px = -radius; px <= radius; ++px)
+                            {
+                                const long vx = clampIndex(x + px, nx);
+                                const long wx = vx + r[0];
+                                const float neighbor = (neighborRow && wx >= 0 && wx < nx) ? neighborRow[wx] : 0.0f;
+                                const float diff = row[vx] - neighbor;
+                                sum += diff * diff;
+                            }
+                        }
+                    }
+                    descriptor[dir] = static_cast<float>(sum * patchScale);
+                }
+                
+                NormalizeDescriptor(descriptor, numDirections);
+            }
+        },
+        m_NumberOfThreads);
+}
+
+// ============================================================================
+// 移动图像MIND特征块缓存
+// ============================================================================
+
+std::shared_ptr<MINDFeatureTileCache> MINDMetric::CreateFeatureTiles(ImageType::Pointer image) const
+{
+    // 只记录图像和参数, 特征及梯度在采样点第一次落入某块时才计算
+    // (替代为整幅移动图像预先构建交错特征体和梯度)
+    return std::make_shared<MINDFeatureTileCache>(image, m_NeighborhoodOffsets, m_MINDRadius,
+                                                  m_MovingFeatureTileMemoryLimit);
+}
+
+MINDFeatureTileCache::Statistics MINDMetric::GetMovingFeatureTileStatistics() const
+{
+    return m_MovingMINDTiles ? m_MovingMINDTiles->GetStatistics() : MINDFeatureTileCache::Statistics();
 }
 
 // ============================================================================
@@ -472,53 +441,29 @@ void MINDMetric::Initialize()
     // 初始化邻域偏移量（根据固定图像的尺寸和spacing动态调整）
     InitializeNeighborhoodOffsets();
     
-    // 【性能关键】检查固定图像是否改变，避免重复计算
-    bool fixedImageChanged = (m_CachedFixedImage != m_FixedImage);
-    if (fixedImageChanged || !m_FixedMINDFeaturesValid)
-    {
-        if (m_Verbose)
-        {
-            std::cout << "[MIND] Computing MIND features for fixed image..." << std::endl;
-        }
-        ComputeMINDFeatures(m_FixedImage, m_FixedMINDFeatures);
-        m_CachedFixedImage = m_FixedImage;
-        m_FixedMINDFeaturesValid = true;
-    }
-    else
-    {
-        if (m_Verbose)
-        {
-            std::cout << "[MIND] Using cached MIND features for fixed image" << std::endl;
-        }
-    }
+    // 固定图像只在采样点处计算描述子 (见 StoreSamples), 不构建完整特征体
     
     // 【性能关键】检查移动图像是否改变
     bool movingImageChanged = (m_CachedMovingImage != m_MovingImage);
     if (movingImageChanged || !m_MovingMINDFeaturesValid)
     {
+        const bool hit = m_SharedMovingFeatureCache
+            ? m_SharedMovingFeatureCache->Acquire(m_MovingImage, m_MINDRadius, m_NeighborhoodType,
+                  [this](SharedFeatureCache::FeatureTiles& tiles) { tiles = CreateFeatureTiles(m_MovingImage); },
+                  m_MovingMINDTiles)
+            : AcquireMINDFeatureTiles(m_MovingImage, m_MovingMINDTiles);
+        m_MovingMINDTiles->SetMemoryLimit(m_MovingFeatureTileMemoryLimit);
         if (m_Verbose)
         {
-            std::cout << "[MIND] Computing MIND features for moving image..." << std::endl;
+            const auto statistics = m_MovingMINDTiles->GetStatistics();
+            std::cout << (hit ? "[MIND] Using cached MIND feature tiles for moving image ("
+                              : "[MIND] Created lazy MIND feature tiles for moving image (")
+                      << statistics.residentTiles << "/" << statistics.totalTiles << " tiles of "
+                      << m_MovingMINDTiles->GetTileSize() << "^3 computed)" << std::endl;
         }
-        ComputeMINDFeatures(m_MovingImage, m_MovingMINDFeatures);
         
-        // 计算移动图像MIND特征的梯度（用于解析梯度计算）
-        ComputeMINDFeatureGradients();
-        
-        // 【性能关键】预创建所有移动MIND特征的插值器
-        m_MovingMINDInterpolators.clear();
-        m_MovingMINDInterpolators.resize(m_MovingMINDFeatures.size());
-        for (size_t ch = 0; ch < m_MovingMINDFeatures.size(); ++ch)
-        {
-            m_MovingMINDInterpolators[ch] = InterpolatorType::New();
-            m_MovingMINDInterpolators[ch]->SetInputImage(m_MovingMINDFeatures[ch]);
-        }
-        
-        if (m_Verbose)
-        {
-            std::cout << "[MIND] Pre-allocated " << m_MovingMINDInterpolators.size() 
-                      << " interpolators for MIND features" << std::endl;
-        }
+        // 【性能关键】所有通道及其梯度共用一组三线性权重 (特征几何与移动图像相同)
+        m_MovingMINDSampler.SetImage(m_MovingImage);
         
         m_CachedMovingImage = m_MovingImage;
         m_MovingMINDFeaturesValid = true;
@@ -531,10 +476,7 @@ void MINDMetric::Initialize()
         }
     }
     
-    // 采样固定图像
-    SampleFixedImage();
-    
-    // 初始化随机数生成器
+    // 初始化随机数生成器 (须在采样之前, 否则首次采样不受 m_RandomSeed 控制)
     if (m_UseFixedSeed)
     {
         m_RandomGenerator.seed(m_RandomSeed);
@@ -545,32 +487,202 @@ void MINDMetric::Initialize()
         m_RandomGenerator.seed(rd());
     }
     
+    // 采样固定图像
+    SampleFixedImage();
+    m_EvaluationCache.Invalidate();
+    
     if (m_Verbose)
     {
         std::cout << "[MIND] Initialization complete. Samples: " 
-                  << m_SamplePoints.size() << std::endl;
+                  << m_Samples.GetNumberOfSamples() << std::endl;
     }
 }
 
 void MINDMetric::ReinitializeSampling()
 {
-    // 重新计算移动图像MIND特征
-    ComputeMINDFeatures(m_MovingImage, m_MovingMINDFeatures);
-    
-    // 重新计算梯度
-    ComputeMINDFeatureGradients();
+    // 丢弃移动图像已计算的特征块 (新的块缓存按需重新计算)
+    m_MovingMINDTiles = CreateFeatureTiles(m_MovingImage);
+    m_MovingMINDSampler.SetImage(m_MovingImage);
     
-    // 重新采样
+    // 重新采样 (与 MattesMutualInformation 一致, 固定种子时结果可重复)
+    if (m_UseFixedSeed)
+    {
+        m_RandomGenerator.seed(m_RandomSeed);
+    }
     SampleFixedImage();
+    m_EvaluationCache.Invalidate();
+}
+
+bool MINDMetric::AcquireMINDFeatureTiles(ImageType::Pointer image, std::shared_ptr<MINDFeatureTileCache>& tiles)
+{
+    const unsigned long modifiedTime = image->GetMTime();
+    ++m_FeatureCacheUseCounter;
+    
+    for (auto& entry : m_FeatureCache)
+    {
+        if (entry.image == image && entry.modifiedTime == modifiedTime &&
+            entry.radius == m_MINDRadius && entry.neighborhoodType == m_NeighborhoodType)
+        {
+            entry.lastUse = m_FeatureCacheUseCounter;
+            tiles = entry.tiles;
+            return true;
+        }
+    }
+    
+    tiles = CreateFeatureTiles(image);
+    
+    // 同一图像的旧项 (参数或MTime已变) 及超出容量时最久未用的项被替换
+    auto slot = std::find_if(m_FeatureCache.begin(), m_FeatureCache.end(),
+                             [&image](const FeatureCacheEntry& entry) { return entry.image == image; });
+    if (slot == m_FeatureCache.end())
+    {
+        if (m_FeatureCache.size() < MaxFeatureCacheEntries)
+        {
+            m_FeatureCache.emplace_back();
+            slot = m_FeatureCache.end() - 1;
+        }
+        else
+        {
+            slot = std::min_element(m_FeatureCache.begin(), m_FeatureCache.end(),
+                                    [](const FeatureCacheEntry& a, const FeatureCacheEntry& b) { return a.lastUse < b.lastUse; });
+        }
+    }
+    
+    slot->image = image;
+    slot->modifiedTime = modifiedTime;
+    slot->radius = m_MINDRadius;
+    slot->neighborhoodType = m_NeighborhoodType;
+    slot->tiles = tiles;
+    slot->lastUse = m_FeatureCacheUseCounter;
+    return false;
+}
+
+bool MINDMetric::SharedFeatureCache::Acquire(ImageType::Pointer image, unsigned int radius, NeighborhoodType neighborhoodType,
+                                             const ComputeFunctionType& compute, FeatureTiles& tiles)
+{
+    const unsigned long modifiedTime = image->GetMTime();
+    auto matches = [&](const Entry& entry) {
+        return entry.image == image && entry.modifiedTime == modifiedTime &&
+               entry.radius == radius && entry.neighborhoodType == neighborhoodType;
+    };
+    auto isReady = [](const Entry& entry) {
+        return entry.tiles.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
+    
+    std::promise<FeatureTiles> promise;
+    std::shared_future<FeatureTiles> pending;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        ++m_UseCounter;
+        
+        auto found = std::find_if(m_Entries.begin(), m_Entries.end(), matches);
+        if (found != m_Entries.end())
+        {
+            found->lastUse = m_UseCounter;
+            pending = found->tiles;
+        }
+        else
+        {
+            // 先登记未完成项, 同时请求同一项的调用者等待本次计算
+            // 替换: 同一图像的旧项, 否则未满时追加, 否则最久未用的已完成项
+            auto slot = std::find_if(m_Entries.begin(), m_Entries.end(),
+                                     [&](const Entry& entry) { return entry.image == image && isReady(entry); });
+            if (slot == m_Entries.end() && m_Entries.size() >= m_MaxEntries)
+            {
+                for (auto it = m_Entries.begin(); it != m_Entries.end(); ++it)
+                {
+                    if (isReady(*it) && (slot == m_Entries.end() || it->lastUse < slot->lastUse))
+                    {
+                        slot = it;
+                    }
+                }
+            }
+            if (slot == m_Entries.end())
+            {
+                m_Entries.emplace_back();   // 全部项都在计算中时临时超出容量
+                slot = m_Entries.end() - 1;
+            }
+            
+            slot->image = image;
+            slot->modifiedTime = modifiedTime;
+            slot->radius = radius;
+            slot->neighborhoodType = neighborhoodType;
+            slot->tiles = promise.get_future().share();
+            slot->lastUse = m_UseCounter;
+        }
+    }
+    
+    // 命中: 在锁外等待 (其他任务可能仍在计算该项)
+    if (pending.valid())
+    {
+        tiles = pending.get();
+        return true;
+    }
+    
+    try
+    {
+        compute(tiles);
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Entries.erase(std::remove_if(m_Entries.begin(), m_Entries.end(), matches), m_Entries.end());
+        throw;
+    }
+    promise.set_value(tiles);
+    return false;
+}
+
+void MINDMetric::SharedFeatureCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Entries.clear();
+}
+
+size_t MINDMetric::SharedFeatureCache::GetNumberOfEntries()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Entries.size();
+}
+
+MINDFeatureTileCache::Statistics MINDMetric::SharedFeatureCache::GetTileStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    MINDFeatureTileCache::Statistics total;
+    for (const auto& entry : m_Entries)
+    {
+        if (entry.tiles.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            continue;
+        }
+        MINDFeatureTileCache::Statistics statistics;
+        try
+        {
+            statistics = entry.tiles.get()->GetStatistics();
+        }
+        catch (...)
+        {
+            continue;   // 创建失败的项 (正在被移除)
+        }
+        total.hits += statistics.hits;
+        total.misses += statistics.misses;
+        total.evictions += statistics.evictions;
+        total.residentTiles += statistics.residentTiles;
+        total.residentBytes += statistics.residentBytes;
+        total.peakBytes += statistics.peakBytes;
+        total.totalTiles += statistics.totalTiles;
+    }
+    return total;
 }
 
 void MINDMetric::ResetCache()
 {
     // 显式清空所有缓存状态，强制下次Initialize()重新计算MIND特征
-    m_CachedFixedImage = nullptr;
     m_CachedMovingImage = nullptr;
-    m_FixedMINDFeaturesValid = false;
     m_MovingMINDFeaturesValid = false;
+    m_FeatureCache.clear();
+    m_EvaluationCache.Invalidate();
     
     if (m_Verbose)
     {
@@ -582,8 +694,22 @@ void MINDMetric::ResetCache()
 // 采样策略
 // ============================================================================
 
+void MINDMetric::UpdateFixedMaskBitmap()
+{
+    if (m_FixedImageMask.IsNull())
+    {
+        m_FixedMaskBitmap.Clear();
+        return;
+    }
+
+    // 掩膜和固定图像均未改变时直接复用 (见 MaskBitmap 的缓存键)
+    m_FixedMaskBitmap.Rasterize(m_FixedImageMask.GetPointer(), m_FixedImage.GetPointer(), m_NumberOfThreads);
+}
+
 void MINDMetric::SampleFixedImage()
 {
+    UpdateFixedMaskBitmap();
+
     if (m_UseStratifiedSampling)
     {
         SampleFixedImageStratified();
@@ -596,7 +722,7 @@ void MINDMetric::SampleFixedImage()
 
 void MINDMetric::SampleFixedImageStratified()
 {
-    m_SamplePoints.clear();
+    std::vector<ImageType::IndexType> sampleIndices;
     
     ImageType::RegionType region = m_FixedImage->GetLargestPossibleRegion();
     ImageType::SizeType size = region.GetSize();
@@ -613,7 +739,7 @@ void MINDMetric::SampleFixedImageStratified()
     unsigned int padding = m_MINDRadius + 1;
     
     // 预分配空间避免频繁reallocation
-    m_SamplePoints.reserve(targetSamples);
+    sampleIndices.reserve(targetSamples);
     
     for (unsigned int z = padding; z < size[2] - padding; z += step)
     {
@@ -622,7 +748,7 @@ void MINDMetric::SampleFixedImageStratified()
             for (unsigned int x = padding; x < size[0] - padding; x += step)
             {
                 // 【添加上限控制】参考MattesMutualInformation实现
-                if (m_SamplePoints.size() >= targetSamples)
+                if (sampleIndices.size() >= targetSamples)
                 {
                     goto sampling_complete;
                 }
@@ -632,47 +758,29 @@ void MINDMetric::SampleFixedImageStratified()
                 index[1] = y;
                 index[2] = z;
                 
-                // 如果有掩膜，检查点是否在掩膜内
-                ImageType::PointType point;
-                m_FixedImage->TransformIndexToPhysicalPoint(index, point);
-                
-                if (m_FixedImageMask.IsNotNull())
-                {
-                    if (!m_FixedImageMask->IsInsideInObjectSpace(point))
-                    {
-                        continue;
-                    }
-                }
-                
-                // 创建采样点
-                SamplePoint sample;
-                sample.fixedPoint = point;
-                sample.fixedIndex = index;
-                
-                // 获取固定图像MIND特征值
-                sample.fixedMINDValues.resize(m_FixedMINDFeatures.size());
-                for (size_t ch = 0; ch < m_FixedMINDFeatures.size(); ++ch)
+                // 如果有掩膜，检查点是否在掩膜内 (位图查询)
+                if (m_FixedImageMask.IsNotNull() && !m_FixedMaskBitmap.IsInside(index))
                 {
-                    sample.fixedMINDValues[ch] = m_FixedMINDFeatures[ch]->GetPixel(index);
+                    continue;
                 }
                 
-                m_SamplePoints.push_back(sample);
+                sampleIndices.push_back(index);
             }
         }
     }
     
 sampling_complete:
+    StoreSamples(sampleIndices);
+    
     if (m_Verbose)
     {
-        std::cout << "[MIND] Stratified sampling: " << m_SamplePoints.size() 
+        std::cout << "[MIND] Stratified sampling: " << m_Samples.GetNumberOfSamples() 
                   << " samples (target: " << targetSamples << ")" << std::endl;
     }
 }
 
 void MINDMetric::SampleFixedImageRandom()
 {
-    m_SamplePoints.clear();
-    
     ImageType::RegionType region = m_FixedImage->GetLargestPossibleRegion();
     ImageType::SizeType size = region.GetSize();
     
@@ -680,106 +788,133 @@ void MINDMetric::SampleFixedImageRandom()
     unsigned long totalVoxels = size[0] * size[1] * size[2];
     unsigned long targetSamples = static_cast<unsigned long>(totalVoxels * m_SamplingPercentage);
     
-    // 边界填充
+    // 边界填充: 只在距边界 padding 以内的内部区域采样
     unsigned int padding = m_MINDRadius + 1;
+    std::vector<ImageType::IndexType> sampleIndices;
     
-    // 创建随机分布
-    std::uniform_int_distribution<unsigned int> distX(padding, size[0] - padding - 1);
-    std::uniform_int_distribution<unsigned int> distY(padding, size[1] - padding - 1);
-    std::uniform_int_distribution<unsigned int> distZ(padding, size[2] - padding - 1);
-    
-    unsigned long attempts = 0;
-    unsigned long maxAttempts = targetSamples * 3;  // 最大尝试次数
-    
-    while (m_SamplePoints.size() < targetSamples && attempts < maxAttempts)
+    ImageType::RegionType interior = region;
+    bool interiorEmpty = false;
+    for (unsigned int d = 0; d < 3; ++d)
     {
-        ++attempts;
-        
-        ImageType::IndexType index;
-        index[0] = distX(m_RandomGenerator);
-        index[1] = distY(m_RandomGenerator);
-        index[2] = distZ(m_RandomGenerator);
-        
-        ImageType::PointType point;
-        m_FixedImage->TransformIndexToPhysicalPoint(index, point);
-        
-        // 如果有掩膜，检查点是否在掩膜内
-        if (m_FixedImageMask.IsNotNull())
-        {
-            if (!m_FixedImageMask->IsInsideInObjectSpace(point))
-            {
-                continue;
-            }
-        }
-        
-        // 创建采样点
-        SamplePoint sample;
-        sample.fixedPoint = point;
-        sample.fixedIndex = index;
-        
-        // 获取固定图像MIND特征值
-        sample.fixedMINDValues.resize(m_FixedMINDFeatures.size());
-        for (size_t ch = 0; ch < m_FixedMINDFeatures.size(); ++ch)
+        if (size[d] <= 2 * padding)
         {
-            sample.fixedMINDValues[ch] = m_FixedMINDFeatures[ch]->GetPixel(index);
+            interiorEmpty = true;
+            break;
         }
-        
-        m_SamplePoints.push_back(sample);
+        interior.SetIndex(d, region.GetIndex(d) + padding);
+        interior.SetSize(d, size[d] - 2 * padding);
     }
     
+    // 无放回随机采样 (原实现为有放回的拒绝采样, 带掩膜时可能达不到目标数)
+    // 图像小于 2*padding 时没有可用采样点
+    if (interiorEmpty)
+    {
+        sampleIndices.clear();
+    }
+    else if (m_FixedImageMask.IsNull())
+    {
+        RandomVoxelSelector::SelectVoxels(interior, targetSamples, m_RandomGenerator, sampleIndices);
+    }
+    else
+    {
+        // 掩膜内按行程序号直接选取 (行程裁剪到内部区域), 不遍历掩膜外体素
+        RandomVoxelSelector::SelectVoxels(m_FixedMaskBitmap, interior, targetSamples,
+                                          m_RandomGenerator, sampleIndices);
+    }
+    
+    StoreSamples(sampleIndices);
+    
     if (m_Verbose)
     {
-        std::cout << "[MIND] Random sampling: " << m_SamplePoints.size() 
+        std::cout << "[MIND] Random sampling: " << m_Samples.GetNumberOfSamples() 
                   << " samples (target: " << targetSamples << ")" << std::endl;
     }
 }
 
+void MINDMetric::StoreSamples(std::vector<ImageType::IndexType>& indices)
+{
+    // 按Morton序建立结构数组采样集, 相邻采样点访问相邻的移动特征缓存行
+    m_Samples.Build(m_FixedImage, indices);
+    
+    // 固定MIND描述子只在采样点处计算 (含patch均值和局部方差), 直接写入连续缓冲区;
+    // 采样比例10%且有掩膜时, 完整特征体的绝大部分计算和内存都是多余的
+    const size_t numSamples = m_Samples.GetNumberOfSamples();
+    const size_t numChannels = m_NeighborhoodOffsets.size();
+    std::vector<size_t> bufferOffsets(numSamples);
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        bufferOffsets[i] = m_Samples.GetBufferOffset(i);
+    }
+    m_SampleFixedMIND.resize(numSamples * numChannels);
+    ComputeSparseMINDDescriptors(m_FixedImage, bufferOffsets, m_SampleFixedMIND.data());
+    
+    if (m_Verbose)
+    {
+        std::cout << "[MIND] Computed fixed MIND descriptors at " << numSamples << " sample locations" << std::endl;
+    }
+}
+
 // ============================================================================
 // MIND-SSD度量计算
 // ============================================================================
 
 double MINDMetric::ComputeMINDSSD()
 {
+    const size_t numSamples = m_Samples.GetNumberOfSamples();
+    const size_t numChannels = m_MovingMINDTiles->GetNumberOfChannels();
+    m_MovingMINDTiles->BeginPass();
+    
+    // 按固定大小分块提交到全局线程池, 部分和按分块序号存放后顺序合并(结果与线程数无关)
+    const size_t numChunks = ThreadPool::ComputeNumberOfChunks(numSamples, kSampleChunkSize);
+    std::vector<double> chunkSSD(numChunks, 0.0);
+    std::vector<unsigned int> chunkValidCount(numChunks, 0);
+    
+    ThreadPool::GetGlobalInstance().ParallelFor(numSamples, kSampleChunkSize,
+        [&](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            double localSSD = 0.0;
+            unsigned int localValidCount = 0;
+            std::vector<double> movingMIND(numChannels);
+            MINDFeatureTileCache::Accessor movingTiles(*m_MovingMINDTiles);
+            
+            for (size_t i = begin; i < end; ++i)
+            {
+                const ImageType::PointType fixedPoint = m_Samples.GetPoint(i);
+                const float* fixedMIND = m_SampleFixedMIND.data() + i * numChannels;
+                
+                // 变换固定图像点到移动图像空间
+                ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
+                
+                // 所有通道几何相同: 一次边界判断和权重计算
+                TrilinearSampler::Location location;
+                if (!m_MovingMINDSampler.ComputeLocation(transformedPoint, location))
+                {
+                    continue;
+                }
+                
+                movingTiles.Evaluate(location, movingMIND.data(), nullptr);
+                
+                double sampleSSD = 0.0;
+                for (size_t ch = 0; ch < numChannels; ++ch)
+                {
+                    double diff = fixedMIND[ch] - movingMIND[ch];
+                    sampleSSD += diff * diff;
+                }
+                
+                localSSD += sampleSSD;
+                localValidCount++;
+            }
+            
+            chunkSSD[chunkIndex] = localSSD;
+            chunkValidCount[chunkIndex] = localValidCount;
+        },
+        m_NumberOfThreads);
+    
     double totalSSD = 0.0;
     unsigned int validCount = 0;
-    
-    const size_t numSamples = m_SamplePoints.size();
-    const size_t numChannels = m_MovingMINDFeatures.size();
-    
-    // OpenMP并行化采样点遍历,使用reduction子句
-    #pragma omp parallel for schedule(static) reduction(+:totalSSD) reduction(+:validCount) if(numSamples > 1000)
-    for (int i = 0; i < static_cast<int>(numSamples); ++i)
+    for (size_t chunk = 0; chunk < numChunks; ++chunk)
     {
-        const auto& sample = m_SamplePoints[i];
-        
-        // 变换固定图像点到移动图像空间
-        ImageType::PointType transformedPoint = m_Transform->TransformPoint(sample.fixedPoint);
-        
-        bool allChannelsValid = true;
-        double sampleSSD = 0.0;
-        
-        // 遍历所有MIND特征通道
-        for (size_t ch = 0; ch < numChannels; ++ch)
-        {
-            // 【关键优化】使用预分配的插值器,避免循环内New()
-            if (m_MovingMINDInterpolators[ch]->IsInsideBuffer(transformedPoint))
-            {
-                double movingMINDValue = m_MovingMINDInterpolators[ch]->Evaluate(transformedPoint);
-                double diff = sample.fixedMINDValues[ch] - movingMINDValue;
-                sampleSSD += diff * diff;
-            }
-            else
-            {
-                allChannelsValid = false;
-                break;
-            }
-        }
-        
-        if (allChannelsValid)
-        {
-            totalSSD += sampleSSD;
-            validCount++;
-        }
+        totalSSD += chunkSSD[chunk];
+        validCount += chunkValidCount[chunk];
     }
     
     m_NumberOfValidSamples = validCount;
@@ -796,7 +931,18 @@ double MINDMetric::ComputeMINDSSD()
 
 double MINDMetric::GetValue()
 {
+    const ParametersType key = GetEvaluationCacheKey();
+    double cachedValue;
+    unsigned int cachedValidSamples;
+    if (m_EvaluationCache.FindValue(key, cachedValue, cachedValidSamples))
+    {
+        m_CurrentValue = cachedValue;
+        m_NumberOfValidSamples = cachedValidSamples;
+        return m_CurrentValue;
+    }
+    
     m_CurrentValue = ComputeMINDSSD();
+    m_EvaluationCache.StoreValue(key, m_CurrentValue, m_NumberOfValidSamples);
     return m_CurrentValue;
 }
 
@@ -806,23 +952,36 @@ double MINDMetric::GetValue()
 
 void MINDMetric::GetDerivative(ParametersType& derivative)
 {
-    derivative.resize(m_NumberOfParameters, 0.0);
+    const ParametersType key = GetEvaluationCacheKey();
+    if (m_EvaluationCache.FindDerivative(key, derivative))
+    {
+        return;
+    }
+    
+    derivative.assign(m_NumberOfParameters, 0.0);
     
     // 使用解析梯度（如果提供了雅可比函数）或有限差分
     if (m_JacobianFunction)
     {
-        ComputeAnalyticalGradient(derivative);
+        // 解析梯度的遍历同时得到SSD值, 一并写入缓存
+        double ssdValue = 0.0;
+        unsigned int validSamples = 0;
+        ComputeAnalyticalGradient(derivative, &ssdValue, &validSamples);
+        m_EvaluationCache.StoreValue(key, ssdValue, validSamples);
     }
     else
     {
         ComputeFiniteDifferenceGradient(derivative);
     }
+    
+    m_EvaluationCache.StoreDerivative(key, derivative);
 }
 
 void MINDMetric::GetValueAndDerivative(double& value, ParametersType& derivative)
 {
-    value = GetValue();
+    // 先取梯度: 解析梯度路径会顺带缓存值, 随后的GetValue()直接命中
     GetDerivative(derivative);
+    value = GetValue();
 }
 
 // ============================================================================
@@ -831,47 +990,57 @@ void MINDMetric::GetValueAndDerivative(double& value, ParametersType& derivative
 
 void MINDMetric::GetResiduals(std::vector<double>& residuals)
 {
-    const size_t numSamples = m_SamplePoints.size();
-    const size_t numChannels = m_MovingMINDFeatures.size();
+    const size_t numSamples = m_Samples.GetNumberOfSamples();
+    const size_t numChannels = m_MovingMINDTiles->GetNumberOfChannels();
+    m_MovingMINDTiles->BeginPass();
+    
+    // 分块残差 (按分块序号存放, 顺序拼接后与逐采样点串行遍历的行序相同)
+    const size_t numChunks = ThreadPool::ComputeNumberOfChunks(numSamples, kSampleChunkSize);
+    std::vector<std::vector<double>> chunkResiduals(numChunks);
+    
+    ThreadPool::GetGlobalInstance().ParallelFor(numSamples, kSampleChunkSize,
+        [&](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            std::vector<double>& localResiduals = chunkResiduals[chunkIndex];
+            localResiduals.reserve((end - begin) * numChannels);
+            std::vector<double> movingMIND(numChannels);
+            MINDFeatureTileCache::Accessor movingTiles(*m_MovingMINDTiles);
+            
+            for (size_t i = begin; i < end; ++i)
+            {
+                const ImageType::PointType fixedPoint = m_Samples.GetPoint(i);
+                const float* fixedMIND = m_SampleFixedMIND.data() + i * numChannels;
+                
+                // 变换固定图像点到移动图像空间
+                ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
+                
+                // 检查采样点是否有效 (所有通道几何相同, 一次判断)
+                TrilinearSampler::Location location;
+                if (m_MovingMINDSampler.ComputeLocation(transformedPoint, location))
+                {
+                    // 计算每个通道的残差: f = fixed - moving
+                    movingTiles.Evaluate(location, movingMIND.data(), nullptr);
+                    for (size_t ch = 0; ch < numChannels; ++ch)
+                    {
+                        localResiduals.push_back(fixedMIND[ch] - movingMIND[ch]);
+                    }
+                }
+            }
+        },
+        m_NumberOfThreads);
     
-    // 预分配空间: numSamples * numChannels
+    size_t numResiduals = 0;
+    for (const auto& partial : chunkResiduals)
+    {
+        numResiduals += partial.size();
+    }
     residuals.clear();
-    residuals.reserve(numSamples * numChannels);
-    
-    unsigned int validCount = 0;
-    
-    for (size_t i = 0; i < numSamples; ++i)
+    residuals.reserve(numResiduals);
+    for (const auto& partial : chunkResiduals)
     {
-        const auto& sample = m_SamplePoints[i];
-        
-        // 变换固定图像点到移动图像空间
-        ImageType::PointType transformedPoint = m_Transform->TransformPoint(sample.fixedPoint);
-        
-        // 检查所有通道是否有效
-        bool allChannelsValid = true;
-        for (size_t ch = 0; ch < numChannels; ++ch)
-        {
-            if (!m_MovingMINDInterpolators[ch]->IsInsideBuffer(transformedPoint))
-            {
-                allChannelsValid = false;
-                break;
-            }
-        }
-        
-        if (allChannelsValid)
-        {
-            // 计算每个通道的残差: f = fixed - moving
-            for (size_t ch = 0; ch < numChannels; ++ch)
-            {
-                double movingMINDValue = m_MovingMINDInterpolators[ch]->Evaluate(transformedPoint);
-                double residual = sample.fixedMINDValues[ch] - movingMINDValue;
-                residuals.push_back(residual);
-            }
-            ++validCount;
-        }
+        residuals.insert(residuals.end(), partial.begin(), partial.end());
     }
     
-    m_NumberOfValidSamples = validCount;
+    m_NumberOfValidSamples = static_cast<unsigned int>(numResiduals / numChannels);
 }
 
 void MINDMetric::GetJacobian(std::vector<std::vector<double>>& jacobian)
@@ -888,94 +1057,289 @@ void MINDMetric::GetResidualsAndJacobian(std::vector<double>& residuals,
         throw std::runtime_error("[MIND] Jacobian function must be set for Gauss-Newton optimization");
     }
     
-    const size_t numSamples = m_SamplePoints.size();
-    const size_t numChannels = m_MovingMINDFeatures.size();
+    const size_t numSamples = m_Samples.GetNumberOfSamples();
+    const size_t numChannels = m_MovingMINDTiles->GetNumberOfChannels();
     const size_t numParams = m_NumberOfParameters;
+    m_MovingMINDTiles->BeginPass();
+    
+    // 分块部分结果: 残差/雅可比行按分块顺序拼接, SSD和梯度按分块顺序合并 (可重复)
+    const size_t numChunks = ThreadPool::ComputeNumberOfChunks(numSamples, kSampleChunkSize);
+    std::vector<std::vector<double>> chunkResiduals(numChunks);
+    std::vector<std::vector<std::vector<double>>> chunkJacobians(numChunks);
+    std::vector<double> chunkDerivatives(numChunks * numParams, 0.0);
+    std::vector<double> chunkSSD(numChunks, 0.0);
+    
+    ThreadPool::GetGlobalInstance().ParallelFor(numSamples, kSampleChunkSize,
+        [&](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            std::vector<double>& localResiduals = chunkResiduals[chunkIndex];
+            std::vector<std::vector<double>>& localJacobian = chunkJacobians[chunkIndex];
+            double* localDerivative = chunkDerivatives.data() + chunkIndex * numParams;
+            double localSSD = 0.0;
+            localResiduals.reserve((end - begin) * numChannels);
+            localJacobian.reserve((end - begin) * numChannels);
+            
+            // 变换雅可比缓冲区在分块内复用
+            std::vector<std::array<double, 3>> transformJacobian;
+            std::vector<double> movingMIND(numChannels);
+            std::vector<double> movingGradients(numChannels * 3);
+            MINDFeatureTileCache::Accessor movingTiles(*m_MovingMINDTiles);
+            
+            for (size_t i = begin; i < end; ++i)
+            {
+                const ImageType::PointType fixedPoint = m_Samples.GetPoint(i);
+                const float* fixedMIND = m_SampleFixedMIND.data() + i * numChannels;
+                
+                // 变换固定图像点到移动图像空间
+                ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
+                
+                // 检查所有通道和梯度是否有效 (几何相同, 一次判断)
+                TrilinearSampler::Location location;
+                if (!m_MovingMINDSampler.ComputeLocation(transformedPoint, location))
+                {
+                    continue;
+                }
+                
+                // 获取变换的雅可比矩阵 ∂T/∂q: [numParams][3]
+                m_JacobianFunction(fixedPoint, transformJacobian);
+                
+                // 全部通道的值和MIND特征空间梯度 ∇MIND_moving (同一组权重)
+                movingTiles.Evaluate(location, movingMIND.data(), movingGradients.data());
+                
+                // 对每个通道计算残差和雅可比
+                for (size_t ch = 0; ch < numChannels; ++ch)
+                {
+                    // 残差: f = fixed - moving
+                    const std::array<double, 3> mindGradient = {
+                        movingGradients[ch], movingGradients[numChannels + ch], movingGradients[2 * numChannels + ch]};
+                    double residual = fixedMIND[ch] - movingMIND[ch];
+                    localResiduals.push_back(residual);
+                    localSSD += residual * residual;
+                    
+                    // 雅可比矩阵行: J[row][p] = ∂f/∂q_p = -∇MIND · ∂T/∂q_p
+                    // 注意负号: f = fixed - moving, ∂f/∂q = -∂moving/∂q = -∇MIND · ∂T/∂q
+                    std::vector<double> jacobianRow(numParams, 0.0);
+                    for (size_t p = 0; p < numParams; ++p)
+                    {
+                        double dotProduct = 0.0;
+                        for (unsigned int dim = 0; dim < 3; ++dim)
+                        {
+                            dotProduct += mindGradient[dim] * transformJacobian[p][dim];
+                        }
+                        jacobianRow[p] = -dotProduct;  // 负号!
+                        localDerivative[p] += 2.0 * residual * jacobianRow[p];
+                    }
+                    localJacobian.push_back(std::move(jacobianRow));
+                }
+            }
+            
+            chunkSSD[chunkIndex] = localSSD;
+        },
+        m_NumberOfThreads);
     
-    // 清空并预分配
+    // 按分块顺序合并
+    size_t numResiduals = 0;
+    for (const auto& partial : chunkResiduals)
+    {
+        numResiduals += partial.size();
+    }
     residuals.clear();
     jacobian.clear();
-    residuals.reserve(numSamples * numChannels);
-    jacobian.reserve(numSamples * numChannels);
-    
-    unsigned int validCount = 0;
+    residuals.reserve(numResiduals);
+    jacobian.reserve(numResiduals);
     
-    for (size_t i = 0; i < numSamples; ++i)
+    double ssd = 0.0;
+    ParametersType derivative(numParams, 0.0);
+    for (size_t chunk = 0; chunk < numChunks; ++chunk)
     {
-        const auto& sample = m_SamplePoints[i];
-        
-        // 变换固定图像点到移动图像空间
-        ImageType::PointType transformedPoint = m_Transform->TransformPoint(sample.fixedPoint);
+        residuals.insert(residuals.end(), chunkResiduals[chunk].begin(), chunkResiduals[chunk].end());
+        std::move(chunkJacobians[chunk].begin(), chunkJacobians[chunk].end(), std::back_inserter(jacobian));
         
-        // 检查所有通道和梯度是否有效
-        bool allValid = true;
-        for (size_t ch = 0; ch < numChannels; ++ch)
+        const double* partial = chunkDerivatives.data() + chunk * numParams;
+        for (size_t p = 0; p < numParams; ++p)
         {
-            if (!m_MovingMINDInterpolators[ch]->IsInsideBuffer(transformedPoint))
-            {
-                allValid = false;
-                break;
-            }
-            for (unsigned int dim = 0; dim < 3; ++dim)
-            {
-                if (!m_MovingMINDFeatureGradientInterpolators[ch][dim]->IsInsideBuffer(transformedPoint))
-                {
-                    allValid = false;
-                    break;
-                }
-            }
-            if (!allValid) break;
+            derivative[p] += partial[p];
         }
-        
-        if (!allValid)
+        ssd += chunkSSD[chunk];
+    }
+    
+    const unsigned int validCount = static_cast<unsigned int>(numResiduals / numChannels);
+    m_NumberOfValidSamples = validCount;
+    
+    // 残差与雅可比已经完整描述了当前参数处的SSD值和梯度:
+    // SSD = sum(f^2) / (N*C), dSSD/dq = 2 * J^T f / (N*C)
+    // 写入评估缓存, 线搜索随后在当前参数上请求梯度时直接命中
+    if (validCount > 0)
+    {
+        const double normFactor = 1.0 / (static_cast<double>(validCount) * numChannels);
+        for (size_t p = 0; p < numParams; ++p)
         {
-            continue;
+            derivative[p] *= normFactor;
         }
         
-        // 获取变换的雅可比矩阵 ∂T/∂q: [numParams][3]
-        std::vector<std::array<double, 3>> transformJacobian;
-        m_JacobianFunction(sample.fixedPoint, transformJacobian);
-        
-        // 对每个通道计算残差和雅可比
-        for (size_t ch = 0; ch < numChannels; ++ch)
-        {
-            // 残差: f = fixed - moving
-            double movingMINDValue = m_MovingMINDInterpolators[ch]->Evaluate(transformedPoint);
-            double residual = sample.fixedMINDValues[ch] - movingMINDValue;
-            residuals.push_back(residual);
+        const ParametersType key = GetEvaluationCacheKey();
+        m_EvaluationCache.StoreValue(key, ssd * normFactor, validCount);
+        m_EvaluationCache.StoreDerivative(key, derivative);
+    }
+    
+    if (m_Verbose && validCount > 0)
+    {
+        std::cout << "[MIND] Gauss-Newton: " << residuals.size() << " residuals, "
+                  << validCount << " valid samples" << std::endl;
+    }
+}
+
+size_t MINDMetric::GetNormalEquations(std::vector<double>& JtJ, std::vector<double>& Jtf)
+{
+    if (!m_JacobianFunction)
+    {
+        throw std::runtime_error("[MIND] Jacobian function must be set for Gauss-Newton optimization");
+    }
+    
+    const size_t numSamples = m_Samples.GetNumberOfSamples();
+    const size_t numChannels = m_MovingMINDTiles->GetNumberOfChannels();
+    const size_t numParams = m_NumberOfParameters;
+    m_MovingMINDTiles->BeginPass();
+    
+    // 分块部分和: JtJ只累加上三角, 按分块序号顺序合并 (与线程数无关, 可重复)
+    const size_t numChunks = ThreadPool::ComputeNumberOfChunks(numSamples, kSampleChunkSize);
+    std::vector<double> chunkJtJ(numChunks * numParams * numParams, 0.0);
+    std::vector<double> chunkJtf(numChunks * numParams, 0.0);
+    std::vector<double> chunkSSD(numChunks, 0.0);
+    std::vector<unsigned int> chunkValidSamples(numChunks, 0);
+    
+    ThreadPool::GetGlobalInstance().ParallelFor(numSamples, kSampleChunkSize,
+        [&](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            double* localJtJ = chunkJtJ.data() + chunkIndex * numParams * numParams;
+            double* localJtf = chunkJtf.data() + chunkIndex * numParams;
+            double localSSD = 0.0;
+            unsigned int localValidSamples = 0;
             
-            // MIND特征的空间梯度 ∇MIND_moving
-            std::array<double, 3> mindGradient;
-            for (unsigned int dim = 0; dim < 3; ++dim)
-            {
-                mindGradient[dim] = m_MovingMINDFeatureGradientInterpolators[ch][dim]->Evaluate(transformedPoint);
-            }
+            std::vector<std::array<double, 3>> transformJacobian;
+            std::vector<std::array<double, 3>> weightedJacobian(numParams);
+            std::vector<double> movingMIND(numChannels);
+            std::vector<double> movingGradients(numChannels * 3);
+            MINDFeatureTileCache::Accessor movingTiles(*m_MovingMINDTiles);
             
-            // 雅可比矩阵行: J[row][p] = ∂f/∂q_p = -∇MIND · ∂T/∂q_p
-            // 注意负号: f = fixed - moving, ∂f/∂q = -∂moving/∂q = -∇MIND · ∂T/∂q
-            std::vector<double> jacobianRow(numParams, 0.0);
-            for (size_t p = 0; p < numParams; ++p)
+            for (size_t i = begin; i < end; ++i)
             {
-                double dotProduct = 0.0;
-                for (unsigned int dim = 0; dim < 3; ++dim)
+                const ImageType::PointType fixedPoint = m_Samples.GetPoint(i);
+                const float* fixedMIND = m_SampleFixedMIND.data() + i * numChannels;
+                
+                ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
+                
+                TrilinearSampler::Location location;
+                if (!m_MovingMINDSampler.ComputeLocation(transformedPoint, location))
+                {
+                    continue;
+                }
+                
+                m_JacobianFunction(fixedPoint, transformJacobian);
+                movingTiles.Evaluate(location, movingMIND.data(), movingGradients.data());
+                
+                // 雅可比行 J[ch][p] = -g_ch · t_p (t_p = ∂T/∂q_p), 因此一个采样点的贡献为
+                //   Σ_ch J[ch][p] J[ch][q] = t_pᵀ G t_q,  G = Σ_ch g_ch g_chᵀ (3×3)
+                //   Σ_ch J[ch][p] f_ch     = -t_p · b,    b = Σ_ch f_ch g_ch
+                // 先在通道上累加 G 和 b, 每采样点的开销从 C·P² 降为 C + P²
+                double G[3][3] = {{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+                double b[3] = {0.0, 0.0, 0.0};
+                for (size_t ch = 0; ch < numChannels; ++ch)
+                {
+                    const double g[3] = {
+                        movingGradients[ch], movingGradients[numChannels + ch], movingGradients[2 * numChannels + ch]};
+                    const double residual = fixedMIND[ch] - movingMIND[ch];
+                    localSSD += residual * residual;
+                    for (unsigned int r = 0; r < 3; ++r)
+                    {
+                        b[r] += residual * g[r];
+                        for (unsigned int c = r; c < 3; ++c)
+                        {
+                            G[r][c] += g[r] * g[c];
+                        }
+                    }
+                }
+                G[1][0] = G[0][1];
+                G[2][0] = G[0][2];
+                G[2][1] = G[1][2];
+                
+                for (size_t p = 0; p < numParams; ++p)
+                {
+                    const std::array<double, 3>& t = transformJacobian[p];
+                    for (unsigned int r = 0; r < 3; ++r)
+                    {
+                        weightedJacobian[p][r] = G[r][0] * t[0] + G[r][1] * t[1] + G[r][2] * t[2];
+                    }
+                    localJtf[p] -= t[0] * b[0] + t[1] * b[1] + t[2] * b[2];
+                }
+                for (size_t p = 0; p < numParams; ++p)
                 {
-                    dotProduct += mindGradient[dim] * transformJacobian[p][dim];
+                    const std::array<double, 3>& t = transformJacobian[p];
+                    double* row = localJtJ + p * numParams;
+                    for (size_t q = p; q < numParams; ++q)
+                    {
+                        const std::array<double, 3>& w = weightedJacobian[q];
+                        row[q] += t[0] * w[0] + t[1] * w[1] + t[2] * w[2];
+                    }
                 }
-                jacobianRow[p] = -dotProduct;  // 负号!
+                ++localValidSamples;
             }
-            jacobian.push_back(jacobianRow);
+            
+            chunkSSD[chunkIndex] = localSSD;
+            chunkValidSamples[chunkIndex] = localValidSamples;
+        },
+        m_NumberOfThreads);
+    
+    // 按分块顺序合并, 再由上三角补全对称矩阵
+    JtJ.assign(numParams * numParams, 0.0);
+    Jtf.assign(numParams, 0.0);
+    double ssd = 0.0;
+    unsigned int validCount = 0;
+    for (size_t chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const double* partialJtJ = chunkJtJ.data() + chunk * numParams * numParams;
+        const double* partialJtf = chunkJtf.data() + chunk * numParams;
+        for (size_t p = 0; p < numParams; ++p)
+        {
+            for (size_t q = p; q < numParams; ++q)
+            {
+                JtJ[p * numParams + q] += partialJtJ[p * numParams + q];
+            }
+            Jtf[p] += partialJtf[p];
+        }
+        ssd += chunkSSD[chunk];
+        validCount += chunkValidSamples[chunk];
+    }
+    for (size_t p = 0; p < numParams; ++p)
+    {
+        for (size_t q = 0; q < p; ++q)
+        {
+            JtJ[p * numParams + q] = JtJ[q * numParams + p];
         }
-        
-        ++validCount;
     }
     
     m_NumberOfValidSamples = validCount;
     
+    // 与 GetResidualsAndJacobian 相同: SSD = sum(f^2) / (N*C), dSSD/dq = 2 * J^T f / (N*C)
+    if (validCount > 0)
+    {
+        const double normFactor = 1.0 / (static_cast<double>(validCount) * numChannels);
+        ParametersType derivative(numParams, 0.0);
+        for (size_t p = 0; p < numParams; ++p)
+        {
+            derivative[p] = 2.0 * Jtf[p] * normFactor;
+        }
+        
+        const ParametersType key = GetEvaluationCacheKey();
+        m_EvaluationCache.StoreValue(key, ssd * normFactor, validCount);
+        m_EvaluationCache.StoreDerivative(key, derivative);
+    }
+    
+    const size_t numResiduals = static_cast<size_t>(validCount) * numChannels;
     if (m_Verbose && validCount > 0)
     {
-        std::cout << "[MIND] Gauss-Newton: " << residuals.size() << " residuals, "
+        std::cout << "[MIND] Gauss-Newton: normal equations from " << numResiduals << " residuals, "
                   << validCount << " valid samples" << std::endl;
     }
+    return numResiduals;
 }
 
 void MINDMetric::ComputeFiniteDifferenceGradient(ParametersType& derivative)
@@ -1003,9 +1367,11 @@ void MINDMetric::ComputeFiniteDifferenceGradient(ParametersType& derivative)
     SetTransformParameters(currentParams);
 }
 
-void MINDMetric::ComputeAnalyticalGradient(ParametersType& derivative)
+void MINDMetric::ComputeAnalyticalGradient(ParametersType& derivative,
+                                            double* ssdValue,
+                                            unsigned int* validSampleCount)
 {
-    derivative.resize(m_NumberOfParameters, 0.0);
+    derivative.assign(m_NumberOfParameters, 0.0);
     
     if (!m_JacobianFunction)
     {
@@ -1014,99 +1380,98 @@ void MINDMetric::ComputeAnalyticalGradient(ParametersType& derivative)
         return;
     }
     
-    std::vector<double> localDerivative(m_NumberOfParameters, 0.0);
-    unsigned int validSamples = 0;
-    
-    const size_t numSamples = m_SamplePoints.size();
-    const size_t numChannels = m_MovingMINDFeatures.size();
-    
-    // 使用临界区保护梯度累加
-    #pragma omp parallel if(numSamples > 1000)
-    {
-        std::vector<double> threadDerivative(m_NumberOfParameters, 0.0);
-        unsigned int threadValidSamples = 0;
-        
-        #pragma omp for schedule(static) nowait
-        for (int i = 0; i < static_cast<int>(numSamples); ++i)
-        {
-            const auto& sample = m_SamplePoints[i];
-            
-            ImageType::PointType transformedPoint = m_Transform->TransformPoint(sample.fixedPoint);
+    const size_t numSamples = m_Samples.GetNumberOfSamples();
+    const size_t numChannels = m_MovingMINDTiles->GetNumberOfChannels();
+    const unsigned int numParams = m_NumberOfParameters;
+    m_MovingMINDTiles->BeginPass();
+    
+    // 分块部分结果 (按分块序号存放, 顺序合并保证可重复)
+    const size_t numChunks = ThreadPool::ComputeNumberOfChunks(numSamples, kSampleChunkSize);
+    std::vector<double> chunkDerivatives(numChunks * numParams, 0.0);
+    std::vector<double> chunkSSD(numChunks, 0.0);
+    std::vector<unsigned int> chunkValidSamples(numChunks, 0);
+    
+    ThreadPool::GetGlobalInstance().ParallelFor(numSamples, kSampleChunkSize,
+        [&](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            double* localDerivative = chunkDerivatives.data() + chunkIndex * numParams;
+            unsigned int localValidSamples = 0;
+            double localSSD = 0.0;
             
-            // 获取雅可比矩阵
+            // 雅可比和逐采样点梯度缓冲区在分块内复用
             std::vector<std::array<double, 3>> jacobian;
-            m_JacobianFunction(sample.fixedPoint, jacobian);
+            std::vector<double> channelGradients(numParams, 0.0);
+            std::vector<double> movingMIND(numChannels);
+            std::vector<double> movingGradients(numChannels * 3);
+            MINDFeatureTileCache::Accessor movingTiles(*m_MovingMINDTiles);
             
-            bool isValid = true;
-            std::vector<double> channelGradients(m_NumberOfParameters, 0.0);
-            
-            for (size_t ch = 0; ch < numChannels && isValid; ++ch)
+            for (size_t i = begin; i < end; ++i)
             {
-                // 【关键优化】使用预分配的插值器
-                if (!m_MovingMINDInterpolators[ch]->IsInsideBuffer(transformedPoint))
-                {
-                    isValid = false;
-                    break;
-                }
+                const ImageType::PointType fixedPoint = m_Samples.GetPoint(i);
+                const float* fixedMIND = m_SampleFixedMIND.data() + i * numChannels;
                 
-                // 检查梯度插值器
-                bool gradientValid = true;
-                for (unsigned int dim = 0; dim < 3; ++dim)
-                {
-                    if (!m_MovingMINDFeatureGradientInterpolators[ch][dim]->IsInsideBuffer(transformedPoint))
-                    {
-                        gradientValid = false;
-                        break;
-                    }
-                }
+                ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
                 
-                if (!gradientValid)
+                // 所有通道及梯度几何相同: 一次边界判断和权重计算
+                TrilinearSampler::Location location;
+                if (!m_MovingMINDSampler.ComputeLocation(transformedPoint, location))
                 {
-                    isValid = false;
-                    break;
+                    continue;
                 }
                 
-                double movingMINDValue = m_MovingMINDInterpolators[ch]->Evaluate(transformedPoint);
-                double diff = sample.fixedMINDValues[ch] - movingMINDValue;
+                // 获取雅可比矩阵
+                m_JacobianFunction(fixedPoint, jacobian);
                 
-                // 获取MIND特征梯度
-                std::array<double, 3> mindGradient;
-                for (unsigned int dim = 0; dim < 3; ++dim)
-                {
-                    mindGradient[dim] = m_MovingMINDFeatureGradientInterpolators[ch][dim]->Evaluate(transformedPoint);
-                }
+                std::fill(channelGradients.begin(), channelGradients.end(), 0.0);
+                double sampleSSD = 0.0;
                 
-                // d(SSD)/dp = -2 * (F - M) * ∇M * dT/dp
-                for (unsigned int p = 0; p < m_NumberOfParameters; ++p)
+                // 全部通道的值和MIND特征梯度: 一次角点遍历 (按角点所在块读取), 内层按通道连续
+                movingTiles.Evaluate(location, movingMIND.data(), movingGradients.data());
+                
+                for (size_t ch = 0; ch < numChannels; ++ch)
                 {
-                    double dotProduct = 0.0;
-                    for (unsigned int dim = 0; dim < 3; ++dim)
+                    const std::array<double, 3> mindGradient = {
+                        movingGradients[ch], movingGradients[numChannels + ch], movingGradients[2 * numChannels + ch]};
+                    double diff = fixedMIND[ch] - movingMIND[ch];
+                    sampleSSD += diff * diff;
+                    
+                    // d(SSD)/dp = -2 * (F - M) * ∇M * dT/dp
+                    for (unsigned int p = 0; p < numParams; ++p)
                     {
-                        dotProduct += mindGradient[dim] * jacobian[p][dim];
+                        double dotProduct = 0.0;
+                        for (unsigned int dim = 0; dim < 3; ++dim)
+                        {
+                            dotProduct += mindGradient[dim] * jacobian[p][dim];
+                        }
+                        channelGradients[p] += -2.0 * diff * dotProduct;
                     }
-                    channelGradients[p] += -2.0 * diff * dotProduct;
                 }
-            }
-            
-            if (isValid)
-            {
-                for (unsigned int p = 0; p < m_NumberOfParameters; ++p)
+                
+                for (unsigned int p = 0; p < numParams; ++p)
                 {
-                    threadDerivative[p] += channelGradients[p];
+                    localDerivative[p] += channelGradients[p];
                 }
-                ++threadValidSamples;
+                localSSD += sampleSSD;
+                ++localValidSamples;
             }
-        }
-        
-        // 合并线程结果
-        #pragma omp critical
+            
+            chunkSSD[chunkIndex] = localSSD;
+            chunkValidSamples[chunkIndex] = localValidSamples;
+        },
+        m_NumberOfThreads);
+    
+    // 合并分块结果
+    std::vector<double> localDerivative(numParams, 0.0);
+    unsigned int validSamples = 0;
+    double totalSSD = 0.0;
+    for (size_t chunk = 0; chunk < numChunks; ++chunk)
+    {
+        const double* partial = chunkDerivatives.data() + chunk * numParams;
+        for (unsigned int p = 0; p < numParams; ++p)
         {
-            for (unsigned int p = 0; p < m_NumberOfParameters; ++p)
-            {
-                localDerivative[p] += threadDerivative[p];
-            }
-            validSamples += threadValidSamples;
+            localDerivative[p] += partial[p];
         }
+        validSamples += chunkValidSamples[chunk];
+        totalSSD += chunkSSD[chunk];
     }
     
     // 归一化
@@ -1118,6 +1483,15 @@ void MINDMetric::ComputeAnalyticalGradient(ParametersType& derivative)
             derivative[p] = localDerivative[p] * normFactor;
         }
     }
+    
+    if (ssdValue)
+    {
+        *ssdValue = (validSamples > 0) ? totalSSD / (validSamples * numChannels) : 0.0;
+    }
+    if (validSampleCount)
+    {
+        *validSampleCount = validSamples;
+    }
 }
 
 // ============================================================================
@@ -1140,6 +1514,21 @@ MINDMetric::ParametersType MINDMetric::GetTransformParameters() const
     return params;
 }
 
+MINDMetric::ParametersType MINDMetric::GetEvaluationCacheKey() const
+{
+    // 缓存键: 变换参数 + 固定参数(旋转中心等), 逐位比较
+    ParametersType key = GetTransformParameters();
+    if (m_Transform)
+    {
+        const auto& fixedParameters = m_Transform->GetFixedParameters();
+        for (unsigned int i = 0; i < fixedParameters.Size(); ++i)
+        {
+            key.push_back(fixedParameters[i]);
+        }
+    }
+    return key;
+}
+
 void MINDMetric::SetTransformParameters(const ParametersType& parameters)
 {
     if (!m_Transform || parameters.size() != m_Transform->GetNumberOfParameters())
@@ -0,0 +1,482 @@
+#include "MaskBitmap.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+// ============================================================================
+// 辅助函数
+// ============================================================================
+
+// 3×3 矩阵求逆 (参考网格的 index→physical 矩阵, 非奇异)
+static void Invert3x3(const double m[3][3], double inverse[3][3])
+{
+    const double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                     - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                     + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    if (std::abs(det) < 1e-300)
+    {
+        throw std::runtime_error("MaskBitmap: reference grid matrix is singular");
+    }
+    const double invDet = 1.0 / det;
+
+    inverse[0][0] =  (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+    inverse[0][1] = -(m[0][1] * m[2][2] - m[0][2] * m[2][1]) * invDet;
+    inverse[0][2] =  (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+    inverse[1][0] = -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) * invDet;
+    inverse[1][1] =  (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+    inverse[1][2] = -(m[0][0] * m[1][2] - m[0][2] * m[1][0]) * invDet;
+    inverse[2][0] =  (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+    inverse[2][1] = -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) * invDet;
+    inverse[2][2] =  (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+}
+
+static MaskBitmap::RegionType MakeEmptyRegion(const MaskBitmap::RegionType& reference)
+{
+    MaskBitmap::RegionType region;
+    region.SetIndex(reference.GetIndex());
+    MaskBitmap::RegionType::SizeType size;
+    size.Fill(0);
+    region.SetSize(size);
+    return region;
+}
+
+// ============================================================================
+// 构造函数
+// ============================================================================
+
+MaskBitmap::MaskBitmap()
+    : m_Rasterized(false)
+    , m_NumberOfInsideVoxels(0)
+    , m_WordsPerRow(0)
+    , m_MaskImage(nullptr)
+    , m_MaskModifiedTime(0)
+    , m_ReferenceImage(nullptr)
+    , m_ReferenceModifiedTime(0)
+    , m_BoundingBoxMask(nullptr)
+    , m_BoundingBoxMaskModifiedTime(0)
+{
+}
+
+void MaskBitmap::Clear()
+{
+    m_Rasterized = false;
+    m_NumberOfInsideVoxels = 0;
+    m_Bits.clear();
+    m_Runs.clear();
+    m_MaskImage = nullptr;
+    m_ReferenceImage = nullptr;
+}
+
+// ============================================================================
+// 栅格化
+// ============================================================================
+
+void MaskBitmap::Rasterize(const MaskSpatialObjectType* maskObject, const ImageType* reference, unsigned int maxThreads)
+{
+    if (!maskObject || !maskObject->GetImage() || !reference)
+    {
+        throw std::runtime_error("MaskBitmap: mask or reference image is null");
+    }
+
+    const MaskImageType* mask = maskObject->GetImage();
+    if (m_Rasterized && m_MaskImage == mask && m_MaskModifiedTime == mask->GetMTime() &&
+        m_ReferenceImage == reference && m_ReferenceModifiedTime == reference->GetMTime())
+    {
+        return;
+    }
+
+    double origin[3];
+    double indexToPhysical[3][3];
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        origin[i] = reference->GetOrigin()[i];
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            indexToPhysical[i][j] = reference->GetIndexToPhysicalPoint()(i, j);
+        }
+    }
+
+    RasterizeOnGrid(mask, reference->GetLargestPossibleRegion(), origin, indexToPhysical, maxThreads);
+
+    m_MaskImage = mask;
+    m_MaskModifiedTime = mask->GetMTime();
+    m_ReferenceImage = reference;
+    m_ReferenceModifiedTime = reference->GetMTime();
+}
+
+void MaskBitmap::Rasterize(const MaskImageType* mask, unsigned int maxThreads)
+{
+    if (!mask)
+    {
+        throw std::runtime_error("MaskBitmap: mask image is null");
+    }
+
+    if (m_Rasterized && m_MaskImage == mask && m_MaskModifiedTime == mask->GetMTime() &&
+        m_ReferenceImage == mask && m_ReferenceModifiedTime == mask->GetMTime())
+    {
+        return;
+    }
+
+    double origin[3];
+    double indexToPhysical[3][3];
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        origin[i] = mask->GetOrigin()[i];
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            indexToPhysical[i][j] = mask->GetIndexToPhysicalPoint()(i, j);
+        }
+    }
+
+    RasterizeOnGrid(mask, mask->GetLargestPossibleRegion(), origin, indexToPhysical, maxThreads);
+
+    m_MaskImage = mask;
+    m_MaskModifiedTime = mask->GetMTime();
+    m_ReferenceImage = mask;
+    m_ReferenceModifiedTime = mask->GetMTime();
+}
+
+void MaskBitmap::RasterizeOnGrid(const MaskImageType* mask,
+                                 const RegionType& referenceRegion,
+                                 const double referenceOrigin[3],
+                                 const double indexToPhysical[3][3],
+                                 unsigned int maxThreads)
+{
+    m_Rasterized = true;
+    m_ReferenceRegion = referenceRegion;
+    m_RasterRegion = MakeEmptyRegion(referenceRegion);
+    m_BoundingBox = MakeEmptyRegion(referenceRegion);
+    m_NumberOfInsideVoxels = 0;
+    m_Bits.clear();
+    m_Runs.clear();
+    m_WordsPerRow = 0;
+
+    const RegionType& maskBox = GetMaskIndexBoundingBox(mask);
+    if (maskBox.GetNumberOfPixels() == 0)
+    {
+        return;
+    }
+
+    // 参考索引 → 掩膜连续索引: c = A * idx + b
+    //   A = P_mask * M_ref,  b = P_mask * (O_ref - O_mask)
+    const auto& maskPhysicalToIndex = mask->GetPhysicalPointToIndex();
+    const auto& maskIndexToPhysical = mask->GetIndexToPhysicalPoint();
+    const auto& maskOrigin = mask->GetOrigin();
+
+    double A[3][3];
+    double b[3];
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+        b[i] = 0.0;
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            A[i][j] = 0.0;
+            for (unsigned int k = 0; k < 3; ++k)
+            {
+                A[i][j] += maskPhysicalToIndex(i, k) * indexToPhysical[k][j];
+            }
+            b[i] += maskPhysicalToIndex(i, j) * (referenceOrigin[j] - maskOrigin[j]);
+        }
+    }
+
+    // 候选区域: 掩膜包围盒(外扩半个体素)的8个角点映射到参考网格, 外扩1个体素后与参考区域求交
+    double physicalToReference[3][3];
+    Invert3x3(indexToPhysical, physicalToReference);
+
+    double lower[3] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    double upper[3] = {std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        double maskIndex[3];
+        for (unsigned int d = 0; d < 3; ++d)
+        {
+            const bool high = (corner >> d) & 1;
+            maskIndex[d] = high ? maskBox.GetIndex(d) + static_cast<double>(maskBox.GetSize(d)) - 0.5
+                                : maskBox.GetIndex(d) - 0.5;
+        }
+
+        double physical[3];
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            physical[i] = maskOrigin[i];
+            for (unsigned int j = 0; j < 3; ++j)
+            {
+                physical[i] += maskIndexToPhysical(i, j) * maskIndex[j];
+            }
+        }
+
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            double referenceIndex = 0.0;
+            for (unsigned int j = 0; j < 3; ++j)
+            {
+                referenceIndex += physicalToReference[i][j] * (physical[j] - referenceOrigin[j]);
+            }
+            lower[i] = std::min(lower[i], referenceIndex);
+            upper[i] = std::max(upper[i], referenceIndex);
+        }
+    }
+
+    IndexType rasterStart;
+    RegionType::SizeType rasterSize;
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        const long regionBegin = referenceRegion.GetIndex(d);
+        const long regionEnd = regionBegin + static_cast<long>(referenceRegion.GetSize(d));
+        const long begin = std::max(regionBegin, static_cast<long>(std::floor(lower[d])) - 1);
+        const long end = std::min(regionEnd, static_cast<long>(std::ceil(upper[d])) + 2);
+        if (end <= begin)
+        {
+            return;
+        }
+        rasterStart[d] = begin;
+        rasterSize[d] = static_cast<itk::SizeValueType>(end - begin);
+    }
+    m_RasterRegion.SetIndex(rasterStart);
+    m_RasterRegion.SetSize(rasterSize);
+
+    const long nx = static_cast<long>(rasterSize[0]);
+    const long ny = static_cast<long>(rasterSize[1]);
+    const long nz = static_cast<long>(rasterSize[2]);
+    m_WordsPerRow = static_cast<size_t>((nx + 63) / 64);
+    m_Bits.assign(m_WordsPerRow * static_cast<size_t>(ny) * static_cast<size_t>(nz), 0);
+
+    // 掩膜缓冲区几何
+    const auto& maskRegion = mask->GetBufferedRegion();
+    const unsigned char* maskBuffer = mask->GetBufferPointer();
+    long maskStart[3];
+    long maskSize[3];
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        maskStart[d] = maskRegion.GetIndex(d);
+        maskSize[d] = static_cast<long>(maskRegion.GetSize(d));
+    }
+    const size_t maskStrideY = static_cast<size_t>(maskSize[0]);
+    const size_t maskStrideZ = maskStrideY * static_cast<size_t>(maskSize[1]);
+
+    // 每个z切片独立生成行程, 最后按切片顺序拼接 (结果与线程数无关)
+    std::vector<std::vector<Run>> sliceRuns(static_cast<size_t>(nz));
+    uint64_t* bits = m_Bits.data();
+    const size_t wordsPerRow = m_WordsPerRow;
+
+    ThreadPool::GetGlobalInstance().ParallelFor(static_cast<size_t>(nz), 1,
+        [&](size_t, size_t zBegin, size_t zEnd, unsigned int) {
+            for (size_t zi = zBegin; zi < zEnd; ++zi)
+            {
+                const long z = rasterStart[2] + static_cast<long>(zi);
+                std::vector<Run>& runs = sliceRuns[zi];
+
+                for (long yi = 0; yi < ny; ++yi)
+                {
+                    const long y = rasterStart[1] + yi;
+                    uint64_t* rowBits = bits + (zi * static_cast<size_t>(ny) + static_cast<size_t>(yi)) * wordsPerRow;
+
+                    // 行起点的掩膜连续索引, 沿x方向按A的第0列增量
+                    double rowStart[3];
+                    for (unsigned int i = 0; i < 3; ++i)
+                    {
+                        rowStart[i] = A[i][0] * rasterStart[0] + A[i][1] * y + A[i][2] * z + b[i];
+                    }
+
+                    long runBegin = -1;
+                    for (long xi = 0; xi <= nx; ++xi)
+                    {
+                        bool inside = false;
+                        if (xi < nx)
+                        {
+                            long m[3];
+                            inside = true;
+                            for (unsigned int i = 0; i < 3; ++i)
+                            {
+                                // 四舍五入, 半整数向上 (与 TransformPhysicalPointToIndex 一致)
+                                m[i] = static_cast<long>(std::floor(rowStart[i] + A[i][0] * xi + 0.5)) - maskStart[i];
+                                if (m[i] < 0 || m[i] >= maskSize[i])
+                                {
+                                    inside = false;
+                                    break;
+                                }
+                            }
+                            if (inside)
+                            {
+                                const size_t offset = static_cast<size_t>(m[0])
+                                                    + static_cast<size_t>(m[1]) * maskStrideY
+                                                    + static_cast<size_t>(m[2]) * maskStrideZ;
+                                inside = (maskBuffer[offset] != 0);
+                            }
+                        }
+
+                        if (inside)
+                        {
+                            rowBits[xi >> 6] |= uint64_t(1) << (xi & 63);
+                            if (runBegin < 0)
+                            {
+                                runBegin = xi;
+                            }
+                        }
+                        else if (runBegin >= 0)
+                        {
+                            Run run;
+                            run.start[0] = rasterStart[0] + runBegin;
+                            run.start[1] = y;
+                            run.start[2] = z;
+                            run.length = static_cast<uint64_t>(xi - runBegin);
+                            run.rank = 0;
+                            runs.push_back(run);
+                            runBegin = -1;
+                        }
+                    }
+                }
+            }
+        },
+        maxThreads);
+
+    // 拼接行程, 计算序号和紧包围盒
+    size_t numberOfRuns = 0;
+    for (const auto& runs : sliceRuns)
+    {
+        numberOfRuns += runs.size();
+    }
+    m_Runs.reserve(numberOfRuns);
+
+    long boxLower[3] = {std::numeric_limits<long>::max(), std::numeric_limits<long>::max(), std::numeric_limits<long>::max()};
+    long boxUpper[3] = {std::numeric_limits<long>::lowest(), std::numeric_limits<long>::lowest(), std::numeric_limits<long>::lowest()};
+    uint64_t rank = 0;
+    for (auto& runs : sliceRuns)
+    {
+        for (Run& run : runs)
+        {
+            run.rank = rank;
+            rank += run.length;
+
+            boxLower[0] = std::min(boxLower[0], static_cast<long>(run.start[0]));
+            boxUpper[0] = std::max(boxUpper[0], static_cast<long>(run.start[0] + run.length) - 1);
+            for (unsigned int d = 1; d < 3; ++d)
+            {
+                boxLower[d] = std::min(boxLower[d], static_cast<long>(run.start[d]));
+                boxUpper[d] = std::max(boxUpper[d], static_cast<long>(run.start[d]));
+            }
+            m_Runs.push_back(run);
+        }
+    }
+    m_NumberOfInsideVoxels = rank;
+
+    if (rank > 0)
+    {
+        IndexType boxStart;
+        RegionType::SizeType boxSize;
+        for (unsigned int d = 0; d < 3; ++d)
+        {
+            boxStart[d] = boxLower[d];
+            boxSize[d] = static_cast<itk::SizeValueType>(boxUpper[d] - boxLower[d] + 1);
+        }
+        m_BoundingBox.SetIndex(boxStart);
+        m_BoundingBox.SetSize(boxSize);
+    }
+}
+
+// ============================================================================
+// 掩膜非零包围盒
+// ============================================================================
+
+const MaskBitmap::RegionType& MaskBitmap::GetMaskIndexBoundingBox(const MaskImageType* mask)
+{
+    if (m_BoundingBoxMask == mask && m_BoundingBoxMaskModifiedTime == mask->GetMTime())
+    {
+        return m_MaskIndexBoundingBox;
+    }
+
+    const auto& region = mask->GetBufferedRegion();
+    const long nx = static_cast<long>(region.GetSize(0));
+    const long ny = static_cast<long>(region.GetSize(1));
+    const long nz = static_cast<long>(region.GetSize(2));
+    const unsigned char* buffer = mask->GetBufferPointer();
+
+    // 每个z切片的x/y范围, 切片内无非零体素时 xMin > xMax
+    struct SliceBounds
+    {
+        long xMin, xMax, yMin, yMax;
+    };
+    std::vector<SliceBounds> slices(static_cast<size_t>(nz));
+
+    ThreadPool::GetGlobalInstance().ParallelFor(static_cast<size_t>(nz), 1,
+        [&](size_t, size_t zBegin, size_t zEnd, unsigned int) {
+            for (size_t z = zBegin; z < zEnd; ++z)
+            {
+                SliceBounds bounds = {nx, -1, ny, -1};
+                const unsigned char* slice = buffer + z * static_cast<size_t>(nx) * static_cast<size_t>(ny);
+                for (long y = 0; y < ny; ++y)
+                {
+                    const unsigned char* row = slice + static_cast<size_t>(y) * nx;
+                    for (long x = 0; x < nx; ++x)
+                    {
+                        if (row[x] != 0)
+                        {
+                            bounds.xMin = std::min(bounds.xMin, x);
+                            bounds.xMax = std::max(bounds.xMax, x);
+                            bounds.yMin = std::min(bounds.yMin, y);
+                            bounds.yMax = std::max(bounds.yMax, y);
+                        }
+                    }
+                }
+                slices[z] = bounds;
+            }
+        });
+
+    long lower[3] = {nx, ny, nz};
+    long upper[3] = {-1, -1, -1};
+    for (long z = 0; z < nz; ++z)
+    {
+        const SliceBounds& bounds = slices[static_cast<size_t>(z)];
+        if (bounds.xMin > bounds.xMax)
+        {
+            continue;
+        }
+        lower[0] = std::min(lower[0], bounds.xMin);
+        upper[0] = std::max(upper[0], bounds.xMax);
+        lower[1] = std::min(lower[1], bounds.yMin);
+        upper[1] = std::max(upper[1], bounds.yMax);
+        lower[2] = std::min(lower[2], z);
+        upper[2] = std::max(upper[2], z);
+    }
+
+    m_MaskIndexBoundingBox = MakeEmptyRegion(region);
+    if (upper[0] >= 0)
+    {
+        IndexType start;
+        RegionType::SizeType size;
+        for (unsigned int d = 0; d < 3; ++d)
+        {
+            start[d] = region.GetIndex(d) + lower[d];
+            size[d] = static_cast<itk::SizeValueType>(upper[d] - lower[d] + 1);
+        }
+        m_MaskIndexBoundingBox.SetIndex(start);
+        m_MaskIndexBoundingBox.SetSize(size);
+    }
+
+    m_BoundingBoxMask = mask;
+    m_BoundingBoxMaskModifiedTime = mask->GetMTime();
+    return m_MaskIndexBoundingBox;
+}
+
+// ============================================================================
+// 按序号取掩膜体素
+// ============================================================================
+
+MaskBitmap::IndexType MaskBitmap::GetInsideVoxel(uint64_t rank) const
+{
+    if (rank >= m_NumberOfInsideVoxels)
+    {
+        throw std::runtime_error("MaskBitmap: voxel rank out of range");
+    }
+
+    // 最后一个 run.rank <= rank 的行程
+    auto it = std::upper_bound(m_Runs.begin(), m_Runs.end(), rank,
+        [](uint64_t value, const Run& run) { return value < run.rank; });
+    --it;
+
+    IndexType index = it->start;
+    index[0] += static_cast<long>(rank - it->rank);
+    return index;
+}
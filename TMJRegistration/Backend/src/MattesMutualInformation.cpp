@@ -1,25 +1,50 @@
 #include "MattesMutualInformation.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
-#include "itkGradientImageFilter.h"
 #include <cmath>
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <numeric>
+#include <chrono>
+
+// 采样点分块: 最小分块大小固定, 分块数上限为 工作者数 × kChunksPerWorker。
+// 每个工作者有多个分块, 由池中线程动态领取: 采样点按Morton序排列, 越界和被掩膜剔除的采样点
+// 在空间上成片, 每个工作者一个静态分块时个别线程会承担大部分实际工作。
+// 每个分块一份局部结果, 按分块序号合并 (给定线程数时结果逐位可重复)
+static const size_t kSampleChunkSize = 1024;
+static const size_t kChunksPerWorker = 8;
+
+static size_t ComputeSampleChunkSize(size_t totalSamples, size_t numberOfWorkers)
+{
+    const size_t maxChunks = std::max<size_t>(1, numberOfWorkers * kChunksPerWorker);
+    return std::max(kSampleChunkSize, (totalSamples + maxChunks - 1) / maxChunks);
+}
+
+size_t MattesMutualInformation::GetDerivativeBufferBytes() const
+{
+    size_t count = m_JointPDFDerivatives.size();
+    for (const auto& chunk : m_ChunkHistograms)
+    {
+        count += chunk.jointPDFDerivatives.size();
+    }
+    return count * sizeof(double);
+}
 
 // ============================================================================
 // 构造函数和析构函数
 // ============================================================================
 
 MattesMutualInformation::MattesMutualInformation()
-    : m_NumberOfHistogramBins(50)
+    : m_NumberOfParameters(6)  // 默认刚体6参数
+    , m_MovingImageBuffer(nullptr)
+    , m_MovingGradientBuffer(nullptr)
+    , m_NumberOfHistogramBins(50)
     , m_NumberOfSpatialSamples(0) // will be computed from sampling percentage by default
     , m_SamplingPercentage(0.10)   // default 10%
     , m_RandomSeed(121212)
     , m_UseFixedSeed(true)
     , m_UseStratifiedSampling(true)  // 默认使用分层采样
     , m_NumberOfValidSamples(0)
-    , m_NumberOfParameters(6)  // 默认刚体6参数
     , m_FixedImageMin(0.0)
     , m_FixedImageMax(1.0)
     , m_MovingImageMin(0.0)
@@ -27,17 +52,11 @@ MattesMutualInformation::MattesMutualInformation()
     , m_FixedImageBinSize(1.0)
     , m_MovingImageBinSize(1.0)
     , m_CurrentValue(0.0)
-    , m_NumberOfThreads(std::thread::hardware_concurrency())  // 自动检测CPU核心数
+    , m_NumberOfThreads(ThreadPool::GetGlobalNumberOfThreads())  // 默认使用全局线程池的全部线程
+    , m_UseExplicitPDFDerivatives(true)
 {
-    m_Interpolator = InterpolatorType::New();
     m_RandomGenerator.seed(m_RandomSeed);
     
-    // 初始化梯度插值器
-    for (int i = 0; i < 3; ++i)
-    {
-        m_GradientInterpolators[i] = InterpolatorType::New();
-    }
-    
     if (m_NumberOfThreads == 0) m_NumberOfThreads = 1;
     
     std::cout << "[Metric] Multi-threading enabled: " << m_NumberOfThreads << " threads" << std::endl;
@@ -54,12 +73,13 @@ MattesMutualInformation::~MattesMutualInformation()
 void MattesMutualInformation::SetFixedImage(ImageType::Pointer fixedImage)
 {
     m_FixedImage = fixedImage;
+    m_EvaluationCache.Invalidate();
 }
 
 void MattesMutualInformation::SetMovingImage(ImageType::Pointer movingImage)
 {
     m_MovingImage = movingImage;
-    m_Interpolator->SetInputImage(m_MovingImage);
+    m_EvaluationCache.Invalidate();
 }
 
 // ============================================================================
@@ -78,6 +98,9 @@ void MattesMutualInformation::Initialize()
     {
         m_RandomGenerator.seed(m_RandomSeed);
     }
+    
+    // 采样集和直方图参数即将改变, 旧的评估结果全部失效
+    m_EvaluationCache.Invalidate();
 
     // 计算图像强度范围
     ComputeImageExtrema();
@@ -93,21 +116,11 @@ void MattesMutualInformation::Initialize()
         auto size = region.GetSize();
         unsigned long totalVoxels = static_cast<unsigned long>(size[0]) * size[1] * size[2];
         
-        // 如果有掩膜,需要先计算掩膜内的体素数
+        // 如果有掩膜,需要先计算掩膜内的体素数 (由栅格化位图直接给出)
         if (m_FixedImageMask.IsNotNull())
         {
-            unsigned long maskVoxels = 0;
-            using IteratorType = itk::ImageRegionConstIteratorWithIndex<ImageType>;
-            IteratorType it(m_FixedImage, region);
-            for (it.GoToBegin(); !it.IsAtEnd(); ++it)
-            {
-                ImageType::PointType physicalPoint;
-                m_FixedImage->TransformIndexToPhysicalPoint(it.GetIndex(), physicalPoint);
-                if (m_FixedImageMask->IsInsideInWorldSpace(physicalPoint))
-                {
-                    ++maskVoxels;
-                }
-            }
+            UpdateFixedMaskBitmap();
+            unsigned long maskVoxels = static_cast<unsigned long>(m_FixedMaskBitmap.GetNumberOfInsideVoxels());
             // 使用掩膜内体素数计算采样数
             m_NumberOfSpatialSamples = static_cast<unsigned int>(maskVoxels * m_SamplingPercentage + 0.5);
             if (m_Verbose)
@@ -139,19 +152,38 @@ void MattesMutualInformation::Initialize()
     {
         std::cout << "[Metric Debug] Computed moving image gradient" << std::endl;
     }
+    SetupMovingSampler();
 
-    // 初始化直方图
-    m_JointPDF.resize(m_NumberOfHistogramBins, 
-                     std::vector<double>(m_NumberOfHistogramBins, 0.0));
-    m_FixedImageMarginalPDF.resize(m_NumberOfHistogramBins, 0.0);
-    m_MovingImageMarginalPDF.resize(m_NumberOfHistogramBins, 0.0);
+    // 初始化直方图 (扁平连续存储)
+    const size_t numCells = static_cast<size_t>(m_NumberOfHistogramBins) * m_NumberOfHistogramBins;
+    m_JointPDF.assign(numCells, 0.0);
+    m_FixedImageMarginalPDF.assign(m_NumberOfHistogramBins, 0.0);
+    m_MovingImageMarginalPDF.assign(m_NumberOfHistogramBins, 0.0);
+    
+    // 初始化梯度PDF存储 (根据参数数量动态分配, 参数维在最内层)
+    // 两遍模式不需要 B²·P 导数缓冲区, 释放之前可能分配过的内存
+    if (m_UseExplicitPDFDerivatives)
+    {
+        m_JointPDFDerivatives.assign(numCells * m_NumberOfParameters, 0.0);
+    }
+    else
+    {
+        HistogramBufferType().swap(m_JointPDFDerivatives);
+        for (auto& hist : m_ChunkHistograms)
+        {
+            HistogramBufferType().swap(hist.jointPDFDerivatives);
+        }
+        m_PDFLogRatios.assign(numCells, 0.0);
+    }
     
-    // 初始化梯度PDF存储 (根据参数数量动态分配)
-    m_JointPDFDerivatives.resize(m_NumberOfParameters);
-    for (auto& paramDerivative : m_JointPDFDerivatives)
+    // 预分配分块直方图, 之后的每次评估只清零不分配
+    PrepareChunkHistograms(ThreadPool::GetGlobalInstance().GetNumberOfWorkers(m_NumberOfThreads),
+                           m_UseExplicitPDFDerivatives);
+    
+    if (m_Verbose)
     {
-        paramDerivative.resize(m_NumberOfHistogramBins,
-                              std::vector<double>(m_NumberOfHistogramBins, 0.0));
+        std::cout << "[Metric Debug] PDF derivative mode: "
+                  << (m_UseExplicitPDFDerivatives ? "explicit" : "two-pass") << std::endl;
     }
 }
 
@@ -162,6 +194,7 @@ void MattesMutualInformation::ReinitializeSampling()
         m_RandomGenerator.seed(m_RandomSeed);
     }
     SampleFixedImage();
+    m_EvaluationCache.Invalidate();
 }
 
 // ============================================================================
@@ -215,113 +248,83 @@ void MattesMutualInformation::ComputeImageExtrema()
 
 void MattesMutualInformation::ComputeMovingImageGradient()
 {
-    // 使用ITK的GradientImageFilter计算图像梯度
-    using GradientFilterType = itk::GradientImageFilter<ImageType, float, float>;
-    using GradientOutputType = GradientFilterType::OutputImageType;
-    
-    auto gradientFilter = GradientFilterType::New();
-    gradientFilter->SetInput(m_MovingImage);
-    gradientFilter->SetUseImageSpacing(true);  // 考虑物理spacing
-    gradientFilter->Update();
-    
-    GradientOutputType::Pointer gradientImage = gradientFilter->GetOutput();
-    
-    // 将梯度向量图像分解为3个标量图像(便于插值)
-    ImageType::RegionType region = m_MovingImage->GetLargestPossibleRegion();
-    
-    for (int dim = 0; dim < 3; ++dim)
-    {
-        m_MovingImageGradient[dim] = ImageType::New();
-        m_MovingImageGradient[dim]->SetRegions(region);
-        m_MovingImageGradient[dim]->SetSpacing(m_MovingImage->GetSpacing());
-        m_MovingImageGradient[dim]->SetOrigin(m_MovingImage->GetOrigin());
-        m_MovingImageGradient[dim]->SetDirection(m_MovingImage->GetDirection());
-        m_MovingImageGradient[dim]->Allocate();
-    }
-    
-    // 复制梯度分量
-    using GradientIteratorType = itk::ImageRegionConstIteratorWithIndex<GradientOutputType>;
-    GradientIteratorType gradIt(gradientImage, region);
-    
-    for (gradIt.GoToBegin(); !gradIt.IsAtEnd(); ++gradIt)
-    {
-        auto index = gradIt.GetIndex();
-        auto gradientVector = gradIt.Get();
-        
-        for (int dim = 0; dim < 3; ++dim)
-        {
-            m_MovingImageGradient[dim]->SetPixel(index, gradientVector[dim]);
-        }
-    }
+    // 并行计算交错梯度 (与 GradientImageFilter 相同的中心差分/spacing/方向语义);
+    // 同一移动图像对象(同一金字塔层级)再次初始化时直接命中缓存
+    m_MovingImageGradient = GradientImageCache::GetGlobalInstance().GetGradient(m_MovingImage, m_NumberOfThreads);
+}
+
+void MattesMutualInformation::SetupMovingSampler()
+{
+    m_MovingSampler.SetImage(m_MovingImage);
+    m_MovingImageBuffer = m_MovingImage->GetBufferPointer();
     
-    // 设置梯度插值器
-    for (int dim = 0; dim < 3; ++dim)
+    // 梯度缓冲区与移动图像缓冲区逐体素对应, 共用同一组角点偏移
+    if (!m_MovingImageGradient || m_MovingImageGradient->numberOfPixels != m_MovingSampler.GetNumberOfPixels())
     {
-        m_GradientInterpolators[dim]->SetInputImage(m_MovingImageGradient[dim]);
+        throw std::runtime_error("Moving image gradient does not match moving image buffer");
     }
+    m_MovingGradientBuffer = m_MovingImageGradient->GetBufferPointer();
 }
 
 // ============================================================================
 // 采样策略
 // ============================================================================
 
-void MattesMutualInformation::SampleFixedImage()
+void MattesMutualInformation::UpdateFixedMaskBitmap()
 {
-    // 随机采样固定图像
-    using IteratorType = itk::ImageRegionConstIteratorWithIndex<ImageType>;
-    ImageType::RegionType region = m_FixedImage->GetLargestPossibleRegion();
-
-    // 收集所有有效点的索引
-    std::vector<ImageType::IndexType> allIndices;
-    IteratorType it(m_FixedImage, region);
-
-    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    if (m_FixedImageMask.IsNull())
     {
-        // 如果设置了掩膜,只收集掩膜内部的索引
-        if (m_FixedImageMask.IsNotNull())
-        {
-            ImageType::PointType physicalPoint;
-            m_FixedImage->TransformIndexToPhysicalPoint(it.GetIndex(), physicalPoint);
-            if (!m_FixedImageMask->IsInsideInWorldSpace(physicalPoint))
-            {
-                continue;  // 跳过掩膜外的点
-            }
-        }
-        allIndices.push_back(it.GetIndex());
+        m_FixedMaskBitmap.Clear();
+        return;
     }
 
-    // 使用固定种子随机打乱
-    std::shuffle(allIndices.begin(), allIndices.end(), m_RandomGenerator);
+    // 掩膜和固定图像均未改变时直接复用 (见 MaskBitmap 的缓存键)
+    m_FixedMaskBitmap.Rasterize(m_FixedImageMask.GetPointer(), m_FixedImage.GetPointer(), m_NumberOfThreads);
+}
 
-    unsigned int numSamples = std::min(m_NumberOfSpatialSamples, 
-                                      static_cast<unsigned int>(allIndices.size()));
-    
-    m_SamplePoints.clear();
-    m_SamplePoints.reserve(numSamples);
+void MattesMutualInformation::SampleFixedImage()
+{
+    UpdateFixedMaskBitmap();
 
-    for (unsigned int i = 0; i < numSamples; ++i)
-    {
-        SamplePoint sample;
-        m_FixedImage->TransformIndexToPhysicalPoint(allIndices[i], sample.fixedPoint);
-        sample.fixedValue = m_FixedImage->GetPixel(allIndices[i]);
-        // compute parzen window index and weights for fixed image intensity
-        double fixedContinuousIndex = ComputeFixedImageContinuousIndex(sample.fixedValue);
-        int fixedStartIndex;
-        ComputeBSplineWeights(fixedContinuousIndex, fixedStartIndex, sample.fixedBSplineWeights);
-        sample.fixedParzenWindowIndex = fixedStartIndex;
-        m_SamplePoints.push_back(sample);
-    }
+    // 随机采样固定图像 (无放回, 固定种子)
+    SampleFixedImageRandom();
 
-    m_NumberOfValidSamples = static_cast<unsigned int>(m_SamplePoints.size());
+    m_NumberOfValidSamples = static_cast<unsigned int>(m_Samples.GetNumberOfSamples());
 
     if (m_Verbose)
     {
-        std::cout << "[Metric Debug] SampleFixedImage: numSamples=" << numSamples
+        std::cout << "[Metric Debug] SampleFixedImage: numSamples=" << m_NumberOfSpatialSamples
                   << " validSamples=" << m_NumberOfValidSamples 
                   << " maskEnabled=" << (m_FixedImageMask.IsNotNull() ? "Yes" : "No") << std::endl;
     }
 }
 
+void MattesMutualInformation::StoreSamples(std::vector<ImageType::IndexType>& indices)
+{
+    // 按Morton序建立结构数组采样集, 打乱的采样顺序不再决定移动图像的访存顺序
+    m_Samples.Build(m_FixedImage, indices);
+    
+    const size_t numSamples = m_Samples.GetNumberOfSamples();
+    const float* fixedBuffer = m_FixedImage->GetBufferPointer();
+    
+    m_SampleFixedParzenIndices.resize(numSamples);
+    m_SampleFixedWeights.resize(numSamples * NumberOfBSplineCoefficients);
+    
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        // 预计算固定图像B样条权重
+        const double fixedValue = fixedBuffer[m_Samples.GetBufferOffset(i)];
+        double fixedContinuousIndex = ComputeFixedImageContinuousIndex(fixedValue);
+        int fixedStartIndex;
+        std::array<double, 4> fixedWeights;
+        ComputeBSplineWeights(fixedContinuousIndex, fixedStartIndex, fixedWeights);
+        
+        m_SampleFixedParzenIndices[i] = fixedStartIndex;
+        std::copy(fixedWeights.begin(), fixedWeights.end(),
+                  m_SampleFixedWeights.begin() + i * NumberOfBSplineCoefficients);
+    }
+}
+
 void MattesMutualInformation::SampleFixedImageStratified()
 {
     // 分层均匀采样: 将图像划分为网格,在每个格子中随机采样
@@ -354,8 +357,8 @@ void MattesMutualInformation::SampleFixedImageStratified()
     unsigned int cellSizeY = size[1] / gridY;
     unsigned int cellSizeZ = size[2] / gridZ;
     
-    m_SamplePoints.clear();
-    m_SamplePoints.reserve(m_NumberOfSpatialSamples);
+    std::vector<ImageType::IndexType> sampleIndices;
+    sampleIndices.reserve(m_NumberOfSpatialSamples);
     
     std::uniform_real_distribution<double> dist(0.0, 1.0);
     
@@ -378,7 +381,7 @@ void MattesMutualInformation::SampleFixedImageStratified()
                 // 在格子内随机采样
                 for (unsigned int s = 0; s < samplesPerCell; ++s)
                 {
-                    if (m_SamplePoints.size() >= m_NumberOfSpatialSamples)
+                    if (sampleIndices.size() >= m_NumberOfSpatialSamples)
                         break;
                     
                     // 随机索引
@@ -392,82 +395,39 @@ void MattesMutualInformation::SampleFixedImageStratified()
                     index[1] = std::min(index[1], static_cast<ImageType::IndexType::IndexValueType>(size[1] - 1));
                     index[2] = std::min(index[2], static_cast<ImageType::IndexType::IndexValueType>(size[2] - 1));
                     
-                    // 转换为物理坐标
-                    ImageType::PointType physicalPoint;
-                    m_FixedImage->TransformIndexToPhysicalPoint(index, physicalPoint);
-                    
                     // 掩膜检查: 如果设置了掩膜,只采样掩膜内部的点
-                    if (m_FixedImageMask.IsNotNull())
+                    if (m_FixedImageMask.IsNotNull() && !m_FixedMaskBitmap.IsInside(index))
                     {
-                        if (!m_FixedImageMask->IsInsideInWorldSpace(physicalPoint))
-                        {
-                            continue;  // 跳过掩膜外的点
-                        }
+                        continue;  // 跳过掩膜外的点
                     }
                     
-                    SamplePoint sample;
-                    sample.fixedPoint = physicalPoint;
-                    sample.fixedValue = m_FixedImage->GetPixel(index);
-                    
-                    // 预计算固定图像B样条权重
-                    double fixedContinuousIndex = ComputeFixedImageContinuousIndex(sample.fixedValue);
-                    ComputeBSplineWeights(fixedContinuousIndex, 
-                                         sample.fixedParzenWindowIndex,
-                                         sample.fixedBSplineWeights);
-                    
-                    m_SamplePoints.push_back(sample);
+                    sampleIndices.push_back(index);
                 }
             }
         }
     }
+    
+    StoreSamples(sampleIndices);
 }
 
 void MattesMutualInformation::SampleFixedImageRandom()
 {
-    // 原始随机采样方法(作为备选)
-    using IteratorType = itk::ImageRegionConstIteratorWithIndex<ImageType>;
+    // 无放回随机采样, 代价只与采样数相关: 不再收集并打乱全部体素索引
     ImageType::RegionType region = m_FixedImage->GetLargestPossibleRegion();
+    std::vector<ImageType::IndexType> sampleIndices;
     
-    std::vector<ImageType::IndexType> allIndices;
-    IteratorType it(m_FixedImage, region);
-    
-    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    if (m_FixedImageMask.IsNull())
     {
-        // 如果设置了掩膜,只收集掩膜内部的索引
-        if (m_FixedImageMask.IsNotNull())
-        {
-            ImageType::PointType physicalPoint;
-            m_FixedImage->TransformIndexToPhysicalPoint(it.GetIndex(), physicalPoint);
-            if (!m_FixedImageMask->IsInsideInWorldSpace(physicalPoint))
-            {
-                continue;  // 跳过掩膜外的点
-            }
-        }
-        allIndices.push_back(it.GetIndex());
+        RandomVoxelSelector::SelectVoxels(region, m_NumberOfSpatialSamples, m_RandomGenerator, sampleIndices);
     }
-
-    std::shuffle(allIndices.begin(), allIndices.end(), m_RandomGenerator);
-
-    unsigned int numSamples = std::min(m_NumberOfSpatialSamples, 
-                                      static_cast<unsigned int>(allIndices.size()));
-    
-    m_SamplePoints.clear();
-    m_SamplePoints.reserve(numSamples);
-
-    for (unsigned int i = 0; i < numSamples; ++i)
+    else
     {
-        SamplePoint sample;
-        m_FixedImage->TransformIndexToPhysicalPoint(allIndices[i], sample.fixedPoint);
-        sample.fixedValue = m_FixedImage->GetPixel(allIndices[i]);
-        
-        // 预计算固定图像B样条权重
-        double fixedContinuousIndex = ComputeFixedImageContinuousIndex(sample.fixedValue);
-        ComputeBSplineWeights(fixedContinuousIndex, 
-                             sample.fixedParzenWindowIndex,
-                             sample.fixedBSplineWeights);
-        
-        m_SamplePoints.push_back(sample);
+        // 掩膜内按行程序号直接选取, 不遍历掩膜外体素
+        RandomVoxelSelector::SelectVoxels(m_FixedMaskBitmap, region, m_NumberOfSpatialSamples,
+                                          m_RandomGenerator, sampleIndices);
     }
+    
+    StoreSamples(sampleIndices);
 }
 
 // ============================================================================
@@ -555,6 +515,29 @@ void MattesMutualInformation::ComputeBSplineDerivativeWeights(
 // 强度到连续索引转换
 // ============================================================================
 
+MattesMutualInformation::ParametersType MattesMutualInformation::GetEvaluationCacheKey() const
+{
+    // 缓存键: 变换参数 + 固定参数(旋转中心等), 逐位比较
+    ParametersType key;
+    if (!m_Transform)
+    {
+        return key;
+    }
+    
+    const auto& parameters = m_Transform->GetParameters();
+    const auto& fixedParameters = m_Transform->GetFixedParameters();
+    key.reserve(parameters.Size() + fixedParameters.Size());
+    for (unsigned int i = 0; i < parameters.Size(); ++i)
+    {
+        key.push_back(parameters[i]);
+    }
+    for (unsigned int i = 0; i < fixedParameters.Size(); ++i)
+    {
+        key.push_back(fixedParameters[i]);
+    }
+    return key;
+}
+
 double MattesMutualInformation::ComputeFixedImageContinuousIndex(double value) const
 {
     // 将图像强度值转换为直方图的连续索引
@@ -572,6 +555,12 @@ double MattesMutualInformation::ComputeMovingImageContinuousIndex(double value)
 // ============================================================================
 // 核心计算: 联合PDF和导数
 // ============================================================================
+//
+// 直方图布局说明:
+// - m_JointPDF 为 numBins×numBins 的扁平行主序数组
+// - m_JointPDFDerivatives 以参数索引为最内层: [(fixedBin*numBins + movingBin)*numParams + k]
+// 这样每个采样点对某个(fixedBin, movingBin)的导数贡献是一段连续内存上的
+// 6(刚体)或12(仿射)宽的乘加, 编译器可以直接向量化, 也避免了逐参数的指针跳转。
 
 void MattesMutualInformation::ComputeJointPDFAndDerivatives()
 {
@@ -585,40 +574,65 @@ void MattesMutualInformation::ComputeJointPDFAndDerivatives()
         throw std::runtime_error("Jacobian function not set in metric");
     }
 
-    // 清空直方图
-    for (auto& row : m_JointPDF)
-    {
-        std::fill(row.begin(), row.end(), 0.0);
-    }
-    std::fill(m_FixedImageMarginalPDF.begin(), m_FixedImageMarginalPDF.end(), 0.0);
-    std::fill(m_MovingImageMarginalPDF.begin(), m_MovingImageMarginalPDF.end(), 0.0);
+    // 单线程版本: 整个采样集作为一个分块处理
+    PrepareChunkHistograms(1, true);
+    m_ChunkHistograms[0].Reset(true);
+    ComputePDFRange(0, m_Samples.GetNumberOfSamples(), m_ChunkHistograms[0]);
     
-    // 清空梯度PDF
-    for (auto& paramDerivative : m_JointPDFDerivatives)
+    MergeAndNormalizeHistograms(1);
+
+    if (m_Verbose)
     {
-        for (auto& row : paramDerivative)
-        {
-            std::fill(row.begin(), row.end(), 0.0);
-        }
+        unsigned int nonZeroBins = static_cast<unsigned int>(
+            std::count_if(m_JointPDF.begin(), m_JointPDF.end(), [](double p) { return p > 0.0; }));
+        double fillRatio = static_cast<double>(nonZeroBins) / (m_NumberOfHistogramBins * m_NumberOfHistogramBins);
+        std::cout << "[Metric Debug] JointPDF filled bins: " << nonZeroBins << " (" << fillRatio << ")" << std::endl;
     }
+}
 
-    m_NumberOfValidSamples = 0;
-    std::vector<std::array<double, 3>> jacobian;
+// ============================================================================
+// 多线程版本: 核心计算 - 联合PDF和导数 (高性能)
+// ============================================================================
 
-    // 遍历所有采样点
-    for (const auto& sample : m_SamplePoints)
+void MattesMutualInformation::ComputePDFRange(
+    size_t startIdx, 
+    size_t endIdx, 
+    ThreadLocalHistograms& localHist)
+{
+    const unsigned int numBins = m_NumberOfHistogramBins;
+    const unsigned int numParams = m_NumberOfParameters;
+    const size_t derivativeRowStride = static_cast<size_t>(numBins) * numParams;
+    
+    double* jointPDF = localHist.jointPDF.data();
+    double* jointPDFDerivatives = localHist.jointPDFDerivatives.data();
+    
+    std::vector<std::array<double, 3>> jacobian;
+    
+    // dm/dp 缓冲区在整个分块内复用, 避免逐采样点分配
+    AlignedVector<double> dmDp(numParams, 0.0);
+    
+    // 处理分配给此线程的采样点
+    for (size_t sampleIdx = startIdx; sampleIdx < endIdx; ++sampleIdx)
     {
+        const ImageType::PointType fixedPoint = m_Samples.GetPoint(sampleIdx);
+        const int fixedParzenIndex = m_SampleFixedParzenIndices[sampleIdx];
+        const double* fixedWeights = m_SampleFixedWeights.data() + sampleIdx * NumberOfBSplineCoefficients;
+        
         // 使用变换将固定图像点变换到移动图像空间
-        ImageType::PointType transformedPoint = m_Transform->TransformPoint(sample.fixedPoint);
+        ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
 
-        // 检查变换后的点是否在移动图像范围内
-        if (!m_Interpolator->IsInsideBuffer(transformedPoint))
+        // 检查变换后的点是否在移动图像范围内, 同时计算三线性角点和权重
+        TrilinearSampler::Location location;
+        if (!m_MovingSampler.ComputeLocation(transformedPoint, location))
         {
             continue;
         }
 
-        // 插值获取移动图像值
-        double movingValue = m_Interpolator->Evaluate(transformedPoint);
+        // 一次遍历8个角点, 同时得到移动图像值和梯度
+        double movingValue;
+        std::array<double, 3> movingGradient;
+        TrilinearSampler::EvaluateValueAndGradient(m_MovingImageBuffer, m_MovingGradientBuffer,
+                                                   location, movingValue, movingGradient);
         
         // 计算移动图像的连续索引和B样条权重
         double movingContinuousIndex = ComputeMovingImageContinuousIndex(movingValue);
@@ -631,213 +645,101 @@ void MattesMutualInformation::ComputeJointPDFAndDerivatives()
         int tempStartIndex;
         ComputeBSplineDerivativeWeights(movingContinuousIndex, tempStartIndex, movingBSplineDerivativeWeights);
         
-        // 获取移动图像梯度
-        std::array<double, 3> movingGradient = {0.0, 0.0, 0.0};
-        for (int dim = 0; dim < 3; ++dim)
-        {
-            if (m_GradientInterpolators[dim]->IsInsideBuffer(transformedPoint))
-            {
-                movingGradient[dim] = m_GradientInterpolators[dim]->Evaluate(transformedPoint);
-            }
-        }
-        
         // 使用外部提供的雅可比函数计算变换雅可比矩阵
-        m_JacobianFunction(sample.fixedPoint, jacobian);
+        m_JacobianFunction(fixedPoint, jacobian);
         
-        // 计算 dm/dp = gradient_M^T * dT/dp
-        // dm/dp[k] = sum_d (gradient_M[d] * jacobian[k][d])
-        std::vector<double> dmDp(m_NumberOfParameters, 0.0);
-        for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
+        // 计算 dm/dp = gradient_M^T * dT/dp (转换为bin索引的导数)
+        for (unsigned int k = 0; k < numParams; ++k)
         {
-            dmDp[k] = 0.0;
+            double value = 0.0;
             for (int d = 0; d < 3; ++d)
             {
-                dmDp[k] += movingGradient[d] * jacobian[k][d];
+                value += movingGradient[d] * jacobian[k][d];
             }
-            // 转换为bin索引的导数
-            dmDp[k] /= m_MovingImageBinSize;
-        }
-
-        // Print debug info for first few samples
-        if (m_Verbose && m_NumberOfValidSamples < 5)
-        {
-            std::cout << "[Metric Debug] Sample " << m_NumberOfValidSamples << " fixedVal=" << sample.fixedValue
-                      << " movedVal=" << movingValue << std::endl;
-            std::cout << "  movingGradient: " << movingGradient[0] << " " << movingGradient[1] << " " << movingGradient[2] << std::endl;
-            std::cout << "  jacobian[0]: " << jacobian[0][0] << " " << jacobian[0][1] << " " << jacobian[0][2] << std::endl;
-            std::cout << "  dmDp (first 6): ";
-            for (unsigned int k = 0; k < std::min<unsigned int>(6, dmDp.size()); ++k)
-            {
-                std::cout << dmDp[k] << " ";
-            }
-            std::cout << std::endl;
+            dmDp[k] = value / m_MovingImageBinSize;
         }
+        const double* dmDpData = dmDp.data();
         
-        // 累加到联合PDF和导数PDF
+        // 累加到局部线程的联合PDF和导数PDF
         for (int fi = 0; fi < 4; ++fi)
         {
-            int fixedBin = sample.fixedParzenWindowIndex + fi;
-            if (fixedBin < 0 || fixedBin >= static_cast<int>(m_NumberOfHistogramBins))
+            int fixedBin = fixedParzenIndex + fi;
+            if (fixedBin < 0 || fixedBin >= static_cast<int>(numBins))
                 continue;
                 
-            double fixedWeight = sample.fixedBSplineWeights[fi];
+            const double fixedWeight = fixedWeights[fi];
+            double* pdfRow = jointPDF + static_cast<size_t>(fixedBin) * numBins;
+            double* derivativeRow = jointPDFDerivatives + static_cast<size_t>(fixedBin) * derivativeRowStride;
             
             for (int mi = 0; mi < 4; ++mi)
             {
                 int movingBin = movingStartIndex + mi;
-                if (movingBin < 0 || movingBin >= static_cast<int>(m_NumberOfHistogramBins))
+                if (movingBin < 0 || movingBin >= static_cast<int>(numBins))
                     continue;
                 
-                double movingWeight = movingBSplineWeights[mi];
-                double movingDerivWeight = movingBSplineDerivativeWeights[mi];
-                
                 // 联合PDF贡献
-                double jointContribution = fixedWeight * movingWeight;
-                m_JointPDF[fixedBin][movingBin] += jointContribution;
+                pdfRow[movingBin] += fixedWeight * movingBSplineWeights[mi];
                 
-                // 导数PDF贡献
-                // dP/dp = B_fixed * dB_moving/dm * dm/dp
-                for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
+                // 导数PDF贡献: dP/dp = B_fixed * dB_moving/dm * dm/dp
+                // 参数维在内存中连续, 整段一次乘加
+                const double derivativeWeight = fixedWeight * movingBSplineDerivativeWeights[mi];
+                double* cell = derivativeRow + static_cast<size_t>(movingBin) * numParams;
+                for (unsigned int k = 0; k < numParams; ++k)
                 {
-                    double derivContribution = fixedWeight * movingDerivWeight * dmDp[k];
-                    m_JointPDFDerivatives[k][fixedBin][movingBin] += derivContribution;
+                    cell[k] += derivativeWeight * dmDpData[k];
                 }
             }
         }
         
-        m_NumberOfValidSamples++;
-    }
-
-    // 归一化为概率分布
-    if (m_NumberOfValidSamples > 0)
-    {
-        double normFactor = 1.0 / static_cast<double>(m_NumberOfValidSamples);
-        
-        for (unsigned int i = 0; i < m_NumberOfHistogramBins; ++i)
-        {
-            for (unsigned int j = 0; j < m_NumberOfHistogramBins; ++j)
-            {
-                m_JointPDF[i][j] *= normFactor;
-                m_FixedImageMarginalPDF[i] += m_JointPDF[i][j];
-                m_MovingImageMarginalPDF[j] += m_JointPDF[i][j];
-                
-                // 归一化导数
-                for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
-                {
-                    m_JointPDFDerivatives[k][i][j] *= normFactor;
-                }
-            }
-        }
-    }
-
-    if (m_Verbose)
-    {
-        unsigned int nonZeroBins = 0;
-        for (unsigned int i = 0; i < m_NumberOfHistogramBins; ++i)
-        {
-            for (unsigned int j = 0; j < m_NumberOfHistogramBins; ++j)
-            {
-                if (m_JointPDF[i][j] > 0.0)
-                    ++nonZeroBins;
-            }
-        }
-        double fillRatio = static_cast<double>(nonZeroBins) / (m_NumberOfHistogramBins * m_NumberOfHistogramBins);
-        std::cout << "[Metric Debug] JointPDF filled bins: " << nonZeroBins << " (" << fillRatio << ")" << std::endl;
+        localHist.validSamples++;
     }
 }
 
-// ============================================================================
-// 多线程版本: 核心计算 - 联合PDF和导数 (高性能)
-// ============================================================================
-
-void MattesMutualInformation::ComputePDFRange(
+void MattesMutualInformation::ComputePDFValueRange(
     size_t startIdx, 
     size_t endIdx, 
     ThreadLocalHistograms& localHist)
 {
-    std::vector<std::array<double, 3>> jacobian;
+    const unsigned int numBins = m_NumberOfHistogramBins;
+    double* jointPDF = localHist.jointPDF.data();
     
-    // 处理分配给此线程的采样点
     for (size_t sampleIdx = startIdx; sampleIdx < endIdx; ++sampleIdx)
     {
-        const auto& sample = m_SamplePoints[sampleIdx];
+        const ImageType::PointType fixedPoint = m_Samples.GetPoint(sampleIdx);
+        const int fixedParzenIndex = m_SampleFixedParzenIndices[sampleIdx];
+        const double* fixedWeights = m_SampleFixedWeights.data() + sampleIdx * NumberOfBSplineCoefficients;
         
-        // 使用变换将固定图像点变换到移动图像空间
-        ImageType::PointType transformedPoint = m_Transform->TransformPoint(sample.fixedPoint);
-
-        // 检查变换后的点是否在移动图像范围内
-        if (!m_Interpolator->IsInsideBuffer(transformedPoint))
+        ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
+        TrilinearSampler::Location location;
+        if (!m_MovingSampler.ComputeLocation(transformedPoint, location))
         {
             continue;
         }
 
-        // 插值获取移动图像值
-        double movingValue = m_Interpolator->Evaluate(transformedPoint);
+        double movingValue = TrilinearSampler::Evaluate(m_MovingImageBuffer, location);
         
-        // 计算移动图像的连续索引和B样条权重
         double movingContinuousIndex = ComputeMovingImageContinuousIndex(movingValue);
         int movingStartIndex;
         std::array<double, 4> movingBSplineWeights;
         ComputeBSplineWeights(movingContinuousIndex, movingStartIndex, movingBSplineWeights);
         
-        // 计算移动图像B样条导数权重
-        std::array<double, 4> movingBSplineDerivativeWeights;
-        int tempStartIndex;
-        ComputeBSplineDerivativeWeights(movingContinuousIndex, tempStartIndex, movingBSplineDerivativeWeights);
-        
-        // 获取移动图像梯度
-        std::array<double, 3> movingGradient = {0.0, 0.0, 0.0};
-        for (int dim = 0; dim < 3; ++dim)
-        {
-            if (m_GradientInterpolators[dim]->IsInsideBuffer(transformedPoint))
-            {
-                movingGradient[dim] = m_GradientInterpolators[dim]->Evaluate(transformedPoint);
-            }
-        }
-        
-        // 使用外部提供的雅可比函数计算变换雅可比矩阵
-        m_JacobianFunction(sample.fixedPoint, jacobian);
-        
-        // 计算 dm/dp = gradient_M^T * dT/dp
-        std::vector<double> dmDp(m_NumberOfParameters, 0.0);
-        for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
-        {
-            dmDp[k] = 0.0;
-            for (int d = 0; d < 3; ++d)
-            {
-                dmDp[k] += movingGradient[d] * jacobian[k][d];
-            }
-            dmDp[k] /= m_MovingImageBinSize;
-        }
-        
-        // 累加到局部线程的联合PDF和导数PDF
+        // 只累加联合PDF
         for (int fi = 0; fi < 4; ++fi)
         {
-            int fixedBin = sample.fixedParzenWindowIndex + fi;
-            if (fixedBin < 0 || fixedBin >= static_cast<int>(m_NumberOfHistogramBins))
+            int fixedBin = fixedParzenIndex + fi;
+            if (fixedBin < 0 || fixedBin >= static_cast<int>(numBins))
                 continue;
                 
-            double fixedWeight = sample.fixedBSplineWeights[fi];
+            const double fixedWeight = fixedWeights[fi];
+            double* pdfRow = jointPDF + static_cast<size_t>(fixedBin) * numBins;
             
             for (int mi = 0; mi < 4; ++mi)
             {
                 int movingBin = movingStartIndex + mi;
-                if (movingBin < 0 || movingBin >= static_cast<int>(m_NumberOfHistogramBins))
+                if (movingBin < 0 || movingBin >= static_cast<int>(numBins))
                     continue;
                 
-                double movingWeight = movingBSplineWeights[mi];
-                double movingDerivWeight = movingBSplineDerivativeWeights[mi];
-                
-                // 联合PDF贡献
-                double jointContribution = fixedWeight * movingWeight;
-                localHist.jointPDF[fixedBin][movingBin] += jointContribution;
-                
-                // 导数PDF贡献
-                for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
-                {
-                    double derivContribution = fixedWeight * movingDerivWeight * dmDp[k];
-                    localHist.jointPDFDerivatives[k][fixedBin][movingBin] += derivContribution;
-                }
+                pdfRow[movingBin] += fixedWeight * movingBSplineWeights[mi];
             }
         }
         
@@ -845,123 +747,204 @@ void MattesMutualInformation::ComputePDFRange(
     }
 }
 
-void MattesMutualInformation::ComputeJointPDFAndDerivativesThreaded()
+void MattesMutualInformation::MergeAndNormalizeHistograms(
+    size_t numberOfHistograms,
+    bool includeDerivatives)
 {
-    if (!m_Transform)
-    {
-        throw std::runtime_error("Transform not set in metric");
-    }
+    const unsigned int numBins = m_NumberOfHistogramBins;
+    const unsigned int numParams = m_NumberOfParameters;
+    const size_t numCells = static_cast<size_t>(numBins) * numBins;
+    const size_t derivativeRowStride = static_cast<size_t>(numBins) * numParams;
     
-    if (!m_JacobianFunction)
+    m_JointPDF.resize(numCells);
+    if (includeDerivatives)
     {
-        throw std::runtime_error("Jacobian function not set in metric");
+        m_JointPDFDerivatives.resize(numCells * numParams);
     }
-
-    // 清空全局直方图
-    for (auto& row : m_JointPDF)
+    
+    m_NumberOfValidSamples = 0;
+    for (size_t h = 0; h < numberOfHistograms; ++h)
     {
-        std::fill(row.begin(), row.end(), 0.0);
+        m_NumberOfValidSamples += m_ChunkHistograms[h].validSamples;
     }
+    const double normFactor = (m_NumberOfValidSamples > 0)
+        ? 1.0 / static_cast<double>(m_NumberOfValidSamples) : 0.0;
+    
+    // 合并 + 归一化 (Reduce阶段), 按固定图像bin行划分给线程池:
+    // 每个分块独占若干行, 直接写入全局直方图, 无需加锁或二次合并。
+    // 每个单元按分块直方图序号顺序求和, 结果与线程数无关。
+    // 原串行实现的代价为 分块数 × bins² × 参数数, 随线程数线性增长, 成为多核扩展的瓶颈
+    double* jointPDF = m_JointPDF.data();
+    double* jointPDFDerivatives = m_JointPDFDerivatives.data();
+    const ThreadLocalHistograms* chunkHistograms = m_ChunkHistograms.data();
+    
+    ThreadPool::GetGlobalInstance().ParallelFor(numBins, 1,
+        [=](size_t, size_t rowBegin, size_t rowEnd, unsigned int) {
+            for (size_t row = rowBegin; row < rowEnd; ++row)
+            {
+                double* pdfRow = jointPDF + row * numBins;
+                std::copy_n(chunkHistograms[0].jointPDF.data() + row * numBins, numBins, pdfRow);
+                for (size_t h = 1; h < numberOfHistograms; ++h)
+                {
+                    const double* localRow = chunkHistograms[h].jointPDF.data() + row * numBins;
+                    for (unsigned int j = 0; j < numBins; ++j)
+                    {
+                        pdfRow[j] += localRow[j];
+                    }
+                }
+                for (unsigned int j = 0; j < numBins; ++j)
+                {
+                    pdfRow[j] *= normFactor;
+                }
+                
+                if (!includeDerivatives)
+                {
+                    continue;
+                }
+                
+                double* derivativeRow = jointPDFDerivatives + row * derivativeRowStride;
+                std::copy_n(chunkHistograms[0].jointPDFDerivatives.data() + row * derivativeRowStride,
+                            derivativeRowStride, derivativeRow);
+                for (size_t h = 1; h < numberOfHistograms; ++h)
+                {
+                    const double* localRow = chunkHistograms[h].jointPDFDerivatives.data() + row * derivativeRowStride;
+                    for (size_t d = 0; d < derivativeRowStride; ++d)
+                    {
+                        derivativeRow[d] += localRow[d];
+                    }
+                }
+                for (size_t d = 0; d < derivativeRowStride; ++d)
+                {
+                    derivativeRow[d] *= normFactor;
+                }
+            }
+        },
+        m_NumberOfThreads);
+    
+    // 边缘分布 (bins² 次加法, 串行即可)
     std::fill(m_FixedImageMarginalPDF.begin(), m_FixedImageMarginalPDF.end(), 0.0);
     std::fill(m_MovingImageMarginalPDF.begin(), m_MovingImageMarginalPDF.end(), 0.0);
-    
-    for (auto& paramDerivative : m_JointPDFDerivatives)
+    if (m_NumberOfValidSamples > 0)
     {
-        for (auto& row : paramDerivative)
+        for (unsigned int i = 0; i < numBins; ++i)
         {
-            std::fill(row.begin(), row.end(), 0.0);
+            const double* pdfRow = jointPDF + static_cast<size_t>(i) * numBins;
+            for (unsigned int j = 0; j < numBins; ++j)
+            {
+                m_FixedImageMarginalPDF[i] += pdfRow[j];
+                m_MovingImageMarginalPDF[j] += pdfRow[j];
+            }
         }
     }
+}
 
-    // 创建线程局部直方图
-    std::vector<ThreadLocalHistograms> threadHistograms;
-    threadHistograms.reserve(m_NumberOfThreads);
-    for (unsigned int t = 0; t < m_NumberOfThreads; ++t)
+void MattesMutualInformation::PrepareChunkHistograms(size_t numberOfChunks, bool includeDerivatives)
+{
+    const size_t numCells = static_cast<size_t>(m_NumberOfHistogramBins) * m_NumberOfHistogramBins;
+    const size_t numDerivatives = numCells * m_NumberOfParameters;
+    
+    if (m_ChunkHistograms.size() < numberOfChunks)
     {
-        threadHistograms.emplace_back(m_NumberOfHistogramBins, m_NumberOfParameters);
+        m_ChunkHistograms.reserve(numberOfChunks);
+        while (m_ChunkHistograms.size() < numberOfChunks)
+        {
+            m_ChunkHistograms.emplace_back(m_NumberOfHistogramBins, includeDerivatives ? m_NumberOfParameters : 0);
+        }
     }
-
-    // 将采样点分配给各个线程
-    size_t totalSamples = m_SamplePoints.size();
-    size_t samplesPerThread = totalSamples / m_NumberOfThreads;
     
-    std::vector<std::thread> threads;
-    threads.reserve(m_NumberOfThreads);
-    
-    for (unsigned int t = 0; t < m_NumberOfThreads; ++t)
+    // bin数或参数数变化时才重新分配; 仅值路径保留已有的导数缓冲区
+    for (size_t h = 0; h < numberOfChunks; ++h)
     {
-        size_t startIdx = t * samplesPerThread;
-        size_t endIdx = (t == m_NumberOfThreads - 1) ? totalSamples : (t + 1) * samplesPerThread;
-        
-        threads.emplace_back([this, startIdx, endIdx, &threadHistograms, t]() {
-            this->ComputePDFRange(startIdx, endIdx, threadHistograms[t]);
-        });
+        ThreadLocalHistograms& hist = m_ChunkHistograms[h];
+        if (hist.jointPDF.size() != numCells)
+        {
+            hist.jointPDF.assign(numCells, 0.0);
+        }
+        if (includeDerivatives && hist.jointPDFDerivatives.size() != numDerivatives)
+        {
+            hist.jointPDFDerivatives.assign(numDerivatives, 0.0);
+        }
     }
+}
+
+void MattesMutualInformation::RunPDFKernelThreaded(bool includeDerivatives)
+{
+    ThreadPool& pool = ThreadPool::GetGlobalInstance();
+    
+    // 每个工作者最多 kChunksPerWorker 个分块, 动态领取以均衡负载;
+    // 分块直方图数量 (及显式导数模式的 bins²×参数数 缓冲区) 随之为 分块数 份
+    const size_t totalSamples = m_Samples.GetNumberOfSamples();
+    const size_t chunkSize = ComputeSampleChunkSize(totalSamples, pool.GetNumberOfWorkers(m_NumberOfThreads));
+    const size_t numberOfUsedChunks = std::max<size_t>(1, ThreadPool::ComputeNumberOfChunks(totalSamples, chunkSize));
     
-    // 等待所有线程完成
-    for (auto& thread : threads)
+    PrepareChunkHistograms(numberOfUsedChunks, includeDerivatives);
+    if (totalSamples == 0)
     {
-        thread.join();
+        m_ChunkHistograms[0].Reset(includeDerivatives);
     }
     
-    // 合并所有线程的局部直方图到全局直方图 (Reduce阶段)
-    m_NumberOfValidSamples = 0;
-    for (const auto& localHist : threadHistograms)
-    {
-        m_NumberOfValidSamples += localHist.validSamples;
-        
-        for (unsigned int i = 0; i < m_NumberOfHistogramBins; ++i)
-        {
-            for (unsigned int j = 0; j < m_NumberOfHistogramBins; ++j)
+    auto accumulateStart = std::chrono::steady_clock::now();
+    
+    // 清零由执行分块的线程完成 (并行清零, 且缓冲区落在使用它的线程附近)
+    pool.ParallelFor(totalSamples, chunkSize,
+        [this, includeDerivatives](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            ThreadLocalHistograms& localHist = m_ChunkHistograms[chunkIndex];
+            localHist.Reset(includeDerivatives);
+            if (includeDerivatives)
             {
-                m_JointPDF[i][j] += localHist.jointPDF[i][j];
-                
-                for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
-                {
-                    m_JointPDFDerivatives[k][i][j] += localHist.jointPDFDerivatives[k][i][j];
-                }
+                ComputePDFRange(begin, end, localHist);
             }
-        }
-    }
-
-    // 归一化为概率分布
-    if (m_NumberOfValidSamples > 0)
-    {
-        double normFactor = 1.0 / static_cast<double>(m_NumberOfValidSamples);
-        
-        for (unsigned int i = 0; i < m_NumberOfHistogramBins; ++i)
-        {
-            for (unsigned int j = 0; j < m_NumberOfHistogramBins; ++j)
+            else
             {
-                m_JointPDF[i][j] *= normFactor;
-                m_FixedImageMarginalPDF[i] += m_JointPDF[i][j];
-                m_MovingImageMarginalPDF[j] += m_JointPDF[i][j];
-                
-                for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
-                {
-                    m_JointPDFDerivatives[k][i][j] *= normFactor;
-                }
+                ComputePDFValueRange(begin, end, localHist);
             }
-        }
+        },
+        m_NumberOfThreads);
+    
+    auto mergeStart = std::chrono::steady_clock::now();
+    MergeAndNormalizeHistograms(numberOfUsedChunks, includeDerivatives);
+    auto mergeEnd = std::chrono::steady_clock::now();
+    
+    m_TimingStatistics.accumulateSeconds += std::chrono::duration<double>(mergeStart - accumulateStart).count();
+    m_TimingStatistics.mergeSeconds += std::chrono::duration<double>(mergeEnd - mergeStart).count();
+    ++m_TimingStatistics.evaluations;
+}
+
+void MattesMutualInformation::ComputeJointPDFAndDerivativesThreaded()
+{
+    if (!m_Transform)
+    {
+        throw std::runtime_error("Transform not set in metric");
+    }
+    
+    if (!m_JacobianFunction)
+    {
+        throw std::runtime_error("Jacobian function not set in metric");
     }
 
+    RunPDFKernelThreaded(true);
+
     if (m_Verbose)
     {
-        unsigned int nonZeroBins = 0;
-        for (unsigned int i = 0; i < m_NumberOfHistogramBins; ++i)
-        {
-            for (unsigned int j = 0; j < m_NumberOfHistogramBins; ++j)
-            {
-                if (m_JointPDF[i][j] > 0.0)
-                    ++nonZeroBins;
-            }
-        }
+        unsigned int nonZeroBins = static_cast<unsigned int>(
+            std::count_if(m_JointPDF.begin(), m_JointPDF.end(), [](double p) { return p > 0.0; }));
         double fillRatio = static_cast<double>(nonZeroBins) / (m_NumberOfHistogramBins * m_NumberOfHistogramBins);
         std::cout << "[Metric Debug - Multithreaded] JointPDF filled bins: " << nonZeroBins 
                   << " (" << fillRatio << "), Valid samples: " << m_NumberOfValidSamples << std::endl;
     }
 }
 
+void MattesMutualInformation::ComputeJointPDFThreaded()
+{
+    if (!m_Transform)
+    {
+        throw std::runtime_error("Transform not set in metric");
+    }
+
+    // 仅值路径: 分块直方图只清零和累加联合PDF部分
+    RunPDFKernelThreaded(false);
+}
+
 // ============================================================================
 // 计算互信息值
 // ============================================================================
@@ -970,18 +953,20 @@ double MattesMutualInformation::ComputeMutualInformation()
 {
     double mutualInformation = 0.0;
     const double epsilon = 1e-16;
+    const unsigned int numBins = m_NumberOfHistogramBins;
 
-    for (unsigned int i = 0; i < m_NumberOfHistogramBins; ++i)
+    for (unsigned int i = 0; i < numBins; ++i)
     {
         double fixedProb = m_FixedImageMarginalPDF[i];
         
         if (fixedProb < epsilon)
             continue;
 
-        for (unsigned int j = 0; j < m_NumberOfHistogramBins; ++j)
+        const double* pdfRow = m_JointPDF.data() + static_cast<size_t>(i) * numBins;
+        for (unsigned int j = 0; j < numBins; ++j)
         {
             double movingProb = m_MovingImageMarginalPDF[j];
-            double jointProb = m_JointPDF[i][j];
+            double jointProb = pdfRow[j];
 
             if (jointProb < epsilon || movingProb < epsilon)
                 continue;
@@ -1010,13 +995,18 @@ void MattesMutualInformation::ComputeAnalyticalGradient(ParametersType& derivati
     // dMI/dp = sum_f sum_m [ dP(f,m)/dp * log(P(f,m) / P(m)) ]
     
     const double epsilon = 1e-16;
-    derivative.resize(m_NumberOfParameters, 0.0);
+    const unsigned int numBins = m_NumberOfHistogramBins;
+    const unsigned int numParams = m_NumberOfParameters;
+    
+    // 注意: 调用方可能传入已有尺寸的向量, 必须显式清零
+    derivative.assign(numParams, 0.0);
     
-    for (unsigned int i = 0; i < m_NumberOfHistogramBins; ++i)
+    for (unsigned int i = 0; i < numBins; ++i)
     {
-        for (unsigned int j = 0; j < m_NumberOfHistogramBins; ++j)
+        for (unsigned int j = 0; j < numBins; ++j)
         {
-            double jointProb = m_JointPDF[i][j];
+            const size_t cellIndex = static_cast<size_t>(i) * numBins + j;
+            double jointProb = m_JointPDF[cellIndex];
             double movingProb = m_MovingImageMarginalPDF[j];
             
             if (jointProb < epsilon || movingProb < epsilon)
@@ -1025,15 +1015,16 @@ void MattesMutualInformation::ComputeAnalyticalGradient(ParametersType& derivati
             // log(P(f,m) / P(m))
             double logTerm = std::log(jointProb / movingProb);
             
-            for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
+            const double* cell = m_JointPDFDerivatives.data() + cellIndex * numParams;
+            for (unsigned int k = 0; k < numParams; ++k)
             {
-                derivative[k] += m_JointPDFDerivatives[k][i][j] * logTerm;
+                derivative[k] += cell[k] * logTerm;
             }
         }
     }
     
     // 因为我们最小化负互信息,所以梯度取负
-    for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
+    for (unsigned int k = 0; k < numParams; ++k)
     {
         derivative[k] = -derivative[k];
     }
@@ -1041,46 +1032,256 @@ void MattesMutualInformation::ComputeAnalyticalGradient(ParametersType& derivati
     if (m_Verbose)
     {
         double maxAbs = 0.0, sumAbs = 0.0;
-        for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
+        for (unsigned int k = 0; k < numParams; ++k)
         {
             double a = std::abs(derivative[k]);
             if (a > maxAbs) maxAbs = a;
             sumAbs += a;
         }
-        double meanAbs = sumAbs / m_NumberOfParameters;
+        double meanAbs = sumAbs / numParams;
         std::cout << "[Metric Debug] Gradient stats: maxAbs=" << maxAbs << " meanAbs=" << meanAbs << std::endl;
         std::cout << "  gradient: ";
-        for (unsigned int k = 0; k < m_NumberOfParameters; ++k)
+        for (unsigned int k = 0; k < numParams; ++k)
             std::cout << std::fixed << std::setprecision(6) << derivative[k] << " ";
         std::cout << std::endl;
     }
 }
 
+// ============================================================================
+// 两遍模式: 第2遍逐采样点计算梯度
+// ============================================================================
+
+// 把显式模式的缩并顺序交换:
+// dMI/dp = sum_f sum_m [ dP(f,m)/dp * L(f,m) ],  L(f,m) = log(P(f,m) / P(m))
+//        = 1/N * sum_x sum_f sum_m [ B_f(x) * dB_m(x)/dm * L(f,m) ] * dm(x)/dp
+// 方括号内只与采样点有关的标量 c(x) 先在 4×4 个bin上求出, 再乘以 dm/dp 累加到P维向量。
+// 与显式模式数学上等价, 区别只在浮点求和顺序。
+
+void MattesMutualInformation::ComputeDerivativeRange(
+    size_t startIdx,
+    size_t endIdx,
+    double* derivative)
+{
+    const unsigned int numBins = m_NumberOfHistogramBins;
+    const unsigned int numParams = m_NumberOfParameters;
+    const double* logRatios = m_PDFLogRatios.data();
+    
+    std::vector<std::array<double, 3>> jacobian;
+    
+    for (size_t sampleIdx = startIdx; sampleIdx < endIdx; ++sampleIdx)
+    {
+        const ImageType::PointType fixedPoint = m_Samples.GetPoint(sampleIdx);
+        const int fixedParzenIndex = m_SampleFixedParzenIndices[sampleIdx];
+        const double* fixedWeights = m_SampleFixedWeights.data() + sampleIdx * NumberOfBSplineCoefficients;
+        
+        ImageType::PointType transformedPoint = m_Transform->TransformPoint(fixedPoint);
+        TrilinearSampler::Location location;
+        if (!m_MovingSampler.ComputeLocation(transformedPoint, location))
+        {
+            continue;
+        }
+        
+        double movingValue;
+        std::array<double, 3> movingGradient;
+        TrilinearSampler::EvaluateValueAndGradient(m_MovingImageBuffer, m_MovingGradientBuffer,
+                                                   location, movingValue, movingGradient);
+        
+        double movingContinuousIndex = ComputeMovingImageContinuousIndex(movingValue);
+        int movingStartIndex;
+        std::array<double, 4> movingBSplineDerivativeWeights;
+        ComputeBSplineDerivativeWeights(movingContinuousIndex, movingStartIndex, movingBSplineDerivativeWeights);
+        
+        // c(x) = sum_f sum_m B_f * dB_m/dm * L(f,m)
+        double coefficient = 0.0;
+        for (int fi = 0; fi < 4; ++fi)
+        {
+            int fixedBin = fixedParzenIndex + fi;
+            if (fixedBin < 0 || fixedBin >= static_cast<int>(numBins))
+                continue;
+            
+            const double* logRow = logRatios + static_cast<size_t>(fixedBin) * numBins;
+            double rowSum = 0.0;
+            for (int mi = 0; mi < 4; ++mi)
+            {
+                int movingBin = movingStartIndex + mi;
+                if (movingBin < 0 || movingBin >= static_cast<int>(numBins))
+                    continue;
+                rowSum += movingBSplineDerivativeWeights[mi] * logRow[movingBin];
+            }
+            coefficient += fixedWeights[fi] * rowSum;
+        }
+        
+        // 落在空单元或平坦区域的采样点对梯度无贡献, 省掉雅可比回调
+        if (coefficient == 0.0)
+        {
+            continue;
+        }
+        
+        m_JacobianFunction(fixedPoint, jacobian);
+        
+        // dm/dp = gradient_M^T * dT/dp / binSize
+        const double scale = coefficient / m_MovingImageBinSize;
+        for (unsigned int k = 0; k < numParams; ++k)
+        {
+            double value = 0.0;
+            for (int d = 0; d < 3; ++d)
+            {
+                value += movingGradient[d] * jacobian[k][d];
+            }
+            derivative[k] += scale * value;
+        }
+    }
+}
+
+void MattesMutualInformation::ComputeAnalyticalGradientTwoPass(ParametersType& derivative)
+{
+    if (!m_JacobianFunction)
+    {
+        throw std::runtime_error("Jacobian function not set in metric");
+    }
+    
+    const double epsilon = 1e-16;
+    const unsigned int numBins = m_NumberOfHistogramBins;
+    const unsigned int numParams = m_NumberOfParameters;
+    const size_t numCells = static_cast<size_t>(numBins) * numBins;
+    
+    derivative.assign(numParams, 0.0);
+    if (m_NumberOfValidSamples == 0)
+    {
+        return;
+    }
+    
+    auto passStart = std::chrono::steady_clock::now();
+    
+    // log(P(f,m) / P(m)) 表, 跳过的单元与显式模式一致
+    m_PDFLogRatios.resize(numCells);
+    for (unsigned int i = 0; i < numBins; ++i)
+    {
+        const double* pdfRow = m_JointPDF.data() + static_cast<size_t>(i) * numBins;
+        double* logRow = m_PDFLogRatios.data() + static_cast<size_t>(i) * numBins;
+        for (unsigned int j = 0; j < numBins; ++j)
+        {
+            const double jointProb = pdfRow[j];
+            const double movingProb = m_MovingImageMarginalPDF[j];
+            logRow[j] = (jointProb < epsilon || movingProb < epsilon) ? 0.0 : std::log(jointProb / movingProb);
+        }
+    }
+    
+    // 与第1遍相同的分块方式; 每个分块只有一个P维部分和
+    ThreadPool& pool = ThreadPool::GetGlobalInstance();
+    const size_t totalSamples = m_Samples.GetNumberOfSamples();
+    const size_t chunkSize = ComputeSampleChunkSize(totalSamples, pool.GetNumberOfWorkers(m_NumberOfThreads));
+    const size_t numberOfUsedChunks = ThreadPool::ComputeNumberOfChunks(totalSamples, chunkSize);
+    
+    if (m_ChunkDerivatives.size() < numberOfUsedChunks)
+    {
+        m_ChunkDerivatives.resize(numberOfUsedChunks);
+    }
+    
+    pool.ParallelFor(totalSamples, chunkSize,
+        [this, numParams](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            AlignedVector<double>& partial = m_ChunkDerivatives[chunkIndex];
+            partial.assign(numParams, 0.0);
+            ComputeDerivativeRange(begin, end, partial.data());
+        },
+        m_NumberOfThreads);
+    
+    // 按分块顺序合并, 归一化 1/N, 取负 (最小化负互信息)
+    for (size_t c = 0; c < numberOfUsedChunks; ++c)
+    {
+        for (unsigned int k = 0; k < numParams; ++k)
+        {
+            derivative[k] += m_ChunkDerivatives[c][k];
+        }
+    }
+    const double normFactor = 1.0 / static_cast<double>(m_NumberOfValidSamples);
+    for (unsigned int k = 0; k < numParams; ++k)
+    {
+        derivative[k] = -derivative[k] * normFactor;
+    }
+    
+    m_TimingStatistics.derivativePassSeconds +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - passStart).count();
+    
+    if (m_Verbose)
+    {
+        double maxAbs = 0.0;
+        for (unsigned int k = 0; k < numParams; ++k)
+        {
+            maxAbs = std::max(maxAbs, std::abs(derivative[k]));
+        }
+        std::cout << "[Metric Debug] Two-pass gradient: maxAbs=" << maxAbs << std::endl;
+    }
+}
+
 // ============================================================================
 // 公共接口
 // ============================================================================
 
 double MattesMutualInformation::GetValue()
 {
-    ComputeJointPDFAndDerivativesThreaded();
+    const ParametersType key = GetEvaluationCacheKey();
+    double cachedValue;
+    unsigned int cachedValidSamples;
+    if (m_EvaluationCache.FindValue(key, cachedValue, cachedValidSamples))
+    {
+        m_CurrentValue = cachedValue;
+        m_NumberOfValidSamples = cachedValidSamples;
+        return m_CurrentValue;
+    }
+    
+    // 只需要标量MI: 走仅值路径, 不构建导数直方图
+    ComputeJointPDFThreaded();
     double mi = ComputeMutualInformation();
     m_CurrentValue = -mi;  // 返回负值,因为我们要最小化
+    
+    m_EvaluationCache.StoreValue(key, m_CurrentValue, m_NumberOfValidSamples);
     return m_CurrentValue;
 }
 
 void MattesMutualInformation::GetDerivative(ParametersType& derivative)
 {
-    // 先计算PDF(如果还没计算的话)
-    ComputeJointPDFAndDerivativesThreaded();
-    ComputeAnalyticalGradient(derivative);
+    const ParametersType key = GetEvaluationCacheKey();
+    if (m_EvaluationCache.FindDerivative(key, derivative))
+    {
+        return;
+    }
+    
+    // 完整路径同时得到值和梯度, 两者都写入缓存
+    double value;
+    GetValueAndDerivative(value, derivative);
 }
 
 void MattesMutualInformation::GetValueAndDerivative(double& value, ParametersType& derivative)
 {
-    ComputeJointPDFAndDerivativesThreaded();
-    value = -ComputeMutualInformation();
-    m_CurrentValue = value;
-    ComputeAnalyticalGradient(derivative);
+    const ParametersType key = GetEvaluationCacheKey();
+    unsigned int cachedValidSamples;
+    if (m_EvaluationCache.FindDerivative(key, derivative) &&
+        m_EvaluationCache.FindValue(key, value, cachedValidSamples))
+    {
+        m_CurrentValue = value;
+        m_NumberOfValidSamples = cachedValidSamples;
+        return;
+    }
+    
+    if (m_UseExplicitPDFDerivatives)
+    {
+        ComputeJointPDFAndDerivativesThreaded();
+        value = -ComputeMutualInformation();
+        m_CurrentValue = value;
+        ComputeAnalyticalGradient(derivative);
+    }
+    else
+    {
+        // 第1遍: 仅联合PDF (与 GetValue 相同的路径); 第2遍: 逐采样点梯度
+        ComputeJointPDFThreaded();
+        value = -ComputeMutualInformation();
+        m_CurrentValue = value;
+        ComputeAnalyticalGradientTwoPass(derivative);
+    }
+    
+    m_EvaluationCache.StoreValue(key, value, m_NumberOfValidSamples);
+    m_EvaluationCache.StoreDerivative(key, derivative);
 }
 
 // ============================================================================
@@ -0,0 +1,151 @@
+#include "MetricEvaluationCache.h"
+#include <algorithm>
+
+// ============================================================================
+// 构造函数和析构函数
+// ============================================================================
+
+MetricEvaluationCache::MetricEvaluationCache(unsigned int capacity)
+    : m_Capacity(std::max(1u, capacity))
+    , m_Generation(0)
+    , m_UseCounter(0)
+    , m_Enabled(true)
+{
+    m_Entries.reserve(m_Capacity);
+}
+
+MetricEvaluationCache::~MetricEvaluationCache()
+{
+}
+
+// ============================================================================
+// 失效控制
+// ============================================================================
+
+void MetricEvaluationCache::SetEnabled(bool enabled)
+{
+    m_Enabled = enabled;
+    if (!m_Enabled)
+    {
+        Invalidate();
+    }
+}
+
+void MetricEvaluationCache::Invalidate()
+{
+    ++m_Generation;
+    m_Entries.clear();
+}
+
+// ============================================================================
+// 查找
+// ============================================================================
+
+MetricEvaluationCache::Entry* MetricEvaluationCache::FindEntry(const ParametersType& parameters)
+{
+    for (auto& entry : m_Entries)
+    {
+        if (entry.generation == m_Generation && entry.parameters == parameters)
+        {
+            entry.lastUse = ++m_UseCounter;
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+MetricEvaluationCache::Entry& MetricEvaluationCache::FindOrCreateEntry(const ParametersType& parameters)
+{
+    Entry* existing = FindEntry(parameters);
+    if (existing)
+    {
+        return *existing;
+    }
+
+    // 未命中: 追加新记录, 满时替换最久未使用的记录
+    Entry* target = nullptr;
+    if (m_Entries.size() < m_Capacity)
+    {
+        m_Entries.emplace_back();
+        target = &m_Entries.back();
+    }
+    else
+    {
+        target = &*std::min_element(m_Entries.begin(), m_Entries.end(),
+            [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+        *target = Entry();
+    }
+
+    target->parameters = parameters;
+    target->generation = m_Generation;
+    target->lastUse = ++m_UseCounter;
+    return *target;
+}
+
+bool MetricEvaluationCache::FindValue(const ParametersType& parameters, double& value, unsigned int& validSamples)
+{
+    if (!m_Enabled)
+    {
+        return false;
+    }
+
+    Entry* entry = FindEntry(parameters);
+    if (entry && entry->hasValue)
+    {
+        value = entry->value;
+        validSamples = entry->validSamples;
+        ++m_Statistics.valueHits;
+        return true;
+    }
+
+    ++m_Statistics.valueMisses;
+    return false;
+}
+
+bool MetricEvaluationCache::FindDerivative(const ParametersType& parameters, ParametersType& derivative)
+{
+    if (!m_Enabled)
+    {
+        return false;
+    }
+
+    Entry* entry = FindEntry(parameters);
+    if (entry && entry->hasDerivative)
+    {
+        derivative = entry->derivative;
+        ++m_Statistics.derivativeHits;
+        return true;
+    }
+
+    ++m_Statistics.derivativeMisses;
+    return false;
+}
+
+// ============================================================================
+// 写入
+// ============================================================================
+
+void MetricEvaluationCache::StoreValue(const ParametersType& parameters, double value, unsigned int validSamples)
+{
+    if (!m_Enabled)
+    {
+        return;
+    }
+
+    Entry& entry = FindOrCreateEntry(parameters);
+    entry.hasValue = true;
+    entry.value = value;
+    entry.validSamples = validSamples;
+}
+
+void MetricEvaluationCache::StoreDerivative(const ParametersType& parameters, const ParametersType& derivative)
+{
+    if (!m_Enabled)
+    {
+        return;
+    }
+
+    Entry& entry = FindOrCreateEntry(parameters);
+    entry.hasDerivative = true;
+    entry.derivative = derivative;
+}
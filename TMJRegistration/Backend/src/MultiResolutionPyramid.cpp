@@ -0,0 +1,440 @@
+#include "MultiResolutionPyramid.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <itkRegionOfInterestImageFilter.h>
+#include <itkShrinkImageFilter.h>
+#include <itkSmoothingRecursiveGaussianImageFilter.h>
+
+// ============================================================================
+// 构造函数
+// ============================================================================
+
+MultiResolutionPyramid::MultiResolutionPyramid()
+    : m_InputModifiedTime(0)
+    , m_UseRecursiveConstruction(false)
+{
+}
+
+void MultiResolutionPyramid::SetInput(ImageType::Pointer image)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (image == m_Input && (!image || image->GetMTime() == m_InputModifiedTime))
+    {
+        return;
+    }
+
+    ClearLocked();
+    m_Input = image;
+    m_InputModifiedTime = image ? image->GetMTime() : 0;
+}
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::GetInput() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Input;
+}
+
+MultiResolutionPyramid::Statistics MultiResolutionPyramid::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Statistics;
+}
+
+void MultiResolutionPyramid::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    ClearLocked();
+}
+
+void MultiResolutionPyramid::ClearLocked()
+{
+    m_CroppedImages.clear();
+    m_WinsorizedImages.clear();
+    m_Levels.clear();
+}
+
+void MultiResolutionPyramid::SetUseRecursiveConstruction(bool use)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (use != m_UseRecursiveConstruction)
+    {
+        m_Levels.clear();
+        m_UseRecursiveConstruction = use;
+    }
+}
+
+bool MultiResolutionPyramid::GetUseRecursiveConstruction() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_UseRecursiveConstruction;
+}
+
+void MultiResolutionPyramid::ValidateInput()
+{
+    if (!m_Input)
+    {
+        throw std::runtime_error("MultiResolutionPyramid: input image not set");
+    }
+
+    if (m_Input->GetMTime() != m_InputModifiedTime)
+    {
+        ClearLocked();
+        m_InputModifiedTime = m_Input->GetMTime();
+    }
+}
+
+MultiResolutionPyramid::RegionKey MultiResolutionPyramid::MakeRegionKey(const RegionType& region)
+{
+    RegionKey key;
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        key[d] = region.GetIndex(d);
+        key[3 + d] = static_cast<long>(region.GetSize(d));
+    }
+    return key;
+}
+
+// ============================================================================
+// 层级获取
+// ============================================================================
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::GetLevel(const LevelSettings& settings)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    ValidateInput();
+
+    const double lower = settings.winsorize ? settings.lowerQuantile : 0.0;
+    const double upper = settings.winsorize ? settings.upperQuantile : 0.0;
+    const unsigned int shrinkFactor = std::max(1u, settings.shrinkFactor);
+    const double sigma = std::max(0.0, settings.smoothingSigma);
+    const LevelKey key(MakeRegionKey(settings.cropRegion), settings.winsorize, lower, upper, shrinkFactor, sigma);
+
+    auto it = m_Levels.find(key);
+    if (it != m_Levels.end())
+    {
+        ++m_Statistics.hits;
+        return it->second;
+    }
+    ++m_Statistics.misses;
+
+    ImageType::Pointer image;
+    unsigned int sourceShrink = 1;
+    double sourceSigma = 0.0;
+    ImageType::Pointer source = m_UseRecursiveConstruction ? FindRecursiveSource(key, sourceShrink, sourceSigma) : nullptr;
+    if (source)
+    {
+        // 由更细层级导出: 补足剩余的平滑量后抽取
+        const double incrementalSigma = std::sqrt(std::max(0.0, sigma * sigma - sourceSigma * sourceSigma));
+        image = SmoothImage(source, incrementalSigma > 1e-6 ? incrementalSigma : 0.0);
+        image = ShrinkImage(image, shrinkFactor / sourceShrink);
+        ++m_Statistics.recursiveBuilds;
+    }
+    else
+    {
+        image = settings.winsorize
+            ? GetWinsorizedImage(settings.cropRegion, lower, upper)
+            : GetCroppedImage(settings.cropRegion);
+        image = SmoothImage(image, sigma);
+        image = ShrinkImage(image, shrinkFactor);
+    }
+
+    m_Levels[key] = image;
+    return image;
+}
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::FindRecursiveSource(const LevelKey& target,
+                                                                                       unsigned int& sourceShrink,
+                                                                                       double& sourceSigma) const
+{
+    const unsigned int targetShrink = std::get<4>(target);
+    const double targetSigma = std::get<5>(target);
+    const auto& spacing = m_Input->GetSpacing();
+
+    ImageType::Pointer best;
+    for (const auto& entry : m_Levels)
+    {
+        const LevelKey& key = entry.first;
+        if (std::get<0>(key) != std::get<0>(target) || std::get<1>(key) != std::get<1>(target) ||
+            std::get<2>(key) != std::get<2>(target) || std::get<3>(key) != std::get<3>(target))
+        {
+            continue;
+        }
+
+        const unsigned int shrink = std::get<4>(key);
+        const double sigma = std::get<5>(key);
+        if (shrink > targetShrink || targetShrink % shrink != 0 || sigma > targetSigma)
+        {
+            continue;
+        }
+
+        // 已抽取的源层级必须足够平滑, 否则在其网格上继续平滑无法消除已有的混叠
+        if (shrink > 1)
+        {
+            bool antiAliased = true;
+            for (unsigned int d = 0; d < 3; ++d)
+            {
+                if (sigma < MinimumAntiAliasingSigma * shrink * spacing[d])
+                {
+                    antiAliased = false;
+                    break;
+                }
+            }
+            if (!antiAliased)
+            {
+                continue;
+            }
+        }
+
+        // 取最粗的源; 同样粗时取平滑量最大的 (剩余滤波最少)
+        if (!best || shrink > sourceShrink || (shrink == sourceShrink && sigma > sourceSigma))
+        {
+            best = entry.second;
+            sourceShrink = shrink;
+            sourceSigma = sigma;
+        }
+    }
+    return best;
+}
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::GetCroppedImage(const RegionType& region)
+{
+    if (region.GetNumberOfPixels() == 0)
+    {
+        return m_Input;
+    }
+
+    const RegionKey key = MakeRegionKey(region);
+    auto it = m_CroppedImages.find(key);
+    if (it != m_CroppedImages.end())
+    {
+        return it->second;
+    }
+
+    ImageType::Pointer cropped = CropImage(m_Input, region);
+    m_CroppedImages[key] = cropped;
+    return cropped;
+}
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::GetWinsorizedImage(const RegionType& region,
+                                                                                      double lowerQuantile,
+                                                                                      double upperQuantile)
+{
+    const WinsorizeKey key(MakeRegionKey(region), lowerQuantile, upperQuantile);
+    auto it = m_WinsorizedImages.find(key);
+    if (it != m_WinsorizedImages.end())
+    {
+        return it->second;
+    }
+
+    ImageType::Pointer winsorized = WinsorizeImage(GetCroppedImage(region), lowerQuantile, upperQuantile);
+    m_WinsorizedImages[key] = winsorized;
+    return winsorized;
+}
+
+// ============================================================================
+// 单步处理
+// ============================================================================
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::CropImage(ImageType::Pointer image, const RegionType& region)
+{
+    if (region.GetNumberOfPixels() == 0 || region == image->GetLargestPossibleRegion())
+    {
+        return image;
+    }
+
+    // RegionOfInterestImageFilter 调整原点使物理位置不变
+    using ROIFilterType = itk::RegionOfInterestImageFilter<ImageType, ImageType>;
+    auto roiFilter = ROIFilterType::New();
+    roiFilter->SetInput(image);
+    roiFilter->SetRegionOfInterest(region);
+    roiFilter->Update();
+    return roiFilter->GetOutput();
+}
+
+void MultiResolutionPyramid::ComputeQuantileThresholds(const ImageType* image, double lowerQuantile, double upperQuantile,
+                                                       float& lowerThreshold, float& upperThreshold)
+{
+    // 精确分位数, 与"全部排序后取 values[floor(q*n)]"的结果逐位相同:
+    // 1. 并行求 min/max
+    // 2. 并行统计 [min, max] 上的细分直方图, 由累计计数定位两个目标序号所在的bin
+    // 3. 再遍历一次, 只收集落入这两个bin的值, 在其中 nth_element
+    // 复杂度 O(n), 额外内存为直方图 + 目标bin内的值 (通常远小于n)
+    const size_t numberOfPixels = image->GetBufferedRegion().GetNumberOfPixels();
+    if (numberOfPixels == 0)
+    {
+        throw std::runtime_error("MultiResolutionPyramid: cannot compute quantiles of an empty image");
+    }
+    const float* buffer = image->GetBufferPointer();
+
+    size_t lowerIndex = static_cast<size_t>(lowerQuantile * numberOfPixels);
+    size_t upperIndex = static_cast<size_t>(upperQuantile * numberOfPixels);
+    if (lowerIndex >= numberOfPixels) lowerIndex = 0;
+    if (upperIndex >= numberOfPixels) upperIndex = numberOfPixels - 1;
+
+    ThreadPool& pool = ThreadPool::GetGlobalInstance();
+    const size_t chunkSize = 1 << 16;
+    const size_t numberOfChunks = ThreadPool::ComputeNumberOfChunks(numberOfPixels, chunkSize);
+
+    // 1. min/max (分块结果按序合并)
+    std::vector<float> chunkMin(numberOfChunks);
+    std::vector<float> chunkMax(numberOfChunks);
+    pool.ParallelFor(numberOfPixels, chunkSize,
+        [&](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            float minValue = buffer[begin];
+            float maxValue = buffer[begin];
+            for (size_t i = begin + 1; i < end; ++i)
+            {
+                minValue = std::min(minValue, buffer[i]);
+                maxValue = std::max(maxValue, buffer[i]);
+            }
+            chunkMin[chunkIndex] = minValue;
+            chunkMax[chunkIndex] = maxValue;
+        });
+    const float minValue = *std::min_element(chunkMin.begin(), chunkMin.end());
+    const float maxValue = *std::max_element(chunkMax.begin(), chunkMax.end());
+    if (!(maxValue > minValue))
+    {
+        lowerThreshold = minValue;
+        upperThreshold = minValue;
+        return;
+    }
+
+    // 2. 直方图 (每个工作者一份, 计数与合并顺序无关)
+    const size_t numberOfBins = 1 << 16;
+    const double binScale = static_cast<double>(numberOfBins) / (static_cast<double>(maxValue) - minValue);
+    auto binOf = [minValue, binScale](float value) {
+        const size_t bin = static_cast<size_t>((static_cast<double>(value) - minValue) * binScale);
+        return std::min(bin, numberOfBins - 1);
+    };
+
+    const unsigned int numberOfWorkers = pool.GetNumberOfWorkers(0);
+    std::vector<std::vector<uint64_t>> workerHistograms(numberOfWorkers, std::vector<uint64_t>(numberOfBins, 0));
+    pool.ParallelFor(numberOfPixels, chunkSize,
+        [&](size_t, size_t begin, size_t end, unsigned int workerIndex) {
+            uint64_t* histogram = workerHistograms[workerIndex].data();
+            for (size_t i = begin; i < end; ++i)
+            {
+                ++histogram[binOf(buffer[i])];
+            }
+        });
+
+    // 定位目标序号所在的bin及其在bin内的序号
+    auto locate = [&](size_t rank, size_t& bin, size_t& rankInBin) {
+        uint64_t cumulative = 0;
+        for (bin = 0; bin < numberOfBins; ++bin)
+        {
+            uint64_t count = 0;
+            for (const auto& histogram : workerHistograms)
+            {
+                count += histogram[bin];
+            }
+            if (rank < cumulative + count)
+            {
+                rankInBin = static_cast<size_t>(rank - cumulative);
+                return;
+            }
+            cumulative += count;
+        }
+        bin = numberOfBins - 1;
+        rankInBin = 0;
+    };
+    size_t lowerBin = 0, lowerRankInBin = 0;
+    size_t upperBin = 0, upperRankInBin = 0;
+    locate(lowerIndex, lowerBin, lowerRankInBin);
+    locate(upperIndex, upperBin, upperRankInBin);
+
+    // 3. 收集两个目标bin内的值 (分块内保持顺序, 结果与线程数无关)
+    std::vector<std::vector<float>> chunkLower(numberOfChunks);
+    std::vector<std::vector<float>> chunkUpper(numberOfChunks);
+    pool.ParallelFor(numberOfPixels, chunkSize,
+        [&](size_t chunkIndex, size_t begin, size_t end, unsigned int) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t bin = binOf(buffer[i]);
+                if (bin == lowerBin) chunkLower[chunkIndex].push_back(buffer[i]);
+                if (bin == upperBin) chunkUpper[chunkIndex].push_back(buffer[i]);
+            }
+        });
+
+    auto select = [](std::vector<std::vector<float>>& chunks, size_t rankInBin) {
+        std::vector<float> values;
+        for (auto& chunk : chunks)
+        {
+            values.insert(values.end(), chunk.begin(), chunk.end());
+            std::vector<float>().swap(chunk);
+        }
+        std::nth_element(values.begin(), values.begin() + rankInBin, values.end());
+        return values[rankInBin];
+    };
+    lowerThreshold = select(chunkLower, lowerRankInBin);
+    upperThreshold = select(chunkUpper, upperRankInBin);
+}
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::WinsorizeImage(ImageType::Pointer image, double lowerQuantile, double upperQuantile)
+{
+    // ANTs风格的Winsorizing: 将强度截断在指定分位数之间
+    // 这能极大提高MI对软组织的敏感度,忽略骨骼高亮或背景噪声
+    float lowerThreshold = 0.0f;
+    float upperThreshold = 0.0f;
+    ComputeQuantileThresholds(image.GetPointer(), lowerQuantile, upperQuantile, lowerThreshold, upperThreshold);
+
+    // 创建输出图像并并行截断
+    auto output = ImageType::New();
+    output->SetRegions(image->GetLargestPossibleRegion());
+    output->SetSpacing(image->GetSpacing());
+    output->SetOrigin(image->GetOrigin());
+    output->SetDirection(image->GetDirection());
+    output->Allocate();
+
+    const float* input = image->GetBufferPointer();
+    float* result = output->GetBufferPointer();
+    const size_t numberOfPixels = image->GetBufferedRegion().GetNumberOfPixels();
+    ThreadPool::GetGlobalInstance().ParallelFor(numberOfPixels, 1 << 16,
+        [&](size_t, size_t begin, size_t end, unsigned int) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                float value = input[i];
+                if (value < lowerThreshold)
+                    value = lowerThreshold;
+                else if (value > upperThreshold)
+                    value = upperThreshold;
+                result[i] = value;
+            }
+        });
+
+    return output;
+}
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::SmoothImage(ImageType::Pointer image, double sigma)
+{
+    if (sigma <= 0.0)
+    {
+        return image;
+    }
+
+    using SmoothingFilterType = itk::SmoothingRecursiveGaussianImageFilter<ImageType, ImageType>;
+    auto smoothFilter = SmoothingFilterType::New();
+    smoothFilter->SetInput(image);
+    smoothFilter->SetSigma(sigma);
+    smoothFilter->Update();
+    return smoothFilter->GetOutput();
+}
+
+MultiResolutionPyramid::ImageType::Pointer MultiResolutionPyramid::ShrinkImage(ImageType::Pointer image, unsigned int factor)
+{
+    if (factor <= 1)
+    {
+        return image;
+    }
+
+    using ShrinkFilterType = itk::ShrinkImageFilter<ImageType, ImageType>;
+    auto shrinkFilter = ShrinkFilterType::New();
+    shrinkFilter->SetInput(image);
+    shrinkFilter->SetShrinkFactors(factor);
+    shrinkFilter->Update();
+    return shrinkFilter->GetOutput();
+}
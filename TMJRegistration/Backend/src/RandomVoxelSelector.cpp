@@ -0,0 +1,131 @@
+#include "RandomVoxelSelector.h"
+#include <algorithm>
+#include <unordered_set>
+
+// ============================================================================
+// 无放回序号选择
+// ============================================================================
+
+void RandomVoxelSelector::SelectDistinct(uint64_t populationSize, uint64_t count,
+                                         GeneratorType& generator, std::vector<uint64_t>& selected)
+{
+    selected.clear();
+    count = std::min(count, populationSize);
+    if (count == 0)
+    {
+        return;
+    }
+    selected.reserve(count);
+
+    if (count * 4 >= populationSize)
+    {
+        // 稠密: 顺序选择 (算法S), 第i个序号以 剩余需要数/剩余候选数 的概率入选
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
+        uint64_t remaining = count;
+        for (uint64_t i = 0; i < populationSize && remaining > 0; ++i)
+        {
+            if (static_cast<double>(populationSize - i) * distribution(generator) < static_cast<double>(remaining))
+            {
+                selected.push_back(i);
+                --remaining;
+            }
+        }
+        return;
+    }
+
+    // 稀疏: Floyd 算法, 每步恰好一次随机数, 无拒绝重试
+    std::unordered_set<uint64_t> chosen;
+    chosen.reserve(static_cast<size_t>(count) * 2);
+    for (uint64_t j = populationSize - count; j < populationSize; ++j)
+    {
+        std::uniform_int_distribution<uint64_t> distribution(0, j);
+        const uint64_t t = distribution(generator);
+        if (!chosen.insert(t).second)
+        {
+            chosen.insert(j);
+        }
+    }
+
+    selected.assign(chosen.begin(), chosen.end());
+    std::sort(selected.begin(), selected.end());
+}
+
+// ============================================================================
+// 区域内体素选择
+// ============================================================================
+
+void RandomVoxelSelector::SelectVoxels(const RegionType& region, uint64_t count,
+                                       GeneratorType& generator, std::vector<IndexType>& indices)
+{
+    const uint64_t numberOfVoxels = static_cast<uint64_t>(region.GetSize(0))
+                                  * region.GetSize(1) * region.GetSize(2);
+
+    std::vector<uint64_t> selected;
+    SelectDistinct(numberOfVoxels, count, generator, selected);
+
+    indices.resize(selected.size());
+    for (size_t i = 0; i < selected.size(); ++i)
+    {
+        indices[i] = LinearToIndex(region, selected[i]);
+    }
+}
+
+void RandomVoxelSelector::SelectVoxels(const MaskBitmap& mask, const RegionType& restrictRegion, uint64_t count,
+                                       GeneratorType& generator, std::vector<IndexType>& indices)
+{
+    indices.clear();
+
+    // 把行程裁剪到限制区域, 重新累计序号
+    struct ClippedRun
+    {
+        IndexType start;
+        uint64_t length;
+        uint64_t rank;
+    };
+    std::vector<ClippedRun> runs;
+    runs.reserve(mask.GetRuns().size());
+
+    const long xBegin = restrictRegion.GetIndex(0);
+    const long xEnd = xBegin + static_cast<long>(restrictRegion.GetSize(0));
+    uint64_t total = 0;
+    for (const MaskBitmap::Run& run : mask.GetRuns())
+    {
+        IndexType rowIndex = run.start;
+        rowIndex[0] = xBegin;
+        if (restrictRegion.GetSize(0) == 0 || !restrictRegion.IsInside(rowIndex))
+        {
+            continue;
+        }
+
+        const long begin = std::max(xBegin, static_cast<long>(run.start[0]));
+        const long end = std::min(xEnd, static_cast<long>(run.start[0] + run.length));
+        if (end <= begin)
+        {
+            continue;
+        }
+
+        ClippedRun clipped;
+        clipped.start = run.start;
+        clipped.start[0] = begin;
+        clipped.length = static_cast<uint64_t>(end - begin);
+        clipped.rank = total;
+        total += clipped.length;
+        runs.push_back(clipped);
+    }
+
+    std::vector<uint64_t> selected;
+    SelectDistinct(total, count, generator, selected);
+
+    // selected 升序, 与行程顺序同步推进
+    indices.resize(selected.size());
+    size_t runIndex = 0;
+    for (size_t i = 0; i < selected.size(); ++i)
+    {
+        while (selected[i] >= runs[runIndex].rank + runs[runIndex].length)
+        {
+            ++runIndex;
+        }
+        indices[i] = runs[runIndex].start;
+        indices[i][0] += static_cast<long>(selected[i] - runs[runIndex].rank);
+    }
+}
@@ -0,0 +1,519 @@
+#include "RegistrationServer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <itkImageFileReader.h>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+// 服务中的特征缓存跨请求保留, 容量大于单次配准的默认值
+// (每幅图像每层一项: 若干固定/移动图像 × 多分辨率层级)
+const size_t ServerFeatureCacheEntries = 48;
+
+std::string FormatDouble(double value)
+{
+    // JSON 没有 NaN/Inf (例如没有运行任何层级时的度量值)
+    if (!std::isfinite(value))
+    {
+        return "null";
+    }
+    std::ostringstream stream;
+    stream << std::setprecision(10) << value;
+    return stream.str();
+}
+
+InitializationMode ParseInitializationMode(const std::string& mode)
+{
+    if (mode == "moments")
+    {
+        return InitializationMode::Moments;
+    }
+    if (mode == "geometry")
+    {
+        return InitializationMode::Geometry;
+    }
+    throw std::runtime_error("Invalid initMode: " + mode + " (use 'geometry' or 'moments')");
+}
+
+} // namespace
+
+// ============================================================================
+// 构造函数
+// ============================================================================
+
+RegistrationServer::RegistrationServer()
+    : m_FeatureCache(std::make_shared<MINDMetric::SharedFeatureCache>(ServerFeatureCacheEntries))
+    , m_MaximumNumberOfCachedImages(DefaultMaximumNumberOfCachedImages)
+    , m_UseCounter(0)
+    , m_NumberOfRequests(0)
+    , m_Verbose(false)
+{
+}
+
+// ============================================================================
+// 服务循环
+// ============================================================================
+
+int RegistrationServer::ServeStream(std::istream& input, std::ostream& output)
+{
+    output << "{\"status\": \"ready\"}" << std::endl;
+
+    std::string line;
+    bool shutdownRequested = false;
+    while (!shutdownRequested && std::getline(input, line))
+    {
+        if (ConfigManager::Trim(line).empty())
+        {
+            continue;
+        }
+        // 每条响应立即刷新, 调用方按行读取
+        output << HandleRequest(line, shutdownRequested) << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+int RegistrationServer::ServeSocket(const std::string& socketPath)
+{
+#ifdef _WIN32
+    std::cerr << "[Server] UNIX domain sockets are not supported on this platform, use stdin/stdout: "
+              << socketPath << std::endl;
+    return EXIT_FAILURE;
+#else
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "[Server] Socket path too long: " << socketPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    const int listenSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket < 0)
+    {
+        std::cerr << "[Server] socket() failed: " << std::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    ::unlink(socketPath.c_str());   // 上次异常退出留下的套接字文件
+    if (::bind(listenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::listen(listenSocket, 4) < 0)
+    {
+        std::cerr << "[Server] Failed to listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        ::close(listenSocket);
+        return EXIT_FAILURE;
+    }
+    std::cout << "[Server] Listening on " << socketPath << std::endl;
+
+    auto sendLine = [](int connection, const std::string& text) {
+        const std::string data = text + "\n";
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            const ssize_t n = ::send(connection, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    };
+
+    // 连接依次服务: 请求本来就逐个执行, 缓存在连接之间保留
+    bool shutdownRequested = false;
+    while (!shutdownRequested)
+    {
+        const int connection = ::accept(listenSocket, nullptr, nullptr);
+        if (connection < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "[Server] accept() failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+
+        bool connected = sendLine(connection, "{\"status\": \"ready\"}");
+        std::string buffer;
+        char chunk[4096];
+        while (connected && !shutdownRequested)
+        {
+            const ssize_t n = ::recv(connection, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+            {
+                break;
+            }
+            buffer.append(chunk, static_cast<size_t>(n));
+
+            size_t newline;
+            while (connected && !shutdownRequested && (newline = buffer.find('\n')) != std::string::npos)
+            {
+                const std::string line = buffer.substr(0, newline);
+                buffer.erase(0, newline + 1);
+                if (!ConfigManager::Trim(line).empty())
+                {
+                    connected = sendLine(connection, HandleRequest(line, shutdownRequested));
+                }
+            }
+        }
+        ::close(connection);
+    }
+
+    ::close(listenSocket);
+    ::unlink(socketPath.c_str());
+    return EXIT_SUCCESS;
+#endif
+}
+
+// ============================================================================
+// 请求分发
+// ============================================================================
+
+std::string RegistrationServer::HandleRequest(const std::string& request, bool& shutdownRequested)
+{
+    const std::string id = ConfigManager::ExtractValue(request, "id");
+    const std::string command = GetString(request, "command");
+    ++m_NumberOfRequests;
+
+    if (m_Verbose)
+    {
+        std::cout << "[Server] Request " << (id.empty() ? "-" : id) << ": " << command << std::endl;
+    }
+
+    try
+    {
+        if (request.find('{') == std::string::npos)
+        {
+            throw std::runtime_error("Request is not a JSON object");
+        }
+        if (command == "register")
+        {
+            return HandleRegister(request, id);
+        }
+        if (command == "evaluate")
+        {
+            return HandleEvaluate(request, id);
+        }
+        if (command == "status")
+        {
+            return HandleStatus(id);
+        }
+        if (command == "clear")
+        {
+            ClearCaches();
+            return "{\"id\": \"" + ConfigManager::EscapeString(id) + "\", \"status\": \"ok\"}";
+        }
+        if (command == "shutdown")
+        {
+            shutdownRequested = true;
+            return "{\"id\": \"" + ConfigManager::EscapeString(id) + "\", \"status\": \"ok\"}";
+        }
+        throw std::runtime_error("Unknown command: '" + command + "'");
+    }
+    catch (const itk::ExceptionObject& e)
+    {
+        return ErrorResponse(id, std::string("ITK: ") + e.what());
+    }
+    catch (const std::exception& e)
+    {
+        return ErrorResponse(id, e.what());
+    }
+}
+
+std::string RegistrationServer::GetString(const std::string& request, const std::string& key)
+{
+    return ConfigManager::UnescapeString(ConfigManager::ExtractValue(request, key));
+}
+
+std::string RegistrationServer::ErrorResponse(const std::string& id, const std::string& message)
+{
+    std::cerr << "[Server] Request failed: " << message << std::endl;
+    return "{\"id\": \"" + ConfigManager::EscapeString(id) + "\", \"status\": \"error\", \"message\": \"" +
+           ConfigManager::EscapeString(message) + "\"}";
+}
+
+// ============================================================================
+// 缓存
+// ============================================================================
+
+RegistrationServer::FileStamp RegistrationServer::GetFileStamp(const std::string& path)
+{
+    if (!fs::exists(path))
+    {
+        throw std::runtime_error("File not found: " + path);
+    }
+    FileStamp stamp;
+    stamp.writeTime = fs::last_write_time(path);
+    stamp.size = fs::file_size(path);
+    return stamp;
+}
+
+RegistrationServer::CachedImage& RegistrationServer::AcquireImage(const std::string& path)
+{
+    const FileStamp stamp = GetFileStamp(path);
+    ++m_UseCounter;
+
+    auto found = m_Images.find(path);
+    if (found != m_Images.end() && found->second.stamp == stamp)
+    {
+        found->second.lastUse = m_UseCounter;
+        return found->second;
+    }
+
+    // 未缓存或文件已改写: 重新读取, 金字塔随之重建
+    std::cout << "[Server] Loading image: " << path << std::endl;
+    auto reader = itk::ImageFileReader<ImageType>::New();
+    reader->SetFileName(path);
+    reader->Update();
+
+    CachedImage entry;
+    entry.stamp = stamp;
+    entry.image = reader->GetOutput();
+    entry.image->DisconnectPipeline();
+    entry.pyramid = std::make_shared<MultiResolutionPyramid>();
+    entry.lastUse = m_UseCounter;
+
+    // 淘汰最久未用的图像 (其特征项随后在特征缓存中被替换)
+    while (found == m_Images.end() && !m_Images.empty() && m_Images.size() >= m_MaximumNumberOfCachedImages)
+    {
+        auto oldest = std::min_element(m_Images.begin(), m_Images.end(),
+                                       [](const auto& a, const auto& b) { return a.second.lastUse < b.second.lastUse; });
+        std::cout << "[Server] Evicting cached image: " << oldest->first << std::endl;
+        m_Images.erase(oldest);
+    }
+
+    CachedImage& cached = m_Images[path];
+    cached = std::move(entry);
+    return cached;
+}
+
+const ImageRegistration& RegistrationServer::AcquireFixedReference(const std::string& fixedPath, const std::string& maskPath)
+{
+    CachedImage& fixed = AcquireImage(fixedPath);
+    const FileStamp maskStamp = maskPath.empty() ? FileStamp() : GetFileStamp(maskPath);
+
+    const std::string key = fixedPath + "\n" + maskPath;
+    auto found = m_FixedReferences.find(key);
+    if (found != m_FixedReferences.end() &&
+        found->second.fixedImage == fixed.image && found->second.maskStamp == maskStamp)
+    {
+        found->second.lastUse = m_UseCounter;
+        return *found->second.reference;
+    }
+
+    auto reference = std::make_unique<ImageRegistration>();
+    reference->SetFixedImage(fixed.image);
+    reference->SetFixedPyramid(fixed.pyramid);
+    if (!maskPath.empty() && !reference->LoadFixedMask(maskPath))
+    {
+        throw std::runtime_error("Failed to load fixed mask: " + maskPath);
+    }
+
+    // 与图像缓存同样的上限; 固定参考只持有图像的引用, 掩膜是主要开销
+    while (found == m_FixedReferences.end() && !m_FixedReferences.empty() &&
+           m_FixedReferences.size() >= m_MaximumNumberOfCachedImages)
+    {
+        auto oldest = std::min_element(m_FixedReferences.begin(), m_FixedReferences.end(),
+                                       [](const auto& a, const auto& b) { return a.second.lastUse < b.second.lastUse; });
+        m_FixedReferences.erase(oldest);
+    }
+
+    FixedReference& entry = m_FixedReferences[key];
+    entry.fixedImage = fixed.image;
+    entry.maskStamp = maskStamp;
+    entry.reference = std::move(reference);
+    entry.lastUse = m_UseCounter;
+    return *entry.reference;
+}
+
+void RegistrationServer::ClearCaches()
+{
+    m_FixedReferences.clear();
+    m_Images.clear();
+    m_FeatureCache->Clear();
+    std::cout << "[Server] Caches cleared" << std::endl;
+}
+
+void RegistrationServer::PrepareRegistration(ImageRegistration& registration, const std::string& request)
+{
+    const std::string fixedPath = GetString(request, "fixed");
+    const std::string movingPath = GetString(request, "moving");
+    if (fixedPath.empty() || movingPath.empty())
+    {
+        throw std::runtime_error("Request requires 'fixed' and 'moving'");
+    }
+
+    registration.SetVerbose(m_Verbose);
+    registration.ShareFixedResources(AcquireFixedReference(fixedPath, GetString(request, "fixedMask")));
+
+    // 移动图像的金字塔和MIND特征同样跨请求保留
+    CachedImage& moving = AcquireImage(movingPath);
+    registration.SetMovingImage(moving.image);
+    registration.SetMovingPyramid(moving.pyramid);
+    registration.SetSharedMovingMINDFeatureCache(m_FeatureCache);
+}
+
+// ============================================================================
+// 命令
+// ============================================================================
+
+std::string RegistrationServer::HandleRegister(const std::string& request, const std::string& id)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    const std::string outputFolder = GetString(request, "output");
+    if (outputFolder.empty())
+    {
+        throw std::runtime_error("register requires 'output'");
+    }
+
+    ConfigManager configManager;
+    const std::string configPath = GetString(request, "config");
+    if (!configPath.empty() && !configManager.LoadFromFile(configPath))
+    {
+        throw std::runtime_error("Failed to load config: " + configPath);
+    }
+    const std::string transformType = GetString(request, "transformType");
+    if (!transformType.empty())
+    {
+        configManager.SetTransformType(transformType);
+    }
+    const ConfigManager::RegistrationConfig& config = configManager.GetConfig();
+
+    ImageRegistration registration;
+    registration.LoadFromConfig(config);
+    const std::string sampling = ConfigManager::ExtractValue(request, "samplingPercentage");
+    if (!sampling.empty())
+    {
+        registration.SetSamplingPercentage(std::stod(sampling));
+    }
+    const std::string initMode = GetString(request, "initMode");
+    if (!initMode.empty())
+    {
+        registration.SetInitializationMode(ParseInitializationMode(initMode));
+    }
+    PrepareRegistration(registration, request);
+
+    const std::string initialPath = GetString(request, "initial");
+    if (!initialPath.empty() && !registration.LoadInitialTransform(initialPath))
+    {
+        throw std::runtime_error("Failed to load initial transform: " + initialPath);
+    }
+
+    registration.RunConfigured(config);
+    const std::string transformPath = registration.SaveFinalTransform(outputFolder);
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double elapsed = std::chrono::duration<double>(end - start).count();
+
+    const bool affine = registration.GetResultTransformType() == ConfigManager::TransformType::Affine;
+    const auto parameters = affine ? registration.GetAffineTransform()->GetParameters()
+                                   : registration.GetRigidTransform()->GetParameters();
+
+    std::ostringstream response;
+    response << "{\"id\": \"" << ConfigManager::EscapeString(id) << "\", \"status\": \"ok\""
+             << ", \"transformPath\": \"" << ConfigManager::EscapeString(transformPath) << "\""
+             << ", \"transformType\": \"" << ConfigManager::TransformTypeToString(registration.GetResultTransformType()) << "\""
+             << ", \"metricValue\": " << FormatDouble(registration.GetFinalMetricValue())
+             << ", \"elapsedTime\": " << FormatDouble(elapsed)
+             << ", \"parameters\": [";
+    for (unsigned int i = 0; i < parameters.GetSize(); ++i)
+    {
+        response << (i > 0 ? ", " : "") << FormatDouble(parameters[i]);
+    }
+    response << "]}";
+    return response.str();
+}
+
+std::string RegistrationServer::HandleEvaluate(const std::string& request, const std::string& id)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    const std::string transformPath = GetString(request, "transform");
+    if (transformPath.empty())
+    {
+        throw std::runtime_error("evaluate requires 'transform'");
+    }
+
+    // 与 --evaluate 相同: 默认使用 config/Evaluation.json, 不存在时使用内置评估配置
+    ConfigManager configManager;
+    std::string configPath = GetString(request, "config");
+    if (configPath.empty() && fs::exists("config/Evaluation.json"))
+    {
+        configPath = "config/Evaluation.json";
+    }
+    if (configPath.empty())
+    {
+        configManager.GetConfig() = ConfigManager::CreateEvaluationConfig();
+    }
+    else if (!configManager.LoadFromFile(configPath))
+    {
+        throw std::runtime_error("Failed to load config: " + configPath);
+    }
+
+    ImageRegistration registration;
+    registration.LoadFromConfig(configManager.GetConfig());
+    const std::string sampling = ConfigManager::ExtractValue(request, "samplingPercentage");
+    if (!sampling.empty())
+    {
+        registration.SetSamplingPercentage(std::stod(sampling));
+    }
+    PrepareRegistration(registration, request);
+
+    if (!registration.LoadInitialTransform(transformPath))
+    {
+        throw std::runtime_error("Failed to load transform: " + transformPath);
+    }
+    registration.Update();
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double elapsed = std::chrono::duration<double>(end - start).count();
+
+    std::ostringstream response;
+    response << "{\"id\": \"" << ConfigManager::EscapeString(id) << "\", \"status\": \"ok\""
+             << ", \"metricValue\": " << FormatDouble(registration.GetFinalMetricValue())
+             << ", \"elapsedTime\": " << FormatDouble(elapsed) << "}";
+    return response.str();
+}
+
+std::string RegistrationServer::HandleStatus(const std::string& id)
+{
+    const auto tiles = m_FeatureCache->GetTileStatistics();
+    std::ostringstream response;
+    response << "{\"id\": \"" << ConfigManager::EscapeString(id) << "\", \"status\": \"ok\""
+             << ", \"requests\": " << m_NumberOfRequests
+             << ", \"cachedImages\": " << m_Images.size()
+             << ", \"cachedFixedReferences\": " << m_FixedReferences.size()
+             << ", \"cachedFeatureEntries\": " << m_FeatureCache->GetNumberOfEntries()
+             << ", \"featureTiles\": {\"resident\": " << tiles.residentTiles
+             << ", \"total\": " << tiles.totalTiles
+             << ", \"residentBytes\": " << tiles.residentBytes
+             << ", \"hits\": " << tiles.hits
+             << ", \"misses\": " << tiles.misses
+             << ", \"evictions\": " << tiles.evictions << "}"
+             << ", \"images\": [";
+    bool first = true;
+    for (const auto& entry : m_Images)
+    {
+        response << (first ? "" : ", ") << "\"" << ConfigManager::EscapeString(entry.first) << "\"";
+        first = false;
+    }
+    response << "]}";
+    return response.str();
+}
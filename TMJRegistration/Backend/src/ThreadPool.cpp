@@ -0,0 +1,242 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+// ============================================================================
+// 全局实例
+// ============================================================================
+
+namespace
+{
+    std::mutex s_GlobalPoolMutex;
+    std::unique_ptr<ThreadPool> s_GlobalPool;
+    unsigned int s_GlobalNumberOfThreads = 0;  // 0 = hardware_concurrency
+
+    unsigned int ResolveNumberOfThreads(unsigned int requested)
+    {
+        if (requested > 0)
+        {
+            return requested;
+        }
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        return (hardwareThreads > 0) ? hardwareThreads : 1;
+    }
+}
+
+ThreadPool& ThreadPool::GetGlobalInstance()
+{
+    std::lock_guard<std::mutex> lock(s_GlobalPoolMutex);
+    if (!s_GlobalPool)
+    {
+        s_GlobalPool = std::make_unique<ThreadPool>(ResolveNumberOfThreads(s_GlobalNumberOfThreads));
+    }
+    return *s_GlobalPool;
+}
+
+void ThreadPool::SetGlobalNumberOfThreads(unsigned int numberOfThreads)
+{
+    std::lock_guard<std::mutex> lock(s_GlobalPoolMutex);
+    s_GlobalNumberOfThreads = numberOfThreads;
+
+    // 已创建且大小不同时重建 (只应在没有任务运行时调用)
+    if (s_GlobalPool && s_GlobalPool->GetNumberOfThreads() != ResolveNumberOfThreads(numberOfThreads))
+    {
+        s_GlobalPool.reset();
+        s_GlobalPool = std::make_unique<ThreadPool>(ResolveNumberOfThreads(numberOfThreads));
+    }
+}
+
+unsigned int ThreadPool::GetGlobalNumberOfThreads()
+{
+    std::lock_guard<std::mutex> lock(s_GlobalPoolMutex);
+    if (s_GlobalPool)
+    {
+        return s_GlobalPool->GetNumberOfThreads();
+    }
+    return ResolveNumberOfThreads(s_GlobalNumberOfThreads);
+}
+
+// ============================================================================
+// 构造函数和析构函数
+// ============================================================================
+
+ThreadPool::ThreadPool(unsigned int numberOfThreads)
+    : m_NumberOfThreads(std::max(1u, numberOfThreads))
+    , m_Stop(false)
+{
+    // 调用线程占用一个槽位, 只需创建 N-1 个后台线程
+    m_Threads.reserve(m_NumberOfThreads - 1);
+    for (unsigned int t = 1; t < m_NumberOfThreads; ++t)
+    {
+        m_Threads.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_WorkAvailable.notify_all();
+
+    for (auto& thread : m_Threads)
+    {
+        thread.join();
+    }
+}
+
+// ============================================================================
+// 任务调度
+// ============================================================================
+
+size_t ThreadPool::ComputeNumberOfChunks(size_t numberOfItems, size_t chunkSize)
+{
+    chunkSize = std::max<size_t>(1, chunkSize);
+    return (numberOfItems + chunkSize - 1) / chunkSize;
+}
+
+unsigned int ThreadPool::GetNumberOfWorkers(unsigned int maxWorkers) const
+{
+    if (maxWorkers == 0 || maxWorkers > m_NumberOfThreads)
+    {
+        return m_NumberOfThreads;
+    }
+    return maxWorkers;
+}
+
+std::shared_ptr<ThreadPool::Job> ThreadPool::FindAvailableJob() const
+{
+    // 调用方持有 m_Mutex
+    // 多个调用方并发提交时 (批处理中同时运行的多个配准), 加入当前执行线程最少的任务,
+    // 使空闲线程在各任务间均摊, 而不是全部堆到最早提交的任务上
+    std::shared_ptr<Job> selected;
+    for (const auto& job : m_Jobs)
+    {
+        if (job->joinedWorkers < job->maxWorkers &&
+            job->nextChunk.load(std::memory_order_relaxed) < job->numberOfChunks &&
+            (!selected || job->activeWorkers < selected->activeWorkers))
+        {
+            selected = job;
+        }
+    }
+    return selected;
+}
+
+void ThreadPool::RunChunks(Job& job, unsigned int workerIndex)
+{
+    // 动态领取分块, 直到全部分块被领完
+    while (true)
+    {
+        const size_t chunkIndex = job.nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunkIndex >= job.numberOfChunks)
+        {
+            break;
+        }
+
+        const size_t begin = chunkIndex * job.chunkSize;
+        const size_t end = std::min(job.numberOfItems, begin + job.chunkSize);
+
+        try
+        {
+            (*job.function)(chunkIndex, begin, end, workerIndex);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(job.exceptionMutex);
+            if (!job.exception)
+            {
+                job.exception = std::current_exception();
+            }
+            // 放弃剩余分块
+            job.nextChunk.store(job.numberOfChunks, std::memory_order_relaxed);
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true)
+    {
+        std::shared_ptr<Job> job;
+        m_WorkAvailable.wait(lock, [this, &job]() {
+            if (m_Stop)
+            {
+                return true;
+            }
+            job = FindAvailableJob();
+            return job != nullptr;
+        });
+
+        if (m_Stop)
+        {
+            return;
+        }
+
+        const unsigned int workerIndex = job->joinedWorkers++;
+        ++job->activeWorkers;
+
+        lock.unlock();
+        RunChunks(*job, workerIndex);
+        lock.lock();
+
+        if (--job->activeWorkers == 0)
+        {
+            m_JobFinished.notify_all();
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(size_t numberOfItems, size_t chunkSize,
+                             const ChunkFunctionType& func, unsigned int maxWorkers)
+{
+    chunkSize = std::max<size_t>(1, chunkSize);
+    const size_t numberOfChunks = ComputeNumberOfChunks(numberOfItems, chunkSize);
+    if (numberOfChunks == 0)
+    {
+        return;
+    }
+
+    const unsigned int numberOfWorkers = static_cast<unsigned int>(
+        std::min<size_t>(GetNumberOfWorkers(maxWorkers), numberOfChunks));
+
+    // 单工作者: 在调用线程中直接执行, 不经过队列
+    if (numberOfWorkers <= 1 || m_Threads.empty())
+    {
+        for (size_t chunkIndex = 0; chunkIndex < numberOfChunks; ++chunkIndex)
+        {
+            const size_t begin = chunkIndex * chunkSize;
+            func(chunkIndex, begin, std::min(numberOfItems, begin + chunkSize), 0);
+        }
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->function = &func;
+    job->numberOfItems = numberOfItems;
+    job->chunkSize = chunkSize;
+    job->numberOfChunks = numberOfChunks;
+    job->maxWorkers = numberOfWorkers;
+    job->joinedWorkers = 1;  // 槽位0留给调用线程
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Jobs.push_back(job);
+    }
+    m_WorkAvailable.notify_all();
+
+    // 调用线程参与计算
+    RunChunks(*job, 0);
+
+    // 从队列移除(不再接受新的工作者), 等待已加入的后台线程完成
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Jobs.erase(std::remove(m_Jobs.begin(), m_Jobs.end(), job), m_Jobs.end());
+        m_JobFinished.wait(lock, [&job]() { return job->activeWorkers == 0; });
+    }
+
+    if (job->exception)
+    {
+        std::rethrow_exception(job->exception);
+    }
+}
@@ -0,0 +1,91 @@
+#include "TrilinearSampler.h"
+#include <cmath>
+#include <stdexcept>
+
+// ============================================================================
+// 构造函数
+// ============================================================================
+
+TrilinearSampler::TrilinearSampler()
+    : m_Initialized(false)
+    , m_NumberOfPixels(0)
+{
+    for (int d = 0; d < 3; ++d)
+    {
+        m_Origin[d] = 0.0;
+        m_StartIndex[d] = 0.0;
+        m_Size[d] = 0;
+        m_Stride[d] = 0;
+        for (int j = 0; j < 3; ++j)
+        {
+            m_PhysicalToIndex[d][j] = (d == j) ? 1.0 : 0.0;
+        }
+    }
+}
+
+// ============================================================================
+// 几何设置
+// ============================================================================
+
+void TrilinearSampler::SetImage(const ImageType* image)
+{
+    if (!image)
+    {
+        throw std::runtime_error("TrilinearSampler: image is null");
+    }
+
+    // 与插值器一致, 使用缓冲区域 (GetBufferPointer 指向该区域的起点)
+    const auto& region = image->GetBufferedRegion();
+    const auto& origin = image->GetOrigin();
+    const auto& physicalToIndex = image->GetPhysicalPointToIndex();
+
+    size_t stride = 1;
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        m_Origin[d] = origin[d];
+        m_StartIndex[d] = static_cast<double>(region.GetIndex(d));
+        m_Size[d] = static_cast<long>(region.GetSize(d));
+        m_Stride[d] = stride;
+        stride *= region.GetSize(d);
+
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            m_PhysicalToIndex[d][j] = physicalToIndex(d, j);
+        }
+    }
+
+    m_NumberOfPixels = stride;
+    m_Initialized = (m_NumberOfPixels > 0);
+}
+
+bool TrilinearSampler::HasSameGeometry(const ImageType* image) const
+{
+    if (!image || !m_Initialized)
+    {
+        return false;
+    }
+
+    const auto& region = image->GetBufferedRegion();
+    const auto& origin = image->GetOrigin();
+    const auto& physicalToIndex = image->GetPhysicalPointToIndex();
+    const double tolerance = 1e-9;
+
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        if (static_cast<long>(region.GetSize(d)) != m_Size[d] ||
+            static_cast<double>(region.GetIndex(d)) != m_StartIndex[d] ||
+            std::abs(origin[d] - m_Origin[d]) > tolerance)
+        {
+            return false;
+        }
+        for (unsigned int j = 0; j < 3; ++j)
+        {
+            if (std::abs(physicalToIndex(d, j) - m_PhysicalToIndex[d][j]) > tolerance)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,679 @@
+/**
+ * @brief 度量性能基准程序 - 线程扩展性测试
+ *
+ * 在合成体数据上重复评估 Mattes MI 的值和梯度, 对不同线程数统计:
+ * - 每次评估的总耗时和加速比
+ * - 采样点累加阶段 / 直方图合并归一化阶段各自的耗时
+ * 用于确认合并阶段不会随线程数增长而成为瓶颈。
+ * 另外在单线程和线程池满载时对比显式PDF导数模式与两遍模式的耗时、导数缓冲区内存和梯度差异,
+ * 以及直接构建与递归构建金字塔的耗时和输出差异。
+ * MIND-SSD 同样按线程数统计值、梯度和 Gauss-Newton 正规方程组装的耗时,
+ * 并与物化雅可比矩阵的旧组装路径对比。
+ * 最后在多种分布和体素数上校验截断分位数与全排序结果逐位相同 (不一致时返回非零)。
+ *
+ * 使用方法：
+ * BenchmarkMetric [size=128] [iterations=20] [bins=50] [samplingPercentage=0.10] [maxThreads=0]
+ *
+ * maxThreads=0 表示使用 hardware_concurrency
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <random>
+#include <cstring>
+#include "itkImage.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkEuler3DTransform.h"
+#include "itkLinearInterpolateImageFunction.h"
+#include "MattesMutualInformation.h"
+#include "MINDMetric.h"
+#include "MultiResolutionPyramid.h"
+#include "ThreadPool.h"
+
+using ImageType = itk::Image<float, 3>;
+using TransformType = itk::Euler3DTransform<double>;
+
+// ============================================================================
+// 合成数据
+// ============================================================================
+
+// 平滑体模: 若干高斯团块叠加在椭球背景上, 移动图像为平移+强度非线性映射版本
+static ImageType::Pointer CreatePhantom(unsigned int size, double shift, bool remapIntensity)
+{
+    ImageType::Pointer image = ImageType::New();
+    ImageType::RegionType region;
+    ImageType::SizeType imageSize;
+    imageSize.Fill(size);
+    region.SetSize(imageSize);
+    image->SetRegions(region);
+    image->Allocate();
+
+    const double c = 0.5 * size;
+    const double blobs[4][4] = {
+        {0.35, 0.40, 0.50, 0.08},
+        {0.65, 0.55, 0.45, 0.10},
+        {0.50, 0.30, 0.60, 0.06},
+        {0.45, 0.65, 0.35, 0.07}
+    };
+
+    itk::ImageRegionIteratorWithIndex<ImageType> it(image, region);
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+        const ImageType::IndexType idx = it.GetIndex();
+        const double x = idx[0] - shift;
+        const double y = idx[1] - 0.5 * shift;
+        const double z = idx[2];
+
+        const double r2 = ((x - c) * (x - c) + (y - c) * (y - c)) / (0.40 * size * 0.40 * size)
+                        + (z - c) * (z - c) / (0.45 * size * 0.45 * size);
+        double value = (r2 < 1.0) ? 100.0 : 0.0;
+
+        for (const auto& b : blobs)
+        {
+            const double dx = x - b[0] * size, dy = y - b[1] * size, dz = z - b[2] * size;
+            const double s = b[3] * size;
+            value += 400.0 * std::exp(-(dx * dx + dy * dy + dz * dz) / (2.0 * s * s));
+        }
+
+        if (remapIntensity)
+        {
+            value = 1000.0 - 2.0 * value + 0.001 * value * value;
+        }
+        it.Set(static_cast<float>(value));
+    }
+
+    return image;
+}
+
+// ============================================================================
+// MI 线程扩展性
+// ============================================================================
+
+// 带轻微旋转和平移的刚体变换, 中心位于体数据中心
+static TransformType::Pointer CreateTestTransform(ImageType::Pointer fixedImage)
+{
+    TransformType::Pointer transform = TransformType::New();
+    ImageType::PointType center;
+    const auto size = fixedImage->GetLargestPossibleRegion().GetSize();
+    for (unsigned int d = 0; d < 3; ++d)
+    {
+        center[d] = 0.5 * (size[d] - 1);
+    }
+    transform->SetCenter(center);
+
+    TransformType::ParametersType params = transform->GetParameters();
+    params[0] = 0.02; params[1] = -0.01; params[2] = 0.015;
+    params[3] = 1.5;  params[4] = -0.5;  params[5] = 0.25;
+    transform->SetParameters(params);
+    return transform;
+}
+
+static void ConfigureMI(MattesMutualInformation& mi, ImageType::Pointer fixedImage, ImageType::Pointer movingImage,
+                        TransformType::Pointer transform, unsigned int bins, double samplingPercentage)
+{
+    mi.SetFixedImage(fixedImage);
+    mi.SetMovingImage(movingImage);
+    mi.SetTransform(transform);
+    mi.SetNumberOfHistogramBins(bins);
+    mi.SetSamplingPercentage(samplingPercentage);
+    mi.SetNumberOfParameters(6);
+    mi.SetUseEvaluationCache(false);  // 每次都完整计算
+    mi.SetJacobianFunction([transform](const ImageType::PointType& point,
+                                       std::vector<std::array<double, 3>>& jacobian) {
+        TransformType::JacobianType j;
+        transform->ComputeJacobianWithRespectToParameters(point, j);
+        jacobian.resize(6);
+        for (unsigned int k = 0; k < 6; ++k)
+        {
+            jacobian[k] = {j(0, k), j(1, k), j(2, k)};
+        }
+    });
+}
+
+static void BenchmarkMIThreadScaling(ImageType::Pointer fixedImage, ImageType::Pointer movingImage,
+                                     unsigned int iterations, unsigned int bins,
+                                     double samplingPercentage, unsigned int maxThreads)
+{
+    TransformType::Pointer transform = CreateTestTransform(fixedImage);
+
+    MattesMutualInformation mi;
+    ConfigureMI(mi, fixedImage, movingImage, transform, bins, samplingPercentage);
+    mi.Initialize();
+    mi.GetValue();
+
+    std::cout << "\n=== Mattes MI value+derivative, " << bins << " bins, "
+              << mi.GetNumberOfValidSamples() << " valid samples ===" << std::endl;
+
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int t = 1; t < maxThreads; t *= 2)
+    {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "ms/eval"
+              << std::setw(12) << "speedup" << std::setw(16) << "accumulate ms"
+              << std::setw(12) << "merge ms" << std::setw(10) << "merge %" << std::endl;
+
+    double baseline = 0.0;
+    for (unsigned int threads : threadCounts)
+    {
+        mi.SetNumberOfThreads(threads);
+
+        // 预热 (分块直方图分配、页面首次触碰)
+        double value;
+        MattesMutualInformation::ParametersType derivative;
+        mi.GetValueAndDerivative(value, derivative);
+        mi.ResetTimingStatistics();
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            mi.GetValueAndDerivative(value, derivative);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        const double msPerEval = 1000.0 * std::chrono::duration<double>(end - start).count() / iterations;
+        if (threads == 1)
+        {
+            baseline = msPerEval;
+        }
+
+        const auto& timing = mi.GetTimingStatistics();
+        const double accumulateMs = 1000.0 * timing.accumulateSeconds / std::max(1ul, timing.evaluations);
+        const double mergeMs = 1000.0 * timing.mergeSeconds / std::max(1ul, timing.evaluations);
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << std::setw(8) << threads << std::setw(14) << msPerEval
+                  << std::setw(12) << (baseline > 0.0 ? baseline / msPerEval : 1.0)
+                  << std::setw(16) << accumulateMs << std::setw(12) << mergeMs
+                  << std::setw(10) << std::setprecision(1) << (100.0 * mergeMs / msPerEval) << std::endl;
+    }
+}
+
+// ============================================================================
+// MI 梯度模式对比: 显式PDF导数 vs 两遍
+// ============================================================================
+
+static void BenchmarkMIDerivativeModes(ImageType::Pointer fixedImage, ImageType::Pointer movingImage,
+                                       unsigned int iterations, unsigned int bins,
+                                       double samplingPercentage, unsigned int threads)
+{
+    TransformType::Pointer transform = CreateTestTransform(fixedImage);
+
+    std::cout << "\n=== Mattes MI derivative modes, " << bins << " bins, "
+              << threads << " threads ===" << std::endl;
+    std::cout << std::setw(12) << "mode" << std::setw(14) << "ms/eval"
+              << std::setw(16) << "pass 2 ms" << std::setw(18) << "dPDF buffers MB" << std::endl;
+
+    MattesMutualInformation::ParametersType reference;
+    double referenceValue = 0.0;
+    for (bool useExplicit : {true, false})
+    {
+        MattesMutualInformation mi;
+        ConfigureMI(mi, fixedImage, movingImage, transform, bins, samplingPercentage);
+        mi.SetNumberOfThreads(threads);
+        mi.SetUseExplicitPDFDerivatives(useExplicit);
+        mi.Initialize();
+
+        double value;
+        MattesMutualInformation::ParametersType derivative;
+        mi.GetValueAndDerivative(value, derivative);
+        mi.ResetTimingStatistics();
+
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            mi.GetValueAndDerivative(value, derivative);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        const double msPerEval = 1000.0 * std::chrono::duration<double>(end - start).count() / iterations;
+        const auto& timing = mi.GetTimingStatistics();
+        const double passMs = 1000.0 * timing.derivativePassSeconds / std::max(1u, iterations);
+
+        // 显式模式: 每个分块一份 + 合并结果一份 bins²×参数数 的double
+        const double derivativeMB = mi.GetDerivativeBufferBytes() / (1024.0 * 1024.0);
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << std::setw(12) << (useExplicit ? "explicit" : "two-pass")
+                  << std::setw(14) << msPerEval << std::setw(16) << passMs
+                  << std::setw(18) << derivativeMB << std::endl;
+
+        if (useExplicit)
+        {
+            reference = derivative;
+            referenceValue = value;
+        }
+        else
+        {
+            double maxDifference = 0.0, maxReference = 0.0;
+            for (size_t k = 0; k < derivative.size(); ++k)
+            {
+                maxDifference = std::max(maxDifference, std::abs(derivative[k] - reference[k]));
+                maxReference = std::max(maxReference, std::abs(reference[k]));
+            }
+            std::cout << std::scientific << std::setprecision(3)
+                      << "  |value diff| = " << std::abs(value - referenceValue)
+                      << ", max |gradient diff| = " << maxDifference
+                      << " (max |gradient| = " << maxReference << ")" << std::endl;
+        }
+    }
+}
+
+// ============================================================================
+// MIND 线程扩展性: 值 / 梯度 / Gauss-Newton 正规方程组装
+// ============================================================================
+
+static void ConfigureMIND(MINDMetric& mind, ImageType::Pointer fixedImage, ImageType::Pointer movingImage,
+                          TransformType::Pointer transform, double samplingPercentage)
+{
+    mind.SetFixedImage(fixedImage);
+    mind.SetMovingImage(movingImage);
+    mind.SetTransform(transform);
+    mind.SetSamplingPercentage(samplingPercentage);
+    mind.SetRandomSeed(42);
+    mind.SetNumberOfParameters(6);
+    mind.SetUseEvaluationCache(false);  // 每次都完整计算
+    mind.SetJacobianFunction([transform](const ImageType::PointType& point,
+                                         std::vector<std::array<double, 3>>& jacobian) {
+        TransformType::JacobianType j;
+        transform->ComputeJacobianWithRespectToParameters(point, j);
+        jacobian.resize(6);
+        for (unsigned int k = 0; k < 6; ++k)
+        {
+            jacobian[k] = {j(0, k), j(1, k), j(2, k)};
+        }
+    });
+}
+
+// 旧路径: 物化残差和雅可比矩阵后再累加 J^T J, J^T f (与优化器原来的做法相同)
+static size_t AssembleNormalEquationsFromJacobian(MINDMetric& mind, std::vector<double>& JtJ, std::vector<double>& Jtf)
+{
+    std::vector<double> residuals;
+    std::vector<std::vector<double>> jacobian;
+    mind.GetResidualsAndJacobian(residuals, jacobian);
+
+    const size_t n = jacobian.empty() ? 0 : jacobian[0].size();
+    JtJ.assign(n * n, 0.0);
+    Jtf.assign(n, 0.0);
+    for (size_t row = 0; row < residuals.size(); ++row)
+    {
+        const std::vector<double>& r = jacobian[row];
+        for (size_t p = 0; p < n; ++p)
+        {
+            for (size_t q = 0; q < n; ++q)
+            {
+                JtJ[p * n + q] += r[p] * r[q];
+            }
+            Jtf[p] += r[p] * residuals[row];
+        }
+    }
+    return residuals.size();
+}
+
+static void BenchmarkMINDThreadScaling(ImageType::Pointer fixedImage, ImageType::Pointer movingImage,
+                                       unsigned int iterations, double samplingPercentage, unsigned int maxThreads)
+{
+    TransformType::Pointer transform = CreateTestTransform(fixedImage);
+
+    MINDMetric mind;
+    ConfigureMIND(mind, fixedImage, movingImage, transform, samplingPercentage);
+    mind.Initialize();
+    mind.GetValue();
+
+    std::cout << "\n=== MIND-SSD value / gradient / Gauss-Newton assembly, "
+              << mind.GetNumberOfValidSamples() << " valid samples ===" << std::endl;
+
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int t = 1; t < maxThreads; t *= 2)
+    {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "value ms" << std::setw(10) << "speedup"
+              << std::setw(12) << "grad ms" << std::setw(10) << "speedup"
+              << std::setw(12) << "JtJ ms" << std::setw(10) << "speedup"
+              << std::setw(16) << "J+JtJ (old) ms" << std::endl;
+
+    auto timeMs = [iterations](const std::function<void()>& evaluate) {
+        evaluate();  // 预热 (特征块首次计算、分块缓冲区分配)
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < iterations; ++i)
+        {
+            evaluate();
+        }
+        auto end = std::chrono::steady_clock::now();
+        return 1000.0 * std::chrono::duration<double>(end - start).count() / iterations;
+    };
+
+    double baseline[3] = {0.0, 0.0, 0.0};
+    for (unsigned int threads : threadCounts)
+    {
+        mind.SetNumberOfThreads(threads);
+
+        MINDMetric::ParametersType derivative;
+        std::vector<double> JtJ, Jtf;
+        const double valueMs = timeMs([&]() { mind.GetValue(); });
+        const double gradientMs = timeMs([&]() { mind.GetDerivative(derivative); });
+        const double normalMs = timeMs([&]() { mind.GetNormalEquations(JtJ, Jtf); });
+        const double jacobianMs = timeMs([&]() { AssembleNormalEquationsFromJacobian(mind, JtJ, Jtf); });
+        if (threads == 1)
+        {
+            baseline[0] = valueMs;
+            baseline[1] = gradientMs;
+            baseline[2] = normalMs;
+        }
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << std::setw(8) << threads
+                  << std::setw(12) << valueMs << std::setw(10) << baseline[0] / valueMs
+                  << std::setw(12) << gradientMs << std::setw(10) << baseline[1] / gradientMs
+                  << std::setw(12) << normalMs << std::setw(10) << baseline[2] / normalMs
+                  << std::setw(16) << jacobianMs << std::endl;
+    }
+
+    // 一致性: 直接组装与物化雅可比得到的正规方程, 以及不同线程数的结果 (分块顺序合并, 应逐位相同)
+    std::vector<double> directJtJ, directJtf, referenceJtJ, referenceJtf, singleJtJ, singleJtf;
+    mind.SetNumberOfThreads(maxThreads);
+    mind.GetNormalEquations(directJtJ, directJtf);
+    AssembleNormalEquationsFromJacobian(mind, referenceJtJ, referenceJtf);
+    mind.SetNumberOfThreads(1);
+    mind.GetNormalEquations(singleJtJ, singleJtf);
+
+    double maxDifference = 0.0, maxReference = 0.0, threadDifference = 0.0;
+    for (size_t k = 0; k < directJtJ.size(); ++k)
+    {
+        maxDifference = std::max(maxDifference, std::abs(directJtJ[k] - referenceJtJ[k]));
+        maxReference = std::max(maxReference, std::abs(referenceJtJ[k]));
+        threadDifference = std::max(threadDifference, std::abs(directJtJ[k] - singleJtJ[k]));
+    }
+    for (size_t k = 0; k < directJtf.size(); ++k)
+    {
+        maxDifference = std::max(maxDifference, std::abs(directJtf[k] - referenceJtf[k]));
+        threadDifference = std::max(threadDifference, std::abs(directJtf[k] - singleJtf[k]));
+    }
+    std::cout << std::scientific << std::setprecision(3)
+              << "  max |normal equations diff| direct vs Jacobian = " << maxDifference
+              << " (max |JtJ| = " << maxReference << "), "
+              << maxThreads << " vs 1 threads = " << threadDifference << std::endl;
+}
+
+// ============================================================================
+// 金字塔构建对比: 直接构建 vs 递归构建
+// ============================================================================
+
+// 在参考图像体素中心处比较两幅层级图像 (网格可能有亚体素的抽取相位差, 按物理坐标线性插值)
+static void CompareLevels(ImageType::Pointer reference, ImageType::Pointer test,
+                          double& relativeRMS, double& relativeMax)
+{
+    using InterpolatorType = itk::LinearInterpolateImageFunction<ImageType, double>;
+    auto interpolator = InterpolatorType::New();
+    interpolator->SetInputImage(test);
+
+    float minValue = std::numeric_limits<float>::max();
+    float maxValue = std::numeric_limits<float>::lowest();
+    double sumSquared = 0.0;
+    double maxDifference = 0.0;
+    size_t count = 0;
+
+    itk::ImageRegionIteratorWithIndex<ImageType> it(reference, reference->GetLargestPossibleRegion());
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+        minValue = std::min(minValue, it.Get());
+        maxValue = std::max(maxValue, it.Get());
+
+        ImageType::PointType point;
+        reference->TransformIndexToPhysicalPoint(it.GetIndex(), point);
+        if (!interpolator->IsInsideBuffer(point))
+        {
+            continue;
+        }
+        const double difference = std::abs(interpolator->Evaluate(point) - it.Get());
+        sumSquared += difference * difference;
+        maxDifference = std::max(maxDifference, difference);
+        ++count;
+    }
+
+    const double range = std::max(1e-12, static_cast<double>(maxValue) - minValue);
+    relativeRMS = (count > 0) ? std::sqrt(sumSquared / count) / range : 0.0;
+    relativeMax = maxDifference / range;
+}
+
+static void BenchmarkPyramidConstruction(unsigned int size)
+{
+    std::cout << "\n=== Pyramid Construction: Direct vs Recursive ===" << std::endl;
+
+    // CBCT量级的体素间距, 使用配置文件默认的5层策略
+    ImageType::Pointer image = CreatePhantom(size, 0.0, false);
+    ImageType::SpacingType spacing;
+    spacing.Fill(0.3);
+    image->SetSpacing(spacing);
+
+    const std::vector<unsigned int> shrinkFactors = {12, 8, 4, 2, 1};
+    const std::vector<double> smoothingSigmas = {4.0, 3.0, 2.0, 1.0, 1.0};
+    const size_t numberOfLevels = shrinkFactors.size();
+
+    auto makeSettings = [&](size_t level) {
+        MultiResolutionPyramid::LevelSettings settings;
+        settings.shrinkFactor = shrinkFactors[level];
+        settings.smoothingSigma = smoothingSigmas[level];
+        return settings;
+    };
+
+    // 直接构建: 与 ImageRegistration 的默认顺序相同 (由粗到细, 每层都从全分辨率开始)
+    MultiResolutionPyramid direct;
+    direct.SetInput(image);
+    std::vector<ImageType::Pointer> directLevels(numberOfLevels);
+    std::vector<double> directSeconds(numberOfLevels);
+    for (size_t level = 0; level < numberOfLevels; ++level)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        directLevels[level] = direct.GetLevel(makeSettings(level));
+        directSeconds[level] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // 递归构建: 由细到粗
+    MultiResolutionPyramid recursive;
+    recursive.SetInput(image);
+    recursive.SetUseRecursiveConstruction(true);
+    std::vector<ImageType::Pointer> recursiveLevels(numberOfLevels);
+    std::vector<double> recursiveSeconds(numberOfLevels);
+    for (size_t level = numberOfLevels; level-- > 0;)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        recursiveLevels[level] = recursive.GetLevel(makeSettings(level));
+        recursiveSeconds[level] = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    std::cout << std::setw(8) << "Level" << std::setw(10) << "Shrink" << std::setw(10) << "Sigma"
+              << std::setw(14) << "Direct(ms)" << std::setw(16) << "Recursive(ms)"
+              << std::setw(14) << "RelRMS" << std::setw(14) << "RelMax" << std::endl;
+
+    double directTotal = 0.0;
+    double recursiveTotal = 0.0;
+    for (size_t level = 0; level < numberOfLevels; ++level)
+    {
+        double relativeRMS = 0.0;
+        double relativeMax = 0.0;
+        CompareLevels(directLevels[level], recursiveLevels[level], relativeRMS, relativeMax);
+        directTotal += directSeconds[level];
+        recursiveTotal += recursiveSeconds[level];
+
+        std::cout << std::setw(8) << level << std::setw(10) << shrinkFactors[level]
+                  << std::setw(10) << std::fixed << std::setprecision(1) << smoothingSigmas[level]
+                  << std::setw(14) << std::setprecision(2) << directSeconds[level] * 1000.0
+                  << std::setw(16) << recursiveSeconds[level] * 1000.0
+                  << std::setw(14) << std::scientific << std::setprecision(2) << relativeRMS
+                  << std::setw(14) << relativeMax << std::endl;
+    }
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "Total: direct " << directTotal * 1000.0 << " ms, recursive " << recursiveTotal * 1000.0
+              << " ms (" << recursive.GetStatistics().recursiveBuilds << " levels derived from finer levels)" << std::endl;
+    std::cout << "(RelRMS/RelMax: difference relative to the direct level's intensity range)" << std::endl;
+}
+
+// ============================================================================
+// 截断分位数: 直方图 + nth_element vs 全排序
+// ============================================================================
+
+// 参考实现: 复制全部体素排序后取 values[floor(q*n)] (ComputeQuantileThresholds 之前的做法)
+static void SortedQuantileThresholds(const ImageType* image, double lowerQuantile, double upperQuantile,
+                                     float& lowerThreshold, float& upperThreshold)
+{
+    const size_t numberOfPixels = image->GetBufferedRegion().GetNumberOfPixels();
+    std::vector<float> values(image->GetBufferPointer(), image->GetBufferPointer() + numberOfPixels);
+    std::sort(values.begin(), values.end());
+    size_t lowerIndex = static_cast<size_t>(lowerQuantile * values.size());
+    size_t upperIndex = static_cast<size_t>(upperQuantile * values.size());
+    if (lowerIndex >= values.size()) lowerIndex = 0;
+    if (upperIndex >= values.size()) upperIndex = values.size() - 1;
+    lowerThreshold = values[lowerIndex];
+    upperThreshold = values[upperIndex];
+}
+
+// 返回不一致的组合数 (阈值按位比较)
+static unsigned int BenchmarkQuantileThresholds(unsigned int size)
+{
+    std::cout << "\n=== Winsorize Quantile Thresholds: Histogram+nth_element vs std::sort ===" << std::endl;
+
+    const std::vector<std::string> distributions = {"uniform", "discrete", "heavy-tailed", "constant"};
+    const size_t volumeVoxels = static_cast<size_t>(size) * size * size;
+    const std::vector<size_t> voxelCounts = {1, 7, 1000, (1 << 16) + 1, volumeVoxels};
+    const std::vector<std::pair<double, double>> quantiles = {
+        {0.005, 0.995}, {0.0, 1.0}, {0.25, 0.75}, {0.5, 0.5}, {0.999, 0.001}};
+
+    std::mt19937 generator(12345);
+    unsigned int mismatches = 0;
+    unsigned int comparisons = 0;
+
+    std::cout << std::setw(14) << "input" << std::setw(12) << "voxels"
+              << std::setw(12) << "sort ms" << std::setw(14) << "histogram ms" << std::setw(12) << "mismatch" << std::endl;
+
+    for (const std::string& distribution : distributions)
+    {
+        for (size_t voxels : voxelCounts)
+        {
+            ImageType::Pointer image = ImageType::New();
+            ImageType::RegionType region;
+            ImageType::SizeType imageSize;
+            imageSize[0] = voxels;
+            imageSize[1] = 1;
+            imageSize[2] = 1;
+            region.SetSize(imageSize);
+            image->SetRegions(region);
+            image->Allocate();
+            float* buffer = image->GetBufferPointer();
+
+            std::uniform_real_distribution<float> uniform(-1000.0f, 3000.0f);
+            std::uniform_int_distribution<int> levels(0, 15);
+            std::lognormal_distribution<float> lognormal(0.0f, 2.5f);
+            for (size_t i = 0; i < voxels; ++i)
+            {
+                if (distribution == "uniform")
+                    buffer[i] = uniform(generator);
+                else if (distribution == "discrete")
+                    buffer[i] = 100.0f * levels(generator) - 500.0f;   // 大量并列值
+                else if (distribution == "heavy-tailed")
+                    buffer[i] = (i % 97 == 0) ? -lognormal(generator) * 1e4f : lognormal(generator);
+                else
+                    buffer[i] = 42.0f;
+            }
+
+            double sortSeconds = 0.0;
+            double histogramSeconds = 0.0;
+            unsigned int localMismatches = 0;
+            for (const auto& q : quantiles)
+            {
+                float referenceLower, referenceUpper, lower, upper;
+                auto start = std::chrono::steady_clock::now();
+                SortedQuantileThresholds(image.GetPointer(), q.first, q.second, referenceLower, referenceUpper);
+                auto middle = std::chrono::steady_clock::now();
+                MultiResolutionPyramid::ComputeQuantileThresholds(image.GetPointer(), q.first, q.second, lower, upper);
+                auto end = std::chrono::steady_clock::now();
+                sortSeconds += std::chrono::duration<double>(middle - start).count();
+                histogramSeconds += std::chrono::duration<double>(end - middle).count();
+
+                ++comparisons;
+                if (std::memcmp(&lower, &referenceLower, sizeof(float)) != 0 ||
+                    std::memcmp(&upper, &referenceUpper, sizeof(float)) != 0)
+                {
+                    ++localMismatches;
+                    std::cout << "  MISMATCH q=(" << q.first << ", " << q.second << "): "
+                              << std::setprecision(9) << lower << "/" << upper << " vs sorted "
+                              << referenceLower << "/" << referenceUpper << std::endl;
+                }
+            }
+            mismatches += localMismatches;
+
+            std::cout << std::fixed << std::setprecision(3)
+                      << std::setw(14) << distribution << std::setw(12) << voxels
+                      << std::setw(12) << 1000.0 * sortSeconds / quantiles.size()
+                      << std::setw(14) << 1000.0 * histogramSeconds / quantiles.size()
+                      << std::setw(12) << localMismatches << std::endl;
+        }
+    }
+
+    std::cout << (mismatches == 0 ? "All " : "FAILED: ") << (comparisons - mismatches) << "/" << comparisons
+              << " threshold pairs bit-identical to the sorted reference" << std::endl;
+    return mismatches;
+}
+
+// ============================================================================
+// 主函数
+// ============================================================================
+
+int main(int argc, char* argv[])
+{
+    unsigned int size = (argc > 1) ? static_cast<unsigned int>(std::stoul(argv[1])) : 128;
+    unsigned int iterations = (argc > 2) ? static_cast<unsigned int>(std::stoul(argv[2])) : 20;
+    unsigned int bins = (argc > 3) ? static_cast<unsigned int>(std::stoul(argv[3])) : 50;
+    double samplingPercentage = (argc > 4) ? std::stod(argv[4]) : 0.10;
+    unsigned int maxThreads = (argc > 5) ? static_cast<unsigned int>(std::stoul(argv[5])) : 0;
+
+    if (maxThreads > 0)
+    {
+        ThreadPool::SetGlobalNumberOfThreads(maxThreads);
+    }
+    maxThreads = ThreadPool::GetGlobalInstance().GetNumberOfThreads();
+
+    std::cout << "\n=== Metric Benchmark ===" << std::endl;
+    std::cout << "Volume: " << size << "^3, iterations: " << iterations
+              << ", pool threads: " << maxThreads << std::endl;
+
+    try
+    {
+        ImageType::Pointer fixedImage = CreatePhantom(size, 0.0, false);
+        ImageType::Pointer movingImage = CreatePhantom(size, 2.0, true);
+
+        BenchmarkMIThreadScaling(fixedImage, movingImage, iterations, bins, samplingPercentage, maxThreads);
+        // 单线程比较两种模式的核函数开销; 线程池满载时显式模式还要合并每个分块的 bins²×参数数 导数直方图
+        BenchmarkMIDerivativeModes(fixedImage, movingImage, iterations, bins, samplingPercentage, 1);
+        if (maxThreads > 1)
+        {
+            BenchmarkMIDerivativeModes(fixedImage, movingImage, iterations, bins, samplingPercentage, maxThreads);
+        }
+        BenchmarkMINDThreadScaling(fixedImage, movingImage, iterations, samplingPercentage, maxThreads);
+        BenchmarkPyramidConstruction(size);
+        if (BenchmarkQuantileThresholds(size) > 0)
+        {
+            return EXIT_FAILURE;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "[Benchmark] Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -14,10 +14,14 @@
 
 #include "ImageRegistration.h"
 #include "ConfigManager.h"
+#include "BatchRegistration.h"
+#include "RegistrationServer.h"
+#include "ThreadPool.h"
 
 #include <itkTransformFileWriter.h>
 #include <itkTransformFileReader.h>
 #include <itkCompositeTransform.h>
+#include <itkMultiThreaderBase.h>
 
 namespace fs = std::filesystem;
 
@@ -36,10 +40,15 @@ struct CommandLineArgs
     std::string transformType;  // 空字符串表示未指定，使用配置文件的值
     std::string initMode;       // 初始化模式: "geometry" 或 "moments"
     std::string transformToEvaluate;  // 用于评估模式的变换文件路径
+    std::string batchManifestPath;    // 批量模式清单 (多个移动图像配准到同一固定图像)
+    std::string serverSocketPath;     // 服务模式监听的UNIX域套接字, 空表示使用 stdin/stdout
     bool showHelp = false;
     bool generateConfig = false;
     bool evaluateMode = false;  // 评估模式：只计算互信息，不执行优化
+    bool serveMode = false;     // 常驻服务模式：逐行处理JSON请求
     double samplingPercentage = -1.0;
+    unsigned int numberOfThreads = 0;   // 0 = 未指定 (单次配准: hardware_concurrency; 批量: 清单中的 threads)
+    double memoryLimitMB = -1.0;        // 批量模式内存预算, <0 表示使用清单中的值
     bool verbose = false;
 };
 
@@ -105,12 +114,24 @@ void PrintUsage(const char* programName)
     std::cout << "  --config <file>     Load configuration from JSON file" << std::endl;
     std::cout << "  --initial <file>    Load initial transform from .h5 file (coarse registration)" << std::endl;
     std::cout << "  --fixed-mask <file> Load mask for local registration (only ROI voxels used)" << std::endl;
-    std::cout << "  --transform <type>  Transform type: Rigid (default) or Affine" << std::endl;
+    std::cout << "  --transform <type>  Transform type: Rigid (default), Affine or Translation" << std::endl;
     std::cout << "  --init-mode <mode>  Initialization mode when no initial transform:" << std::endl;
     std::cout << "                        geometry - Align image geometric centers (default)" << std::endl;
     std::cout << "                        moments   - Align image centers of mass (intensity-weighted)" << std::endl;
     std::cout << "  --evaluate <file>   Evaluation mode: calculate MI value for given transform" << std::endl;
     std::cout << "                      (No optimization, just evaluate the transform quality)" << std::endl;
+    std::cout << "  --batch <manifest>  Batch mode: register all moving images listed in a JSON manifest" << std::endl;
+    std::cout << "                      to one fixed image in this process (fixed image, mask and pyramid" << std::endl;
+    std::cout << "                      are shared; positional arguments not needed). --initial, --fixed-mask," << std::endl;
+    std::cout << "                      --config and --transform are set per job in the manifest instead" << std::endl;
+    std::cout << "  --threads <n>       Total worker thread budget (default: all hardware threads)." << std::endl;
+    std::cout << "                      Use when several registrations run at the same time" << std::endl;
+    std::cout << "  --memory-limit <MB> Batch mode: hold back jobs whose projected pyramid/feature" << std::endl;
+    std::cout << "                      memory would exceed this limit" << std::endl;
+    std::cout << "  --serve             Server mode: read one JSON request per line from stdin and write one" << std::endl;
+    std::cout << "                      JSON response per line to stdout (logs go to stderr). Images, pyramids" << std::endl;
+    std::cout << "                      and MIND features stay cached between requests" << std::endl;
+    std::cout << "  --socket <path>     Server mode: listen on a local UNIX domain socket instead (POSIX only)" << std::endl;
     std::cout << "  --generate-config   Generate default config files and exit\n" << std::endl;
     std::cout << "  --sampling-percentage <0.0-1.0>  Sampling ratio (default 0.10)\n";
     
@@ -121,7 +142,25 @@ void PrintUsage(const char* programName)
     std::cout << "  " << programName << " --init-mode moments fixed.nrrd moving.nrrd output/" << std::endl;
     std::cout << "  " << programName << " --evaluate transform.h5 fixed.nrrd moving.nrrd output/" << std::endl;
     std::cout << "  " << programName << " --fixed-mask mask.nrrd --initial coarse.h5 fixed.nrrd moving.nrrd output/" << std::endl;
-    std::cout << "  " << programName << " --transform Affine fixed.nrrd moving.nrrd output/\n" << std::endl;
+    std::cout << "  " << programName << " --transform Affine fixed.nrrd moving.nrrd output/" << std::endl;
+    std::cout << "  " << programName << " --config Staged.json fixed.nrrd moving.nrrd output/   (\"stages\" list in config)" << std::endl;
+    std::cout << "  " << programName << " --batch manifest.json" << std::endl;
+    std::cout << "  " << programName << " --serve\n" << std::endl;
+    
+    std::cout << "Batch manifest (relative paths are relative to the manifest file):" << std::endl;
+    std::cout << "  { \"fixed\": \"fixed.nrrd\", \"fixedMask\": \"mask.nrrd\", \"config\": \"Rigid.json\"," << std::endl;
+    std::cout << "    \"output\": \"batch_output\", \"maxConcurrentJobs\": 2, \"threads\": 16, \"memoryLimitMB\": 8192," << std::endl;
+    std::cout << "    \"jobs\": [ { \"moving\": \"p01.nrrd\", \"initial\": \"p01.h5\" }," << std::endl;
+    std::cout << "              { \"name\": \"p02\", \"moving\": \"p02.nrrd\", \"config\": \"Affine.json\" }," << std::endl;
+    std::cout << "              { \"fixed\": \"p03_ct.nrrd\", \"fixedMask\": \"p03_mask.nrrd\", \"moving\": \"p03_mr.nrrd\" } ] }" << std::endl;
+    std::cout << "  Each job writes to <output>/<name> (name defaults to the moving image file name)." << std::endl;
+    std::cout << "  Jobs with the same fixed image and mask share the fixed image pyramid.\n" << std::endl;
+    
+    std::cout << "Server requests (one JSON object per line):" << std::endl;
+    std::cout << "  {\"id\": 1, \"command\": \"register\", \"fixed\": \"f.nrrd\", \"moving\": \"m.nrrd\", \"output\": \"out\"," << std::endl;
+    std::cout << "   \"config\": \"Rigid.json\", \"fixedMask\": \"mask.nrrd\", \"initial\": \"coarse.h5\"}" << std::endl;
+    std::cout << "  {\"id\": 2, \"command\": \"evaluate\", \"fixed\": \"f.nrrd\", \"moving\": \"m.nrrd\", \"transform\": \"t.h5\"}" << std::endl;
+    std::cout << "  {\"id\": 3, \"command\": \"status\"}, {\"command\": \"clear\"}, {\"command\": \"shutdown\"}\n" << std::endl;
     
     std::cout << "Supported image formats: NIFTI (.nii, .nii.gz), NRRD (.nrrd), MetaImage (.mhd/.mha)" << std::endl;
 }
@@ -241,6 +280,58 @@ bool ParseCommandLine(int argc, std::vector<std::string>& args, CommandLineArgs&
                 return false;
             }
         }
+        else if (arg == "--batch")
+        {
+            if (i + 1 < args.size())
+            {
+                parsedArgs.batchManifestPath = args[++i];
+            }
+            else
+            {
+                std::cerr << "[Error] --batch requires a manifest file path (.json)" << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--serve")
+        {
+            parsedArgs.serveMode = true;
+        }
+        else if (arg == "--socket")
+        {
+            if (i + 1 < args.size())
+            {
+                parsedArgs.serverSocketPath = args[++i];
+            }
+            else
+            {
+                std::cerr << "[Error] --socket requires a socket file path" << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--threads")
+        {
+            if (i + 1 < args.size())
+            {
+                parsedArgs.numberOfThreads = static_cast<unsigned int>(std::stoul(args[++i]));
+            }
+            else
+            {
+                std::cerr << "[Error] --threads requires a thread count" << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--memory-limit")
+        {
+            if (i + 1 < args.size())
+            {
+                parsedArgs.memoryLimitMB = std::stod(args[++i]);
+            }
+            else
+            {
+                std::cerr << "[Error] --memory-limit requires a size in MB" << std::endl;
+                return false;
+            }
+        }
         else if (arg == "--verbose")
         {
             parsedArgs.verbose = true;
@@ -256,6 +347,25 @@ bool ParseCommandLine(int argc, std::vector<std::string>& args, CommandLineArgs&
         }
     }
     
+    // 批量模式按任务从清单读取掩膜/初始变换/配置, 命令行中的这些选项不会生效, 直接报错而不是静默忽略
+    if (!parsedArgs.batchManifestPath.empty())
+    {
+        const std::vector<std::pair<bool, std::string>> perJobOptions = {
+            {!parsedArgs.initialTransformPath.empty(), "--initial (use \"initial\" in the manifest jobs)"},
+            {!parsedArgs.fixedMaskPath.empty(), "--fixed-mask (use \"fixedMask\" in the manifest)"},
+            {!parsedArgs.configFilePath.empty(), "--config (use \"config\" in the manifest)"},
+            {!parsedArgs.transformType.empty(), "--transform (set \"transformType\" in the job config)"},
+        };
+        for (const auto& option : perJobOptions)
+        {
+            if (option.first)
+            {
+                std::cerr << "[Error] " << option.second << " cannot be combined with --batch" << std::endl;
+                return false;
+            }
+        }
+    }
+    
     if (positionalArgs.size() >= 3)
     {
         parsedArgs.fixedImagePath = positionalArgs[0];
@@ -263,7 +373,8 @@ bool ParseCommandLine(int argc, std::vector<std::string>& args, CommandLineArgs&
         parsedArgs.outputFolder = positionalArgs[2];
         return true;
     }
-    else if (!parsedArgs.showHelp && !parsedArgs.generateConfig)
+    else if (!parsedArgs.showHelp && !parsedArgs.generateConfig && parsedArgs.batchManifestPath.empty() &&
+             !parsedArgs.serveMode)
     {
         std::cerr << "[Error] Missing required arguments" << std::endl;
         return false;
@@ -278,6 +389,17 @@ bool ParseCommandLine(int argc, std::vector<std::string>& args, CommandLineArgs&
 
 int main(int argc, char* argv[])
 {
+    // 服务模式: 标准输出只留给协议响应, 日志 (std::cout) 改写到 stderr
+    std::ostream protocolOutput(std::cout.rdbuf());
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--serve")
+        {
+            std::cout.rdbuf(std::cerr.rdbuf());
+            break;
+        }
+    }
+
     std::cout << "=== Mutual Information Registration (Custom Implementation) ===" << std::endl;
     std::cout << "Multi-Resolution 3D Registration for MRI/CT Images" << std::endl;
     std::cout << "============================================================\n" << std::endl;
@@ -320,6 +442,83 @@ int main(int argc, char* argv[])
         ConfigManager::CreateDefaultConfigFile("Affine.json", ConfigManager::TransformType::Affine);
         return EXIT_SUCCESS;
     }
+    
+    // ========== 批量模式：多个移动图像配准到同一固定图像 ==========
+    if (!parsedArgs.batchManifestPath.empty())
+    {
+        try
+        {
+            BatchRegistration batch;
+            batch.SetManifest(BatchRegistration::LoadManifest(parsedArgs.batchManifestPath));
+            batch.SetVerbose(parsedArgs.verbose);
+            batch.SetSamplingPercentage(parsedArgs.samplingPercentage);
+            if (parsedArgs.numberOfThreads > 0)
+            {
+                batch.SetNumberOfThreads(parsedArgs.numberOfThreads);
+            }
+            if (parsedArgs.memoryLimitMB >= 0.0)
+            {
+                batch.SetMemoryLimitMB(parsedArgs.memoryLimitMB);
+            }
+            if (!parsedArgs.initMode.empty())
+            {
+                batch.SetInitializationMode(parsedArgs.initMode == "moments" ? InitializationMode::Moments
+                                                                               : InitializationMode::Geometry);
+            }
+            
+            const auto& manifest = batch.GetManifest();
+            std::cout << "[Batch Configuration]" << std::endl;
+            if (!manifest.fixedImagePath.empty())
+            {
+                std::cout << "  Fixed Image:  " << manifest.fixedImagePath << std::endl;
+            }
+            if (!manifest.fixedMaskPath.empty())
+            {
+                std::cout << "  Fixed Mask: " << manifest.fixedMaskPath << std::endl;
+            }
+            if (!manifest.configFilePath.empty())
+            {
+                std::cout << "  Config File: " << manifest.configFilePath << std::endl;
+            }
+            std::cout << "  Output Folder: " << manifest.outputFolder << std::endl;
+            std::cout << "  Jobs: " << manifest.jobs.size() << std::endl;
+            
+
+            const size_t succeeded = batch.Run();
+            batch.PrintSummary();
+            return (succeeded == manifest.jobs.size()) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        catch (const itk::ExceptionObject& e)
+        {
+            std::cerr << "\n[ITK Error] " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "\n[Error] " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // 线程预算 (单次配准/服务模式): 度量线程池和ITK滤波器都不超过指定线程数
+    if (parsedArgs.numberOfThreads > 0)
+    {
+        ThreadPool::SetGlobalNumberOfThreads(parsedArgs.numberOfThreads);
+        itk::MultiThreaderBase::SetGlobalDefaultNumberOfThreads(parsedArgs.numberOfThreads);
+    }
+
+    // ========== 服务模式：常驻进程, 图像/金字塔/MIND特征在请求之间保留 ==========
+    if (parsedArgs.serveMode)
+    {
+        RegistrationServer server;
+        server.SetVerbose(parsedArgs.verbose);
+        if (!parsedArgs.serverSocketPath.empty())
+        {
+            return server.ServeSocket(parsedArgs.serverSocketPath);
+        }
+        std::cout << "[Server] Reading requests from stdin" << std::endl;
+        return server.ServeStream(std::cin, protocolOutput);
+    }
 
     std::cout << "[Input Configuration]" << std::endl;
     std::cout << "  Fixed Image:  " << parsedArgs.fixedImagePath << std::endl;
@@ -388,15 +587,7 @@ int main(int argc, char* argv[])
             {
                 std::cerr << "[Warning] Evaluation.json not found, using default settings" << std::endl;
                 // 设置默认评估参数：单层、零学习率、1次迭代
-                auto& config = configManager.GetConfig();
-                config.transformType = ConfigManager::TransformType::Affine;
-                config.numberOfHistogramBins = 32;
-                config.samplingPercentage = 0.1;
-                config.learningRate = {0.0};
-                config.numberOfIterations = {1};
-                config.numberOfLevels = 1;
-                config.shrinkFactors = {1};
-                config.smoothingSigmas = {0.0};
+                configManager.GetConfig() = ConfigManager::CreateEvaluationConfig();
             }
             
             // 命令行采样参数覆盖配置文件
@@ -552,203 +743,44 @@ int main(int argc, char* argv[])
             std::cout << "  Smoothing Sigma: " << sigma << " mm" << std::endl;
         });
         
-        // 判断是否为级联配准
-        bool isCascade = (configManager.GetConfig().transformType == ConfigManager::TransformType::RigidThenAffine);
+        // 判断是否为级联/多阶段配准
+        const auto& stages = configManager.GetConfig().stages;
+        bool isCascade = !stages.empty() ||
+                         (configManager.GetConfig().transformType == ConfigManager::TransformType::RigidThenAffine);
         double totalElapsedTime = 0.0;
         
         if (isCascade)
         {
-            std::cout << "\n[Cascade Registration Mode: Rigid + Affine]" << std::endl;
-            std::cout << "==========================================" << std::endl;
-            
-            // ===== 阶段1: 刚体配准 =====
-            std::cout << "\n[Phase 1: Rigid Registration]" << std::endl;
-            std::cout << "==========================================" << std::endl;
-            
-            registration.SetTransformType(ConfigManager::TransformType::Rigid);
-            registration.Update();
-            totalElapsedTime += registration.GetElapsedTime();
-            
-            std::cout << "\n[Phase 1 Completed]" << std::endl;
-            std::cout << "  Time: " << std::fixed << std::setprecision(2) 
-                      << registration.GetElapsedTime() << " seconds" << std::endl;
-            
-            // 输出刚体变换参数
-            auto rigidTransform = registration.GetRigidTransform();
-            auto rigidParams = rigidTransform->GetParameters();
-            std::cout << "  Rigid Transform:" << std::endl;
-            std::cout << "    Rotation (rad): [" << std::fixed << std::setprecision(6)
-                      << rigidParams[0] << ", " << rigidParams[1] << ", " << rigidParams[2] << "]" << std::endl;
-            std::cout << "    Translation (mm): [" << std::fixed << std::setprecision(4)
-                      << rigidParams[3] << ", " << rigidParams[4] << ", " << rigidParams[5] << "]" << std::endl;
-            
-            // ===== 阶段2: 仿射配准 (基于刚体结果) =====
-            std::cout << "\n[Phase 2: Affine Registration (initialized from Rigid)]" << std::endl;
-            std::cout << "==========================================" << std::endl;
-            
-            // 保存刚体结果到临时文件
-            fs::path tempRigidPath = fs::path(parsedArgs.outputFolder) / "temp_rigid_cascade.h5";
-            try
-            {
-                if (!fs::exists(parsedArgs.outputFolder))
-                {
-                    fs::create_directories(parsedArgs.outputFolder);
-                }
-                
-                using WriterType = itk::TransformFileWriter;
-                auto tempWriter = WriterType::New();
-                tempWriter->SetFileName(tempRigidPath.string());
-                tempWriter->SetInput(rigidTransform);
-                tempWriter->Update();
-                
-                std::cout << "[Temp] Rigid result saved: " << tempRigidPath.string() << std::endl;
-            }
-            catch (const std::exception& e)
-            {
-                std::cerr << "[Warning] Could not save temp rigid transform: " << e.what() << std::endl;
-            }
-            
-            // 创建新的配准实例用于Affine阶段
-            ImageRegistration affineRegistration;
-            affineRegistration.SetFixedImage(registration.GetFixedImage());
-            affineRegistration.SetMovingImage(registration.GetMovingImage());
-            affineRegistration.SetTransformType(ConfigManager::TransformType::Affine);
-            
-            // 加载刚体结果作为初始变换
-            if (fs::exists(tempRigidPath))
+            // 同一实例内依次执行各阶段, 上一阶段结果在内存中作为下一阶段初始变换,
+            // 金字塔层级、掩膜位图和MIND特征在各阶段间保持
+            if (!stages.empty())
             {
-                affineRegistration.LoadInitialTransform(tempRigidPath.string());
+                std::cout << "\n[Multi-Stage Registration: " << stages.size() << " stages]" << std::endl;
+                std::cout << "==========================================" << std::endl;
+                registration.RunCascade(stages);
             }
-            
-            // 复制配置参数
-            affineRegistration.SetNumberOfHistogramBins(registration.GetNumberOfHistogramBins());
-            affineRegistration.SetSamplingPercentage(registration.GetSamplingPercentage());
-            affineRegistration.SetLearningRate(registration.GetLearningRate());
-            affineRegistration.SetMinimumStepLength(registration.GetMinimumStepLength());
-            affineRegistration.SetNumberOfIterations(registration.GetNumberOfIterations());
-            affineRegistration.SetRelaxationFactor(registration.GetRelaxationFactor());
-            affineRegistration.SetGradientMagnitudeTolerance(registration.GetGradientMagnitudeTolerance());
-            affineRegistration.SetNumberOfLevels(registration.GetNumberOfLevels());
-            affineRegistration.SetShrinkFactors(registration.GetShrinkFactors());
-            affineRegistration.SetSmoothingSigmas(registration.GetSmoothingSigmas());
-            affineRegistration.SetRandomSeed(registration.GetRandomSeed());
-            affineRegistration.SetUseStratifiedSampling(true);
-            
-            // 复制度量类型和MIND参数（如果使用MIND）
-            affineRegistration.SetMetricType(registration.GetMetricType());
-            affineRegistration.SetMINDRadius(registration.GetMINDRadius());
-            affineRegistration.SetMINDSigma(registration.GetMINDSigma());
-            affineRegistration.SetMINDNeighborhoodType(registration.GetMINDNeighborhoodType());
-            
-            // 【关键修复】如果使用MIND度量，清空缓存确保Affine阶段重新计算MIND特征
-            // 避免使用Rigid阶段的过时缓存导致配准失败
-            if (registration.GetMetricType() == ConfigManager::MetricType::MIND)
-            {
-                if (auto mindMetric = affineRegistration.GetMINDMetric())
-                {
-                    mindMetric->ResetCache();
-                    std::cout << "[MIND Cache] Reset cache for Affine stage" << std::endl;
-                }
-            }
-            
-            // 复制掩膜设置
-            if (registration.HasFixedMask())
+            else
             {
-                affineRegistration.SetFixedImageMask(registration.GetFixedImageMask());
+                std::cout << "\n[Cascade Registration Mode: Rigid + Affine]" << std::endl;
+                std::cout << "==========================================" << std::endl;
+                registration.RunCascade({ConfigManager::TransformType::Rigid, ConfigManager::TransformType::Affine});
             }
+            totalElapsedTime = registration.GetElapsedTime();
             
-            // 设置观察者
-            auto affineMetricType = registration.GetMetricType();
-            affineRegistration.SetIterationObserver([affineMetricType](int iteration, double value, double stepLength) {
-                const char* metricLabel = (affineMetricType == ConfigManager::MetricType::MattesMutualInformation) 
-                                          ? "MI Value:" : "MIND SSD:";
-                std::cout << "  Iteration " << std::setw(4) << iteration 
-                          << " | " << metricLabel << " " << std::fixed << std::setprecision(6) << value
-                          << " | Step: " << std::scientific << std::setprecision(2) << stepLength
-                          << std::endl;
-            });
-            
-            affineRegistration.SetLevelObserver([](int level, int shrinkFactor, double sigma) {
-                std::cout << "\n[Multi-Resolution Level " << (level + 1) << "]" << std::endl;
-                std::cout << "  Shrink Factor: " << shrinkFactor << "x" << std::endl;
-                std::cout << "  Smoothing Sigma: " << sigma << " mm" << std::endl;
-            });
-            
-            // 执行仿射配准
-            affineRegistration.Update();
-            totalElapsedTime += affineRegistration.GetElapsedTime();
-            
-            std::cout << "\n[Phase 2 Completed]" << std::endl;
-            std::cout << "  Time: " << std::fixed << std::setprecision(2) 
-                      << affineRegistration.GetElapsedTime() << " seconds" << std::endl;
-            
-            // 清理临时文件
-            try
-            {
-                if (fs::exists(tempRigidPath))
-                {
-                    fs::remove(tempRigidPath);
-                }
-            }
-            catch (const std::exception& e)
+            std::cout << "\n[Cascade Registration Completed]" << std::endl;
+            const auto& stageResults = registration.GetCascadeStageResults();
+            for (size_t s = 0; s < stageResults.size(); ++s)
             {
-                std::cerr << "[Warning] Could not delete temp file: " << e.what() << std::endl;
+                std::cout << "  Stage " << (s + 1) << " (" << ConfigManager::TransformTypeToString(stageResults[s].transformType)
+                          << "): " << std::fixed << std::setprecision(2) << stageResults[s].elapsedTime << " seconds, metric "
+                          << std::scientific << std::setprecision(4) << stageResults[s].finalMetricValue << std::endl;
             }
-            
-            // 保存仿射结果的指针供后续使用
-            auto finalAffineTransform = affineRegistration.GetAffineTransform();
-            
-            std::cout << "\n[Cascade Registration Completed]" << std::endl;
             std::cout << "  Total Time: " << std::fixed << std::setprecision(2) 
                       << totalElapsedTime << " seconds" << std::endl;
-            
-            // 输出最终仿射变换参数
-            std::cout << "\n[Final Transform Parameters]" << std::endl;
-            auto parameters = finalAffineTransform->GetParameters();
-            std::cout << "  Matrix:" << std::endl;
-            std::cout << "    [" << std::fixed << std::setprecision(6)
-                      << parameters[0] << ", " << parameters[1] << ", " << parameters[2] << "]" << std::endl;
-            std::cout << "    [" << parameters[3] << ", " << parameters[4] << ", " << parameters[5] << "]" << std::endl;
-            std::cout << "    [" << parameters[6] << ", " << parameters[7] << ", " << parameters[8] << "]" << std::endl;
-            std::cout << "  Translation (mm):  [" 
-                      << std::fixed << std::setprecision(4)
-                      << parameters[9] << ", " 
-                      << parameters[10] << ", " 
-                      << parameters[11] << "]" << std::endl;
-            
-            auto center = finalAffineTransform->GetCenter();
-            std::cout << "  Center:   [" 
-                      << std::fixed << std::setprecision(2)
-                      << center[0] << ", " 
-                      << center[1] << ", " 
-                      << center[2] << "]" << std::endl;
-            
-            // 保存最终变换
-            std::cout << "\n[Saving Transform...]" << std::endl;
-            try
-            {
-                fs::path outputPath = fs::path(parsedArgs.outputFolder) / GenerateTimestampFilename();
-                
-                using WriterType = itk::TransformFileWriter;
-                auto writer = WriterType::New();
-                writer->SetFileName(outputPath.string());
-                writer->SetInput(finalAffineTransform);
-                writer->Update();
-                
-                std::cout << "[Transform Saved] " << outputPath.string() << std::endl;
-            }
-            catch (const std::exception& e)
-            {
-                std::cerr << "[Error] Failed to save transform: " << e.what() << std::endl;
-                return EXIT_FAILURE;
-            }
-            
-            std::cout << "\n=== Registration Successfully Completed ===" << std::endl;
-            return EXIT_SUCCESS;
         }
         else
         {
-            // 单阶段配准 (Rigid 或 Affine)
+            // 单阶段配准 (Translation, Rigid 或 Affine)
             std::cout << "\n[Starting Registration...]" << std::endl;
             registration.Update();
             totalElapsedTime = registration.GetElapsedTime();
@@ -761,14 +793,12 @@ int main(int argc, char* argv[])
         // 输出变换参数
         std::cout << "\n[Final Transform Parameters]" << std::endl;
         
-        // 级联配准总是输出Affine结果，单阶段按实际类型输出
-        ConfigManager::TransformType outputType = configManager.GetConfig().transformType;
-        if (outputType == ConfigManager::TransformType::RigidThenAffine)
-        {
-            outputType = ConfigManager::TransformType::Affine;  // 级联配准最终是Affine
-        }
+        // 按最后执行的阶段类型输出 (级联配准结束后为最后一个阶段的类型)
+        ConfigManager::TransformType outputType = registration.GetResultTransformType();
+        bool outputRigid = (outputType == ConfigManager::TransformType::Rigid ||
+                            outputType == ConfigManager::TransformType::Translation);
         
-        if (outputType == ConfigManager::TransformType::Rigid)
+        if (outputRigid)
         {
             auto rigidTransform = registration.GetRigidTransform();
             auto parameters = rigidTransform->GetParameters();
@@ -822,8 +852,8 @@ int main(int argc, char* argv[])
         // 这避免了 .h5 文件中包含多个变换导致的混淆
         itk::Transform<double, 3, 3>::Pointer finalTransform;
         
-        // 级联配准保存Affine，单阶段按实际类型保存
-        if (outputType == ConfigManager::TransformType::Rigid)
+        // 按最后执行的阶段类型保存
+        if (outputRigid)
         {
             finalTransform = registration.GetRigidTransform();
         }